@@ -0,0 +1,116 @@
+#include "libs/clock/gps_clock.h"
+#include "libs/gps/myGPS.h"
+#include "hardware/rtc.h"
+#include <cstdio>
+#include <cstring>
+
+void GpsClock::setFallback(uint32_t epoch) {
+    if (synced) {
+        return;
+    }
+
+    offset_us = (int64_t)epoch * 1000000LL - (int64_t)time_us_64();
+    printf("CLOCK: Running from fallback time %lu until GPS time is available\n", (unsigned long)epoch);
+}
+
+bool GpsClock::discipline(uint32_t utc_epoch, uint64_t capture_us) {
+    int64_t sample_us = (int64_t)utc_epoch * 1000000LL - (int64_t)capture_us;
+
+    if (!synced) {
+        sync_step_us = sample_us - offset_us;
+        offset_us = sample_us;
+        slew_us = 0;
+        synced = true;
+        window_count = 0;
+        printf("CLOCK: Synchronized to GPS time %lu (step %lld ms)\n",
+               (unsigned long)utc_epoch, (long long)(sync_step_us / 1000));
+        syncRtc();
+        return true;
+    }
+
+    // A sentence always arrives some time after the second it describes, so
+    // the sample with the largest offset had the least delay. Keep the best
+    // sample of each window and correct towards it.
+    if (window_count == 0 || sample_us > window_best_us) {
+        window_best_us = sample_us;
+    }
+    if (++window_count < GPS_CLOCK_WINDOW) {
+        return false;
+    }
+    window_count = 0;
+
+    // Start the next slew from wherever the current one has got to
+    uint64_t time_us = time_us_64();
+    offset_us = offsetAt(time_us);
+    slew_start_us = time_us;
+    int64_t error_us = window_best_us - offset_us;
+    if (error_us > GPS_CLOCK_STEP_THRESHOLD_US) {
+        offset_us = window_best_us;
+        slew_us = 0;
+        printf("CLOCK: Stepped by %lld ms\n", (long long)(error_us / 1000));
+        syncRtc();
+    } else if (error_us < -GPS_CLOCK_STEP_THRESHOLD_US) {
+        // Stepping back would repeat timestamps; run slow instead
+        slew_us = -GPS_CLOCK_STEP_THRESHOLD_US;
+        printf("CLOCK: Slewing back by %lld ms\n", (long long)(-error_us / 1000));
+    } else {
+        // A quarter of the error per window filters jitter
+        slew_us = error_us / 4;
+    }
+
+    if (time_us_64() - last_rtc_sync_us >= GPS_CLOCK_RTC_SYNC_INTERVAL_US) {
+        syncRtc();
+    }
+    return false;
+}
+
+void GpsClock::syncRtc() {
+    if (!rtc_started) {
+        rtc_init();
+        rtc_started = true;
+    }
+
+    uint32_t epoch = now();
+    int year, month, day, hour, minute, second;
+    myGPS::epochToUtc(epoch, year, month, day, hour, minute, second);
+
+    datetime_t t;
+    t.year = (int16_t)year;
+    t.month = (int8_t)month;
+    t.day = (int8_t)day;
+    t.dotw = (int8_t)(((epoch / 86400) + 4) % 7);  // 1970-01-01 was a Thursday
+    t.hour = (int8_t)hour;
+    t.min = (int8_t)minute;
+    t.sec = (int8_t)second;
+
+    if (rtc_set_datetime(&t)) {
+        last_rtc_sync_us = time_us_64();
+    } else {
+        printf("CLOCK ERROR: Failed to set RTC\n");
+    }
+}
+
+static inline void put_two_digits(char *p, uint32_t value) {
+    p[0] = (char)('0' + value / 10);
+    p[1] = (char)('0' + value % 10);
+}
+
+size_t TimestampFormatter::format(uint32_t epoch, char *out) {
+    int32_t day_number = (int32_t)(epoch / 86400);
+    if (day_number != cached_day) {
+        int year, month, day, hour, minute, second;
+        myGPS::epochToUtc(epoch, year, month, day, hour, minute, second);
+        snprintf(date_prefix, sizeof(date_prefix), "%04d-%02d-%02d ", year, month, day);
+        cached_day = day_number;
+    }
+
+    uint32_t seconds_of_day = epoch % 86400;
+    memcpy(out, date_prefix, 11);
+    put_two_digits(out + 11, seconds_of_day / 3600);
+    out[13] = ':';
+    put_two_digits(out + 14, (seconds_of_day % 3600) / 60);
+    out[16] = ':';
+    put_two_digits(out + 17, seconds_of_day % 60);
+    memcpy(out + 19, "+00:00", 7);  // Includes the terminator
+    return 25;
+}
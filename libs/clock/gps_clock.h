@@ -0,0 +1,92 @@
+#ifndef GPS_CLOCK_H
+#define GPS_CLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pico/stdlib.h"
+
+// Number of GPS samples collected before the offset is corrected
+#define GPS_CLOCK_WINDOW 8
+
+// Errors above this are stepped forward, smaller ones are slewed in. The clock
+// is never stepped back: a larger negative error is slewed out at most this
+// much per window.
+#define GPS_CLOCK_STEP_THRESHOLD_US 500000
+
+// A correction is spread over this long, about one window of 1 Hz samples.
+// At most GPS_CLOCK_STEP_THRESHOLD_US per period, so UTC runs at 94-106 %
+// of the timebase rate while slewing and never goes back.
+#define GPS_CLOCK_SLEW_PERIOD_US (GPS_CLOCK_WINDOW * 1000000ULL)
+
+// RTC is rewritten from the disciplined clock at least this often
+#define GPS_CLOCK_RTC_SYNC_INTERVAL_US (3600ULL * 1000000ULL)
+
+// System clock: monotonic microsecond timebase (time_us_64) plus a UTC offset
+// that is disciplined from GPS RMC time. Until the first GPS sample it runs
+// from a coarse fallback epoch and reports itself as unsynced.
+class GpsClock {
+public:
+    GpsClock() = default;
+
+    // Seed the clock from a coarse epoch (receiver backup clock, persisted state)
+    // Ignored once the clock is synced to GPS
+    void setFallback(uint32_t epoch);
+
+    // Feed a GPS UTC second together with the time_us_64() value at which the
+    // sentence carrying it started. Returns true when this sample synced the
+    // clock for the first time (see getSyncStepUs()).
+    bool discipline(uint32_t utc_epoch, uint64_t capture_us);
+
+    // Current UTC in seconds / microseconds
+    uint32_t now() const { return (uint32_t)(nowUs() / 1000000ULL); }
+    uint64_t nowUs() const {
+        uint64_t time_us = time_us_64();
+        return (uint64_t)((int64_t)time_us + offsetAt(time_us));
+    }
+
+    bool isSynced() const { return synced; }
+
+    // Correction applied by the first sync; add to timestamps taken before it
+    int64_t getSyncStepUs() const { return sync_step_us; }
+
+    // Write the current UTC into the RP2040 RTC
+    void syncRtc();
+
+private:
+    // UTC us minus time_us_64() at the given timebase time
+    int64_t offsetAt(uint64_t time_us) const {
+        uint64_t elapsed_us = time_us - slew_start_us;
+        if (slew_us == 0 || elapsed_us >= GPS_CLOCK_SLEW_PERIOD_US) {
+            return offset_us + slew_us;
+        }
+        return offset_us + slew_us * (int64_t)elapsed_us / (int64_t)GPS_CLOCK_SLEW_PERIOD_US;
+    }
+
+    int64_t offset_us = 0;           // Offset when the current slew started
+    int64_t slew_us = 0;             // Correction being slewed in
+    uint64_t slew_start_us = 0;
+    bool synced = false;
+    int64_t sync_step_us = 0;
+    int64_t window_best_us = 0;      // Least delayed sample in the current window
+    uint8_t window_count = 0;
+    uint64_t last_rtc_sync_us = 0;
+    bool rtc_started = false;
+};
+
+// Formats epochs as "YYYY-MM-DD HH:MM:SS+00:00". The date part is cached and only
+// recomputed when a record falls on a different day, so batches of records
+// cost a few digit writes each instead of a gmtime() call.
+class TimestampFormatter {
+public:
+    // Writes the timestamp into out (at least TIMESTAMP_FORMAT_SIZE bytes)
+    // and returns the string length
+    size_t format(uint32_t epoch, char *out);
+
+    static const size_t TIMESTAMP_FORMAT_SIZE = 26;
+
+private:
+    int32_t cached_day = -1;
+    char date_prefix[12];            // "YYYY-MM-DD "
+};
+
+#endif // GPS_CLOCK_H
@@ -510,6 +510,31 @@ SensorData Flash::loadSensorData(size_t index) {
     return result;
 }
 
+bool Flash::readRecord(size_t index, SensorData& data) {
+    if (!_flash_enabled || index >= _stored_data_count) {
+        return false;
+    }
+    SerializedSensorData serialized;
+    memcpy(&serialized, getRecordArea() + index * SENSOR_DATA_SIZE, sizeof(serialized));
+    if (serialized.magic != 0xABCD1234 || serialized.timestamp == 0) {
+        return false;
+    }
+    data.temp = serialized.temp;
+    data.hum = serialized.hum;
+    data.pres = serialized.pres;
+    data.gasRes = serialized.gasRes;
+    data.pm2_5 = serialized.pm2_5;
+    data.pm5 = serialized.pm5;
+    data.pm10 = serialized.pm10;
+    data.co2 = serialized.co2;
+    data.latitude = serialized.latitude;
+    data.longitude = serialized.longitude;
+    data.timestamp = serialized.timestamp;
+    data.is_fake_gps = (serialized.flags & 0x01) != 0;
+    data.time_unsynced = (serialized.flags & 0x02) != 0;
+    return true;
+}
+
 /**
  * Load all sensor data records from flash storage
  * 
@@ -615,7 +640,8 @@ void Flash::serializeSensorData(const SensorData& data, uint8_t* buffer) {
     serialized.timestamp = data.timestamp;
     
     // Set flags
-    serialized.flags = data.is_fake_gps ? 0x01 : 0x00;  // Bit 0 = is_fake_gps
+    serialized.flags = (data.is_fake_gps ? 0x01 : 0x00) |   // Bit 0 = is_fake_gps
+                       (data.time_unsynced ? 0x02 : 0x00);  // Bit 1 = time_unsynced
     memset(serialized.reserved, 0, sizeof(serialized.reserved));  // Clear reserved bytes
     
     // Zero out the checksum field first to ensure consistent calculation
@@ -762,6 +788,7 @@ SensorData Flash::deserializeSensorData(const uint8_t* buffer) {
     
     // Extract flags
     data.is_fake_gps = (serialized.flags & 0x01) != 0;  // Bit 0 = is_fake_gps
+    data.time_unsynced = (serialized.flags & 0x02) != 0;  // Bit 1 = time_unsynced
     
     // Debug what we extracted
     printf("DESERIALIZED: Temp=%.2f, Hum=%.2f, CO2=%u, PM2.5=%u, Timestamp=%u, FakeGPS=%s\n",
@@ -903,9 +930,94 @@ SensorData Flash::getSensorDataError() {
     error.pm5 = 0;
     error.pm10 = 0;
     error.is_fake_gps = false;
+    error.time_unsynced = false;
     return error;
 }
 
+uint32_t Flash::stateChecksum(const uint8_t* data, size_t size) {
+    uint32_t sum = 0x12345678;
+    for (size_t i = 0; i < size; i++) {
+        sum = ((sum << 5) | (sum >> 27)) ^ data[i];
+    }
+    return sum;
+}
+
+bool Flash::saveState(uint8_t slot, const void* data, size_t size) {
+    if (slot >= FLASH_STATE_SLOT_COUNT || size == 0 || size > FLASH_STATE_MAX_SIZE) {
+        printf("FLASH ERROR: Invalid state slot %u or size %lu\n", slot, (unsigned long)size);
+        return false;
+    }
+    
+    uint32_t address = stateSlotAddress(slot);
+    
+    FlashStateHeader header;
+    header.magic = FLASH_STATE_MAGIC;
+    header.slot = slot;
+    header.size = (uint16_t)size;
+    header.checksum = stateChecksum((const uint8_t*)data, size);
+    header.reserved = 0;
+    
+    // Avoid wearing the sector if the stored copy is already identical
+    const uint8_t* stored = (const uint8_t*)flashAddressToXIP(address);
+    if (memcmp(stored, &header, sizeof(header)) == 0 &&
+        memcmp(stored + sizeof(header), data, size) == 0) {
+        if (_debug_level > 1) printf("FLASH: State slot %u unchanged, skipping write\n", slot);
+        return true;
+    }
+    
+    // Program whole pages only
+    size_t total = sizeof(header) + size;
+    size_t program_size = ((total + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE) * FLASH_PAGE_SIZE;
+    
+    uint8_t* buffer = new uint8_t[program_size];
+    if (!buffer) {
+        printf("FLASH ERROR: Failed to allocate state buffer\n");
+        return false;
+    }
+    memset(buffer, 0xFF, program_size);
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), data, size);
+    
+    bool ok = safeFlashErase(address, FLASH_SECTOR_SIZE) &&
+              safeFlashProgram(address, buffer, program_size);
+    delete[] buffer;
+    
+    if (!ok) {
+        printf("FLASH ERROR: Failed to write state slot %u\n", slot);
+    } else if (_debug_level > 0) {
+        printf("FLASH: Saved state slot %u (%lu bytes)\n", slot, (unsigned long)size);
+    }
+    return ok;
+}
+
+bool Flash::loadState(uint8_t slot, void* data, size_t size) {
+    if (slot >= FLASH_STATE_SLOT_COUNT || size == 0 || size > FLASH_STATE_MAX_SIZE) {
+        return false;
+    }
+    
+    const uint8_t* stored = (const uint8_t*)flashAddressToXIP(stateSlotAddress(slot));
+    FlashStateHeader header;
+    memcpy(&header, stored, sizeof(header));
+    
+    if (header.magic != FLASH_STATE_MAGIC || header.slot != slot) {
+        return false; // Never written (erased flash) or foreign data
+    }
+    
+    if (header.size != size) {
+        printf("FLASH: State slot %u has size %u, expected %lu - ignoring\n",
+               slot, header.size, (unsigned long)size);
+        return false;
+    }
+    
+    if (header.checksum != stateChecksum(stored + sizeof(header), size)) {
+        printf("FLASH: State slot %u checksum mismatch - ignoring\n", slot);
+        return false;
+    }
+    
+    memcpy(data, stored + sizeof(header), size);
+    return true;
+}
+
 // Safe flash erase operation with additional checks and recovery
 bool Flash::safeFlashErase(uint32_t address, size_t size) {
     if (!_flash_enabled) {
@@ -23,6 +23,7 @@ struct SensorData {
     uint32_t longitude = 0;
     uint32_t timestamp = 0;
     bool is_fake_gps = false;  // Flag to indicate if this reading used fake GPS data
+    bool time_unsynced = false; // Timestamp taken before the clock was synced to GPS
 };
 
 // Add this struct to ensure aligned, packed serialization
@@ -50,7 +51,7 @@ struct SerializedSensorData {
     uint32_t timestamp;
     
     // Flags
-    uint8_t flags;       // Bit 0: is_fake_gps, Bits 1-7: reserved for future use
+    uint8_t flags;       // Bit 0: is_fake_gps, Bit 1: time_unsynced, Bits 2-7: reserved
     uint8_t reserved[3]; // Reserved for future expansion, keeps alignment
     
     // Validation checksum
@@ -58,6 +59,32 @@ struct SerializedSensorData {
 };
 #pragma pack(pop)
 
+// Small persisted state blobs (GPS aiding, etc.) live in their own sectors
+// directly after the 32-sector record area, so erasing records keeps them
+enum FlashStateSlot : uint8_t {
+    FLASH_STATE_GPS = 0,    // Last fix, UTC time and TTFF statistics
+    FLASH_STATE_TLS_SESSION,   // Last TLS session for resumed handshakes after a reboot
+    FLASH_STATE_UPLOAD_CURSOR, // Records already acknowledged by the server
+    FLASH_STATE_UPLOAD_BATCH,  // Learned upload batch size per WiFi network
+    FLASH_STATE_WIFI_AP,       // Access point of the last WiFi connection
+    FLASH_STATE_UPLOAD_SEQUENCE, // Sequence number of the first stored record
+    FLASH_STATE_SLOT_COUNT
+};
+
+#define FLASH_STATE_MAGIC 0x53544154  // "STAT"
+
+#pragma pack(push, 1)
+struct FlashStateHeader {
+    uint32_t magic;      // FLASH_STATE_MAGIC
+    uint16_t slot;       // FlashStateSlot this sector belongs to
+    uint16_t size;       // Payload size in bytes
+    uint32_t checksum;   // Checksum over the payload
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+#define FLASH_STATE_MAX_SIZE (FLASH_SECTOR_SIZE - sizeof(FlashStateHeader))
+
 class Flash {
 public:
     Flash(uint32_t flash_offset = 0);
@@ -81,6 +108,14 @@ public:
     // Load all stored sensor data at once
     std::vector<SensorData> loadAllSensorData();
     
+    // Stored records as they lie in flash, mapped through XIP and
+    // SENSOR_DATA_SIZE bytes apart; valid until the storage is erased
+    const uint8_t* getRecordArea() { return (const uint8_t*)flashAddressToXIP(_data_start_address); }
+    
+    // Decodes a stored record without logging, e.g. for streaming them all;
+    // false for a record that is erased or has no valid header
+    bool readRecord(size_t index, SensorData& data);
+    
     // Get count of stored records
     uint32_t getStoredCount();
     
@@ -111,6 +146,12 @@ public:
     // Set debug verbosity level (0=minimal, 1=normal, 2=verbose)
     void setDebugLevel(int level) { _debug_level = level; }
     
+    // Persist a small state blob in its own sector (skipped if unchanged)
+    bool saveState(uint8_t slot, const void* data, size_t size);
+    
+    // Load a state blob; fails if the slot is empty, corrupt or a different size
+    bool loadState(uint8_t slot, void* data, size_t size);
+    
 private:
     uint32_t _flash_offset;                // Where to start storing data in flash
     uint32_t _data_count_address;          // Where to store the count of records
@@ -137,6 +178,14 @@ private:
     // Read a single record from a specific address
     bool readSensorDataRecord(uint32_t addr, SensorData &data);
     
+    // Flash address of the sector holding a state slot
+    uint32_t stateSlotAddress(uint8_t slot) const {
+        return _flash_offset + (32 + slot) * FLASH_SECTOR_SIZE;
+    }
+    
+    // Checksum used for state slots
+    static uint32_t stateChecksum(const uint8_t* data, size_t size);
+    
     // Helper for safe flash operations
     bool safeFlashErase(uint32_t address, size_t size);
     bool safeFlashProgram(uint32_t address, const uint8_t* data, size_t size);
@@ -0,0 +1,316 @@
+#include "libs/gps/gps_playback.h"
+#include "libs/gps/myGPS.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const size_t NOT_FOUND = (size_t)-1;
+
+GpsPlayback::GpsPlayback(const char *data, size_t length, gps_playback_clock_fn clock_us)
+    : data(data), length(length), format(detectFormat(data, length)), clock_us(clock_us) {
+    printf("GPS PLAYBACK: %lu bytes of %s data\n", (unsigned long)length,
+           format == GPS_PLAYBACK_GPX ? "GPX" : "NMEA");
+}
+
+size_t GpsPlayback::blobLength(const char *data, size_t max_length) {
+    size_t len = 0;
+    while (len < max_length && data[len] != '\0' && (uint8_t)data[len] != 0xFF) {
+        len++;
+    }
+    return len;
+}
+
+GpsPlaybackFormat GpsPlayback::detectFormat(const char *data, size_t length) {
+    size_t limit = length < 512 ? length : 512;
+    for (size_t i = 0; i + 4 <= limit; i++) {
+        if (memcmp(data + i, "<gpx", 4) == 0 || memcmp(data + i, "<trk", 4) == 0) {
+            return GPS_PLAYBACK_GPX;
+        }
+    }
+    return GPS_PLAYBACK_NMEA;
+}
+
+void GpsPlayback::restart() {
+    pos = 0;
+    pass_sentence_count = 0;
+    line_len = 0;
+    line_pos = 0;
+    at_end = false;
+    have_base = false;
+    last_time_of_day_ms = -1;
+    day_offset_ms = 0;
+    gpx_year = 2000;
+    gpx_month = 1;
+    gpx_day = 1;
+}
+
+bool GpsPlayback::readable() {
+    if (line_pos >= line_len && !loadNextLine()) {
+        return false;
+    }
+
+    // Lines before the first timed sentence, or an unpaced replay, go out at once
+    if (speed == 0 || last_time_of_day_ms < 0) {
+        return true;
+    }
+
+    uint64_t now_us = clock_us();
+    if (!have_base) {
+        have_base = true;
+        base_track_ms = line_track_ms;
+        base_clock_us = now_us;
+        return true;
+    }
+
+    int64_t elapsed_track_ms = (int64_t)((now_us - base_clock_us) / 1000) * speed;
+    return elapsed_track_ms >= line_track_ms - base_track_ms;
+}
+
+char GpsPlayback::getc() {
+    return line_pos < line_len ? line[line_pos++] : '\n';
+}
+
+bool GpsPlayback::loadNextLine() {
+    if (at_end) {
+        return false;
+    }
+
+    for (;;) {
+        bool loaded = (format == GPS_PLAYBACK_GPX) ? nextGpxPoint() : nextNmeaLine();
+        if (loaded) {
+            sentence_count++;
+            pass_sentence_count++;
+            return true;
+        }
+
+        // End of data: stop, or rewind and re-base pacing on the first sentence.
+        // A pass without a single sentence means there is nothing to replay.
+        if (!loop || pass_sentence_count == 0) {
+            at_end = true;
+            printf("GPS PLAYBACK: End of track after %lu sentences\n", (unsigned long)sentence_count);
+            return false;
+        }
+
+        loop_count++;
+        pass_sentence_count = 0;
+        pos = 0;
+        have_base = false;
+        last_time_of_day_ms = -1;
+        day_offset_ms = 0;
+        gpx_year = 2000;
+        gpx_month = 1;
+        gpx_day = 1;
+        printf("GPS PLAYBACK: Restarting track (loop %lu)\n", (unsigned long)loop_count);
+    }
+}
+
+int64_t GpsPlayback::trackTimeFromTimeOfDay(int64_t time_of_day_ms) {
+    // A jump back by more than 12 h is a day rollover, not a rewind
+    if (last_time_of_day_ms >= 0 && time_of_day_ms + 43200000 < last_time_of_day_ms) {
+        day_offset_ms += 86400000;
+    }
+    last_time_of_day_ms = time_of_day_ms;
+    return day_offset_ms + time_of_day_ms;
+}
+
+bool GpsPlayback::nextNmeaLine() {
+    while (pos < length) {
+        size_t start = pos;
+        size_t end = start;
+        while (end < length && data[end] != '\n') {
+            end++;
+        }
+        pos = (end < length) ? end + 1 : end;
+
+        size_t stop = end;
+        while (stop > start && data[stop - 1] == '\r') {
+            stop--;
+        }
+
+        size_t n = stop - start;
+        if (n < 7 || data[start] != '$' || n > sizeof(line) - 2) {
+            continue; // Blank, non-NMEA or oversized line
+        }
+
+        memcpy(line, data + start, n);
+        line[n++] = '\r';
+        line[n++] = '\n';
+        line_len = n;
+        line_pos = 0;
+
+        // Untimed sentences (GSV, GSA, ...) keep the time of the previous one
+        int64_t time_of_day_ms;
+        if (parseNmeaTime(line, n, time_of_day_ms)) {
+            line_track_ms = trackTimeFromTimeOfDay(time_of_day_ms);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool GpsPlayback::parseNmeaTime(const char *sentence, size_t len, int64_t &time_of_day_ms) {
+    if (len < 7) {
+        return false;
+    }
+
+    // Time is field 1 of RMC/GGA/GNS/ZDA and field 5 of GLL
+    const char *type = sentence + 3;
+    int field;
+    if (memcmp(type, "GLL", 3) == 0) {
+        field = 5;
+    } else if (memcmp(type, "RMC", 3) == 0 || memcmp(type, "GGA", 3) == 0 ||
+               memcmp(type, "GNS", 3) == 0 || memcmp(type, "ZDA", 3) == 0) {
+        field = 1;
+    } else {
+        return false;
+    }
+
+    size_t i = 0;
+    int current = 0;
+    while (i < len && current < field) {
+        if (sentence[i] == ',') {
+            current++;
+        }
+        i++;
+    }
+    if (current != field || i + 6 > len) {
+        return false;
+    }
+
+    for (size_t k = 0; k < 6; k++) {
+        if (sentence[i + k] < '0' || sentence[i + k] > '9') {
+            return false;
+        }
+    }
+
+    int hours = (sentence[i] - '0') * 10 + (sentence[i + 1] - '0');
+    int minutes = (sentence[i + 2] - '0') * 10 + (sentence[i + 3] - '0');
+    int seconds = (sentence[i + 4] - '0') * 10 + (sentence[i + 5] - '0');
+
+    int millis = 0;
+    if (i + 6 < len && sentence[i + 6] == '.') {
+        int scale = 100;
+        for (size_t k = i + 7; k < len && scale > 0 && sentence[k] >= '0' && sentence[k] <= '9'; k++) {
+            millis += (sentence[k] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    time_of_day_ms = ((int64_t)(hours * 60 + minutes) * 60 + seconds) * 1000 + millis;
+    return true;
+}
+
+size_t GpsPlayback::find(const char *needle, size_t from, size_t to) const {
+    size_t n = strlen(needle);
+    if (to > length) {
+        to = length;
+    }
+    for (size_t i = from; i + n <= to; i++) {
+        if (memcmp(data + i, needle, n) == 0) {
+            return i;
+        }
+    }
+    return NOT_FOUND;
+}
+
+size_t GpsPlayback::appendChecksumAndEol(char *sentence, size_t len, size_t capacity) {
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < len; i++) {
+        checksum ^= (uint8_t)sentence[i];
+    }
+    int written = snprintf(sentence + len, capacity - len, "*%02X\r\n", checksum);
+    return written > 0 ? len + written : len;
+}
+
+bool GpsPlayback::nextGpxPoint() {
+    size_t start, tag_end, point_end, lat_attr, lon_attr;
+    for (;;) {
+        start = find("<trkpt", pos, length);
+        tag_end = (start != NOT_FOUND) ? find(">", start, length) : NOT_FOUND;
+        if (tag_end == NOT_FOUND) {
+            pos = length;
+            return false;
+        }
+
+        // Point ends at </trkpt>, or at the next point for self-closing tags
+        point_end = find("</trkpt>", tag_end, length);
+        size_t next_point = find("<trkpt", tag_end, length);
+        if (point_end == NOT_FOUND || (next_point != NOT_FOUND && next_point < point_end)) {
+            point_end = (next_point != NOT_FOUND) ? next_point : length;
+        }
+        pos = point_end;
+
+        lat_attr = find("lat=\"", start, tag_end);
+        lon_attr = find("lon=\"", start, tag_end);
+        if (lat_attr != NOT_FOUND && lon_attr != NOT_FOUND) {
+            break;
+        }
+        // Malformed point, skip it
+    }
+    double lat = strtod(data + lat_attr + 5, nullptr);
+    double lon = strtod(data + lon_attr + 5, nullptr);
+
+    // <time>YYYY-MM-DDTHH:MM:SS[.fff]Z</time>; points without time advance by 1 s
+    // on the date of the previous point
+    int year = gpx_year, month = gpx_month, day = gpx_day;
+    int64_t time_of_day_ms = last_time_of_day_ms >= 0 ? last_time_of_day_ms + 1000 : 0;
+    size_t time_tag = find("<time>", tag_end, point_end);
+    if (time_tag != NOT_FOUND && time_tag + 6 + 19 <= length) {
+        const char *t = data + time_tag + 6;
+        year = atoi(t);
+        month = (t[5] - '0') * 10 + (t[6] - '0');
+        day = (t[8] - '0') * 10 + (t[9] - '0');
+        int hours = (t[11] - '0') * 10 + (t[12] - '0');
+        int minutes = (t[14] - '0') * 10 + (t[15] - '0');
+        int seconds = (t[17] - '0') * 10 + (t[18] - '0');
+        int millis = 0;
+        if (t[19] == '.') {
+            int scale = 100;
+            for (int k = 20; scale > 0 && t[k] >= '0' && t[k] <= '9'; k++) {
+                millis += (t[k] - '0') * scale;
+                scale /= 10;
+            }
+        }
+        time_of_day_ms = ((int64_t)(hours * 60 + minutes) * 60 + seconds) * 1000 + millis;
+        gpx_year = year;
+        gpx_month = month;
+        gpx_day = day;
+    } else if (time_of_day_ms >= 86400000) {
+        // Past midnight: the date moves on with the time of day
+        int hour, minute, second;
+        myGPS::epochToUtc(myGPS::utcToEpoch(year, month, day, 0, 0, 0) + 86400, year, month, day,
+                          hour, minute, second);
+        gpx_year = year;
+        gpx_month = month;
+        gpx_day = day;
+    }
+    time_of_day_ms %= 86400000;
+    line_track_ms = trackTimeFromTimeOfDay(time_of_day_ms);
+
+    // Degrees to NMEA ddmm.mmmm in integer units of 1e-4 minutes
+    uint32_t lat_units = (uint32_t)((lat < 0 ? -lat : lat) * 600000.0 + 0.5);
+    uint32_t lon_units = (uint32_t)((lon < 0 ? -lon : lon) * 600000.0 + 0.5);
+
+    uint32_t tod_s = (uint32_t)(time_of_day_ms / 1000);
+    int centis = (int)((time_of_day_ms % 1000) / 10);
+
+    int n = snprintf(line, sizeof(line),
+                     "$GPRMC,%02lu%02lu%02lu.%02d,A,%02lu%02lu.%04lu,%c,%03lu%02lu.%04lu,%c,0.0,0.0,%02d%02d%02d,,,A",
+                     (unsigned long)(tod_s / 3600), (unsigned long)((tod_s / 60) % 60),
+                     (unsigned long)(tod_s % 60), centis,
+                     (unsigned long)(lat_units / 600000), (unsigned long)((lat_units % 600000) / 10000),
+                     (unsigned long)(lat_units % 10000), lat < 0 ? 'S' : 'N',
+                     (unsigned long)(lon_units / 600000), (unsigned long)((lon_units % 600000) / 10000),
+                     (unsigned long)(lon_units % 10000), lon < 0 ? 'W' : 'E',
+                     day, month, year % 100);
+    size_t len = appendChecksumAndEol(line, (size_t)n, sizeof(line));
+
+    // Satellites-in-view for getVisibleSatellites(); the track has no sky data
+    size_t gsv_start = len;
+    int gsv = snprintf(line + len, sizeof(line) - len, "$GPGSV,1,1,08");
+    len = gsv_start + appendChecksumAndEol(line + gsv_start, (size_t)gsv, sizeof(line) - gsv_start);
+
+    line_len = len;
+    line_pos = 0;
+    return true;
+}
@@ -0,0 +1,94 @@
+#ifndef GPS_PLAYBACK_H
+#define GPS_PLAYBACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Monotonic microsecond clock used for pacing (time_us_64 on the device)
+typedef uint64_t (*gps_playback_clock_fn)(void);
+
+enum GpsPlaybackFormat : uint8_t {
+    GPS_PLAYBACK_NMEA = 0,   // Raw NMEA log, one sentence per line
+    GPS_PLAYBACK_GPX         // GPX 1.1 track, converted to RMC sentences on the fly
+};
+
+// Replays a recorded NMEA log or GPX track as the byte stream a receiver would
+// send, so myGPS decodes it through the same path as the UART. Sentences are
+// released when their UTC time is due relative to the first sentence, scaled
+// by the playback speed. Playback is fully deterministic (no random jitter).
+//
+// Has no Pico SDK dependencies; the device passes time_us_64 as the clock.
+class GpsPlayback {
+public:
+    GpsPlayback(const char *data, size_t length, gps_playback_clock_fn clock_us);
+
+    // 1 = real time, N = N times faster, 0 = unpaced (as fast as it is read)
+    void setSpeed(uint32_t speed) { this->speed = speed; }
+    uint32_t getSpeed() const { return speed; }
+
+    // Restart from the beginning when the end of the track is reached
+    void setLoop(bool loop) { this->loop = loop; }
+
+    void restart();
+
+    // True if the next byte of the stream is due
+    bool readable();
+
+    // Next byte of the stream; only valid after readable() returned true
+    char getc();
+
+    bool finished() const { return at_end && line_pos >= line_len; }
+    GpsPlaybackFormat getFormat() const { return format; }
+    uint32_t getSentenceCount() const { return sentence_count; }
+    uint32_t getLoopCount() const { return loop_count; }
+
+    // Length of a blob stored in flash, which ends at the first erased (0xFF)
+    // or NUL byte
+    static size_t blobLength(const char *data, size_t max_length);
+
+    static GpsPlaybackFormat detectFormat(const char *data, size_t length);
+
+private:
+    const char *data;
+    size_t length;
+    size_t pos = 0;
+    GpsPlaybackFormat format;
+    gps_playback_clock_fn clock_us;
+    uint32_t speed = 1;
+    bool loop = false;
+    bool at_end = false;
+    uint32_t sentence_count = 0;
+    uint32_t loop_count = 0;
+    uint32_t pass_sentence_count = 0;
+
+    // Sentence(s) currently being released
+    char line[192];
+    size_t line_len = 0;
+    size_t line_pos = 0;
+    int64_t line_track_ms = 0;      // Track time of the current line
+
+    // Pacing reference: first timed sentence vs. clock at that moment
+    bool have_base = false;
+    int64_t base_track_ms = 0;
+    uint64_t base_clock_us = 0;
+
+    // Track time is ms since the first day's midnight; rolls over at 24 h
+    int64_t last_time_of_day_ms = -1;
+    int64_t day_offset_ms = 0;
+
+    // UTC date of the last GPX point, for points without <time>
+    int gpx_year = 2000;
+    int gpx_month = 1;
+    int gpx_day = 1;
+
+    bool loadNextLine();
+    bool nextNmeaLine();
+    bool nextGpxPoint();
+    int64_t trackTimeFromTimeOfDay(int64_t time_of_day_ms);
+    size_t find(const char *needle, size_t from, size_t to) const;
+
+    static bool parseNmeaTime(const char *sentence, size_t len, int64_t &time_of_day_ms);
+    static size_t appendChecksumAndEol(char *sentence, size_t len, size_t capacity);
+};
+
+#endif // GPS_PLAYBACK_H
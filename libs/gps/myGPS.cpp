@@ -114,7 +114,7 @@ int myGPS::readLine(std::string &line) {
     absolute_time_t master_timeout = make_timeout_time_ms(200); // Reduced from 300ms to 200ms
     
     // Check if UART has data - if not, return quickly
-    if(!uart_is_readable(this->uart_id)) {
+    if(!sourceReadable()) {
         return 1; // No data available yet
     }
 
@@ -144,12 +144,13 @@ int myGPS::readLine(std::string &line) {
                 return 1; // Timeout reading GPS
             }
             
-            if(uart_is_readable(this->uart_id)) {
-                char c = uart_getc(this->uart_id);
+            if(sourceReadable()) {
+                char c = sourceGetc();
                 this->buffer += c;
                 
                 // Look for end of sentence
                 if (c == '\n') {
+                    line_end_us = time_us_64();
                     break;
                 }
             } else {
@@ -232,6 +233,7 @@ int myGPS::readLine(std::string &line) {
 
         std::getline(iss, token, ','); // Fix validity (A=valid, V=invalid)
         bool valid_fix = (token == "A");
+        if (valid_fix) recordFirstFix();
         
         return valid_fix ? 0 : 2;  // Return 0 for valid fix, 2 for invalid
     }
@@ -245,10 +247,11 @@ int myGPS::readLine(std::string &line) {
         std::getline(iss, token, ','); // Fix validity
         bool valid_fix = (token == "A");
         
-        if (!valid_fix) return 2; // Early return if invalid fix
-        
+        // Keep parsing without a fix: the date at the end is still valid while
+        // the receiver's backup clock runs, and is needed for start-up aiding.
+        // Position fields are only taken from valid fixes.
         std::getline(iss, token, ','); // Latitude
-        if (!token.empty() && token.length() >= 3) {
+        if (valid_fix && !token.empty() && token.length() >= 3) {
             try {
                 this->latitude = std::stod(token.substr(0, 2)) + std::stod(token.substr(2)) / 60.0;
             } catch (...) {
@@ -257,10 +260,10 @@ int myGPS::readLine(std::string &line) {
         }
         
         std::getline(iss, token, ','); // N/S indicator
-        if (!token.empty()) this->nsIndicator = token[0];
+        if (valid_fix && !token.empty()) this->nsIndicator = token[0];
         
         std::getline(iss, token, ','); // Longitude
-        if (!token.empty() && token.length() >= 4) {
+        if (valid_fix && !token.empty() && token.length() >= 4) {
             try {
                 this->longitude = std::stod(token.substr(0, 3)) + std::stod(token.substr(3)) / 60.0;
             } catch (...) {
@@ -269,7 +272,7 @@ int myGPS::readLine(std::string &line) {
         }
         
         std::getline(iss, token, ','); // E/W indicator
-        if (!token.empty()) this->ewIndicator = token[0];
+        if (valid_fix && !token.empty()) this->ewIndicator = token[0];
         
         // Skip speed and course
         std::getline(iss, token, ',');
@@ -281,6 +284,22 @@ int myGPS::readLine(std::string &line) {
             this->date = token;
         }
         
+        if (valid_fix) {
+            recordFirstFix();
+            
+            // Back-date the end of line by the sentence's transmission time
+            // (10 bits per character) to estimate when the '$' arrived
+            uint64_t transmit_us = (uint64_t)this->buffer.length() * 10000000ULL / this->baud_rate;
+            rmc_capture_us = line_end_us - transmit_us;
+            rmc_time_pending = getUtcEpoch(rmc_epoch);
+            
+            if (this->latitude != 0 || this->longitude != 0) {
+                fix_lat_e7 = (int32_t)((this->nsIndicator == 'S' ? -this->latitude : this->latitude) * 10000000);
+                fix_lon_e7 = (int32_t)((this->ewIndicator == 'W' ? -this->longitude : this->longitude) * 10000000);
+                fix_pending = true;
+            }
+        }
+        
         return valid_fix ? 0 : 2;  // Return 0 for valid fix, 2 for invalid
     }
     
@@ -590,9 +609,9 @@ int myGPS::getVisibleSatellites() {
     printf("Checking for visible satellites...\n");
     
     while (!absolute_time_diff_us(get_absolute_time(), timeout) <= 0 && !found_gsv_message) {
-        if (uart_is_readable(this->uart_id)) {
+        if (sourceReadable()) {
             std::string gsv_message = "";
-            char c = uart_getc(this->uart_id);
+            char c = sourceGetc();
             
             // Look for the start of a GSV message
             if (c == '$') {
@@ -600,8 +619,8 @@ int myGPS::getVisibleSatellites() {
                 
                 // Read more characters to check if this is a GSV message
                 for (int i = 0; i < 5; i++) {
-                    if (uart_is_readable(this->uart_id)) {
-                        c = uart_getc(this->uart_id);
+                    if (sourceReadable()) {
+                        c = sourceGetc();
                         gsv_message += c;
                     } else {
                         sleep_ms(1);
@@ -615,8 +634,8 @@ int myGPS::getVisibleSatellites() {
                     // Continue reading the rest of the message
                     bool reading_message = true;
                     while (reading_message) {
-                        if (uart_is_readable(this->uart_id)) {
-                            c = uart_getc(this->uart_id);
+                        if (sourceReadable()) {
+                            c = sourceGetc();
                             gsv_message += c;
                             
                             // End of message
@@ -720,7 +739,7 @@ bool myGPS::waitForFix(int timeout_seconds) {
     bool got_fix = false;
     
     // Reset receiver if we haven't received any valid data
-    if (!uart_is_readable(this->uart_id)) {
+    if (!sourceReadable()) {
         printf("No data from GPS, reinitializing...\n");
         this->init();
         sleep_ms(200);
@@ -728,7 +747,7 @@ bool myGPS::waitForFix(int timeout_seconds) {
     
     while (!absolute_time_diff_us(get_absolute_time(), timeout) <= 0 && !got_fix) {
         // Check for readable data
-        if (uart_is_readable(this->uart_id)) {
+        if (sourceReadable()) {
             try {
                 // Try to read a full line with fix information
                 std::string tmp_buffer;
@@ -1133,3 +1152,301 @@ bool myGPS::optimizeForFastAcquisition() {
     }
 }
 
+// Little-endian field writers for UBX payloads
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+void myGPS::sendNmeaCommand(const char *body) {
+    uint8_t checksum = 0;
+    for (const char *p = body; *p != '\0'; p++) {
+        checksum ^= (uint8_t)*p;
+    }
+    
+    char sentence[96];
+    snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+    uart_puts(this->uart_id, sentence);
+}
+
+void myGPS::sendUbxMessage(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t length) {
+    uint8_t header[6] = {0xB5, 0x62, msg_class, msg_id,
+                         (uint8_t)(length & 0xFF), (uint8_t)(length >> 8)};
+    
+    // 8-bit Fletcher checksum over class, id, length and payload
+    uint8_t ck_a = 0, ck_b = 0;
+    for (int i = 2; i < 6; i++) {
+        ck_a += header[i];
+        ck_b += ck_a;
+    }
+    for (uint16_t i = 0; i < length; i++) {
+        ck_a += payload[i];
+        ck_b += ck_a;
+    }
+    uint8_t trailer[2] = {ck_a, ck_b};
+    
+    uart_write_blocking(this->uart_id, header, sizeof(header));
+    if (length > 0) {
+        uart_write_blocking(this->uart_id, payload, length);
+    }
+    uart_write_blocking(this->uart_id, trailer, sizeof(trailer));
+}
+
+uint32_t myGPS::utcToEpoch(int year, int month, int day, int hour, int minute, int second) {
+    // Days since 1970-01-01 (civil-from-days inverse, valid for the proleptic Gregorian calendar)
+    int y = year - (month <= 2 ? 1 : 0);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + (int32_t)doe - 719468;
+    
+    return (uint32_t)days * 86400u + hour * 3600 + minute * 60 + second;
+}
+
+void myGPS::epochToUtc(uint32_t epoch, int &year, int &month, int &day,
+                       int &hour, int &minute, int &second) {
+    int32_t days = epoch / 86400;
+    uint32_t secs = epoch % 86400;
+    hour = secs / 3600;
+    minute = (secs % 3600) / 60;
+    second = secs % 60;
+    
+    days += 719468;
+    int era = days / 146097;
+    unsigned doe = (unsigned)(days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = (int)yoe + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+bool myGPS::getUtcEpoch(uint32_t &epoch) {
+    if (this->date.size() < 6 || this->time.size() < 8) {
+        return false;
+    }
+    
+    int day = atoi(this->date.substr(0, 2).c_str());
+    int month = atoi(this->date.substr(2, 2).c_str());
+    int year = 2000 + atoi(this->date.substr(4, 2).c_str());
+    int hour = atoi(this->time.substr(0, 2).c_str());
+    int minute = atoi(this->time.substr(3, 2).c_str());
+    int second = atoi(this->time.substr(6, 2).c_str());
+    
+    // Receivers without a running backup clock report their firmware default
+    // date (1970/1980/2080 depending on vendor), so only accept a sane window
+    if (year < 2024 || year > 2079 || month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour > 23 || minute > 59 || second > 60) {
+        return false;
+    }
+    
+    epoch = utcToEpoch(year, month, day, hour, minute, second);
+    return true;
+}
+
+bool myGPS::readReceiverTime(uint32_t &epoch, int timeout_ms) {
+    if (use_fake_data) {
+        epoch = (uint32_t)::time(NULL);
+        return true;
+    }
+    
+    absolute_time_t timeout = make_timeout_time_ms(timeout_ms);
+    std::string line;
+    
+    while (absolute_time_diff_us(get_absolute_time(), timeout) > 0) {
+        int status = readLine(line);
+        if (status != 1 &&
+            (line.find(GNRMC) == 0 || line.find("$GPRMC") == 0) &&
+            getUtcEpoch(epoch)) {
+            printf("GPS receiver time: %s %s (fix %s)\n", this->date.c_str(), this->time.c_str(),
+                   status == 0 ? "valid" : "not yet valid");
+            return true;
+        }
+        sleep_ms(10);
+    }
+    
+    printf("GPS receiver did not report a plausible UTC time\n");
+    return false;
+}
+
+bool myGPS::takeRmcTime(uint32_t &epoch, uint64_t &capture_us) {
+    // Accelerated playback runs faster than UTC, so it must not steer the clock
+    if (!rmc_time_pending || use_fake_data || (playback && playback->getSpeed() != 1)) {
+        return false;
+    }
+    rmc_time_pending = false;
+    
+    epoch = rmc_epoch;
+    capture_us = rmc_capture_us;
+    return true;
+}
+
+bool myGPS::takeFix(int32_t &lat_e7, int32_t &lon_e7, uint64_t &capture_us) {
+    if (!fix_pending || use_fake_data) {
+        return false;
+    }
+    fix_pending = false;
+    
+    lat_e7 = fix_lat_e7;
+    lon_e7 = fix_lon_e7;
+    capture_us = rmc_capture_us;
+    return true;
+}
+
+GpsStartType myGPS::chooseStartType(const GpsAidingState &state, bool have_state,
+                                    uint32_t now_utc, bool have_time) {
+    if (!have_state || state.utc_epoch == 0) {
+        return GPS_START_COLD;
+    }
+    
+    // Without the current time the state age is unknown; keep almanac and
+    // position but let the receiver rebuild ephemeris
+    if (!have_time) {
+        return GPS_START_WARM;
+    }
+    
+    // Clock behind the stored fix means one of the two is wrong
+    if (now_utc < state.utc_epoch) {
+        return GPS_START_COLD;
+    }
+    
+    uint32_t age = now_utc - state.utc_epoch;
+    if (age <= GPS_HOT_START_MAX_AGE_S) {
+        return GPS_START_HOT;
+    }
+    if (age <= GPS_WARM_START_MAX_AGE_S) {
+        return GPS_START_WARM;
+    }
+    return GPS_START_COLD;
+}
+
+const char *myGPS::startTypeName(GpsStartType type) {
+    switch (type) {
+        case GPS_START_HOT:  return "hot";
+        case GPS_START_WARM: return "warm";
+        case GPS_START_COLD: return "cold";
+        default:             return "unknown";
+    }
+}
+
+void myGPS::recordFirstFix() {
+    if (ttff_ms < 0 && start_command_ms != 0) {
+        ttff_ms = (int32_t)(to_ms_since_boot(get_absolute_time()) - start_command_ms);
+        printf("GPS: first fix after %s start, TTFF %ld ms\n",
+               startTypeName(last_start_type), (long)ttff_ms);
+    }
+}
+
+bool myGPS::startWithAiding(GpsStartType type, const GpsAidingState &state, bool have_state,
+                            uint32_t now_utc, bool have_time) {
+    uint32_t entry_ms = to_ms_since_boot(get_absolute_time());
+    printf("Sending GPS %s start command...\n", startTypeName(type));
+    
+    this->init();
+    sleep_ms(100);
+    
+    // MTK: $PMTK101 hot, $PMTK102 warm, $PMTK103 cold
+    static const char *mtk_start[GPS_START_TYPE_COUNT] = {"PMTK101", "PMTK102", "PMTK103"};
+    sendNmeaCommand(mtk_start[type]);
+    
+    // u-blox: UBX-CFG-RST, navBbrMask selects what battery-backed data is
+    // cleared (none / ephemeris / all), resetMode 0x02 = controlled GNSS reset
+    uint16_t nav_bbr_mask = (type == GPS_START_HOT) ? 0x0000 :
+                            (type == GPS_START_WARM) ? 0x0001 : 0xFFFF;
+    uint8_t cfg_rst[4];
+    put_le16(cfg_rst, nav_bbr_mask);
+    cfg_rst[2] = 0x02;
+    cfg_rst[3] = 0x00;
+    sendUbxMessage(0x06, 0x04, cfg_rst, sizeof(cfg_rst));
+    
+    last_start_type = type;
+    start_command_ms = to_ms_since_boot(get_absolute_time());
+    ttff_ms = -1;
+    
+    // Wait for the receiver to come back before injecting aiding data
+    int attempts = 20;
+    bool data_received = false;
+    while (attempts > 0 && !data_received) {
+        sleep_ms(100);
+        if (uart_is_readable(this->uart_id)) {
+            data_received = true;
+        }
+        attempts--;
+    }
+    while (uart_is_readable(this->uart_id)) {
+        uart_getc(this->uart_id);
+    }
+    
+    if (have_time) {
+        // Account for the time spent resetting since the caller read the clock
+        uint32_t utc = now_utc + (to_ms_since_boot(get_absolute_time()) - entry_ms) / 1000;
+        int year, month, day, hour, minute, second;
+        epochToUtc(utc, year, month, day, hour, minute, second);
+        
+        char body[80];
+        
+        // MTK time aiding: PMTK740,YYYY,MM,DD,hh,mm,ss
+        snprintf(body, sizeof(body), "PMTK740,%04d,%02d,%02d,%02d,%02d,%02d",
+                 year, month, day, hour, minute, second);
+        sendNmeaCommand(body);
+        
+        // u-blox UBX-MGA-INI-TIME_UTC, leap seconds unknown, 2 s accuracy
+        uint8_t time_utc[24] = {0};
+        time_utc[0] = 0x10;          // type
+        time_utc[3] = 0x80;          // leapSecs = -128 (unknown)
+        put_le16(&time_utc[4], (uint16_t)year);
+        time_utc[6] = (uint8_t)month;
+        time_utc[7] = (uint8_t)day;
+        time_utc[8] = (uint8_t)hour;
+        time_utc[9] = (uint8_t)minute;
+        time_utc[10] = (uint8_t)second;
+        put_le16(&time_utc[16], 2);  // tAccS
+        sendUbxMessage(0x13, 0x40, time_utc, sizeof(time_utc));
+        sleep_ms(50);
+        
+        // MTK position aiding needs the time as well:
+        // PMTK741,lat,lon,alt,YYYY,MM,DD,hh,mm,ss (altitude unknown, 0 m)
+        if (have_state && type != GPS_START_COLD) {
+            snprintf(body, sizeof(body), "PMTK741,%.6f,%.6f,0,%04d,%02d,%02d,%02d,%02d,%02d",
+                     state.latitude_e7 / 1e7, state.longitude_e7 / 1e7,
+                     year, month, day, hour, minute, second);
+            sendNmeaCommand(body);
+        }
+    }
+    
+    if (have_state && type != GPS_START_COLD) {
+        // u-blox UBX-MGA-INI-POS_LLH, 100 km accuracy covers a moved device
+        uint8_t pos_llh[20] = {0};
+        pos_llh[0] = 0x01;                                   // type
+        put_le32(&pos_llh[4], (uint32_t)state.latitude_e7);
+        put_le32(&pos_llh[8], (uint32_t)state.longitude_e7);
+        put_le32(&pos_llh[12], 0);                           // altitude cm (unknown)
+        put_le32(&pos_llh[16], 10000000);                    // posAcc cm
+        sendUbxMessage(0x13, 0x40, pos_llh, sizeof(pos_llh));
+        
+        printf("GPS aiding: position %.6f, %.6f%s\n",
+               state.latitude_e7 / 1e7, state.longitude_e7 / 1e7,
+               have_time ? " with time" : " (no time available)");
+    } else if (have_time) {
+        printf("GPS aiding: time only\n");
+    }
+    
+    // Make sure RMC/GLL output is enabled again after the reset
+    sendNmeaCommand("PMTK314,0,1,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0");
+    
+    if (data_received) {
+        printf("GPS module responded after %s start command\n", startTypeName(type));
+    } else {
+        printf("No response from GPS module after %s start command\n", startTypeName(type));
+    }
+    return data_received;
+}
@@ -7,6 +7,7 @@
 
 
 #include "hardware/uart.h"
+#include "libs/gps/gps_playback.h"
 #include <string>
 #include <sstream>
 #include <vector>
@@ -35,6 +36,28 @@ const std::string GNTXT = "$GNTXT";
 const std::string GNGLL = "$GNGLL";
 const std::string GNRMC = "$GNRMC";
 
+// Receiver start types, chosen from the age of the persisted aiding state
+enum GpsStartType : uint8_t {
+    GPS_START_HOT = 0,   // Ephemeris still valid, inject time + position
+    GPS_START_WARM,      // Almanac usable, inject time + position
+    GPS_START_COLD,      // State missing or too old
+    GPS_START_TYPE_COUNT
+};
+
+// Persisted state aids are treated as valid up to these ages
+#define GPS_HOT_START_MAX_AGE_S  (2 * 3600)        // Broadcast ephemeris lifetime
+#define GPS_WARM_START_MAX_AGE_S (7 * 24 * 3600)   // Almanac and position still close
+
+// Last good fix, UTC time and TTFF statistics, persisted to flash between boots
+struct GpsAidingState {
+    uint32_t version = 1;
+    int32_t latitude_e7 = 0;     // Degrees * 1e7, negative = south
+    int32_t longitude_e7 = 0;    // Degrees * 1e7, negative = west
+    uint32_t utc_epoch = 0;      // UTC seconds of the fix, 0 if never had one
+    uint32_t ttff_count[GPS_START_TYPE_COUNT] = {0};
+    uint32_t ttff_total_ms[GPS_START_TYPE_COUNT] = {0};
+};
+
 const std::string AUTHREQ = "$AUTHREQ";
 const std::string AUTHRES = "$AUTHRES";
 const std::string DATASEND = "$DATASEND";
@@ -65,6 +88,41 @@ private:
     int fake_satellites = 0;
     int fake_acquisition_time_ms = 5000; // Time to acquire fix (5 seconds)
     
+    // Recorded track replayed instead of the UART, if set
+    GpsPlayback *playback = nullptr;
+    
+    // Byte source for the NMEA decoder: playback if set, UART otherwise
+    bool sourceReadable() {
+        return playback ? playback->readable() : uart_is_readable(this->uart_id);
+    }
+    char sourceGetc() {
+        return playback ? playback->getc() : uart_getc(this->uart_id);
+    }
+    
+    // Time-to-first-fix measurement for the last start command
+    GpsStartType last_start_type = GPS_START_COLD;
+    uint32_t start_command_ms = 0;
+    int32_t ttff_ms = -1;
+    void recordFirstFix();
+    
+    // time_us_64() at which the current sentence ended, and the estimated start
+    // of the last valid RMC sentence (used to discipline the system clock)
+    uint64_t line_end_us = 0;
+    uint64_t rmc_capture_us = 0;
+    uint32_t rmc_epoch = 0;
+    bool rmc_time_pending = false;
+    
+    // Position of the last valid RMC fix (signed degrees * 1e7) for the position filter
+    int32_t fix_lat_e7 = 0;
+    int32_t fix_lon_e7 = 0;
+    bool fix_pending = false;
+    
+    // Write an NMEA command, adding '$', checksum and CR/LF to the body
+    void sendNmeaCommand(const char *body);
+    
+    // Write a UBX binary frame with its Fletcher checksum
+    void sendUbxMessage(uint8_t msg_class, uint8_t msg_id, const uint8_t *payload, uint16_t length);
+    
 public:
     myGPS(uart_inst_t *, int, int, int);
     void init();
@@ -81,6 +139,11 @@ public:
         fake_longitude = lon; 
     }
     
+    // Replay a recorded NMEA log / GPX track through the normal decoder
+    // (pass nullptr to go back to the receiver)
+    void setPlayback(GpsPlayback *source) { playback = source; }
+    bool isPlaybackEnabled() const { return playback != nullptr; }
+    
     // Get the current date from GPS in DDMMYY format
     // Returns empty string if no date is available
     std::string getDate() { return date; }
@@ -123,6 +186,44 @@ public:
     // Optimizes GPS module for faster fix acquisition by sending various configuration commands
     // Returns true if the GPS module is still responding after sending the commands
     bool optimizeForFastAcquisition();
+    
+    // UTC of the last parsed time/date as epoch seconds
+    // Returns false if the receiver has not reported a plausible date yet
+    bool getUtcEpoch(uint32_t &epoch);
+    
+    // Listens for an RMC sentence and returns the receiver's UTC time
+    // Works without a fix as long as the receiver's backup clock is running
+    bool readReceiverTime(uint32_t &epoch, int timeout_ms);
+    
+    // Returns the UTC second of the last valid RMC fix and the time_us_64() at
+    // which that sentence started arriving. Each sample is returned only once.
+    bool takeRmcTime(uint32_t &epoch, uint64_t &capture_us);
+    
+    // Returns the position of the last valid RMC fix (signed degrees * 1e7) and
+    // the time_us_64() at which that sentence started arriving. Each fix is
+    // returned only once.
+    bool takeFix(int32_t &lat_e7, int32_t &lon_e7, uint64_t &capture_us);
+    
+    // Picks hot/warm/cold start from the age of the persisted state
+    // If the current time is unknown, a warm start with position-only aiding is used
+    static GpsStartType chooseStartType(const GpsAidingState &state, bool have_state,
+                                        uint32_t now_utc, bool have_time);
+    
+    // Sends the start command for both MTK (PMTK10x) and u-blox (UBX-CFG-RST)
+    // receivers, then injects time (PMTK740/UBX-MGA-INI-TIME_UTC) and position
+    // (PMTK741/UBX-MGA-INI-POS_LLH) aiding where available. Starts TTFF timing.
+    bool startWithAiding(GpsStartType type, const GpsAidingState &state, bool have_state,
+                         uint32_t now_utc, bool have_time);
+    
+    // TTFF of the last start command in ms, or -1 if no fix has been seen since
+    int32_t getTimeToFirstFixMs() const { return ttff_ms; }
+    GpsStartType getLastStartType() const { return last_start_type; }
+    static const char *startTypeName(GpsStartType type);
+    
+    // Calendar conversion helpers (proleptic Gregorian, UTC)
+    static uint32_t utcToEpoch(int year, int month, int day, int hour, int minute, int second);
+    static void epochToUtc(uint32_t epoch, int &year, int &month, int &day,
+                           int &hour, int &minute, int &second);
 };
 
 
@@ -0,0 +1,58 @@
+#include "libs/https/batch_controller.h"
+#include <cstdio>
+
+BatchController::BatchController(uint16_t initial_size, uint16_t max_size, uint32_t slow_response_ms)
+    : max_size(max_size > 0 ? max_size : 1), slow_response_ms(slow_response_ms) {
+    limit_size = this->max_size;
+    size = initial_size < 1 ? 1 : (initial_size > limit_size ? limit_size : initial_size);
+}
+
+void BatchController::setLimit(uint16_t max_records) {
+    limit_size = max_records < 1 ? 1 : (max_records > max_size ? max_size : max_records);
+    if (size > limit_size) {
+        printf("[UPLOAD] Batch size limited to %u records\n", limit_size);
+        size = limit_size;
+    }
+}
+
+void BatchController::onAcknowledged(uint16_t batch_records, uint32_t response_ms) {
+    if (response_ms > slow_response_ms) {
+        decrease(batch_records, BATCH_CONTROLLER_SLOW_PERCENT, "slow response");
+        return;
+    }
+
+    // A remainder smaller than the batch size says nothing about a larger one
+    if (batch_records >= size && size < limit_size) {
+        uint16_t previous = size;
+        size = (uint16_t)(size + BATCH_CONTROLLER_INCREASE > limit_size ? limit_size : size + BATCH_CONTROLLER_INCREASE);
+        increase_count++;
+        printf("[UPLOAD] Batch acknowledged in %lu ms, batch size %u -> %u records\n",
+               (unsigned long)response_ms, previous, size);
+    }
+}
+
+void BatchController::onFailed(uint16_t batch_records) {
+    decrease(batch_records, BATCH_CONTROLLER_FAILURE_PERCENT, "request failed");
+}
+
+void BatchController::onTooLarge(uint16_t batch_records) {
+    decrease(batch_records, BATCH_CONTROLLER_FAILURE_PERCENT, "body too large");
+    if (batch_records > 1) {
+        setLimit(batch_records - 1);
+    }
+}
+
+void BatchController::decrease(uint16_t batch_records, uint8_t percent, const char *reason) {
+    // Batches sent before the last cut report the same trouble again; with
+    // requests pipelined, cutting for each would collapse the size
+    if (batch_records > size) {
+        return;
+    }
+    uint16_t previous = size;
+    size = (uint16_t)((uint32_t)size * percent / 100);
+    if (size < 1) {
+        size = 1;
+    }
+    decrease_count++;
+    printf("[UPLOAD] Batch %s, batch size %u -> %u records\n", reason, previous, size);
+}
@@ -0,0 +1,51 @@
+#ifndef BATCH_CONTROLLER_H
+#define BATCH_CONTROLLER_H
+
+#include <stdint.h>
+
+// Records added after each acknowledged full-size batch
+#define BATCH_CONTROLLER_INCREASE 2
+
+// Share of the batch size kept after a failed request, and after a response
+// that took longer than the slow threshold, in percent
+#define BATCH_CONTROLLER_FAILURE_PERCENT 50
+#define BATCH_CONTROLLER_SLOW_PERCENT 75
+
+// Additive-increase/multiplicative-decrease controller for the number of
+// records per upload request. Every acknowledged full-size batch grows it by
+// a few records, a failure or slow response cuts it by a fraction, so the
+// size settles just below what the link and server handle. It never goes
+// below one record or above the limit.
+class BatchController {
+public:
+    BatchController(uint16_t initial_size, uint16_t max_size, uint32_t slow_response_ms);
+
+    uint16_t getSize() const { return size; }
+    uint16_t getLimit() const { return limit_size; }
+    uint32_t getIncreaseCount() const { return increase_count; }
+    uint32_t getDecreaseCount() const { return decrease_count; }
+
+    // Lowers the upper bound, e.g. to what fits the server's body size limit
+    void setLimit(uint16_t max_records);
+
+    // A batch of batch_records was acknowledged after response_ms
+    void onAcknowledged(uint16_t batch_records, uint32_t response_ms);
+
+    // The request failed: error status, no response or lost connection
+    void onFailed(uint16_t batch_records);
+
+    // The server refused the body as too large (HTTP 413); smaller batches only
+    void onTooLarge(uint16_t batch_records);
+
+private:
+    uint16_t size;
+    uint16_t max_size;
+    uint16_t limit_size;
+    uint32_t slow_response_ms;
+    uint32_t increase_count = 0;
+    uint32_t decrease_count = 0;
+
+    void decrease(uint16_t batch_records, uint8_t percent, const char *reason);
+};
+
+#endif // BATCH_CONTROLLER_H
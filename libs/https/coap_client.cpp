@@ -0,0 +1,708 @@
+#include "libs/https/coap_client.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/timeouts.h"
+#include "libs/https/dns_cache.h"
+#include "libs/https/tls_arena.h"
+#include "libs/https/tls_session.h"
+#include "libs/https/net_timing.h"
+
+static uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+// Session from the last full DTLS handshake, offered on the next connect to
+// the same host for an abbreviated handshake. It has its own slot next to the
+// TLS one (tls_session.h), as a DTLS server cannot resume a TLS session.
+static mbedtls_ssl_session dtls_session;
+static char dtls_session_host[TLS_SESSION_HOST_MAX];
+static bool dtls_session_initialized = false;
+static bool dtls_session_valid = false;
+static uint8_t dtls_session_failed_offers = 0;
+
+static void dtls_session_clear() {
+    if (!dtls_session_initialized) {
+        mbedtls_ssl_session_init(&dtls_session);
+        dtls_session_initialized = true;
+    }
+    mbedtls_ssl_session_free(&dtls_session);
+    mbedtls_ssl_session_init(&dtls_session);
+    dtls_session_host[0] = '\0';
+    dtls_session_valid = false;
+    dtls_session_failed_offers = 0;
+}
+
+// Returns true if a session was offered
+static bool dtls_session_offer(mbedtls_ssl_context *ssl, const char *host) {
+    if (!dtls_session_valid || strncmp(dtls_session_host, host, TLS_SESSION_HOST_MAX) != 0) {
+        return false;
+    }
+    int ret = mbedtls_ssl_set_session(ssl, &dtls_session);
+    if (ret != 0) {
+        printf("COAP: Cannot offer cached DTLS session for %s (-0x%04x), dropping it\n", host, -ret);
+        dtls_session_clear();
+        return false;
+    }
+    return true;
+}
+
+// Keeps the session of a completed handshake; returns true if the server
+// resumed the offered one, which keeps its master secret
+static bool dtls_session_handshake_done(mbedtls_ssl_context *ssl, const char *host, bool offered) {
+    bool resumed = offered && ssl->session != NULL &&
+                   memcmp(ssl->session->master, dtls_session.master, sizeof(dtls_session.master)) == 0;
+    dtls_session_failed_offers = 0;
+    if (strlen(host) >= TLS_SESSION_HOST_MAX) {
+        return resumed;
+    }
+    mbedtls_ssl_session fresh;
+    mbedtls_ssl_session_init(&fresh);
+    int ret = mbedtls_ssl_get_session(ssl, &fresh);
+    if (ret != 0) {
+        printf("COAP: Cannot read DTLS session from %s (-0x%04x)\n", host, -ret);
+        mbedtls_ssl_session_free(&fresh);
+        return resumed;
+    }
+    dtls_session_clear();
+    dtls_session = fresh;
+    strcpy(dtls_session_host, host);
+    dtls_session_valid = true;
+    return resumed;
+}
+
+// Some servers abort instead of falling back to a full handshake
+static void dtls_session_handshake_failed(const char *host, bool offered) {
+    if (offered && ++dtls_session_failed_offers >= TLS_SESSION_MAX_FAILED_OFFERS) {
+        printf("COAP: %u DTLS handshakes with %s with the cached session failed, dropping it\n",
+               dtls_session_failed_offers, host);
+        dtls_session_clear();
+    }
+}
+
+CoapClient::CoapClient(const char *host, uint16_t port, bool dtls) : host(host), port(port), dtls(dtls) {
+    ip_addr_set_zero(&server_ip);
+    for (int i = 0; i < COAP_CLIENT_HISTORY; i++) {
+        statuses[i] = 0;
+        accepted[i] = -1;
+        response_ms[i] = 0;
+    }
+    next_message_id = (uint16_t)time_us_32();
+}
+
+CoapClient::~CoapClient() {
+    close();
+}
+
+bool CoapClient::beginConnect(uint32_t timeout_ms) {
+    if (conn_state == CONN_OPEN) {
+        return true;
+    }
+    dropConnection();
+
+    printf("COAP: Connecting to %s:%u%s\n", host, port, dtls ? " over DTLS" : "");
+    connect_start_ms = now_ms();
+    connect_timeout_ms = timeout_ms;
+
+    // Usually answered from the cache; otherwise pollConnect() waits for the answer
+    conn_state = CONN_RESOLVING;
+    uint32_t dns_timeout_ms = timeout_ms < DNS_CACHE_QUERY_TIMEOUT_MS ? timeout_ms : DNS_CACHE_QUERY_TIMEOUT_MS;
+    dns_cache_status_t dns_status = dns_cache_lookup_start(&dns_lookup, host, dns_timeout_ms, &server_ip);
+    if (dns_status == DNS_CACHE_IN_PROGRESS) {
+        return true;
+    }
+    return resolved(dns_status);
+}
+
+// Opens the socket (and starts the DTLS handshake) once the host is resolved
+bool CoapClient::resolved(dns_cache_status_t dns_status) {
+    if (dns_status != DNS_CACHE_RESOLVED) {
+        printf("COAP: DNS lookup failed for %s\n", host);
+        net_timing_failed(NET_PHASE_DNS);
+        conn_state = CONN_CLOSED;
+        return false;
+    }
+    net_timing_record(NET_PHASE_DNS, now_ms() - connect_start_ms);
+
+    bool started = false;
+    cyw43_arch_lwip_begin();
+    pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        printf("COAP: No UDP PCB\n");
+    } else {
+        udp_recv(pcb, recv, this);
+        if (udp_connect(pcb, &server_ip, port) != ERR_OK) {
+            printf("COAP: Cannot address %s\n", ipaddr_ntoa(&server_ip));
+        } else if (!dtls) {
+            conn_state = CONN_OPEN;
+            open_ms = now_ms();
+            started = true;
+        } else if (setupDtls()) {
+            conn_state = CONN_HANDSHAKE;
+            handshake_start_ms = now_ms();
+            tls_arena_handshake_started();
+            stepHandshake();   // Sends the ClientHello
+            sys_timeout(COAP_CLIENT_HANDSHAKE_TICK_MS, handshakeTimer, this);
+            started = true;
+        }
+    }
+    cyw43_arch_lwip_end();
+
+    if (!started) {
+        conn_state = CONN_FAILED;
+    }
+    return started;
+}
+
+CoapClient::Progress CoapClient::pollConnect() {
+    if (conn_state == CONN_OPEN) {
+        return COMPLETE;
+    }
+    if (conn_state == CONN_RESOLVING) {
+        dns_cache_status_t dns_status = dns_cache_lookup_poll(&dns_lookup, &server_ip);
+        if (dns_status == DNS_CACHE_IN_PROGRESS) {
+            return IN_PROGRESS;
+        }
+        if (!resolved(dns_status)) {
+            dropConnection();
+            return FAILED;
+        }
+    }
+    if (conn_state == CONN_OPEN) {
+        return COMPLETE;
+    }
+    if (conn_state == CONN_HANDSHAKE) {
+        if (now_ms() - connect_start_ms <= connect_timeout_ms) {
+            return IN_PROGRESS;
+        }
+        printf("COAP: DTLS handshake with %s timed out after %lu ms\n", host, (unsigned long)connect_timeout_ms);
+        net_timing_failed(NET_PHASE_TLS);
+        dtls_session_handshake_failed(host, session_offered);
+        dns_cache_expire(host);
+        dropConnection();
+        return FAILED;
+    }
+
+    // Most likely a server without an ECDSA certificate
+    if (conn_state == CONN_FAILED && dtls && tls_profile == TLS_PROFILE_CONSTRAINED && handshake_count == 0) {
+        printf("COAP: %s refused the constrained TLS profile, using the default one\n", host);
+        tls_profile = TLS_PROFILE_DEFAULT;
+    }
+    dropConnection();
+    return FAILED;
+}
+
+void CoapClient::close() {
+    if (pcb) {
+        printf("COAP: Closing connection to %s after %lu requests, %lu retransmissions\n",
+               host, (unsigned long)next_request_id, (unsigned long)retransmit_count);
+    }
+    dropConnection();
+}
+
+void CoapClient::dropConnection() {
+    if (conn_state == CONN_RESOLVING) {
+        dns_cache_lookup_cancel(&dns_lookup);
+    }
+    cyw43_arch_lwip_begin();
+    sys_untimeout(retransmitTimer, this);
+    sys_untimeout(handshakeTimer, this);
+    if (dtls_ready) {
+        if (conn_state == CONN_OPEN) {
+            mbedtls_ssl_close_notify(&ssl);
+        }
+        freeDtls();
+    }
+    if (pcb) {
+        udp_remove(pcb);
+        pcb = nullptr;
+    }
+    while (rx_count > 0) {
+        pbuf_free(rx_queue[rx_head]);
+        rx_head = (rx_head + 1) % COAP_CLIENT_RECV_QUEUE;
+        rx_count--;
+    }
+    if (tx_state != TX_IDLE) {
+        failRequest(nullptr);
+    }
+    cyw43_arch_lwip_end();
+    if (conn_state == CONN_OPEN) {
+        net_timing_record(NET_PHASE_OPEN, now_ms() - open_ms);
+    }
+    conn_state = CONN_CLOSED;
+}
+
+// Called with the lwIP lock held, which also serialises the TLS arena
+bool CoapClient::setupDtls() {
+    static const char personalization[] = "pico_eu coap";
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    dtls_ready = true;
+
+    int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                    (const unsigned char *)personalization, sizeof(personalization) - 1);
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_DATAGRAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret == 0) {
+        // The server key is checked against the pins once the handshake is done
+        mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
+        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+        mbedtls_ssl_conf_handshake_timeout(&conf, 1000, connect_timeout_ms > 1000 ? connect_timeout_ms : 1000);
+        tls_profile_configure(&conf, tls_profile);
+        ret = mbedtls_ssl_setup(&ssl, &conf);
+    }
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&ssl, host);
+    }
+    if (ret != 0) {
+        printf("COAP: DTLS setup failed (-0x%04x)\n", -ret);
+        freeDtls();
+        return false;
+    }
+    mbedtls_ssl_set_bio(&ssl, this, bioSend, bioRecv, NULL);
+    mbedtls_ssl_set_timer_cb(&ssl, this, setTimer, getTimer);
+    mbedtls_ssl_set_mtu(&ssl, COAP_CLIENT_MESSAGE_MAX);
+    session_offered = dtls_session_offer(&ssl, host);
+    return true;
+}
+
+void CoapClient::freeDtls() {
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    dtls_ready = false;
+}
+
+// Advances the DTLS handshake; mbedTLS retransmits its own flights from the timer
+void CoapClient::stepHandshake() {
+    int ret = mbedtls_ssl_handshake(&ssl);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return;
+    }
+    sys_untimeout(handshakeTimer, this);
+    if (ret != 0) {
+        printf("COAP: DTLS handshake with %s failed (-0x%04x)\n", host, -ret);
+        net_timing_failed(NET_PHASE_TLS);
+        dtls_session_handshake_failed(host, session_offered);
+        conn_state = CONN_FAILED;
+        return;
+    }
+    if (!tls_profile_check_peer(&ssl, host)) {
+        dtls_session_clear();   // It may belong to the same key
+        conn_state = CONN_FAILED;
+        return;
+    }
+
+    handshake_count++;
+    bool resumed = dtls_session_handshake_done(&ssl, host, session_offered);
+    if (resumed) {
+        resumed_count++;
+    }
+    size_t arena = tls_arena_handshake_done();
+    if (arena > handshake_arena_peak) {
+        handshake_arena_peak = arena;
+    }
+    conn_state = CONN_OPEN;
+    open_ms = now_ms();
+    net_timing_record(NET_PHASE_TLS, open_ms - handshake_start_ms);
+    printf("COAP: %s DTLS handshake with %s (%s) in %lu ms, %s, %u bytes of TLS memory\n",
+           resumed ? "Resumed" : "Full", host, tls_profile_name(tls_profile),
+           (unsigned long)(now_ms() - handshake_start_ms), mbedtls_ssl_get_ciphersuite(&ssl), (unsigned)arena);
+}
+
+void CoapClient::handshakeTimer(void *arg) {
+    CoapClient *client = (CoapClient *)arg;
+    if (client->conn_state != CONN_HANDSHAKE) {
+        return;
+    }
+    client->stepHandshake();
+    if (client->conn_state == CONN_HANDSHAKE) {
+        sys_timeout(COAP_CLIENT_HANDSHAKE_TICK_MS, handshakeTimer, client);
+    }
+}
+
+void CoapClient::readRecords() {
+    while (conn_state == CONN_OPEN) {
+        int ret = mbedtls_ssl_read(&ssl, rx_msg, sizeof(rx_msg));
+        if (ret > 0) {
+            handleMessage(rx_msg, (size_t)ret);
+            continue;
+        }
+        if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            printf("COAP: %s closed the DTLS connection\n", host);
+            conn_state = CONN_CLOSED;
+            if (tx_state != TX_IDLE) {
+                failRequest(nullptr);
+            }
+        } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE && ret != 0) {
+            printf("COAP: DTLS read failed (-0x%04x)\n", -ret);
+        }
+        return;
+    }
+}
+
+void CoapClient::recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    CoapClient *client = (CoapClient *)arg;
+    if (!client->dtls) {
+        size_t len = pbuf_copy_partial(p, client->rx_msg, sizeof(client->rx_msg), 0);
+        pbuf_free(p);
+        client->handleMessage(client->rx_msg, len);
+        return;
+    }
+
+    if (client->rx_count == COAP_CLIENT_RECV_QUEUE) {
+        pbuf_free(p);   // Dropped like a lost datagram
+        return;
+    }
+    client->rx_queue[(client->rx_head + client->rx_count) % COAP_CLIENT_RECV_QUEUE] = p;
+    client->rx_count++;
+    if (client->conn_state == CONN_HANDSHAKE) {
+        client->stepHandshake();
+    } else {
+        client->readRecords();
+    }
+}
+
+// A datagram lost here is no different from one lost on the way; the
+// retransmissions of DTLS and CoAP cover both
+int CoapClient::bioSend(void *ctx, const unsigned char *buf, size_t len) {
+    CoapClient *client = (CoapClient *)ctx;
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)len, PBUF_RAM);
+    if (p) {
+        memcpy(p->payload, buf, len);
+        udp_send(client->pcb, p);
+        pbuf_free(p);
+    }
+    return (int)len;
+}
+
+int CoapClient::bioRecv(void *ctx, unsigned char *buf, size_t len) {
+    CoapClient *client = (CoapClient *)ctx;
+    if (client->rx_count == 0) {
+        return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    struct pbuf *p = client->rx_queue[client->rx_head];
+    client->rx_head = (client->rx_head + 1) % COAP_CLIENT_RECV_QUEUE;
+    client->rx_count--;
+    size_t n = pbuf_copy_partial(p, buf, (u16_t)(len < 0xFFFF ? len : 0xFFFF), 0);
+    pbuf_free(p);
+    return (int)n;
+}
+
+void CoapClient::setTimer(void *ctx, uint32_t int_ms, uint32_t fin_ms) {
+    CoapClient *client = (CoapClient *)ctx;
+    client->timer_start_ms = now_ms();
+    client->timer_int_ms = int_ms;
+    client->timer_fin_ms = fin_ms;
+}
+
+// -1 cancelled, 0 running, 1 intermediate delay passed, 2 final delay passed
+int CoapClient::getTimer(void *ctx) {
+    CoapClient *client = (CoapClient *)ctx;
+    if (client->timer_fin_ms == 0) {
+        return -1;
+    }
+    uint32_t elapsed = now_ms() - client->timer_start_ms;
+    return elapsed >= client->timer_fin_ms ? 2 : elapsed >= client->timer_int_ms ? 1 : 0;
+}
+
+bool CoapClient::sendDatagram(const uint8_t *data, size_t len) {
+    if (dtls) {
+        int ret = mbedtls_ssl_write(&ssl, data, len);
+        if (ret != (int)len) {
+            printf("COAP: DTLS write failed (-0x%04x)\n", ret < 0 ? -ret : 0);
+            return false;
+        }
+        return true;
+    }
+    bioSend(this, data, len);
+    return true;
+}
+
+void CoapClient::sendEmpty(coap_type_t type, uint16_t message_id) {
+    uint8_t msg[4];
+    coap_writer_t writer;
+    coap_write_header(&writer, msg, sizeof(msg), type, COAP_CODE_EMPTY, message_id, NULL, 0);
+    sendDatagram(msg, writer.len);
+}
+
+int CoapClient::beginPost(const char *path, const char *content_type, http_body_source_t *body,
+                          uint32_t timeout_ms, const char *content_encoding) {
+    if (conn_state != CONN_OPEN || tx_state != TX_IDLE) {
+        return -1;
+    }
+    int format = coap_content_format(content_type, content_encoding);
+    if (format < 0) {
+        printf("COAP: No Content-Format for %s%s%s\n", content_type,
+               content_encoding ? " + " : "", content_encoding ? content_encoding : "");
+        return -1;
+    }
+
+    uint32_t request_id = next_request_id++;
+    statuses[request_id % COAP_CLIENT_HISTORY] = 0;
+    accepted[request_id % COAP_CLIENT_HISTORY] = -1;
+    response_ms[request_id % COAP_CLIENT_HISTORY] = 0;
+
+    body->rewind(body);
+    cyw43_arch_lwip_begin();
+    tx_request_id = request_id;
+    tx_body = body;
+    tx_path = path;
+    tx_format = format;
+    uint32_t token = time_us_32() ^ (request_id << 16);
+    memcpy(tx_token, &token, sizeof(tx_token));
+    tx_block_num = 0;
+    tx_block_szx = COAP_CLIENT_BLOCK_SZX;
+    tx_block_offset = 0;
+    tx_last_sent = false;
+    tx_failed = false;
+    tx_deadline_ms = now_ms() + timeout_ms;
+    tx_start_ms = now_ms();
+    if (!sendBlock()) {
+        failRequest("Cannot send the first block");
+    }
+    cyw43_arch_lwip_end();
+    return (int)request_id;
+}
+
+CoapClient::Progress CoapClient::pollSend() {
+    if (tx_failed) {
+        return FAILED;
+    }
+    return (tx_state != TX_IDLE && !tx_last_sent) ? IN_PROGRESS : COMPLETE;
+}
+
+// Sends the block at tx_block_offset; called with the lwIP lock held
+bool CoapClient::sendBlock() {
+    size_t block_size = COAP_BLOCK_SIZE(tx_block_szx);
+    size_t remaining = tx_body->length - tx_block_offset;
+    size_t len = remaining < block_size ? remaining : block_size;
+    bool more = len < remaining;
+    bool blockwise = tx_body->length > block_size || tx_block_num > 0;
+
+    coap_writer_t writer;
+    tx_message_id = next_message_id++;
+    coap_write_header(&writer, tx_msg, sizeof(tx_msg), COAP_TYPE_CON, COAP_CODE_POST, tx_message_id,
+                      tx_token, sizeof(tx_token));
+    coap_write_path(&writer, tx_path);
+    coap_write_uint_option(&writer, COAP_OPTION_CONTENT_FORMAT, (uint32_t)tx_format);
+    if (blockwise) {
+        coap_write_uint_option(&writer, COAP_OPTION_BLOCK1, COAP_BLOCK_VALUE(tx_block_num, more, tx_block_szx));
+        if (tx_block_num == 0) {
+            coap_write_uint_option(&writer, COAP_OPTION_SIZE1, (uint32_t)tx_body->length);   // Lets the server refuse early
+        }
+    }
+
+    size_t room;
+    uint8_t *payload = coap_write_payload(&writer, &room);
+    if (len > room) {
+        printf("COAP: Block of %u bytes does not fit a message\n", (unsigned)len);
+        return false;
+    }
+    size_t filled = 0;
+    while (filled < len) {
+        size_t n = tx_body->read(tx_body, (char *)payload + filled, len - filled);
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    if (filled != len) {
+        printf("COAP: Body ended %u bytes early\n", (unsigned)(len - filled));
+        return false;
+    }
+    coap_write_payload_done(&writer, len);
+    if (writer.overflow) {
+        return false;
+    }
+
+    tx_msg_len = writer.len;
+    tx_block_len = len;
+    tx_state = TX_BLOCK;
+    tx_retransmits = 0;
+    tx_timeout_ms = COAP_CLIENT_ACK_TIMEOUT_MS + (time_us_32() % (COAP_CLIENT_ACK_TIMEOUT_MS / 2));
+    if (!more) {
+        tx_last_sent = true;
+        tx_sent_ms = now_ms();
+        net_timing_record(NET_PHASE_SEND, tx_sent_ms - tx_start_ms);
+    }
+    bytes_sent += tx_msg_len;
+    if (!sendDatagram(tx_msg, tx_msg_len)) {
+        return false;
+    }
+    armRetransmit(tx_timeout_ms);
+    return true;
+}
+
+void CoapClient::armRetransmit(uint32_t delay_ms) {
+    uint32_t left = tx_deadline_ms - now_ms();
+    if ((int32_t)left <= 0) {
+        left = 1;
+    }
+    sys_untimeout(retransmitTimer, this);
+    sys_timeout(delay_ms < left ? delay_ms : left, retransmitTimer, this);
+}
+
+void CoapClient::retransmitTimer(void *arg) {
+    CoapClient *client = (CoapClient *)arg;
+    if (client->tx_state == TX_IDLE) {
+        return;
+    }
+    if ((int32_t)(now_ms() - client->tx_deadline_ms) >= 0) {
+        client->failRequest(client->tx_state == TX_SEPARATE ? "No response before the deadline"
+                                                            : "No acknowledgement before the deadline");
+        client->conn_state = CONN_FAILED;
+        return;
+    }
+    if (client->tx_state == TX_SEPARATE) {
+        client->armRetransmit(client->tx_deadline_ms - now_ms());
+        return;
+    }
+    if (client->tx_retransmits >= COAP_CLIENT_MAX_RETRANSMIT) {
+        client->failRequest("No acknowledgement after all retransmissions");
+        client->conn_state = CONN_FAILED;
+        return;
+    }
+    client->tx_retransmits++;
+    client->retransmit_count++;
+    client->tx_timeout_ms *= 2;
+    client->sendDatagram(client->tx_msg, client->tx_msg_len);
+    client->armRetransmit(client->tx_timeout_ms);
+}
+
+void CoapClient::handleMessage(const uint8_t *data, size_t len) {
+    coap_message_t message;
+    if (!coap_parse(data, len, &message)) {
+        return;
+    }
+    bytes_received += len;
+
+    bool ours = tx_state != TX_IDLE && message.token_len == sizeof(tx_token) &&
+                memcmp(message.token, tx_token, sizeof(tx_token)) == 0;
+
+    // A separate response, or a message we don't expect
+    if (message.type == COAP_TYPE_CON || message.type == COAP_TYPE_NON) {
+        if (message.type == COAP_TYPE_CON) {
+            sendEmpty(ours ? COAP_TYPE_ACK : COAP_TYPE_RST, message.message_id);
+        }
+        if (ours && message.code != COAP_CODE_EMPTY) {
+            handleResponse(message);
+        }
+        return;
+    }
+
+    // Acknowledgement of the current block; anything else is a duplicate
+    if (tx_state != TX_BLOCK || message.message_id != tx_message_id) {
+        return;
+    }
+    sys_untimeout(retransmitTimer, this);
+    if (message.type == COAP_TYPE_RST) {
+        failRequest("Server reset the request");
+        return;
+    }
+    if (message.code == COAP_CODE_EMPTY) {
+        tx_state = TX_SEPARATE;
+        armRetransmit(tx_deadline_ms - now_ms());
+        return;
+    }
+    if (ours) {
+        handleResponse(message);
+    }
+}
+
+void CoapClient::handleResponse(const coap_message_t &message) {
+    sys_untimeout(retransmitTimer, this);
+    if (message.code == COAP_CODE_CONTINUE && !tx_last_sent) {
+        // The server may ask for smaller blocks; the next block number is
+        // counted in the new size
+        uint8_t szx = tx_block_szx;
+        if (message.has_block1 && COAP_BLOCK_SZX(message.block1) < szx) {
+            szx = COAP_BLOCK_SZX(message.block1);
+            printf("COAP: Server asks for %u byte blocks\n", (unsigned)COAP_BLOCK_SIZE(szx));
+        }
+        tx_block_offset += tx_block_len;
+        tx_block_szx = szx;
+        tx_block_num = (uint32_t)(tx_block_offset / COAP_BLOCK_SIZE(szx));
+        if (!sendBlock()) {
+            failRequest("Cannot send the next block");
+        }
+        return;
+    }
+
+    // {"accepted":n} as JSON, or the same map in CBOR
+    int32_t records = -1;
+    static const char key[] = "accepted";
+    for (size_t i = 0; message.payload_len >= sizeof(key) && i <= message.payload_len - sizeof(key); i++) {
+        if (memcmp(message.payload + i, key, sizeof(key) - 1) != 0) {
+            continue;
+        }
+        const uint8_t *p = message.payload + i + sizeof(key) - 1;
+        const uint8_t *end = message.payload + message.payload_len;
+        if (*p == '"') {
+            while (p < end && (*p == '"' || *p == ':' || *p == ' ')) {
+                p++;
+            }
+            records = 0;
+            while (p < end && *p >= '0' && *p <= '9') {
+                records = records * 10 + (*p++ - '0');
+            }
+        } else if (*p <= 0x17) {
+            records = *p;
+        } else if (*p == 0x18 && p + 1 < end) {
+            records = p[1];
+        } else if (*p == 0x19 && p + 2 < end) {
+            records = (p[1] << 8) | p[2];
+        }
+        break;
+    }
+    completeRequest(coap_status(message.code), records);
+}
+
+void CoapClient::completeRequest(int status, int32_t records) {
+    uint32_t slot = tx_request_id % COAP_CLIENT_HISTORY;
+    response_ms[slot] = tx_last_sent ? now_ms() - tx_sent_ms : 0;
+    if (status > 0) {
+        // A CoAP response is one datagram: its first byte is its last
+        net_timing_record(NET_PHASE_FIRST_BYTE, response_ms[slot]);
+    }
+    accepted[slot] = records;
+    statuses[slot] = status;
+    tx_state = TX_IDLE;
+    tx_body = nullptr;
+}
+
+void CoapClient::failRequest(const char *reason) {
+    if (reason) {
+        printf("COAP: %s (request %lu, block %lu)\n", reason, (unsigned long)tx_request_id,
+               (unsigned long)tx_block_num);
+    }
+    sys_untimeout(retransmitTimer, this);
+    if (!tx_last_sent) {
+        tx_failed = true;
+    }
+    net_timing_failed(tx_last_sent ? NET_PHASE_FIRST_BYTE : NET_PHASE_SEND);
+    completeRequest(UPLOAD_STATUS_NO_RESPONSE, -1);
+}
+
+int CoapClient::getStatus(int request_id) const {
+    if (request_id < 0 || (uint32_t)request_id >= next_request_id ||
+        next_request_id - (uint32_t)request_id > COAP_CLIENT_HISTORY) {
+        return UPLOAD_STATUS_NO_RESPONSE;
+    }
+    return statuses[request_id % COAP_CLIENT_HISTORY];
+}
+
+int32_t CoapClient::getAccepted(int request_id) const {
+    return getStatus(request_id) > 0 ? accepted[request_id % COAP_CLIENT_HISTORY] : -1;
+}
+
+uint32_t CoapClient::getResponseMs(int request_id) const {
+    return getStatus(request_id) > 0 ? response_ms[request_id % COAP_CLIENT_HISTORY] : 0;
+}
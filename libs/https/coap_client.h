@@ -0,0 +1,182 @@
+#ifndef COAP_CLIENT_H
+#define COAP_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lwip/udp.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "libs/https/dns_cache.h"
+#include "libs/https/upload_client.h"
+#include "libs/https/coap_message.h"
+
+#define COAP_PORT 5683
+#define COAPS_PORT 5684      // CoAP over DTLS
+
+// Request bodies go out in blocks of 16 << 6 = 1024 bytes, which with the
+// CoAP and DTLS headers fits a 1280 byte datagram without IP fragmentation
+#define COAP_CLIENT_BLOCK_SZX 6
+#define COAP_CLIENT_MESSAGE_MAX 1280
+
+// Confirmable messages are retransmitted after ACK_TIMEOUT to 1.5 times that,
+// doubling the wait each time, up to MAX_RETRANSMIT times (RFC 7252 defaults)
+#define COAP_CLIENT_ACK_TIMEOUT_MS 2000
+#define COAP_CLIENT_MAX_RETRANSMIT 4
+
+// DTLS handshake retransmissions are checked this often
+#define COAP_CLIENT_HANDSHAKE_TICK_MS 100
+
+// Datagrams held for the DTLS layer until it reads them
+#define COAP_CLIENT_RECV_QUEUE 4
+
+// Answered requests kept for getStatus()
+#define COAP_CLIENT_HISTORY 4
+
+// Upload over confirmable CoAP POSTs (RFC 7252), on UDP or DTLS 1.2 with the
+// same profiles and key pins as HTTPS (tls_profile.h). A body larger than one
+// block is sent block-wise with the Block1 option (RFC 7959); each block is
+// acknowledged with 2.31 Continue, and the answer to the last one answers the
+// request. There is no TCP handshake, and a lost datagram only delays its own
+// block instead of everything queued behind it. Reconnects offer the session
+// of the last full DTLS handshake, like HttpsClient does with TLS.
+//
+// One request is in progress at a time. A block that stays unacknowledged
+// through all retransmissions fails the request and the connection, like a
+// dropped TCP connection does for HttpsClient.
+class CoapClient : public UploadClient {
+public:
+    // With dtls false, messages go over plain UDP
+    CoapClient(const char *host, uint16_t port = COAPS_PORT, bool dtls = true);
+    ~CoapClient() override;
+
+    bool beginConnect(uint32_t timeout_ms) override;
+    Progress pollConnect() override;
+    void close() override;
+    bool isConnected() const override { return conn_state == CONN_OPEN; }
+    uint8_t getMaxInFlight() const override { return 1; }
+
+    // Returns -1 while the previous request is still in progress, or if the
+    // content type has no CoAP Content-Format
+    int beginPost(const char *path, const char *content_type, http_body_source_t *body,
+                  uint32_t timeout_ms, const char *content_encoding = nullptr) override;
+
+    // COMPLETE once the last block has been sent
+    Progress pollSend() override;
+
+    int getStatus(int request_id) const override;
+    int32_t getAccepted(int request_id) const override;
+    uint32_t getResponseMs(int request_id) const override;
+
+    uint32_t getHandshakeCount() const override { return handshake_count; }
+    uint32_t getResumedCount() const override { return resumed_count; }
+    uint32_t getRequestCount() const override { return next_request_id; }
+    uint32_t getBytesSent() const override { return bytes_sent; }          // CoAP messages, first transmissions
+    uint32_t getBytesReceived() const override { return bytes_received; }
+    size_t getHandshakeArenaPeak() const override { return handshake_arena_peak; }
+    uint32_t getRetransmitCount() const { return retransmit_count; }
+
+private:
+    enum ConnState : uint8_t {
+        CONN_CLOSED = 0,
+        CONN_RESOLVING,      // Waiting for the DNS answer
+        CONN_HANDSHAKE,      // DTLS only
+        CONN_OPEN,
+        CONN_FAILED
+    };
+
+    enum TxState : uint8_t {
+        TX_IDLE = 0,
+        TX_BLOCK,            // Waiting for the block to be acknowledged
+        TX_SEPARATE          // Acknowledged, the response comes in its own message
+    };
+
+    const char *host;
+    uint16_t port;
+    bool dtls;
+    struct udp_pcb *pcb = nullptr;
+    ip_addr_t server_ip;
+    dns_cache_lookup_t dns_lookup = {};
+    volatile ConnState conn_state = CONN_CLOSED;
+    uint32_t connect_start_ms = 0;
+    uint32_t connect_timeout_ms = 0;
+    uint16_t next_message_id = 0;
+
+    // DTLS state, set up for each connection
+    bool dtls_ready = false;
+    bool session_offered = false;     // The cached DTLS session was offered
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    struct pbuf *rx_queue[COAP_CLIENT_RECV_QUEUE];
+    uint8_t rx_head = 0;
+    uint8_t rx_count = 0;
+    uint32_t timer_start_ms = 0;
+    uint32_t timer_int_ms = 0;
+    uint32_t timer_fin_ms = 0;
+    uint32_t handshake_start_ms = 0;
+    uint32_t open_ms = 0;             // When the connection was established
+
+    // Request in progress
+    volatile TxState tx_state = TX_IDLE;
+    http_body_source_t *tx_body = nullptr;
+    const char *tx_path = nullptr;
+    int tx_format = -1;
+    uint32_t tx_request_id = 0;
+    uint8_t tx_token[4];
+    uint16_t tx_message_id = 0;
+    uint32_t tx_block_num = 0;
+    uint8_t tx_block_szx = COAP_CLIENT_BLOCK_SZX;
+    size_t tx_block_offset = 0;       // Body bytes before the current block
+    size_t tx_block_len = 0;
+    bool tx_last_sent = false;        // The last block has gone out once
+    volatile bool tx_failed = false;
+    uint32_t tx_start_ms = 0;         // First transmission of the first block
+    uint32_t tx_sent_ms = 0;          // First transmission of the last block
+    uint32_t tx_deadline_ms = 0;
+    uint32_t tx_timeout_ms = 0;       // Current retransmission wait
+    uint8_t tx_retransmits = 0;
+    uint8_t tx_msg[COAP_CLIENT_MESSAGE_MAX];
+    size_t tx_msg_len = 0;
+    uint8_t rx_msg[COAP_CLIENT_MESSAGE_MAX];
+
+    uint32_t next_request_id = 0;
+    int statuses[COAP_CLIENT_HISTORY];
+    int32_t accepted[COAP_CLIENT_HISTORY];
+    uint32_t response_ms[COAP_CLIENT_HISTORY];
+
+    uint32_t handshake_count = 0;
+    uint32_t resumed_count = 0;
+    uint32_t retransmit_count = 0;
+    uint32_t bytes_sent = 0;
+    uint32_t bytes_received = 0;
+    size_t handshake_arena_peak = 0;
+
+    bool resolved(dns_cache_status_t dns_status);
+    bool setupDtls();
+    void freeDtls();
+    void stepHandshake();
+    void readRecords();
+    void dropConnection();
+    bool sendDatagram(const uint8_t *data, size_t len);
+    bool sendBlock();
+    void sendEmpty(coap_type_t type, uint16_t message_id);
+    void armRetransmit(uint32_t delay_ms);
+    void handleMessage(const uint8_t *data, size_t len);
+    void handleResponse(const coap_message_t &message);
+    void completeRequest(int status, int32_t records);
+    void failRequest(const char *reason);
+
+    static void recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+    static void retransmitTimer(void *arg);
+    static void handshakeTimer(void *arg);
+    static int bioSend(void *ctx, const unsigned char *buf, size_t len);
+    static int bioRecv(void *ctx, unsigned char *buf, size_t len);
+    static void setTimer(void *ctx, uint32_t int_ms, uint32_t fin_ms);
+    static int getTimer(void *ctx);
+};
+
+#endif // COAP_CLIENT_H
@@ -0,0 +1,189 @@
+#include "coap_message.h"
+#include <string.h>
+#include <strings.h>
+
+#define COAP_VERSION 1
+#define COAP_PAYLOAD_MARKER 0xFF
+
+static void put_byte(coap_writer_t *writer, uint8_t byte) {
+    if (writer->len < writer->size) {
+        writer->buf[writer->len++] = byte;
+    } else {
+        writer->overflow = true;
+    }
+}
+
+static void put_bytes(coap_writer_t *writer, const void *data, size_t len) {
+    if (len > writer->size - writer->len) {
+        writer->overflow = true;
+        return;
+    }
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+}
+
+void coap_write_header(coap_writer_t *writer, uint8_t *buf, size_t size, coap_type_t type, uint8_t code,
+                       uint16_t message_id, const uint8_t *token, uint8_t token_len) {
+    writer->buf = buf;
+    writer->size = size;
+    writer->len = 0;
+    writer->last_option = 0;
+    writer->overflow = token_len > COAP_TOKEN_MAX;
+    put_byte(writer, (uint8_t)((COAP_VERSION << 6) | (type << 4) | (token_len & 0x0F)));
+    put_byte(writer, code);
+    put_byte(writer, (uint8_t)(message_id >> 8));
+    put_byte(writer, (uint8_t)message_id);
+    put_bytes(writer, token, token_len);
+}
+
+// Nibble for an option delta or length; larger values follow in 1 or 2 bytes
+static uint8_t option_nibble(size_t value) {
+    return value < 13 ? (uint8_t)value : value < 269 ? 13 : 14;
+}
+
+static void put_option_extension(coap_writer_t *writer, size_t value) {
+    if (value >= 269) {
+        put_byte(writer, (uint8_t)((value - 269) >> 8));
+        put_byte(writer, (uint8_t)(value - 269));
+    } else if (value >= 13) {
+        put_byte(writer, (uint8_t)(value - 13));
+    }
+}
+
+void coap_write_option(coap_writer_t *writer, uint16_t number, const void *value, size_t len) {
+    if (number < writer->last_option || len > 1024) {
+        writer->overflow = true;
+        return;
+    }
+    size_t delta = number - writer->last_option;
+    put_byte(writer, (uint8_t)((option_nibble(delta) << 4) | option_nibble(len)));
+    put_option_extension(writer, delta);
+    put_option_extension(writer, len);
+    put_bytes(writer, value, len);
+    writer->last_option = number;
+}
+
+void coap_write_uint_option(coap_writer_t *writer, uint16_t number, uint32_t value) {
+    uint8_t bytes[4];
+    size_t len = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if (len > 0 || (value >> shift) != 0) {
+            bytes[len++] = (uint8_t)(value >> shift);
+        }
+    }
+    coap_write_option(writer, number, bytes, len);
+}
+
+void coap_write_path(coap_writer_t *writer, const char *path) {
+    while (*path) {
+        while (*path == '/') {
+            path++;
+        }
+        size_t len = strcspn(path, "/");
+        if (len > 0) {
+            coap_write_option(writer, COAP_OPTION_URI_PATH, path, len);
+        }
+        path += len;
+    }
+}
+
+uint8_t *coap_write_payload(coap_writer_t *writer, size_t *room) {
+    put_byte(writer, COAP_PAYLOAD_MARKER);
+    *room = writer->overflow ? 0 : writer->size - writer->len;
+    return writer->buf + writer->len;
+}
+
+void coap_write_payload_done(coap_writer_t *writer, size_t len) {
+    if (len == 0) {
+        writer->len--;      // No payload, no marker
+    } else if (len > writer->size - writer->len) {
+        writer->overflow = true;
+    } else {
+        writer->len += len;
+    }
+}
+
+// Reads an extended option delta or length at *offset, -1 if malformed
+static int32_t option_value(uint8_t nibble, const uint8_t *data, size_t len, size_t *offset) {
+    if (nibble < 13) {
+        return nibble;
+    }
+    if (nibble == 13 && *offset + 1 <= len) {
+        return 13 + data[(*offset)++];
+    }
+    if (nibble == 14 && *offset + 2 <= len) {
+        int32_t value = 269 + ((data[*offset] << 8) | data[*offset + 1]);
+        *offset += 2;
+        return value;
+    }
+    return -1;
+}
+
+bool coap_parse(const uint8_t *data, size_t len, coap_message_t *message) {
+    if (len < 4 || (data[0] >> 6) != COAP_VERSION || (data[0] & 0x0F) > COAP_TOKEN_MAX) {
+        return false;
+    }
+    message->type = (coap_type_t)((data[0] >> 4) & 0x03);
+    message->token_len = data[0] & 0x0F;
+    message->code = data[1];
+    message->message_id = (uint16_t)((data[2] << 8) | data[3]);
+    message->has_block1 = false;
+    message->block1 = 0;
+    message->payload = NULL;
+    message->payload_len = 0;
+
+    size_t offset = 4;
+    if (offset + message->token_len > len) {
+        return false;
+    }
+    memcpy(message->token, data + offset, message->token_len);
+    offset += message->token_len;
+
+    uint32_t number = 0;
+    while (offset < len) {
+        uint8_t byte = data[offset++];
+        if (byte == COAP_PAYLOAD_MARKER) {
+            if (offset == len) {
+                return false;   // A marker must be followed by a payload
+            }
+            message->payload = data + offset;
+            message->payload_len = len - offset;
+            return true;
+        }
+        int32_t delta = option_value(byte >> 4, data, len, &offset);
+        int32_t value_len = option_value(byte & 0x0F, data, len, &offset);
+        if (delta < 0 || value_len < 0 || offset + (size_t)value_len > len) {
+            return false;
+        }
+        number += (uint32_t)delta;
+        if (number == COAP_OPTION_BLOCK1 && value_len <= 3) {
+            message->has_block1 = true;
+            for (int32_t i = 0; i < value_len; i++) {
+                message->block1 = (message->block1 << 8) | data[offset + i];
+            }
+        }
+        offset += (size_t)value_len;
+    }
+    return true;
+}
+
+int coap_status(uint8_t code) {
+    return (code >> 5) * 100 + (code & 0x1F);
+}
+
+int coap_content_format(const char *content_type, const char *content_encoding) {
+    int format;
+    if (strcasecmp(content_type, "application/json") == 0) {
+        format = COAP_FORMAT_JSON;
+    } else if (strcasecmp(content_type, "application/cbor") == 0) {
+        format = COAP_FORMAT_CBOR;
+    } else if (strcasecmp(content_type, "application/octet-stream") == 0) {
+        format = COAP_FORMAT_OCTET_STREAM;
+    } else {
+        return -1;
+    }
+    if (content_encoding == NULL) {
+        return format;
+    }
+    return strcasecmp(content_encoding, "deflate") == 0 ? COAP_FORMAT_DEFLATE_BASE + format : -1;
+}
@@ -0,0 +1,99 @@
+#ifndef COAP_MESSAGE_H
+#define COAP_MESSAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CoAP message encoding and parsing (RFC 7252), with the Block1 option of
+// block-wise transfers (RFC 7959)
+
+typedef enum {
+    COAP_TYPE_CON = 0,      // Confirmable, acknowledged and retransmitted
+    COAP_TYPE_NON = 1,
+    COAP_TYPE_ACK = 2,
+    COAP_TYPE_RST = 3
+} coap_type_t;
+
+#define COAP_CODE(class_, detail) (uint8_t)(((class_) << 5) | (detail))
+#define COAP_CODE_EMPTY     COAP_CODE(0, 0)
+#define COAP_CODE_POST      COAP_CODE(0, 2)
+#define COAP_CODE_CONTINUE  COAP_CODE(2, 31)    // Block received, send the next one
+
+#define COAP_OPTION_URI_PATH        11
+#define COAP_OPTION_CONTENT_FORMAT  12
+#define COAP_OPTION_BLOCK1          27
+#define COAP_OPTION_SIZE1           60
+
+#define COAP_FORMAT_OCTET_STREAM    42
+#define COAP_FORMAT_JSON            50
+#define COAP_FORMAT_CBOR            60
+
+// CoAP has no Content-Encoding; deflated bodies use an experimental-use
+// format: this base plus the format of the uncompressed body
+#define COAP_FORMAT_DEFLATE_BASE    65000
+
+#define COAP_TOKEN_MAX 8
+
+// Block1 option value: block number, more flag and size exponent (16 << szx bytes)
+#define COAP_BLOCK_VALUE(num, more, szx) (((uint32_t)(num) << 4) | ((more) ? 0x08u : 0u) | (szx))
+#define COAP_BLOCK_NUM(value)  ((value) >> 4)
+#define COAP_BLOCK_MORE(value) (((value) & 0x08u) != 0)
+#define COAP_BLOCK_SZX(value)  ((value) & 0x07u)
+#define COAP_BLOCK_SIZE(szx)   ((size_t)16 << (szx))
+
+// Writes one message into a caller's buffer. Options must be added in
+// ascending option number order.
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    uint16_t last_option;
+    bool overflow;          // Something did not fit; the message is unusable
+} coap_writer_t;
+
+void coap_write_header(coap_writer_t *writer, uint8_t *buf, size_t size, coap_type_t type, uint8_t code,
+                       uint16_t message_id, const uint8_t *token, uint8_t token_len);
+void coap_write_option(coap_writer_t *writer, uint16_t number, const void *value, size_t len);
+
+// Unsigned option in its shortest form (zero is empty)
+void coap_write_uint_option(coap_writer_t *writer, uint16_t number, uint32_t value);
+
+// One Uri-Path option per segment of path ("/api/x" gives "api" and "x")
+void coap_write_path(coap_writer_t *writer, const char *path);
+
+// Adds the payload marker and returns where up to *room payload bytes go;
+// add what was written with coap_write_payload_done()
+uint8_t *coap_write_payload(coap_writer_t *writer, size_t *room);
+void coap_write_payload_done(coap_writer_t *writer, size_t len);
+
+typedef struct {
+    coap_type_t type;
+    uint8_t code;
+    uint16_t message_id;
+    uint8_t token[COAP_TOKEN_MAX];
+    uint8_t token_len;
+    bool has_block1;
+    uint32_t block1;
+    const uint8_t *payload;     // Into the parsed buffer
+    size_t payload_len;
+} coap_message_t;
+
+// False if data is not a well-formed CoAP message
+bool coap_parse(const uint8_t *data, size_t len, coap_message_t *message);
+
+// Response code in HTTP numbering: 2.04 is 204, 4.13 is 413
+int coap_status(uint8_t code);
+
+// Content-Format for a MIME type and optional "deflate" encoding, -1 if unknown
+int coap_content_format(const char *content_type, const char *content_encoding);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COAP_MESSAGE_H
@@ -0,0 +1,249 @@
+#include "libs/https/deflate_body.h"
+#include <cstring>
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+static_assert((DEFLATE_WINDOW_SIZE & (DEFLATE_WINDOW_SIZE - 1)) == 0 &&
+              DEFLATE_WINDOW_SIZE >= 256 && DEFLATE_WINDOW_SIZE <= 32768,
+              "zlib windows are powers of two from 256 bytes to 32 KB");
+static_assert(DEFLATE_HASH_SIZE == 256, "hash() produces 8 bits");
+
+// RFC 1951 3.2.5 length and distance code tables
+static const uint16_t LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                       257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                       8193, 12289, 16385, 24577};
+static const uint8_t DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static uint8_t hash(const uint8_t *p) {
+    return (uint8_t)(((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16) * 2654435761u >> 24);
+}
+
+DeflateBody::DeflateBody(http_body_source_t *inner) : inner(inner) {
+    http_body_source_t::read = readSource;
+    http_body_source_t::rewind = rewindSource;
+
+    // Compress once without output for the Content-Length
+    size_t total = 0;
+    char scratch[DEFLATE_OUT_SIZE];
+    size_t n;
+    rewindBody();
+    while ((n = readBody(scratch, sizeof(scratch))) > 0) {
+        total += n;
+    }
+    length = total;
+    rewindBody();
+}
+
+void DeflateBody::rewindBody() {
+    inner->rewind(inner);
+    pos = 0;
+    end = 0;
+    window_start = 0;
+    input_done = false;
+    memset(head, 0, sizeof(head));
+    adler_a = 1;
+    adler_b = 0;
+    out_len = 0;
+    out_offset = 0;
+    bit_buffer = 0;
+    bit_count = 0;
+    stage = STAGE_HEADER;
+}
+
+// Keeps at least DEFLATE_MAX_MATCH bytes of lookahead until the input ends
+void DeflateBody::fillWindow() {
+    while (!input_done && end - pos < DEFLATE_MAX_MATCH) {
+        if (end == sizeof(window)) {
+            // Keep one window of history before pos
+            size_t shift = pos - DEFLATE_WINDOW_SIZE;
+            memmove(window, window + shift, end - shift);
+            pos -= shift;
+            end -= shift;
+            window_start += shift;
+        }
+
+        size_t n = inner->read(inner, (char *)window + end, sizeof(window) - end);
+        if (n == 0) {
+            input_done = true;
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            adler_a = (adler_a + window[end + i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        end += n;
+    }
+}
+
+void DeflateBody::insertHash(size_t at) {
+    if (end - at >= DEFLATE_MIN_MATCH) {
+        head[hash(window + at)] = window_start + at + 1;
+    }
+}
+
+void DeflateBody::putBits(uint32_t value, uint8_t count) {
+    bit_buffer |= value << bit_count;
+    bit_count += count;
+    while (bit_count >= 8) {
+        out[out_len++] = (uint8_t)bit_buffer;
+        bit_buffer >>= 8;
+        bit_count -= 8;
+    }
+}
+
+// Huffman codes are defined most significant bit first
+void DeflateBody::putHuffman(uint32_t code, uint8_t count) {
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    putBits(reversed, count);
+}
+
+// Fixed literal/length code, RFC 1951 3.2.6
+void DeflateBody::putLiteral(uint8_t literal) {
+    if (literal < 144) {
+        putHuffman(0x30 + literal, 8);
+    } else {
+        putHuffman(0x190 + literal - 144, 9);
+    }
+}
+
+void DeflateBody::putMatch(size_t match_length, size_t distance) {
+    int code = 28;
+    while (LENGTH_BASE[code] > match_length) {
+        code--;
+    }
+    int symbol = 257 + code;
+    if (symbol <= 279) {
+        putHuffman(symbol - 256, 7);
+    } else {
+        putHuffman(0xC0 + symbol - 280, 8);
+    }
+    putBits(match_length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (DIST_BASE[code] > distance) {
+        code--;
+    }
+    putHuffman(code, 5);
+    putBits(distance - DIST_BASE[code], DIST_EXTRA[code]);
+}
+
+void DeflateBody::flushBits() {
+    if (bit_count > 0) {
+        out[out_len++] = (uint8_t)bit_buffer;
+    }
+    bit_buffer = 0;
+    bit_count = 0;
+}
+
+// Emits one literal or match at pos
+void DeflateBody::step() {
+    size_t lookahead = end - pos;
+    uint32_t offset = window_start + pos;
+    size_t best_length = 0;
+    size_t best_distance = 0;
+
+    if (lookahead >= DEFLATE_MIN_MATCH) {
+        uint8_t h = hash(window + pos);
+        uint32_t candidate = head[h];
+        head[h] = offset + 1;
+
+        if (candidate != 0 && candidate - 1 >= window_start && offset - (candidate - 1) <= DEFLATE_WINDOW_SIZE) {
+            size_t from = candidate - 1 - window_start;
+            size_t max_length = lookahead < DEFLATE_MAX_MATCH ? lookahead : DEFLATE_MAX_MATCH;
+            size_t match_length = 0;
+            while (match_length < max_length && window[from + match_length] == window[pos + match_length]) {
+                match_length++;
+            }
+            if (match_length >= DEFLATE_MIN_MATCH) {
+                best_length = match_length;
+                best_distance = offset - (candidate - 1);
+            }
+        }
+    }
+
+    if (best_length > 0) {
+        putMatch(best_length, best_distance);
+        for (size_t i = 1; i < best_length; i++) {
+            insertHash(pos + i);
+        }
+        pos += best_length;
+    } else {
+        putLiteral(window[pos]);
+        pos++;
+    }
+}
+
+// Refills the output staging buffer, false once the stream is complete
+bool DeflateBody::produce() {
+    out_len = 0;
+    out_offset = 0;
+
+    // Worst case per step is one match (31 bits) or the end of the stream
+    while (out_len + 8 <= sizeof(out)) {
+        if (stage == STAGE_HEADER) {
+            uint8_t window_bits = 0;
+            while ((1u << window_bits) < DEFLATE_WINDOW_SIZE) {
+                window_bits++;
+            }
+            uint8_t cmf = (uint8_t)(((window_bits - 8) << 4) | 8);   // Deflate with our window size
+            uint8_t flg = (uint8_t)((31 - (cmf * 256) % 31) % 31);  // No dictionary, default level
+            out[out_len++] = cmf;
+            out[out_len++] = flg;
+            putBits(1, 1);      // Final block
+            putBits(1, 2);      // Fixed Huffman codes
+            stage = STAGE_DATA;
+        } else if (stage == STAGE_DATA) {
+            fillWindow();
+            if (pos < end) {
+                step();
+                continue;
+            }
+            putHuffman(0, 7);   // End of block
+            flushBits();
+            stage = STAGE_TRAILER;
+        } else if (stage == STAGE_TRAILER) {
+            uint32_t adler = (adler_b << 16) | adler_a;
+            for (int i = 3; i >= 0; i--) {
+                out[out_len++] = (uint8_t)(adler >> (8 * i));
+            }
+            stage = STAGE_DONE;
+        } else {
+            break;
+        }
+    }
+    return out_len > 0;
+}
+
+size_t DeflateBody::readBody(char *dst, size_t max) {
+    size_t copied = 0;
+    while (copied < max) {
+        if (out_offset == out_len && !produce()) {
+            break;
+        }
+        size_t n = out_len - out_offset;
+        if (n > max - copied) {
+            n = max - copied;
+        }
+        memcpy(dst + copied, out + out_offset, n);
+        out_offset += n;
+        copied += n;
+    }
+    return copied;
+}
+
+size_t DeflateBody::readSource(http_body_source_t *source, char *dst, size_t max) {
+    return static_cast<DeflateBody *>(source)->readBody(dst, max);
+}
+
+void DeflateBody::rewindSource(http_body_source_t *source) {
+    static_cast<DeflateBody *>(source)->rewindBody();
+}
@@ -0,0 +1,73 @@
+#ifndef DEFLATE_BODY_H
+#define DEFLATE_BODY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "libs/https/http_body.h"
+
+// History the compressor matches against; also announced in the zlib header
+#define DEFLATE_WINDOW_SIZE 1024
+
+// Hash table entries for 3-byte match candidates (one candidate per bucket)
+#define DEFLATE_HASH_SIZE 256
+
+// Compressed bytes staged between reads
+#define DEFLATE_OUT_SIZE 64
+
+// Streaming zlib/deflate (RFC 1950/1951) compressor over another body, for
+// "Content-Encoding: deflate". It uses a small window, a single-candidate
+// hash and fixed Huffman codes, so it needs ~3.3 KB of RAM and no tables.
+// Repeated record structure still compresses well. The length is found by
+// compressing once without output.
+class DeflateBody : public http_body_source_t {
+public:
+    // inner must outlive this body and is rewound by it
+    explicit DeflateBody(http_body_source_t *inner);
+
+    size_t getLength() const { return length; }
+
+    // Same as the http_body_source_t callbacks
+    void rewindBody();
+    size_t readBody(char *dst, size_t max);
+
+private:
+    http_body_source_t *inner;
+
+    // Input: DEFLATE_WINDOW_SIZE bytes of history before pos, lookahead after it
+    uint8_t window[2 * DEFLATE_WINDOW_SIZE];
+    size_t pos = 0;
+    size_t end = 0;
+    uint32_t window_start = 0;          // Stream offset of window[0]
+    bool input_done = false;
+    uint32_t head[DEFLATE_HASH_SIZE];   // Stream offset + 1 of the last position per hash, 0 if none
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+
+    // Output
+    uint8_t out[DEFLATE_OUT_SIZE];
+    size_t out_len = 0;
+    size_t out_offset = 0;
+    uint32_t bit_buffer = 0;
+    uint8_t bit_count = 0;
+    enum Stage : uint8_t {
+        STAGE_HEADER = 0,
+        STAGE_DATA,
+        STAGE_TRAILER,
+        STAGE_DONE
+    } stage = STAGE_HEADER;
+
+    void fillWindow();
+    void insertHash(size_t at);
+    void step();
+    void putBits(uint32_t value, uint8_t count);
+    void putHuffman(uint32_t code, uint8_t count);
+    void putLiteral(uint8_t literal);
+    void putMatch(size_t match_length, size_t distance);
+    void flushBits();
+    bool produce();
+
+    static size_t readSource(http_body_source_t *source, char *dst, size_t max);
+    static void rewindSource(http_body_source_t *source);
+};
+
+#endif // DEFLATE_BODY_H
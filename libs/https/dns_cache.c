@@ -0,0 +1,385 @@
+#include "dns_cache.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/dns.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+#define DNS_PORT 53
+#define DNS_TYPE_A 1
+#define DNS_CLASS_IN 1
+#define DNS_MESSAGE_MAX 512
+
+typedef struct {
+    char host[DNS_CACHE_HOST_MAX];
+    ip_addr_t addr;
+    uint32_t expires_ms;
+    uint32_t used_ms;       // For least recently used replacement
+    bool valid;
+} dns_cache_entry_t;
+
+static dns_cache_entry_t cache_entries[DNS_CACHE_SIZE];
+
+// Statistics since boot
+static uint32_t cache_hits = 0;
+static uint32_t cache_queries = 0;
+static uint32_t cache_stale_uses = 0;
+static uint32_t cache_failures = 0;
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static dns_cache_entry_t *find_entry(const char *host) {
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        if (cache_entries[i].valid && strcmp(cache_entries[i].host, host) == 0) {
+            return &cache_entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void store_entry(const char *host, const ip_addr_t *addr, uint32_t ttl_s) {
+    dns_cache_entry_t *entry = find_entry(host);
+    if (!entry) {
+        entry = &cache_entries[0];
+        for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+            if (!cache_entries[i].valid) {
+                entry = &cache_entries[i];
+                break;
+            }
+            if ((int32_t)(cache_entries[i].used_ms - entry->used_ms) < 0) {
+                entry = &cache_entries[i];
+            }
+        }
+        strncpy(entry->host, host, sizeof(entry->host) - 1);
+        entry->host[sizeof(entry->host) - 1] = '\0';
+    }
+
+    if (ttl_s < DNS_CACHE_MIN_TTL_S) {
+        ttl_s = DNS_CACHE_MIN_TTL_S;
+    } else if (ttl_s > DNS_CACHE_MAX_TTL_S) {
+        ttl_s = DNS_CACHE_MAX_TTL_S;
+    }
+    ip_addr_copy(entry->addr, *addr);
+    entry->used_ms = now_ms();
+    entry->expires_ms = entry->used_ms + ttl_s * 1000;
+    entry->valid = true;
+}
+
+// Builds a recursive A query for host, returns its length or 0 if the name is invalid
+static size_t build_query(uint8_t *msg, const char *host, uint16_t id) {
+    memset(msg, 0, 12);
+    msg[0] = (uint8_t)(id >> 8);
+    msg[1] = (uint8_t)id;
+    msg[2] = 0x01;          // Recursion desired
+    msg[5] = 1;             // One question
+
+    size_t n = 12;
+    const char *label = host;
+    while (*label) {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+        if (label_len == 0 || label_len > 63) {
+            return 0;
+        }
+        msg[n++] = (uint8_t)label_len;
+        memcpy(msg + n, label, label_len);
+        n += label_len;
+        label += label_len;
+        if (*label == '.') {
+            label++;
+        }
+    }
+    msg[n++] = 0;
+    msg[n++] = 0;
+    msg[n++] = DNS_TYPE_A;
+    msg[n++] = 0;
+    msg[n++] = DNS_CLASS_IN;
+    return n;
+}
+
+// Offset after the (possibly compressed) name at offset, 0 if it runs past len
+static size_t skip_name(const uint8_t *msg, size_t len, size_t offset) {
+    while (offset < len) {
+        uint8_t c = msg[offset];
+        if ((c & 0xC0) == 0xC0) {
+            return offset + 2 <= len ? offset + 2 : 0;
+        }
+        if (c == 0) {
+            return offset + 1;
+        }
+        offset += c + 1;
+    }
+    return 0;
+}
+
+// Offset after the question for host (type A, class IN) at offset, 0 if the
+// question is for anything else. Names compare case-insensitively, as resolvers
+// may echo them in a different case.
+static size_t match_question(const uint8_t *msg, size_t len, size_t offset, const char *host) {
+    const char *label = host;
+    while (*label) {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot ? (size_t)(dot - label) : strlen(label);
+        if (offset + 1 + label_len > len || msg[offset] != label_len) {
+            return 0;
+        }
+        for (size_t i = 0; i < label_len; i++) {
+            if (tolower(msg[offset + 1 + i]) != tolower((unsigned char)label[i])) {
+                return 0;
+            }
+        }
+        offset += 1 + label_len;
+        label += label_len;
+        if (*label == '.') {
+            label++;
+        }
+    }
+    if (offset + 5 > len || msg[offset] != 0 ||
+        msg[offset + 1] != 0 || msg[offset + 2] != DNS_TYPE_A ||
+        msg[offset + 3] != 0 || msg[offset + 4] != DNS_CLASS_IN) {
+        return 0;
+    }
+    return offset + 5;
+}
+
+// True if addr is one of the servers the query has been sent to so far
+static bool from_queried_server(const dns_cache_lookup_t *lookup, const ip_addr_t *addr) {
+    for (int i = 0; i <= lookup->server_index && i < lookup->server_count; i++) {
+        if (ip_addr_cmp(addr, &lookup->servers[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void dns_cache_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    dns_cache_lookup_t *lookup = (dns_cache_lookup_t *)arg;
+    uint8_t msg[DNS_MESSAGE_MAX];
+    size_t len = pbuf_copy_partial(p, msg, sizeof(msg), 0);
+    pbuf_free(p);
+
+    if (lookup->answered || port != DNS_PORT || !from_queried_server(lookup, addr) || len < 12 ||
+        (uint16_t)((msg[0] << 8) | msg[1]) != lookup->id || !(msg[2] & 0x80)) {
+        return;   // Not the answer to our query
+    }
+
+    // Exactly our question must come back, otherwise it is not our answer
+    uint16_t question_count = (uint16_t)((msg[4] << 8) | msg[5]);
+    size_t offset = question_count == 1 ? match_question(msg, len, 12, lookup->host) : 0;
+    if (!offset) {
+        printf("DNS: Ignoring an answer from %s that does not match the question for %s\n",
+               ipaddr_ntoa(addr), lookup->host);
+        return;
+    }
+
+    // Follow the answers up to the first A record; through a CNAME chain the
+    // shortest TTL bounds how long the address may be used
+    lookup->found = false;
+    uint8_t rcode = msg[3] & 0x0F;
+    uint16_t answer_count = (uint16_t)((msg[6] << 8) | msg[7]);
+    uint32_t ttl_s = UINT32_MAX;
+    for (uint16_t i = 0; rcode == 0 && offset && i < answer_count; i++) {
+        offset = skip_name(msg, len, offset);
+        if (!offset || offset + 10 > len) {
+            break;
+        }
+        uint16_t type = (uint16_t)((msg[offset] << 8) | msg[offset + 1]);
+        uint16_t record_class = (uint16_t)((msg[offset + 2] << 8) | msg[offset + 3]);
+        uint32_t record_ttl = ((uint32_t)msg[offset + 4] << 24) | ((uint32_t)msg[offset + 5] << 16) |
+                              ((uint32_t)msg[offset + 6] << 8) | msg[offset + 7];
+        uint16_t data_len = (uint16_t)((msg[offset + 8] << 8) | msg[offset + 9]);
+        offset += 10;
+        if (offset + data_len > len) {
+            break;
+        }
+        if (record_ttl < ttl_s) {
+            ttl_s = record_ttl;
+        }
+        if (type == DNS_TYPE_A && record_class == DNS_CLASS_IN && data_len == 4) {
+            IP_ADDR4(&lookup->addr, msg[offset], msg[offset + 1], msg[offset + 2], msg[offset + 3]);
+            lookup->ttl_s = ttl_s;
+            lookup->found = true;
+            break;
+        }
+        offset += data_len;
+    }
+    lookup->answered = true;
+}
+
+static bool send_query(dns_cache_lookup_t *lookup) {
+    bool sent = false;
+    cyw43_arch_lwip_begin();
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, lookup->query_len, PBUF_RAM);
+    if (p) {
+        memcpy(p->payload, lookup->query, lookup->query_len);
+        sent = udp_sendto(lookup->pcb, p, &lookup->servers[lookup->server_index], DNS_PORT) == ERR_OK;
+        pbuf_free(p);
+    }
+    cyw43_arch_lwip_end();
+    return sent;
+}
+
+static void remove_pcb(dns_cache_lookup_t *lookup) {
+    if (lookup->pcb) {
+        cyw43_arch_lwip_begin();
+        udp_remove(lookup->pcb);
+        cyw43_arch_lwip_end();
+        lookup->pcb = NULL;
+    }
+}
+
+// The lookup failed: fall back to the last known address if there is one
+static dns_cache_status_t lookup_failed(dns_cache_lookup_t *lookup, ip_addr_t *addr, const char *reason) {
+    remove_pcb(lookup);
+    printf("DNS: Lookup of %s %s after %lu ms\n", lookup->host, reason,
+           (unsigned long)(now_ms() - lookup->start_ms));
+
+    // The resolver is unreachable or broken; the last address is usually still right
+    dns_cache_entry_t *entry = find_entry(lookup->host);
+    if (entry) {
+        cache_stale_uses++;
+        entry->used_ms = now_ms();
+        ip_addr_copy(*addr, entry->addr);
+        printf("DNS: Using last known address of %s (%s)\n", lookup->host, ipaddr_ntoa(addr));
+        return DNS_CACHE_RESOLVED;
+    }
+    cache_failures++;
+    return DNS_CACHE_FAILED;
+}
+
+dns_cache_status_t dns_cache_lookup_start(dns_cache_lookup_t *lookup, const char *host, uint32_t timeout_ms,
+                                          ip_addr_t *addr) {
+    dns_cache_lookup_cancel(lookup);
+    if (ipaddr_aton(host, addr)) {
+        return DNS_CACHE_RESOLVED;   // Already an address
+    }
+
+    dns_cache_entry_t *entry = find_entry(host);
+    if (entry && (int32_t)(entry->expires_ms - now_ms()) > 0) {
+        cache_hits++;
+        entry->used_ms = now_ms();
+        ip_addr_copy(*addr, entry->addr);
+        return DNS_CACHE_RESOLVED;
+    }
+
+    if (strlen(host) >= sizeof(lookup->host)) {
+        cache_failures++;
+        return DNS_CACHE_FAILED;
+    }
+    strcpy(lookup->host, host);
+    lookup->start_ms = now_ms();
+    lookup->id = (uint16_t)(time_us_32() ^ (cache_queries << 8));
+    lookup->query_len = (uint16_t)build_query(lookup->query, host, lookup->id);
+    if (lookup->query_len == 0) {
+        return lookup_failed(lookup, addr, "has an invalid name");
+    }
+
+    // DNS servers from DHCP, public ones if it gave none
+    lookup->server_count = 0;
+    for (u8_t i = 0; i < DNS_CACHE_SERVER_COUNT; i++) {
+        const ip_addr_t *server = dns_getserver(i);
+        if (server && !ip_addr_isany(server)) {
+            ip_addr_copy(lookup->servers[lookup->server_count], *server);
+            lookup->server_count++;
+        }
+    }
+    if (lookup->server_count == 0) {
+        IP_ADDR4(&lookup->servers[0], 8, 8, 8, 8);
+        IP_ADDR4(&lookup->servers[1], 1, 1, 1, 1);
+        lookup->server_count = 2;
+    }
+
+    lookup->answered = false;
+    lookup->found = false;
+    cyw43_arch_lwip_begin();
+    lookup->pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (lookup->pcb) {
+        udp_recv(lookup->pcb, dns_cache_recv, lookup);
+    }
+    cyw43_arch_lwip_end();
+    if (!lookup->pcb) {
+        printf("DNS: No UDP PCB for the lookup\n");
+        return lookup_failed(lookup, addr, "could not start");
+    }
+
+    cache_queries++;
+    lookup->timeout_ms = timeout_ms;
+    lookup->server_index = 0;
+    lookup->attempt_end_ms = lookup->start_ms + timeout_ms / lookup->server_count;
+    if (!send_query(lookup)) {
+        lookup->attempt_end_ms = lookup->start_ms;   // Next server at the first poll
+    }
+    return DNS_CACHE_IN_PROGRESS;
+}
+
+dns_cache_status_t dns_cache_lookup_poll(dns_cache_lookup_t *lookup, ip_addr_t *addr) {
+    if (!lookup->pcb) {
+        return DNS_CACHE_FAILED;   // Not started, or already finished
+    }
+
+    if (lookup->answered) {
+        if (!lookup->found) {
+            return lookup_failed(lookup, addr, "found no address");
+        }
+        remove_pcb(lookup);
+        ip_addr_copy(*addr, lookup->addr);
+        store_entry(lookup->host, addr, lookup->ttl_s);
+        printf("DNS: %s is %s (TTL %lu s) in %lu ms\n", lookup->host, ipaddr_ntoa(addr),
+               (unsigned long)lookup->ttl_s, (unsigned long)(now_ms() - lookup->start_ms));
+        return DNS_CACHE_RESOLVED;
+    }
+
+    // Each server gets its share of the timeout; an answer from an earlier
+    // one is still taken while the next is asked
+    while ((int32_t)(now_ms() - lookup->attempt_end_ms) >= 0) {
+        if (lookup->server_index + 1 >= lookup->server_count) {
+            return lookup_failed(lookup, addr, "timed out");
+        }
+        lookup->server_index++;
+        lookup->attempt_end_ms = lookup->start_ms +
+                                 lookup->timeout_ms * (lookup->server_index + 1) / lookup->server_count;
+        if (!send_query(lookup)) {
+            lookup->attempt_end_ms = now_ms();
+        }
+    }
+    return DNS_CACHE_IN_PROGRESS;
+}
+
+void dns_cache_lookup_cancel(dns_cache_lookup_t *lookup) {
+    remove_pcb(lookup);
+}
+
+bool dns_cache_resolve(const char *host, ip_addr_t *addr, uint32_t timeout_ms) {
+    dns_cache_lookup_t lookup;
+    memset(&lookup, 0, sizeof(lookup));
+    dns_cache_status_t status = dns_cache_lookup_start(&lookup, host, timeout_ms, addr);
+    while (status == DNS_CACHE_IN_PROGRESS) {
+        cyw43_arch_poll();
+        sleep_ms(2);
+        status = dns_cache_lookup_poll(&lookup, addr);
+    }
+    return status == DNS_CACHE_RESOLVED;
+}
+
+void dns_cache_prefetch(const char *host) {
+    ip_addr_t addr;
+    dns_cache_resolve(host, &addr, DNS_CACHE_QUERY_TIMEOUT_MS);
+}
+
+void dns_cache_expire(const char *host) {
+    dns_cache_entry_t *entry = find_entry(host);
+    if (entry) {
+        entry->expires_ms = now_ms();
+    }
+}
+
+void dns_cache_print_stats(void) {
+    printf("DNS: %lu cache hits, %lu lookups, %lu stale fallbacks, %lu failures\n",
+           (unsigned long)cache_hits, (unsigned long)cache_queries,
+           (unsigned long)cache_stale_uses, (unsigned long)cache_failures);
+}
@@ -0,0 +1,103 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hostnames kept; the least recently used one is replaced
+#define DNS_CACHE_SIZE 4
+#define DNS_CACHE_HOST_MAX 64
+
+// Record TTLs are clamped to this range, so a very short TTL doesn't put a
+// DNS round trip back in front of every connection
+#define DNS_CACHE_MIN_TTL_S 60
+#define DNS_CACHE_MAX_TTL_S 86400
+
+// Time allowed for one lookup, split between the configured DNS servers
+#define DNS_CACHE_QUERY_TIMEOUT_MS 1500
+
+// DNS servers asked per lookup, one after the other
+#define DNS_CACHE_SERVER_COUNT 2
+
+// Largest query: header, encoded name, type and class
+#define DNS_CACHE_QUERY_MAX (12 + DNS_CACHE_HOST_MAX + 2 + 4)
+
+// Hostname to IPv4 address cache shared by all connections. Addresses are
+// reused until their TTL runs out; lwIP's resolver does not report TTLs, so
+// lookups are A queries of our own to the DNS servers from DHCP (public
+// resolvers if there are none). If a lookup fails, the last known address
+// is used even when it has expired.
+//
+// An answer is only taken from a server the query went to, with the query's
+// ID and the same question (name, type A, class IN), so a stray or spoofed
+// datagram cannot put an address in the cache.
+//
+// All functions must be called without the lwIP lock held.
+
+struct udp_pcb;
+
+typedef enum {
+    DNS_CACHE_IN_PROGRESS = 0,
+    DNS_CACHE_RESOLVED,
+    DNS_CACHE_FAILED
+} dns_cache_status_t;
+
+// A lookup owned by its caller, so a polled connection can resolve without
+// blocking. Zero-initialise before the first use.
+typedef struct dns_cache_lookup {
+    char host[DNS_CACHE_HOST_MAX];
+    struct udp_pcb *pcb;                 // Non-NULL while the lookup runs
+    ip_addr_t servers[DNS_CACHE_SERVER_COUNT];
+    uint8_t server_count;
+    uint8_t server_index;                // Server the last query went to
+    uint16_t id;
+    uint32_t start_ms;
+    uint32_t timeout_ms;
+    uint32_t attempt_end_ms;             // When to move on to the next server
+    uint8_t query[DNS_CACHE_QUERY_MAX];
+    uint16_t query_len;
+
+    // Set from the UDP receive callback
+    volatile bool answered;
+    bool found;
+    ip_addr_t addr;
+    uint32_t ttl_s;
+} dns_cache_lookup_t;
+
+// Starts resolving host. A literal address or a fresh cache entry is
+// RESOLVED at once; otherwise a query is sent and the lookup is IN_PROGRESS
+// until dns_cache_lookup_poll() says otherwise.
+dns_cache_status_t dns_cache_lookup_start(dns_cache_lookup_t *lookup, const char *host, uint32_t timeout_ms,
+                                          ip_addr_t *addr);
+
+// Takes the answer once it has arrived, or asks the next server when one
+// does not answer in its share of the timeout. RESOLVED sets addr, also when
+// it falls back to an expired entry; FAILED if the host has no address at all.
+dns_cache_status_t dns_cache_lookup_poll(dns_cache_lookup_t *lookup, ip_addr_t *addr);
+
+// Abandons a lookup that is still in progress; no-op otherwise
+void dns_cache_lookup_cancel(dns_cache_lookup_t *lookup);
+
+// Blocking form of the above: fresh cache entry, otherwise a lookup of up to
+// timeout_ms. Returns false if the host has no address at all.
+bool dns_cache_resolve(const char *host, ip_addr_t *addr, uint32_t timeout_ms);
+
+// Looks up host now unless it is cached, so later connections find it there
+void dns_cache_prefetch(const char *host);
+
+// The address did not accept a connection: look it up again next time, but
+// keep it as the fallback
+void dns_cache_expire(const char *host);
+
+void dns_cache_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DNS_CACHE_H
@@ -0,0 +1,367 @@
+#include "download_server.h"
+#include <stdio.h>
+#include <string.h>
+#include "lwip/tcp.h"
+
+typedef enum {
+    DOWNLOAD_NONE = 0,    // Request not complete yet
+    DOWNLOAD_STATIC,      // A block in memory, sent without copying
+    DOWNLOAD_CSV,         // Rows formatted while sending
+    DOWNLOAD_DONE         // Everything queued, closing
+} download_body_t;
+
+typedef struct {
+    struct tcp_pcb *pcb;        // NULL for a free slot
+    char request[DOWNLOAD_SERVER_REQUEST_SIZE];
+    size_t request_len;
+    download_body_t body;
+    const uint8_t *data;        // DOWNLOAD_STATIC
+    size_t data_len;
+    size_t data_offset;
+    size_t next_record;         // DOWNLOAD_CSV
+    size_t record_count;
+    bool records_queued;        // /records.bin bytes referenced by the send queue
+    char chunk[DOWNLOAD_SERVER_CHUNK_SIZE];
+    uint8_t idle_polls;
+} download_conn_t;
+
+static const char index_page[] =
+    "<!DOCTYPE html><html><head><meta name=\"viewport\" content=\"width=device-width\">"
+    "<title>pico_eu</title></head><body><h1>pico_eu</h1><ul>"
+    "<li><a href=\"/records.csv\">records.csv</a></li>"
+    "<li><a href=\"/records.bin\">records.bin</a></li>"
+    "<li><a href=\"/status\">status</a></li>"
+    "</ul></body></html>";
+
+static struct tcp_pcb *listen_pcb = NULL;
+static const download_source_t *server_source = NULL;
+static download_conn_t connections[DOWNLOAD_SERVER_MAX_CONNECTIONS];
+
+// Statistics since the server started
+static uint32_t requests = 0;
+static uint32_t bytes_sent = 0;     // Record and page bodies queued
+static uint32_t downloads = 0;      // Record downloads started
+static uint32_t refused = 0;        // Connections dropped for lack of a slot
+
+static void release_conn(download_conn_t *conn) {
+    tcp_arg(conn->pcb, NULL);
+    tcp_recv(conn->pcb, NULL);
+    tcp_sent(conn->pcb, NULL);
+    tcp_err(conn->pcb, NULL);
+    tcp_poll(conn->pcb, NULL, 0);
+    conn->pcb = NULL;
+}
+
+// Closes once the queued data is out; aborts if that is not possible.
+// Returns ERR_ABRT after an abort, which callbacks must pass on.
+// tcp_close() keeps unacknowledged data for retransmission after the slot
+// is released, so a /records.bin response is only closed once all of it is
+// acknowledged (finish_conn()); the records block may change after that.
+static err_t close_conn(download_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    release_conn(conn);
+    if (tcp_close(pcb) != ERR_OK) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    return ERR_OK;
+}
+
+// Closes a connection whose response is queued, once nothing of it is left to
+// send or acknowledge; ERR_ABRT as close_conn()
+static err_t finish_conn(download_conn_t *conn) {
+    if (conn->body != DOWNLOAD_DONE || tcp_sndqueuelen(conn->pcb) > 0) {
+        return ERR_OK;
+    }
+    return close_conn(conn);
+}
+
+// Queues as much of the body as the send buffer takes
+static void send_body(download_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    if (conn->body == DOWNLOAD_STATIC) {
+        while (conn->data_offset < conn->data_len) {
+            size_t n = conn->data_len - conn->data_offset;
+            if (n > tcp_sndbuf(pcb)) {
+                n = tcp_sndbuf(pcb);
+            }
+            if (n > 0xFFFF) {
+                n = 0xFFFF;
+            }
+            bool more = conn->data_offset + n < conn->data_len;
+            if (n == 0 || tcp_write(pcb, conn->data + conn->data_offset, (u16_t)n,
+                                    more ? TCP_WRITE_FLAG_MORE : 0) != ERR_OK) {
+                break;
+            }
+            conn->data_offset += n;
+            bytes_sent += n;
+        }
+        if (conn->data_offset == conn->data_len) {
+            conn->body = DOWNLOAD_DONE;
+        }
+    } else if (conn->body == DOWNLOAD_CSV) {
+        while (conn->next_record < conn->record_count) {
+            // Whole rows only; each chunk is copied into the send buffer
+            size_t len = 0;
+            size_t next = conn->next_record;
+            while (next < conn->record_count) {
+                size_t row = server_source->csv_row(server_source->arg, next, conn->chunk + len,
+                                                    sizeof(conn->chunk) - len);
+                if (row >= sizeof(conn->chunk) - len) {
+                    if (len == 0) {
+                        next++;    // A row that can never fit is left out
+                    }
+                    break;
+                }
+                len += row;
+                next++;
+            }
+            if (len > tcp_sndbuf(pcb) ||
+                (len > 0 && tcp_write(pcb, conn->chunk, (u16_t)len, TCP_WRITE_FLAG_COPY) != ERR_OK)) {
+                break;
+            }
+            conn->next_record = next;
+            bytes_sent += len;
+        }
+        if (conn->next_record == conn->record_count) {
+            conn->body = DOWNLOAD_DONE;
+        }
+    }
+    tcp_output(pcb);
+}
+
+// Queues the status line and headers; false if they did not fit
+static bool send_header(download_conn_t *conn, const char *status, const char *content_type,
+                        long content_length, const char *extra) {
+    char header[256];
+    int n = snprintf(header, sizeof(header), "HTTP/1.0 %s\r\nContent-Type: %s\r\n", status, content_type);
+    if (content_length >= 0) {
+        n += snprintf(header + n, sizeof(header) - n, "Content-Length: %ld\r\n", content_length);
+    }
+    n += snprintf(header + n, sizeof(header) - n, "%sConnection: close\r\n\r\n", extra ? extra : "");
+    if (n >= (int)sizeof(header)) {
+        return false;
+    }
+    return tcp_write(conn->pcb, header, (u16_t)n, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE) == ERR_OK;
+}
+
+static void send_error(download_conn_t *conn, const char *status) {
+    if (send_header(conn, status, "text/plain", (long)strlen(status), NULL)) {
+        tcp_write(conn->pcb, status, (u16_t)strlen(status), TCP_WRITE_FLAG_COPY);
+    }
+    conn->body = DOWNLOAD_DONE;
+}
+
+static void handle_request(download_conn_t *conn) {
+    requests++;
+    conn->request[conn->request_len] = '\0';
+    bool head = strncmp(conn->request, "HEAD ", 5) == 0;
+    if (!head && strncmp(conn->request, "GET ", 4) != 0) {
+        send_error(conn, "405 Method Not Allowed");
+        return;
+    }
+
+    // Path up to the query or the protocol version
+    char *path = conn->request + (head ? 5 : 4);
+    path[strcspn(path, " ?\r\n")] = '\0';
+    printf("DOWNLOAD: %s %s\n", head ? "HEAD" : "GET", path);
+
+    conn->body = DOWNLOAD_STATIC;
+    conn->data_offset = 0;
+    if (strcmp(path, "/") == 0) {
+        conn->data = (const uint8_t *)index_page;
+        conn->data_len = sizeof(index_page) - 1;
+        send_header(conn, "200 OK", "text/html", (long)conn->data_len, NULL);
+    } else if (strcmp(path, "/status") == 0) {
+        // Copied: the document is formatted into the chunk buffer
+        size_t len = server_source->status_json(server_source->arg, conn->chunk, sizeof(conn->chunk));
+        if (len >= sizeof(conn->chunk)) {
+            len = sizeof(conn->chunk) - 1;
+        }
+        if (send_header(conn, "200 OK", "application/json", (long)len, NULL) && !head) {
+            tcp_write(conn->pcb, conn->chunk, (u16_t)len, TCP_WRITE_FLAG_COPY);
+        }
+        conn->body = DOWNLOAD_DONE;
+    } else if (strcmp(path, "/records.bin") == 0) {
+        size_t count = 0, record_size = 0;
+        conn->data = server_source->records(server_source->arg, &count, &record_size);
+        conn->data_len = conn->data ? count * record_size : 0;
+        conn->records_queued = !head && conn->data_len > 0;
+        char extra[96];
+        snprintf(extra, sizeof(extra), "Content-Disposition: attachment; filename=\"records.bin\"\r\n"
+                 "X-Record-Size: %u\r\n", (unsigned)record_size);
+        send_header(conn, "200 OK", "application/octet-stream", (long)conn->data_len, extra);
+        downloads++;
+    } else if (strcmp(path, "/records.csv") == 0) {
+        // The length is not known up front; the body ends with the connection
+        size_t record_size = 0;
+        server_source->records(server_source->arg, &conn->record_count, &record_size);
+        conn->next_record = 0;
+        conn->body = DOWNLOAD_CSV;
+        if (send_header(conn, "200 OK", "text/csv", -1,
+                        "Content-Disposition: attachment; filename=\"records.csv\"\r\n")) {
+            tcp_write(conn->pcb, server_source->csv_header, (u16_t)strlen(server_source->csv_header),
+                      TCP_WRITE_FLAG_MORE);
+        }
+        downloads++;
+    } else {
+        send_error(conn, "404 Not Found");
+        return;
+    }
+    if (head) {
+        conn->body = DOWNLOAD_DONE;
+    }
+}
+
+static err_t download_server_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    download_conn_t *conn = (download_conn_t *)arg;
+    conn->idle_polls = 0;
+    send_body(conn);
+    return finish_conn(conn);
+}
+
+static err_t download_server_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    download_conn_t *conn = (download_conn_t *)arg;
+    if (!p) {
+        // The client is done sending; a response under way still goes out
+        if (conn->body == DOWNLOAD_NONE) {
+            return close_conn(conn);
+        }
+        return finish_conn(conn);
+    }
+    tcp_recved(pcb, p->tot_len);
+    conn->idle_polls = 0;
+    if (conn->body == DOWNLOAD_NONE) {
+        // Keep what fits; the request line comes first
+        size_t room = sizeof(conn->request) - 1 - conn->request_len;
+        conn->request_len += pbuf_copy_partial(p, conn->request + conn->request_len,
+                                               (u16_t)(p->tot_len < room ? p->tot_len : room), 0);
+        conn->request[conn->request_len] = '\0';
+        if (strstr(conn->request, "\r\n\r\n") || conn->request_len == sizeof(conn->request) - 1) {
+            handle_request(conn);
+            send_body(conn);
+        }
+    }
+    pbuf_free(p);
+    return finish_conn(conn);
+}
+
+static err_t download_server_poll(void *arg, struct tcp_pcb *pcb) {
+    download_conn_t *conn = (download_conn_t *)arg;
+    if (++conn->idle_polls > DOWNLOAD_SERVER_IDLE_POLLS) {
+        printf("DOWNLOAD: Dropping an idle connection\n");
+        release_conn(conn);
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    // Retries a write that found the send queue full
+    if (conn->body != DOWNLOAD_NONE) {
+        send_body(conn);
+        return finish_conn(conn);
+    }
+    return ERR_OK;
+}
+
+static void download_server_err(void *arg, err_t err) {
+    download_conn_t *conn = (download_conn_t *)arg;
+    if (conn) {
+        conn->pcb = NULL;    // lwIP has freed the pcb already
+    }
+}
+
+static err_t download_server_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK || !pcb) {
+        return ERR_VAL;
+    }
+    download_conn_t *conn = NULL;
+    for (int i = 0; i < DOWNLOAD_SERVER_MAX_CONNECTIONS; i++) {
+        if (!connections[i].pcb) {
+            conn = &connections[i];
+            break;
+        }
+    }
+    if (!conn) {
+        refused++;
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+    memset(conn, 0, offsetof(download_conn_t, chunk));
+    conn->pcb = pcb;
+    tcp_arg(pcb, conn);
+    tcp_recv(pcb, download_server_recv);
+    tcp_sent(pcb, download_server_sent);
+    tcp_err(pcb, download_server_err);
+    tcp_poll(pcb, download_server_poll, 1);
+    return ERR_OK;
+}
+
+bool download_server_start(uint16_t port, const download_source_t *source) {
+    if (listen_pcb) {
+        return true;
+    }
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) {
+        return false;
+    }
+    if (tcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
+        printf("DOWNLOAD: Port %u is taken\n", port);
+        tcp_close(pcb);
+        return false;
+    }
+    listen_pcb = tcp_listen_with_backlog(pcb, DOWNLOAD_SERVER_MAX_CONNECTIONS);
+    if (!listen_pcb) {
+        tcp_close(pcb);
+        return false;
+    }
+    server_source = source;
+    memset(connections, 0, sizeof(connections));
+    requests = 0;
+    bytes_sent = 0;
+    downloads = 0;
+    refused = 0;
+    tcp_accept(listen_pcb, download_server_accept);
+    printf("DOWNLOAD: Listening on port %u\n", port);
+    return true;
+}
+
+void download_server_stop(void) {
+    if (!listen_pcb) {
+        return;
+    }
+    for (int i = 0; i < DOWNLOAD_SERVER_MAX_CONNECTIONS; i++) {
+        if (connections[i].pcb) {
+            struct tcp_pcb *pcb = connections[i].pcb;
+            release_conn(&connections[i]);
+            tcp_abort(pcb);
+        }
+    }
+    tcp_close(listen_pcb);
+    listen_pcb = NULL;
+    download_server_print_stats();
+}
+
+bool download_server_running(void) {
+    return listen_pcb != NULL;
+}
+
+bool download_server_records_in_use(void) {
+    for (int i = 0; i < DOWNLOAD_SERVER_MAX_CONNECTIONS; i++) {
+        if (connections[i].pcb && connections[i].records_queued) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t download_server_requests(void) {
+    return requests;
+}
+
+uint32_t download_server_bytes_sent(void) {
+    return bytes_sent;
+}
+
+void download_server_print_stats(void) {
+    printf("DOWNLOAD: %lu requests, %lu record downloads, %lu bytes sent, %lu connections refused\n",
+           (unsigned long)requests, (unsigned long)downloads, (unsigned long)bytes_sent, (unsigned long)refused);
+}
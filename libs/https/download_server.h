@@ -0,0 +1,77 @@
+#ifndef DOWNLOAD_SERVER_H
+#define DOWNLOAD_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DOWNLOAD_SERVER_MAX_CONNECTIONS 2
+
+// Room for the request line and headers; the rest of a longer request is ignored
+#define DOWNLOAD_SERVER_REQUEST_SIZE 256
+
+// CSV rows are formatted into this many bytes at a time, one full segment
+#define DOWNLOAD_SERVER_CHUNK_SIZE 1460
+
+// A connection that makes no progress for this many polls (0.5 s each) is dropped
+#define DOWNLOAD_SERVER_IDLE_POLLS 20
+
+// What the server offers; the callbacks run in the lwIP context
+typedef struct {
+    // Stored records as one block in memory that stays valid while it is
+    // sent, e.g. flash mapped through XIP
+    const uint8_t *(*records)(void *arg, size_t *count, size_t *record_size);
+    // CSV line for record index, with its newline. Returns the length as
+    // snprintf does, 0 to leave the record out.
+    size_t (*csv_row)(void *arg, size_t index, char *out, size_t size);
+    const char *csv_header;    // First CSV line, with its newline
+    // Status document as JSON, returns its length
+    size_t (*status_json)(void *arg, char *out, size_t size);
+    void *arg;
+} download_source_t;
+
+// Tiny HTTP/1.0 server on lwIP's raw TCP API for fetching the stored records
+// without internet, e.g. from a phone on the device's access point:
+//
+//   GET /             links to the documents below
+//   GET /status       status JSON
+//   GET /records.bin  records as stored (X-Record-Size bytes each)
+//   GET /records.csv  one line per record
+//
+// The binary download and the index page are written without copying
+// (tcp_write without TCP_WRITE_FLAG_COPY references them from PBUF_ROM
+// pbufs), so flash is sent straight from XIP memory at the speed of the
+// link. The records block must therefore not change while
+// download_server_records_in_use() says so. Each response closes its
+// connection. Uses only lwIP, so it also runs in a host build (the network
+// rig's test_download_server).
+//
+// Must be called with the lwIP lock held.
+
+// source must outlive the server
+bool download_server_start(uint16_t port, const download_source_t *source);
+
+// Stops listening and drops open connections
+void download_server_stop(void);
+
+bool download_server_running(void);
+
+// True while a /records.bin response has bytes in lwIP's send queue, which
+// point into the records block: erasing or programming that flash must wait
+bool download_server_records_in_use(void);
+
+// Since the server started
+uint32_t download_server_requests(void);
+uint32_t download_server_bytes_sent(void);    // Bodies queued for the clients
+
+void download_server_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DOWNLOAD_SERVER_H
@@ -0,0 +1,59 @@
+#ifndef HTTP_BODY_H
+#define HTTP_BODY_H
+
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Request body produced on demand. The TLS clients pull from it whenever the
+// TCP send buffer has room (altcp_sent), so a body never has to exist in RAM
+// as a whole; only a small chunk is staged at a time.
+typedef struct http_body_source {
+    // Copies up to max bytes of the body to dst; returns 0 once the body is complete
+    size_t (*read)(struct http_body_source *source, char *dst, size_t max);
+
+    // Restarts the body from its first byte, e.g. for a retry on a new connection
+    void (*rewind)(struct http_body_source *source);
+
+    // Total number of bytes read() produces, sent as Content-Length
+    size_t length;
+} http_body_source_t;
+
+// Body backed by a string that is already in memory
+typedef struct {
+    http_body_source_t source;
+    const char *data;
+    size_t offset;
+} http_string_body_t;
+
+static inline size_t http_string_body_read(http_body_source_t *source, char *dst, size_t max) {
+    http_string_body_t *body = (http_string_body_t *)source;
+    size_t n = source->length - body->offset;
+    if (n > max) {
+        n = max;
+    }
+    memcpy(dst, body->data + body->offset, n);
+    body->offset += n;
+    return n;
+}
+
+static inline void http_string_body_rewind(http_body_source_t *source) {
+    ((http_string_body_t *)source)->offset = 0;
+}
+
+static inline void http_string_body_init(http_string_body_t *body, const char *data, size_t length) {
+    body->source.read = http_string_body_read;
+    body->source.rewind = http_string_body_rewind;
+    body->source.length = length;
+    body->data = data;
+    body->offset = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HTTP_BODY_H
@@ -0,0 +1,230 @@
+#include "http_response.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+void http_response_init(http_response_t *response) {
+    response->state = HTTP_RESPONSE_STATUS_LINE;
+    response->status = 0;
+    response->accepted = -1;
+    response->keep_alive = true;
+    response->chunked = false;
+    response->content_length = -1;
+    response->remaining = 0;
+    response->line_len = 0;
+    response->body_len = 0;
+    response->body[0] = '\0';
+}
+
+// Case-insensitive search for a comma separated token in a header value
+static bool header_has_token(const char *value, const char *token) {
+    size_t token_len = strlen(token);
+    for (const char *p = value; *p; p++) {
+        if (strncasecmp(p, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Value of "Name: value" if line is that header, NULL otherwise
+static const char *header_value(const char *line, const char *name) {
+    size_t name_len = strlen(name);
+    if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') {
+        return NULL;
+    }
+    const char *value = line + name_len + 1;
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    return value;
+}
+
+static void parse_header(http_response_t *response, const char *line) {
+    const char *value;
+    if ((value = header_value(line, "Content-Length")) != NULL) {
+        response->content_length = (int32_t)strtol(value, NULL, 10);
+    } else if ((value = header_value(line, "Transfer-Encoding")) != NULL) {
+        response->chunked = header_has_token(value, "chunked");
+    } else if ((value = header_value(line, "Connection")) != NULL) {
+        if (header_has_token(value, "close")) {
+            response->keep_alive = false;
+        } else if (header_has_token(value, "keep-alive")) {
+            response->keep_alive = true;
+        }
+    } else if ((value = header_value(line, HTTP_ACCEPTED_HEADER)) != NULL && isdigit((unsigned char)*value)) {
+        response->accepted = (int32_t)strtol(value, NULL, 10);
+    }
+}
+
+// Looks for "accepted":<n> in the kept start of the body
+static void parse_accepted_body(http_response_t *response) {
+    const char *p = strstr(response->body, "\"accepted\"");
+    if (!p) {
+        return;
+    }
+    p += 10;
+    while (*p == ' ' || *p == '\t' || *p == ':') {
+        p++;
+    }
+    if (isdigit((unsigned char)*p)) {
+        response->accepted = (int32_t)strtol(p, NULL, 10);
+    }
+}
+
+static void finish(http_response_t *response) {
+    if (response->accepted < 0) {
+        parse_accepted_body(response);
+    }
+    response->state = HTTP_RESPONSE_DONE;
+}
+
+static void fail(http_response_t *response, const char *reason) {
+    printf("HTTP: %s\n", reason);
+    response->keep_alive = false;
+    response->state = HTTP_RESPONSE_ERROR;
+}
+
+static void keep_body(http_response_t *response, const char *data, size_t len) {
+    size_t room = HTTP_RESPONSE_BODY_KEEP - response->body_len;
+    if (len > room) {
+        len = room;
+    }
+    memcpy(response->body + response->body_len, data, len);
+    response->body_len += len;
+    response->body[response->body_len] = '\0';
+}
+
+static void end_of_headers(http_response_t *response) {
+    if (response->status >= 100 && response->status < 200) {
+        // Interim response, the real one follows
+        response->state = HTTP_RESPONSE_STATUS_LINE;
+        response->chunked = false;
+        response->content_length = -1;
+        return;
+    }
+    if (response->status == 204 || response->status == 304) {
+        finish(response);
+    } else if (response->chunked) {
+        response->state = HTTP_RESPONSE_CHUNK_SIZE;
+    } else if (response->content_length >= 0) {
+        response->remaining = (uint32_t)response->content_length;
+        response->state = HTTP_RESPONSE_BODY;
+        if (response->remaining == 0) {
+            finish(response);
+        }
+    } else {
+        response->keep_alive = false;
+        response->state = HTTP_RESPONSE_UNTIL_CLOSE;
+    }
+}
+
+static void parse_line(http_response_t *response) {
+    const char *line = response->line;
+    switch (response->state) {
+    case HTTP_RESPONSE_STATUS_LINE:
+        if (response->line_len == 0) {
+            return;   // Stray CRLF between responses
+        }
+        if (response->line_len < 12 || strncmp(line, "HTTP/1.", 7) != 0 || !isdigit((unsigned char)line[9])) {
+            fail(response, "Malformed status line");
+            return;
+        }
+        response->keep_alive = line[7] != '0';   // HTTP/1.0 closes by default
+        response->status = atoi(line + 9);
+        response->state = HTTP_RESPONSE_HEADERS;
+        return;
+
+    case HTTP_RESPONSE_HEADERS:
+        if (response->line_len > 0) {
+            parse_header(response, line);
+        } else {
+            end_of_headers(response);
+        }
+        return;
+
+    case HTTP_RESPONSE_CHUNK_SIZE: {
+        char *end;
+        unsigned long size = strtoul(line, &end, 16);
+        if (end == line) {
+            fail(response, "Malformed chunk size");
+            return;
+        }
+        if (size == 0) {
+            response->state = HTTP_RESPONSE_TRAILERS;
+        } else {
+            response->remaining = (uint32_t)size;
+            response->state = HTTP_RESPONSE_CHUNK_DATA;
+        }
+        return;
+    }
+
+    case HTTP_RESPONSE_CHUNK_END:
+        if (response->line_len != 0) {
+            fail(response, "Missing CRLF after chunk");
+            return;
+        }
+        response->state = HTTP_RESPONSE_CHUNK_SIZE;
+        return;
+
+    case HTTP_RESPONSE_TRAILERS:
+        if (response->line_len > 0) {
+            parse_header(response, line);
+        } else {
+            finish(response);
+        }
+        return;
+
+    default:
+        return;
+    }
+}
+
+size_t http_response_feed(http_response_t *response, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && response->state != HTTP_RESPONSE_DONE && response->state != HTTP_RESPONSE_ERROR) {
+        if (response->state == HTTP_RESPONSE_BODY || response->state == HTTP_RESPONSE_CHUNK_DATA ||
+            response->state == HTTP_RESPONSE_UNTIL_CLOSE) {
+            size_t n = len - i;
+            if (response->state != HTTP_RESPONSE_UNTIL_CLOSE && n > response->remaining) {
+                n = response->remaining;
+            }
+            keep_body(response, data + i, n);
+            i += n;
+            if (response->state == HTTP_RESPONSE_UNTIL_CLOSE) {
+                continue;
+            }
+            response->remaining -= n;
+            if (response->remaining == 0) {
+                if (response->state == HTTP_RESPONSE_BODY) {
+                    finish(response);
+                } else {
+                    response->state = HTTP_RESPONSE_CHUNK_END;
+                }
+            }
+            continue;
+        }
+
+        char c = data[i++];
+        if (c == '\n') {
+            if (response->line_len > 0 && response->line[response->line_len - 1] == '\r') {
+                response->line_len--;
+            }
+            response->line[response->line_len] = '\0';
+            parse_line(response);
+            response->line_len = 0;
+        } else if (response->line_len < sizeof(response->line) - 1) {
+            response->line[response->line_len++] = c;
+        }
+    }
+    return i;
+}
+
+bool http_response_close(http_response_t *response) {
+    if (response->state == HTTP_RESPONSE_UNTIL_CLOSE) {
+        finish(response);
+    }
+    return response->state == HTTP_RESPONSE_DONE;
+}
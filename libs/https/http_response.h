@@ -0,0 +1,75 @@
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest status, header or chunk size line kept; longer lines are truncated
+#define HTTP_RESPONSE_LINE_SIZE 128
+
+// Start of the body kept for the accepted count
+#define HTTP_RESPONSE_BODY_KEEP 128
+
+// Response header with the number of records of the request the server
+// stored, counted from the first one. A JSON body field "accepted" is used
+// when the header is missing.
+#define HTTP_ACCEPTED_HEADER "X-Accepted-Records"
+
+typedef enum {
+    HTTP_RESPONSE_STATUS_LINE = 0,
+    HTTP_RESPONSE_HEADERS,
+    HTTP_RESPONSE_BODY,            // Content-Length framed
+    HTTP_RESPONSE_CHUNK_SIZE,
+    HTTP_RESPONSE_CHUNK_DATA,
+    HTTP_RESPONSE_CHUNK_END,       // CRLF after the chunk data
+    HTTP_RESPONSE_TRAILERS,
+    HTTP_RESPONSE_UNTIL_CLOSE,     // No framing, the body ends with the connection
+    HTTP_RESPONSE_DONE,
+    HTTP_RESPONSE_ERROR            // Not HTTP, or broken framing
+} http_response_state_t;
+
+// Incremental HTTP/1.1 response parser. Bytes can arrive split anywhere;
+// parsing stops at the end of the response so a pipelined response that
+// follows in the same segment is left for the next one.
+typedef struct {
+    http_response_state_t state;
+    int status;
+    int32_t accepted;              // -1 if the server did not say
+    bool keep_alive;               // The connection can carry another response
+    bool chunked;
+    int32_t content_length;        // -1 if not given
+    uint32_t remaining;            // Body or chunk bytes left
+    char line[HTTP_RESPONSE_LINE_SIZE];
+    size_t line_len;
+    char body[HTTP_RESPONSE_BODY_KEEP + 1];
+    size_t body_len;
+} http_response_t;
+
+void http_response_init(http_response_t *response);
+
+// Parses received bytes and returns how many belong to this response. Stops
+// early once the response is done or failed.
+size_t http_response_feed(http_response_t *response, const char *data, size_t len);
+
+// The connection closed: ends a body framed by the close. Returns true if the
+// response is complete.
+bool http_response_close(http_response_t *response);
+
+static inline bool http_response_done(const http_response_t *response) {
+    return response->state == HTTP_RESPONSE_DONE;
+}
+
+static inline bool http_response_failed(const http_response_t *response) {
+    return response->state == HTTP_RESPONSE_ERROR;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HTTP_RESPONSE_H
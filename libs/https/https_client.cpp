@@ -0,0 +1,580 @@
+#include "libs/https/https_client.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/altcp_tls.h"
+#include "lwip/pbuf.h"
+#include "mbedtls/ssl.h"
+#include "libs/https/tls_session.h"
+#include "libs/https/dns_cache.h"
+#include "libs/https/tls_arena.h"
+#include "libs/https/tls_profile.h"
+#include "libs/https/net_timing.h"
+
+static uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+HttpsClient::HttpsClient(const char *host, uint16_t port) : host(host), port(port) {
+    ip_addr_set_zero(&server_ip);
+    for (int i = 0; i < HTTPS_CLIENT_MAX_PIPELINE; i++) {
+        statuses[i] = 0;
+        accepted[i] = -1;
+        queued_ms[i] = 0;
+        body_done_ms[i] = 0;
+        response_ms[i] = 0;
+    }
+    resetParser();
+}
+
+HttpsClient::~HttpsClient() {
+    close();
+    if (tls_config) {
+        altcp_tls_free_config(tls_config);
+        tls_config = nullptr;
+    }
+}
+
+void HttpsClient::resetParser() {
+    http_response_init(&response);
+    server_closing = false;
+    first_byte_ms = 0;
+}
+
+bool HttpsClient::connect(uint32_t timeout_ms) {
+    if (!beginConnect(timeout_ms)) {
+        return false;
+    }
+    Progress progress;
+    while ((progress = pollConnect()) == IN_PROGRESS) {
+        cyw43_arch_poll();
+        sleep_ms(5);
+    }
+    return progress == COMPLETE;
+}
+
+bool HttpsClient::beginConnect(uint32_t timeout_ms) {
+    if (conn_state == CONN_OPEN) {
+        return true;
+    }
+    dropConnection();
+
+    // Suites and curves can be narrowed on a configuration but not widened again
+    if (tls_config && config_profile != tls_profile) {
+        altcp_tls_free_config(tls_config);
+        tls_config = nullptr;
+    }
+    if (!tls_config) {
+        config_profile = tls_profile;
+        tls_config = tls_profile_create_config(tls_profile);
+        if (!tls_config) {
+            printf("HTTPS: Failed to create TLS configuration\n");
+            return false;
+        }
+    }
+
+    printf("HTTPS: Connecting to %s:%u\n", host, port);
+    connect_start_ms = now_ms();
+    connect_timeout_ms = timeout_ms;
+    conn_state = CONN_RESOLVING;
+
+    // Usually answered from the cache without a DNS round trip; otherwise
+    // pollConnect() waits for the answer
+    uint32_t dns_timeout_ms = timeout_ms < DNS_CACHE_QUERY_TIMEOUT_MS ? timeout_ms : DNS_CACHE_QUERY_TIMEOUT_MS;
+    dns_cache_status_t dns_status = dns_cache_lookup_start(&dns_lookup, host, dns_timeout_ms, &server_ip);
+    if (dns_status == DNS_CACHE_IN_PROGRESS) {
+        return true;
+    }
+    return resolved(dns_status);
+}
+
+// Connects once the host is resolved
+bool HttpsClient::resolved(dns_cache_status_t dns_status) {
+    if (dns_status != DNS_CACHE_RESOLVED) {
+        printf("HTTPS: DNS lookup failed for %s\n", host);
+        net_timing_failed(NET_PHASE_DNS);
+        conn_state = CONN_CLOSED;
+        return false;
+    }
+    net_timing_record(NET_PHASE_DNS, now_ms() - connect_start_ms);
+
+    cyw43_arch_lwip_begin();
+    bool started = startConnect();
+    cyw43_arch_lwip_end();
+    return started;
+}
+
+HttpsClient::Progress HttpsClient::pollConnect() {
+    if (conn_state == CONN_OPEN) {
+        return COMPLETE;
+    }
+    if (conn_state == CONN_RESOLVING) {
+        dns_cache_status_t dns_status = dns_cache_lookup_poll(&dns_lookup, &server_ip);
+        if (dns_status == DNS_CACHE_IN_PROGRESS) {
+            return IN_PROGRESS;
+        }
+        if (!resolved(dns_status)) {
+            dropConnection();
+            return FAILED;
+        }
+    }
+    if (conn_state == CONN_CONNECTING) {
+        if (now_ms() - connect_start_ms <= connect_timeout_ms) {
+            return IN_PROGRESS;
+        }
+        printf("HTTPS: Connect to %s timed out after %lu ms\n", host, (unsigned long)connect_timeout_ms);
+        net_timing_failed(handshake_counter.first_send_ms ? NET_PHASE_TLS : NET_PHASE_TCP);
+        tls_session_handshake_failed(host);
+        dns_cache_expire(host);
+        dropConnection();
+        return FAILED;
+    }
+
+    if (conn_state == CONN_FAILED) {
+        net_timing_failed(handshake_counter.first_send_ms ? NET_PHASE_TLS : NET_PHASE_TCP);
+        tls_session_handshake_failed(host);
+
+        // Most likely a server without an ECDSA certificate
+        if (tls_profile == TLS_PROFILE_CONSTRAINED && handshake_count == 0) {
+            printf("HTTPS: %s refused the constrained TLS profile, using the default one\n", host);
+            tls_profile = TLS_PROFILE_DEFAULT;
+        }
+    }
+    dropConnection();
+    return FAILED;
+}
+
+// Called with the lwIP lock held
+bool HttpsClient::startConnect() {
+    handshake_counter = tls_profile_counter_t();
+    pcb = altcp_tls_new(tls_config, IPADDR_TYPE_ANY);
+    if (!pcb) {
+        printf("HTTPS: Failed to create TLS PCB\n");
+        conn_state = CONN_FAILED;
+        return false;
+    }
+
+    // Server Name Indication, needed by virtual-hosted servers
+    mbedtls_ssl_set_hostname((mbedtls_ssl_context *)altcp_tls_context(pcb), host);
+
+    tls_profile_count_handshake(pcb, &handshake_counter);
+
+    // Ask for an abbreviated handshake with the session of the last connection
+    tls_session_offer(pcb, host);
+
+    altcp_arg(pcb, this);
+    altcp_recv(pcb, recv);
+    altcp_sent(pcb, sent);
+    altcp_err(pcb, error);
+
+    conn_state = CONN_CONNECTING;
+    handshake_start_ms = now_ms();
+    tls_arena_handshake_started();
+    err_t err = altcp_connect(pcb, &server_ip, port, connected);
+    if (err != ERR_OK) {
+        printf("HTTPS: Connect failed to start (%d)\n", err);
+        altcp_abort(pcb);
+        pcb = nullptr;
+        conn_state = CONN_FAILED;
+        return false;
+    }
+    return true;
+}
+
+err_t HttpsClient::connected(void *arg, struct altcp_pcb *pcb, err_t err) {
+    HttpsClient *client = (HttpsClient *)arg;
+    if (err != ERR_OK) {
+        printf("HTTPS: Connection failed (%d)\n", err);
+        client->conn_state = CONN_FAILED;
+        return ERR_OK;
+    }
+
+    // altcp_tls only reports the connection once the handshake is done
+    if (!tls_profile_check_pin(pcb, client->host)) {
+        tls_session_clear();   // It may belong to the same key
+        client->conn_state = CONN_FAILED;
+        altcp_abort(pcb);      // Calls error(), which forgets the pcb
+        return ERR_ABRT;
+    }
+    altcp_nagle_disable(pcb);
+    client->handshake_count++;
+    client->last_handshake_ms = now_ms() - client->handshake_start_ms;
+    client->last_handshake_arena = tls_arena_handshake_done();
+    if (client->last_handshake_arena > client->handshake_arena_peak) {
+        client->handshake_arena_peak = client->last_handshake_arena;
+    }
+    bool resumed = tls_session_handshake_done(pcb, client->host, client->last_handshake_ms);
+    if (resumed) {
+        client->resumed_count++;
+    }
+    tls_profile_handshake_done(pcb, client->config_profile, &client->handshake_counter, client->last_handshake_ms,
+                               resumed);
+    uint32_t tcp_connected_ms = client->handshake_counter.first_send_ms;
+    if (tcp_connected_ms) {
+        net_timing_record(NET_PHASE_TCP, tcp_connected_ms - client->handshake_start_ms);
+        net_timing_record(NET_PHASE_TLS, now_ms() - tcp_connected_ms);
+    }
+    client->open_ms = now_ms();
+    client->resetParser();
+    client->conn_state = CONN_OPEN;
+    printf("HTTPS: Connected to %s (%s) in %lu ms, handshake #%lu used %u bytes of TLS memory\n",
+           client->host, ipaddr_ntoa(&client->server_ip), (unsigned long)(now_ms() - client->connect_start_ms),
+           (unsigned long)client->handshake_count, (unsigned)client->last_handshake_arena);
+    return ERR_OK;
+}
+
+void HttpsClient::error(void *arg, err_t err) {
+    HttpsClient *client = (HttpsClient *)arg;
+
+    // The PCB has already been freed by lwIP
+    client->pcb = nullptr;
+    printf("HTTPS: Connection error %d\n", err);
+    client->conn_state = (client->conn_state == CONN_OPEN) ? CONN_CLOSED : CONN_FAILED;
+    client->failPending();
+}
+
+err_t HttpsClient::recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err) {
+    HttpsClient *client = (HttpsClient *)arg;
+
+    if (p == NULL || err != ERR_OK) {
+        if (p) {
+            pbuf_free(p);
+        } else if (http_response_close(&client->response)) {
+            client->completeResponse();   // Body framed by the close
+        }
+        printf("HTTPS: Server closed the connection (%lu requests unanswered)\n",
+               (unsigned long)client->pendingCount());
+        return client->dropConnection() ? ERR_ABRT : ERR_OK;
+    }
+
+    for (struct pbuf *q = p; q != NULL; q = q->next) {
+        client->parseBytes((const char *)q->payload, q->len);
+    }
+    altcp_recved(pcb, p->tot_len);
+    client->bytes_received += p->tot_len;
+    pbuf_free(p);
+
+    // The server announced it will close, or the stream could not be parsed;
+    // requests after the last answered one will not get a response
+    if (client->server_closing) {
+        return client->dropConnection() ? ERR_ABRT : ERR_OK;
+    }
+    return ERR_OK;
+}
+
+void HttpsClient::parseBytes(const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && !server_closing) {
+        // Time to first byte counts from the last byte of the request; a
+        // pipelined response can start in the segment that ended the one
+        // before, and one that starts before the request is all sent (an
+        // early 413 or 401) counts as immediate
+        if (first_byte_ms == 0 && pendingCount() > 0) {
+            first_byte_ms = now_ms();
+            uint32_t body_done = body_done_ms[next_response_id % HTTPS_CLIENT_MAX_PIPELINE];
+            net_timing_record(NET_PHASE_FIRST_BYTE, body_done ? first_byte_ms - body_done : 0);
+        }
+        i += http_response_feed(&response, data + i, len - i);
+        if (http_response_done(&response)) {
+            completeResponse();
+        } else if (http_response_failed(&response)) {
+            printf("HTTPS: Response cannot be parsed, not reusing connection\n");
+            server_closing = true;
+        }
+    }
+}
+
+void HttpsClient::completeResponse() {
+    if (pendingCount() > 0) {
+        net_timing_record(NET_PHASE_RESPONSE, first_byte_ms ? now_ms() - first_byte_ms : 0);
+        statuses[next_response_id % HTTPS_CLIENT_MAX_PIPELINE] = response.status;
+        accepted[next_response_id % HTTPS_CLIENT_MAX_PIPELINE] = response.accepted;
+        uint32_t body_done = body_done_ms[next_response_id % HTTPS_CLIENT_MAX_PIPELINE];
+        response_ms[next_response_id % HTTPS_CLIENT_MAX_PIPELINE] = body_done ? now_ms() - body_done : 0;
+        next_response_id++;
+    } else {
+        printf("HTTPS: Unsolicited response %d\n", response.status);
+    }
+
+    bool closing = !response.keep_alive;
+    resetParser();
+    server_closing = closing;
+}
+
+void HttpsClient::failPending() {
+    while (next_response_id != next_request_id) {
+        net_timing_failed(first_byte_ms ? NET_PHASE_RESPONSE : NET_PHASE_FIRST_BYTE);
+        first_byte_ms = 0;
+        statuses[next_response_id % HTTPS_CLIENT_MAX_PIPELINE] = HTTPS_STATUS_NO_RESPONSE;
+        next_response_id++;
+    }
+}
+
+// Returns true if the PCB had to be aborted (callers inside lwIP callbacks
+// must then return ERR_ABRT)
+bool HttpsClient::dropConnection() {
+    bool aborted = false;
+    cyw43_arch_lwip_begin();
+    if (pcb) {
+        altcp_arg(pcb, NULL);
+        altcp_recv(pcb, NULL);
+        altcp_sent(pcb, NULL);
+        altcp_err(pcb, NULL);
+        tls_profile_stop_counting(pcb, &handshake_counter);
+        if (altcp_close(pcb) != ERR_OK) {
+            altcp_abort(pcb);
+            aborted = true;
+        }
+        pcb = nullptr;
+    }
+    tx_body = nullptr;
+    cyw43_arch_lwip_end();
+
+    if (conn_state == CONN_RESOLVING) {
+        dns_cache_lookup_cancel(&dns_lookup);
+    }
+    if (conn_state == CONN_OPEN) {
+        net_timing_record(NET_PHASE_OPEN, now_ms() - open_ms);
+    }
+    conn_state = CONN_CLOSED;
+    failPending();
+    resetParser();
+    return aborted;
+}
+
+void HttpsClient::close() {
+    if (pcb) {
+        printf("HTTPS: Closing connection to %s after %lu requests, %lu handshakes\n",
+               host, (unsigned long)next_request_id, (unsigned long)handshake_count);
+    }
+    dropConnection();
+}
+
+// Called with the lwIP lock held. Writes the rest of the header, then stages
+// the body chunk by chunk and writes as much as the send buffer takes; the
+// sent callback continues once ACKs free space again.
+void HttpsClient::pumpBody() {
+    bool wrote = false;
+    while (tx_body && pcb) {
+        bool header = tx_header_offset < tx_header_len;
+        const char *data;
+        size_t len;
+        if (header) {
+            data = tx_header + tx_header_offset;
+            len = tx_header_len - tx_header_offset;
+        } else {
+            if (tx_offset == tx_len) {
+                tx_len = tx_body->read(tx_body, tx_chunk, sizeof(tx_chunk));
+                tx_offset = 0;
+                if (tx_len == 0) {
+                    tx_body = nullptr;   // Complete
+                    // Not timed if it was answered before it was all sent;
+                    // the body being sent is always the newest request
+                    uint32_t request_id = next_request_id - 1;
+                    if (pendingCount() > 0) {
+                        body_done_ms[request_id % HTTPS_CLIENT_MAX_PIPELINE] = now_ms();
+                        net_timing_record(NET_PHASE_SEND,
+                                          now_ms() - queued_ms[request_id % HTTPS_CLIENT_MAX_PIPELINE]);
+                    }
+                    break;
+                }
+            }
+            data = tx_chunk + tx_offset;
+            len = tx_len - tx_offset;
+        }
+
+        size_t n = altcp_sndbuf(pcb);
+        if (n > len) {
+            n = len;
+        }
+        if (n == 0) {
+            break;
+        }
+        err_t err = altcp_write(pcb, data, (u16_t)n, TCP_WRITE_FLAG_COPY);
+        if (err == ERR_MEM) {
+            break;   // Send queue full, wait for ACKs
+        }
+        if (err != ERR_OK) {
+            printf("HTTPS: Write failed (%d)\n", err);
+            tx_failed = true;
+            tx_body = nullptr;
+            break;
+        }
+        if (header) {
+            tx_header_offset += n;
+        } else {
+            tx_offset += n;
+        }
+        bytes_sent += n;
+        wrote = true;
+    }
+    if (wrote && pcb) {
+        altcp_output(pcb);
+    }
+}
+
+err_t HttpsClient::sent(void *arg, struct altcp_pcb *pcb, u16_t len) {
+    HttpsClient *client = (HttpsClient *)arg;
+    if (client && client->tx_body) {
+        client->pumpBody();
+    }
+    return ERR_OK;
+}
+
+int HttpsClient::post(const char *path, const char *content_type, const char *body, size_t body_len,
+                      uint32_t timeout_ms) {
+    http_string_body_t string_body;
+    http_string_body_init(&string_body, body, body_len);
+    return post(path, content_type, &string_body.source, timeout_ms);
+}
+
+int HttpsClient::post(const char *path, const char *content_type, http_body_source_t *body,
+                      uint32_t timeout_ms, const char *content_encoding) {
+    int request_id = beginPost(path, content_type, body, timeout_ms, content_encoding);
+    if (request_id < 0) {
+        return -1;
+    }
+    Progress progress;
+    while ((progress = pollSend()) == IN_PROGRESS) {
+        cyw43_arch_poll();
+        sleep_ms(2);
+    }
+    return progress == COMPLETE ? request_id : -1;
+}
+
+int HttpsClient::beginPost(const char *path, const char *content_type, http_body_source_t *body,
+                           uint32_t timeout_ms, const char *content_encoding) {
+    if (conn_state != CONN_OPEN || server_closing || tx_body ||
+        pendingCount() >= HTTPS_CLIENT_MAX_PIPELINE) {
+        return -1;
+    }
+
+    char timing[128] = "";
+#if HTTPS_CLIENT_TIMING_HEADER
+    char summary[96];
+    if (net_timing_summary(summary, sizeof(summary)) > 0) {
+        snprintf(timing, sizeof(timing), "X-Net-Timing: %s\r\n", summary);
+    }
+#endif
+    int header_len = snprintf(tx_header, sizeof(tx_header),
+                              "POST %s HTTP/1.1\r\n"
+                              "Host: %s\r\n"
+                              "Content-Type: %s\r\n"
+                              "%s%s%s"
+                              "%s"
+                              "Content-Length: %lu\r\n"
+                              "Connection: keep-alive\r\n"
+                              "\r\n",
+                              path, host, content_type,
+                              content_encoding ? "Content-Encoding: " : "",
+                              content_encoding ? content_encoding : "",
+                              content_encoding ? "\r\n" : "",
+                              timing, (unsigned long)body->length);
+    if (header_len <= 0 || header_len >= (int)sizeof(tx_header)) {
+        return -1;
+    }
+
+    uint32_t request_id = next_request_id++;
+    statuses[request_id % HTTPS_CLIENT_MAX_PIPELINE] = 0;
+    accepted[request_id % HTTPS_CLIENT_MAX_PIPELINE] = -1;
+    queued_ms[request_id % HTTPS_CLIENT_MAX_PIPELINE] = now_ms();
+    body_done_ms[request_id % HTTPS_CLIENT_MAX_PIPELINE] = 0;
+    response_ms[request_id % HTTPS_CLIENT_MAX_PIPELINE] = 0;
+
+    body->rewind(body);
+    cyw43_arch_lwip_begin();
+    tx_header_len = (size_t)header_len;
+    tx_header_offset = 0;
+    tx_len = 0;
+    tx_offset = 0;
+    tx_failed = false;
+    tx_deadline_ms = now_ms() + timeout_ms;
+    tx_kick_ms = now_ms();
+    tx_body = body;
+    pumpBody();
+    cyw43_arch_lwip_end();
+    return (int)request_id;
+}
+
+HttpsClient::Progress HttpsClient::pollSend() {
+    if (tx_body && conn_state == CONN_OPEN) {
+        if ((int32_t)(now_ms() - tx_deadline_ms) <= 0) {
+            // The sent callback normally keeps the body flowing; retry a write
+            // the stack refused while nothing was in flight
+            if (now_ms() - tx_kick_ms >= 50) {
+                tx_kick_ms = now_ms();
+                cyw43_arch_lwip_begin();
+                pumpBody();
+                cyw43_arch_lwip_end();
+            }
+            if (tx_body) {
+                return IN_PROGRESS;
+            }
+        } else {
+            printf("HTTPS: Send timed out\n");
+        }
+    }
+    if (tx_body || tx_failed) {
+        net_timing_failed(NET_PHASE_SEND);
+    }
+
+    cyw43_arch_lwip_begin();
+    bool complete = tx_body == nullptr && !tx_failed && conn_state == CONN_OPEN;
+    tx_body = nullptr;
+    cyw43_arch_lwip_end();
+    if (!complete) {
+        // A partly written request corrupts the stream
+        dropConnection();
+        return FAILED;
+    }
+    return COMPLETE;
+}
+
+bool HttpsClient::waitResponse(int request_id, uint32_t timeout_ms) {
+    uint32_t start_ms = now_ms();
+    while (request_id >= 0 && (uint32_t)request_id >= next_response_id) {
+        if (now_ms() - start_ms > timeout_ms) {
+            printf("HTTPS: No response after %lu ms\n", (unsigned long)timeout_ms);
+            dropConnection();
+            return false;
+        }
+        cyw43_arch_poll();
+        sleep_ms(2);
+    }
+    return getStatus(request_id) != HTTPS_STATUS_NO_RESPONSE;
+}
+
+bool HttpsClient::waitAll(uint32_t timeout_ms) {
+    if (pendingCount() == 0) {
+        return true;
+    }
+    return waitResponse((int)(next_request_id - 1), timeout_ms);
+}
+
+int HttpsClient::getStatus(int request_id) const {
+    if (request_id < 0 || (uint32_t)request_id >= next_request_id ||
+        (uint32_t)request_id + HTTPS_CLIENT_MAX_PIPELINE < next_request_id) {
+        return HTTPS_STATUS_NO_RESPONSE;
+    }
+    if ((uint32_t)request_id >= next_response_id) {
+        return 0;
+    }
+    return statuses[request_id % HTTPS_CLIENT_MAX_PIPELINE];
+}
+
+int32_t HttpsClient::getAccepted(int request_id) const {
+    if (getStatus(request_id) <= 0) {
+        return -1;
+    }
+    return accepted[request_id % HTTPS_CLIENT_MAX_PIPELINE];
+}
+
+uint32_t HttpsClient::getResponseMs(int request_id) const {
+    if (getStatus(request_id) <= 0) {
+        return 0;
+    }
+    return response_ms[request_id % HTTPS_CLIENT_MAX_PIPELINE];
+}
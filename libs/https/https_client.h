@@ -0,0 +1,184 @@
+#ifndef HTTPS_CLIENT_H
+#define HTTPS_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lwip/altcp.h"
+#include "lwip/ip_addr.h"
+#include "libs/https/dns_cache.h"
+#include "libs/https/http_body.h"
+#include "libs/https/http_response.h"
+#include "libs/https/upload_client.h"
+
+// Requests that may be sent before the first response has arrived
+#define HTTPS_CLIENT_MAX_PIPELINE 4
+
+// Body bytes staged per write while streaming a request body
+#define HTTPS_CLIENT_STREAM_CHUNK 512
+
+// Set to 1 to send the phase timing so far (net_timing.h) with each request
+// in an "X-Net-Timing" header, so the server side sees it next to the data
+#ifndef HTTPS_CLIENT_TIMING_HEADER
+#define HTTPS_CLIENT_TIMING_HEADER 0
+#endif
+
+// Status reported for a request whose response never arrived
+#define HTTPS_STATUS_NO_RESPONSE UPLOAD_STATUS_NO_RESPONSE
+
+// HTTPS client that keeps one TLS connection open across requests
+// (HTTP/1.1 keep-alive). POSTs are pipelined: post() returns as soon as the
+// request is in the TCP send queue, and responses are matched to requests in
+// order by parsing the stream (http_response.h: Content-Length or chunked).
+//
+// The handshake is paid once per connect(), and reconnects offer the cached
+// TLS session (tls_session.h) for an abbreviated one. If the server closes the
+// connection, requests still waiting for a response report
+// HTTPS_STATUS_NO_RESPONSE and the caller reconnects.
+class HttpsClient : public UploadClient {
+public:
+    explicit HttpsClient(const char *host, uint16_t port = 443);
+    ~HttpsClient() override;
+
+    // Resolves the host and completes the TLS handshake; no-op if connected
+    bool connect(uint32_t timeout_ms);
+
+    // Starts connect() and returns without waiting for the DNS answer or the
+    // handshake. Returns false if the connection could not be started.
+    bool beginConnect(uint32_t timeout_ms) override;
+
+    // COMPLETE once connected; FAILED if the connection failed or timed out
+    Progress pollConnect() override;
+
+    // Closes the connection; unanswered requests get HTTPS_STATUS_NO_RESPONSE
+    void close() override;
+
+    bool isConnected() const override { return conn_state == CONN_OPEN; }
+    uint8_t getMaxInFlight() const override { return HTTPS_CLIENT_MAX_PIPELINE; }
+
+    // Queues a POST without waiting for its response. Returns the request id,
+    // or -1 if not connected, the pipeline is full or the write failed.
+    int post(const char *path, const char *content_type, const char *body, size_t body_len,
+             uint32_t timeout_ms);
+
+    // Same, with the body pulled from a producer as send buffer space frees up.
+    // Returns once the whole body is queued; the body can then be discarded.
+    // content_encoding adds a Content-Encoding header (e.g. "deflate").
+    int post(const char *path, const char *content_type, http_body_source_t *body,
+             uint32_t timeout_ms, const char *content_encoding = nullptr);
+
+    // Starts the same POST and returns its request id at once, or -1 if not
+    // connected, the pipeline is full or a body is still being sent. The body
+    // is sent from the sent callback and must stay valid until pollSend()
+    // stops returning IN_PROGRESS.
+    int beginPost(const char *path, const char *content_type, http_body_source_t *body,
+                  uint32_t timeout_ms, const char *content_encoding = nullptr) override;
+
+    // COMPLETE once the request is in the send queue (or nothing is being
+    // sent); FAILED if the write failed or timed out, which closes the connection
+    Progress pollSend() override;
+
+    // Waits until the request has its response. Returns false if the
+    // connection dropped or timed out first (the connection is then closed
+    // and all unanswered requests fail).
+    bool waitResponse(int request_id, uint32_t timeout_ms);
+
+    // Waits until every queued request has a response, see waitResponse()
+    bool waitAll(uint32_t timeout_ms);
+
+    // HTTP status of a request once answered, 0 while pending,
+    // HTTPS_STATUS_NO_RESPONSE if the connection was lost before the response.
+    // Only the last HTTPS_CLIENT_MAX_PIPELINE requests are kept.
+    int getStatus(int request_id) const override;
+
+    // Records of an answered request the server reported as stored
+    // (HTTP_ACCEPTED_HEADER or a JSON "accepted" field), -1 if it did not say
+    int32_t getAccepted(int request_id) const override;
+
+    // Time from the last byte of an answered request being queued to its
+    // response, 0 while pending
+    uint32_t getResponseMs(int request_id) const override;
+
+    uint32_t pendingCount() const { return next_request_id - next_response_id; }
+
+    uint32_t getHandshakeCount() const override { return handshake_count; }
+    uint32_t getResumedCount() const override { return resumed_count; }
+    uint32_t getRequestCount() const override { return next_request_id; }
+    uint32_t getLastHandshakeMs() const { return last_handshake_ms; }   // TCP connect + TLS handshake
+    uint32_t getBytesSent() const override { return bytes_sent; }
+    uint32_t getBytesReceived() const override { return bytes_received; }
+    size_t getLastHandshakeArena() const { return last_handshake_arena; }   // Peak TLS arena use
+    size_t getHandshakeArenaPeak() const override { return handshake_arena_peak; }
+
+private:
+    enum ConnState : uint8_t {
+        CONN_CLOSED = 0,
+        CONN_RESOLVING,      // Waiting for the DNS answer
+        CONN_CONNECTING,     // TCP connect and TLS handshake
+        CONN_OPEN,
+        CONN_FAILED
+    };
+
+    const char *host;
+    uint16_t port;
+    struct altcp_tls_config *tls_config = nullptr;
+    tls_profile_t config_profile = TLS_PROFILE_DEFAULT;   // The one tls_config was set up for
+    tls_profile_counter_t handshake_counter = {};          // Of the connection being made or open
+    struct altcp_pcb *pcb = nullptr;
+    ip_addr_t server_ip;
+    dns_cache_lookup_t dns_lookup = {};
+    volatile ConnState conn_state = CONN_CLOSED;
+    uint32_t connect_start_ms = 0;
+    uint32_t connect_timeout_ms = 0;
+    uint32_t handshake_start_ms = 0;
+    uint32_t open_ms = 0;              // When the connection was established
+    uint32_t first_byte_ms = 0;        // First byte of the response being parsed, 0 before it
+
+    // Request/response bookkeeping; ids increase monotonically
+    uint32_t next_request_id = 0;
+    volatile uint32_t next_response_id = 0;
+    int statuses[HTTPS_CLIENT_MAX_PIPELINE];
+    int32_t accepted[HTTPS_CLIENT_MAX_PIPELINE];
+    uint32_t queued_ms[HTTPS_CLIENT_MAX_PIPELINE];      // beginPost()
+    uint32_t body_done_ms[HTTPS_CLIENT_MAX_PIPELINE];   // Last byte written, 0 before it
+    uint32_t response_ms[HTTPS_CLIENT_MAX_PIPELINE];    // Last byte written to response complete
+
+    // Response being parsed
+    http_response_t response;
+    bool server_closing = false;     // "Connection: close" seen, or the stream cannot be parsed
+
+    // Request being sent, header first; pumped from the sent callback
+    http_body_source_t *volatile tx_body = nullptr;
+    char tx_header[384];
+    size_t tx_header_len = 0;
+    size_t tx_header_offset = 0;
+    char tx_chunk[HTTPS_CLIENT_STREAM_CHUNK];
+    size_t tx_len = 0;
+    size_t tx_offset = 0;
+    volatile bool tx_failed = false;
+    uint32_t tx_deadline_ms = 0;
+    uint32_t tx_kick_ms = 0;
+
+    uint32_t handshake_count = 0;
+    uint32_t resumed_count = 0;
+    uint32_t last_handshake_ms = 0;
+    uint32_t bytes_sent = 0;
+    uint32_t bytes_received = 0;
+    size_t last_handshake_arena = 0;
+    size_t handshake_arena_peak = 0;
+
+    void resetParser();
+    void parseBytes(const char *data, size_t len);
+    void completeResponse();
+    void failPending();
+    bool dropConnection();
+    void pumpBody();
+    bool resolved(dns_cache_status_t dns_status);
+    bool startConnect();
+
+    static err_t connected(void *arg, struct altcp_pcb *pcb, err_t err);
+    static err_t recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err);
+    static err_t sent(void *arg, struct altcp_pcb *pcb, u16_t len);
+    static void error(void *arg, err_t err);
+};
+
+#endif // HTTPS_CLIENT_H
@@ -0,0 +1,129 @@
+#include "net_timing.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t buckets[NET_TIMING_BUCKETS];
+    uint32_t count;
+    uint32_t failures;
+    uint32_t total_ms;
+    uint32_t max_ms;
+} phase_histogram_t;
+
+static phase_histogram_t histograms[NET_PHASE_COUNT];
+
+static const char *const phase_names[NET_PHASE_COUNT] = {
+    "dns", "tcp", "tls", "send", "first byte", "response", "open"
+};
+
+// Short names for net_timing_summary()
+static const char *const phase_keys[NET_PHASE_COUNT] = {
+    "dns", "tcp", "tls", "send", "ttfb", "resp", "open"
+};
+
+static unsigned bucket_of(uint32_t ms) {
+    unsigned bucket = 0;
+    while (ms > 0 && bucket < NET_TIMING_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static uint32_t bucket_limit(unsigned bucket) {
+    return (uint32_t)1 << bucket;
+}
+
+const char *net_timing_phase_name(net_phase_t phase) {
+    return phase < NET_PHASE_COUNT ? phase_names[phase] : "?";
+}
+
+void net_timing_record(net_phase_t phase, uint32_t ms) {
+    if (phase >= NET_PHASE_COUNT) {
+        return;
+    }
+    phase_histogram_t *h = &histograms[phase];
+    h->buckets[bucket_of(ms)]++;
+    h->count++;
+    h->total_ms += ms;
+    if (ms > h->max_ms) {
+        h->max_ms = ms;
+    }
+}
+
+void net_timing_failed(net_phase_t phase) {
+    if (phase < NET_PHASE_COUNT) {
+        histograms[phase].failures++;
+    }
+}
+
+uint32_t net_timing_count(net_phase_t phase) {
+    return phase < NET_PHASE_COUNT ? histograms[phase].count : 0;
+}
+
+uint32_t net_timing_failures(net_phase_t phase) {
+    return phase < NET_PHASE_COUNT ? histograms[phase].failures : 0;
+}
+
+uint32_t net_timing_percentile(net_phase_t phase, uint8_t percentile) {
+    if (phase >= NET_PHASE_COUNT || histograms[phase].count == 0) {
+        return 0;
+    }
+    const phase_histogram_t *h = &histograms[phase];
+    uint32_t rank = (h->count * percentile + 99) / 100;
+    uint32_t seen = 0;
+    for (unsigned i = 0; i < NET_TIMING_BUCKETS - 1; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank && seen > 0) {
+            return bucket_limit(i) < h->max_ms ? bucket_limit(i) : h->max_ms;
+        }
+    }
+    return h->max_ms;
+}
+
+size_t net_timing_summary(char *out, size_t size) {
+    size_t len = 0;
+    if (size > 0) {
+        out[0] = '\0';
+    }
+    for (int i = 0; i < NET_PHASE_COUNT; i++) {
+        if (histograms[i].count == 0) {
+            continue;
+        }
+        int n = snprintf(out + len, size - len, "%s%s=%lu/%lu", len ? "," : "", phase_keys[i],
+                         (unsigned long)net_timing_percentile((net_phase_t)i, 50),
+                         (unsigned long)net_timing_percentile((net_phase_t)i, 90));
+        if (n < 0 || (size_t)n >= size - len) {
+            out[len] = '\0';   // Leave out phases that do not fit
+            break;
+        }
+        len += (size_t)n;
+    }
+    return len;
+}
+
+void net_timing_print(void) {
+    for (int i = 0; i < NET_PHASE_COUNT; i++) {
+        const phase_histogram_t *h = &histograms[i];
+        if (h->count == 0 && h->failures == 0) {
+            continue;
+        }
+        printf("NET TIMING: %-10s %4lu done, %3lu failed, avg %lu ms, p50 %lu, p90 %lu, max %lu |",
+               phase_names[i], (unsigned long)h->count, (unsigned long)h->failures,
+               (unsigned long)(h->count ? h->total_ms / h->count : 0),
+               (unsigned long)net_timing_percentile((net_phase_t)i, 50),
+               (unsigned long)net_timing_percentile((net_phase_t)i, 90), (unsigned long)h->max_ms);
+        for (unsigned b = 0; b < NET_TIMING_BUCKETS; b++) {
+            if (h->buckets[b]) {
+                printf(" %s%lu:%lu", b == NET_TIMING_BUCKETS - 1 ? ">" : "<",
+                       (unsigned long)bucket_limit(b == NET_TIMING_BUCKETS - 1 ? b - 1 : b),
+                       (unsigned long)h->buckets[b]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+void net_timing_reset(void) {
+    memset(histograms, 0, sizeof(histograms));
+}
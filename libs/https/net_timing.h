@@ -0,0 +1,59 @@
+#ifndef NET_TIMING_H
+#define NET_TIMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Histogram buckets per phase: bucket 0 holds durations under 1 ms, bucket i
+// those from 2^(i-1) up to 2^i ms, and the last one everything longer
+#define NET_TIMING_BUCKETS 16
+
+// Phases of a connection and of each request on it, in the order they happen
+typedef enum {
+    NET_PHASE_DNS = 0,      // Name lookup, mostly cache hits
+    NET_PHASE_TCP,          // SYN to the connection being established
+    NET_PHASE_TLS,          // TLS or DTLS handshake after that
+    NET_PHASE_SEND,         // First to last byte of a request written
+    NET_PHASE_FIRST_BYTE,   // Last request byte to the first response byte
+    NET_PHASE_RESPONSE,     // First to last byte of the response
+    NET_PHASE_OPEN,         // Established to closed, how long keep-alive lasts
+    NET_PHASE_COUNT
+} net_phase_t;
+
+// Timing of every connection and request the upload clients make, collected
+// into fixed-size histograms so failures can be placed in the phase they
+// happened in instead of guessed from the total time.
+
+const char *net_timing_phase_name(net_phase_t phase);
+
+// Adds a completed phase
+void net_timing_record(net_phase_t phase, uint32_t ms);
+
+// Counts a connection or request that failed or timed out in phase
+void net_timing_failed(net_phase_t phase);
+
+uint32_t net_timing_count(net_phase_t phase);
+uint32_t net_timing_failures(net_phase_t phase);
+
+// Upper bound of the bucket holding the given percentile (0-100), in ms;
+// 0 if nothing was recorded
+uint32_t net_timing_percentile(net_phase_t phase, uint8_t percentile);
+
+// Writes "dns=1/4,tcp=64/128,..." (median and 90th percentile in ms, phases
+// with records only) into out, e.g. for a request header. Returns the length.
+size_t net_timing_summary(char *out, size_t size);
+
+// Histograms and failures of every phase, to the console
+void net_timing_print(void);
+
+void net_timing_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NET_TIMING_H
@@ -0,0 +1,108 @@
+#include "libs/https/sensor_body.h"
+#include <cstdio>
+#include <cstring>
+
+SensorBody::SensorBody(const SensorData *records, size_t count, const char *token, const Origin &origin,
+                       const Fallback &fallback, float track_max_error_m)
+    : records(records), count(count), token(token), origin(origin), fallback(fallback),
+      track_deltas(track_max_error_m > 0), keep_position(count, true) {
+    http_body_source_t::read = readSource;
+    http_body_source_t::rewind = rewindSource;
+    length = 0;
+
+    // Decide which positions are needed for the track shape. Records without a
+    // position get the fallback position and are not part of the track.
+    if (track_deltas) {
+        TrackSimplifier simplifier(track_max_error_m);
+        size_t previous_index = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!hasPosition(records[i])) {
+                continue;
+            }
+            bool previous_kept = simplifier.add((int32_t)records[i].latitude, (int32_t)records[i].longitude);
+            if (simplifier.getPointCount() > 1) {
+                keep_position[previous_index] = previous_kept;
+            }
+            previous_index = i;
+        }
+        simplifier.finish();
+        position_count = simplifier.getPointCount();
+        kept_position_count = simplifier.getKeptCount();
+        if (position_count > 0) {
+            printf("[UPLOAD] Track: kept %lu/%lu positions (max error %.1f m, worst %.1f m)\n",
+                   (unsigned long)kept_position_count, (unsigned long)position_count,
+                   simplifier.getMaxError(), simplifier.getWorstErrorM());
+        }
+    }
+}
+
+void SensorBody::measure() {
+    size_t total = 0;
+    rewindBody();
+    while (nextPiece()) {
+        total += piece_len;
+    }
+    length = total;
+    rewindBody();
+}
+
+void SensorBody::rewindBody() {
+    part = PART_PREFIX;
+    next_record = 0;
+    piece_len = 0;
+    piece_offset = 0;
+    delta_encoder.reset();
+    restart();
+}
+
+bool SensorBody::deltaPosition(const SensorData &data, int32_t &dlat_e7, int32_t &dlon_e7) {
+    return delta_encoder.encode((int32_t)data.latitude, (int32_t)data.longitude, dlat_e7, dlon_e7);
+}
+
+bool SensorBody::nextPiece() {
+    piece_offset = 0;
+    switch (part) {
+    case PART_PREFIX:
+        piece_len = encodePrefix(piece, sizeof(piece));
+        part = count > 0 ? PART_RECORDS : PART_SUFFIX;
+        return true;
+    case PART_RECORDS:
+        piece_len = encodeRecord(next_record, piece, sizeof(piece));
+        if (++next_record == count) {
+            part = PART_SUFFIX;
+        }
+        return true;
+    case PART_SUFFIX:
+        piece_len = encodeSuffix(piece, sizeof(piece));
+        part = PART_DONE;
+        return true;
+    default:
+        piece_len = 0;
+        return false;
+    }
+}
+
+size_t SensorBody::readBody(char *dst, size_t max) {
+    size_t copied = 0;
+    while (copied < max) {
+        if (piece_offset == piece_len && !nextPiece()) {
+            break;
+        }
+        size_t n = piece_len - piece_offset;
+        if (n > max - copied) {
+            n = max - copied;
+        }
+        memcpy(dst + copied, piece + piece_offset, n);
+        piece_offset += n;
+        copied += n;
+    }
+    return copied;
+}
+
+size_t SensorBody::readSource(http_body_source_t *source, char *dst, size_t max) {
+    return static_cast<SensorBody *>(source)->readBody(dst, max);
+}
+
+void SensorBody::rewindSource(http_body_source_t *source) {
+    static_cast<SensorBody *>(source)->rewindBody();
+}
@@ -0,0 +1,126 @@
+#ifndef SENSOR_BODY_H
+#define SENSOR_BODY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "libs/https/http_body.h"
+#include "libs/flash/flash.h"
+#include "libs/track/track_encoder.h"
+
+// Room for the longest piece produced at once: one encoded record, or the
+// opening part with the token and device ID
+#define SENSOR_BODY_PIECE_SIZE 384
+
+// Upload schema versions, sent in every body so the server knows how to read
+// the positions: 1 = absolute position on every record, 2 = track encoded
+// (positions on the simplified track left out, kept ones after the first as
+// deltas)
+#define SENSOR_BODY_SCHEMA_ABSOLUTE 1
+#define SENSOR_BODY_SCHEMA_TRACK 2
+
+// Upload body for a run of sensor records, encoded one record at a time while
+// it is being sent instead of into a payload buffer. The length is found by an
+// encoding pass without output, so the request can carry a Content-Length.
+// Subclasses provide the encoding and must call measure() when constructed.
+//
+// Positions on a straight stretch of the track are left out when track_max_error_m
+// is positive, and kept ones may be sent as deltas to the previous position in
+// the body (deltaPosition()); the first one, and the first after a fallback
+// position, are absolute. Zero disables both.
+// getSchema() tells which of the two a body uses.
+//
+// Every body names the device and the sequence numbers of its first and last
+// record. A record keeps its number across retries and batch sizes, so the
+// server can drop records it already stored when a batch is delivered twice.
+class SensorBody : public http_body_source_t {
+public:
+    // Used for records stored without a timestamp or position
+    struct Fallback {
+        uint32_t epoch;
+        double latitude;      // Signed degrees
+        double longitude;
+    };
+
+    // Where the records come from
+    struct Origin {
+        const char *device_id;    // Board unique ID in hex
+        uint32_t first_sequence;  // Sequence number of the first record
+    };
+
+    virtual ~SensorBody() = default;
+
+    size_t getLength() const { return length; }
+    size_t getRecordCount() const { return count; }
+    uint32_t getFirstSequence() const { return origin.first_sequence; }
+    uint32_t getLastSequence() const { return origin.first_sequence + (count > 0 ? count - 1 : 0); }
+    size_t getPositionCount() const { return position_count; }
+    size_t getKeptPositionCount() const { return kept_position_count; }
+    uint8_t getSchema() const { return track_deltas ? SENSOR_BODY_SCHEMA_TRACK : SENSOR_BODY_SCHEMA_ABSOLUTE; }
+
+    // Same as the http_body_source_t callbacks
+    void rewindBody();
+    size_t readBody(char *dst, size_t max);
+
+protected:
+    // records must outlive the body
+    SensorBody(const SensorData *records, size_t count, const char *token, const Origin &origin,
+               const Fallback &fallback, float track_max_error_m);
+
+    // Each writes one piece into out and returns its length
+    virtual size_t encodePrefix(char *out, size_t size) = 0;
+    virtual size_t encodeRecord(size_t index, char *out, size_t size) = 0;
+    virtual size_t encodeSuffix(char *out, size_t size) = 0;
+
+    // Reset encoder state kept across records
+    virtual void restart() {}
+
+    // Sets length; call at the end of the subclass constructor
+    void measure();
+
+    bool hasPosition(const SensorData &data) const { return data.latitude != 0 || data.longitude != 0; }
+    bool isPositionKept(size_t index) const { return keep_position[index]; }
+    bool isTrackEncoded() const { return track_deltas; }
+
+    // Delta to the previous kept position; false for the first one
+    bool deltaPosition(const SensorData &data, int32_t &dlat_e7, int32_t &dlon_e7);
+
+    // Call when a position that is not part of the track (the fallback) is
+    // sent. A delta always refers to the last position in the body, so the
+    // next kept position goes out absolute again.
+    void breakDeltas() { delta_encoder.reset(); }
+
+    const SensorData *records;
+    size_t count;
+    const char *token;
+    Origin origin;
+    Fallback fallback;
+
+private:
+    enum Part : uint8_t {
+        PART_PREFIX = 0,
+        PART_RECORDS,
+        PART_SUFFIX,
+        PART_DONE
+    };
+
+    bool track_deltas;
+    std::vector<bool> keep_position;
+    size_t position_count = 0;
+    size_t kept_position_count = 0;
+    TrackDeltaEncoder delta_encoder;
+
+    // Read position
+    Part part = PART_PREFIX;
+    size_t next_record = 0;
+    char piece[SENSOR_BODY_PIECE_SIZE];
+    size_t piece_len = 0;
+    size_t piece_offset = 0;
+
+    bool nextPiece();
+
+    static size_t readSource(http_body_source_t *source, char *dst, size_t max);
+    static void rewindSource(http_body_source_t *source);
+};
+
+#endif // SENSOR_BODY_H
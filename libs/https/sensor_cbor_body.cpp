@@ -0,0 +1,145 @@
+#include "libs/https/sensor_cbor_body.h"
+#include <cmath>
+#include <cstring>
+
+// CBOR major types
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+// Writes a head (major type + argument) in its shortest form, returns its size
+static size_t cborHead(uint8_t *out, uint8_t major, uint64_t value) {
+    major <<= 5;
+    if (value < 24) {
+        out[0] = major | (uint8_t)value;
+        return 1;
+    }
+    int bytes = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFFULL ? 4 : 8;
+    out[0] = major | (bytes == 1 ? 24 : bytes == 2 ? 25 : bytes == 4 ? 26 : 27);
+    for (int i = 0; i < bytes; i++) {
+        out[1 + i] = (uint8_t)(value >> (8 * (bytes - 1 - i)));
+    }
+    return 1 + bytes;
+}
+
+static size_t cborInt(uint8_t *out, int64_t value) {
+    return value >= 0 ? cborHead(out, CBOR_UNSIGNED, (uint64_t)value)
+                      : cborHead(out, CBOR_NEGATIVE, (uint64_t)(-1 - value));
+}
+
+// Rounds a sensor value to fixed point, false for values that aren't numbers
+static bool fixedPoint(float value, float scale, int64_t &out) {
+    if (std::isnan(value) || std::isinf(value)) {
+        return false;
+    }
+    out = (int64_t)llroundf(value * scale);
+    return true;
+}
+
+SensorCborBody::SensorCborBody(const SensorData *records, size_t count, const char *token, const Origin &origin,
+                               const Fallback &fallback, float track_max_error_m)
+    : SensorBody(records, count, token, origin, fallback, track_max_error_m) {
+    base_epoch = count > 0 ? recordEpoch(records[0]) : fallback.epoch;
+    measure();
+}
+
+uint32_t SensorCborBody::recordEpoch(const SensorData &data) const {
+    return data.timestamp != 0 ? data.timestamp : fallback.epoch;
+}
+
+void SensorCborBody::restart() {
+    previous_epoch = base_epoch;
+}
+
+size_t SensorCborBody::encodePrefix(char *out, size_t size) {
+    uint8_t *p = (uint8_t *)out;
+    size_t device_len = strlen(origin.device_id);
+    size_t token_len = strlen(token);
+    if (token_len + device_len + 64 > size) {
+        token_len = size - device_len - 64;
+    }
+
+    size_t n = cborHead(p, CBOR_MAP, 6);
+    n += cborHead(p + n, CBOR_UNSIGNED, SENSOR_CBOR_SCHEMA);
+    n += cborHead(p + n, CBOR_UNSIGNED, getSchema());
+    n += cborHead(p + n, CBOR_UNSIGNED, SENSOR_CBOR_TOKEN);
+    n += cborHead(p + n, CBOR_TEXT, token_len);
+    memcpy(p + n, token, token_len);
+    n += token_len;
+    n += cborHead(p + n, CBOR_UNSIGNED, SENSOR_CBOR_DEVICE);
+    n += cborHead(p + n, CBOR_TEXT, device_len);
+    memcpy(p + n, origin.device_id, device_len);
+    n += device_len;
+    n += cborHead(p + n, CBOR_UNSIGNED, SENSOR_CBOR_SEQUENCE);
+    n += cborHead(p + n, CBOR_ARRAY, 2);
+    n += cborHead(p + n, CBOR_UNSIGNED, getFirstSequence());
+    n += cborHead(p + n, CBOR_UNSIGNED, getLastSequence());
+    n += cborHead(p + n, CBOR_UNSIGNED, SENSOR_CBOR_BASE_EPOCH);
+    n += cborHead(p + n, CBOR_UNSIGNED, base_epoch);
+    n += cborHead(p + n, CBOR_UNSIGNED, SENSOR_CBOR_RECORDS);
+    n += cborHead(p + n, CBOR_ARRAY, count);
+    return n;
+}
+
+size_t SensorCborBody::encodeRecord(size_t index, char *out, size_t size) {
+    const SensorData &data = records[index];
+
+    // Collect the fields first, the map head needs their count
+    struct Field {
+        uint8_t key;
+        int64_t value;
+    } fields[SENSOR_CBOR_FLAGS + 1];
+    size_t field_count = 0;
+
+    uint32_t epoch = recordEpoch(data);
+    fields[field_count++] = {SENSOR_CBOR_TIME_DELTA, (int64_t)epoch - (int64_t)previous_epoch};
+    previous_epoch = epoch;
+
+    int32_t dlat = 0, dlon = 0;
+    if (!hasPosition(data)) {
+        fields[field_count++] = {SENSOR_CBOR_LATITUDE, (int64_t)llround(fallback.latitude * 1e7)};
+        fields[field_count++] = {SENSOR_CBOR_LONGITUDE, (int64_t)llround(fallback.longitude * 1e7)};
+        breakDeltas();
+    } else if (!isPositionKept(index)) {
+        // On the simplified track
+    } else if (isTrackEncoded() && deltaPosition(data, dlat, dlon)) {
+        fields[field_count++] = {SENSOR_CBOR_DLAT, dlat};
+        fields[field_count++] = {SENSOR_CBOR_DLON, dlon};
+    } else {
+        fields[field_count++] = {SENSOR_CBOR_LATITUDE, (int32_t)data.latitude};
+        fields[field_count++] = {SENSOR_CBOR_LONGITUDE, (int32_t)data.longitude};
+    }
+
+    int64_t value;
+    if (fixedPoint(data.temp, 100.0f, value)) {
+        fields[field_count++] = {SENSOR_CBOR_TEMPERATURE, value};
+    }
+    if (fixedPoint(data.hum, 100.0f, value)) {
+        fields[field_count++] = {SENSOR_CBOR_HUMIDITY, value};
+    }
+    if (fixedPoint(data.pres, 10.0f, value)) {
+        fields[field_count++] = {SENSOR_CBOR_PRESSURE, value};
+    }
+    fields[field_count++] = {SENSOR_CBOR_PM25, data.pm2_5};
+    if (fixedPoint(data.gasRes, 1.0f, value)) {
+        fields[field_count++] = {SENSOR_CBOR_GAS_RESISTANCE, value};
+    }
+    fields[field_count++] = {SENSOR_CBOR_PM10, data.pm10};
+    fields[field_count++] = {SENSOR_CBOR_CO2, data.co2};
+    uint8_t flags = (data.is_fake_gps ? 0x01 : 0) | (data.time_unsynced ? 0x02 : 0);
+    if (flags) {
+        fields[field_count++] = {SENSOR_CBOR_FLAGS, flags};
+    }
+
+    // At most 1 + 13 * (1 + 9) bytes, well inside a piece
+    (void)size;
+    uint8_t *p = (uint8_t *)out;
+    size_t n = cborHead(p, CBOR_MAP, field_count);
+    for (size_t i = 0; i < field_count; i++) {
+        n += cborHead(p + n, CBOR_UNSIGNED, fields[i].key);
+        n += cborInt(p + n, fields[i].value);
+    }
+    return n;
+}
@@ -0,0 +1,56 @@
+#ifndef SENSOR_CBOR_BODY_H
+#define SENSOR_CBOR_BODY_H
+
+#include "libs/https/sensor_body.h"
+
+// Record map keys of the CBOR upload encoding
+enum SensorCborKey : uint8_t {
+    SENSOR_CBOR_TIME_DELTA = 0,     // s since the previous record (the first: since the base epoch)
+    SENSOR_CBOR_LATITUDE,           // Degrees * 1e7
+    SENSOR_CBOR_LONGITUDE,
+    SENSOR_CBOR_DLAT,               // Degrees * 1e7 since the previous position in the body
+    SENSOR_CBOR_DLON,
+    SENSOR_CBOR_TEMPERATURE,        // 0.01 degC
+    SENSOR_CBOR_HUMIDITY,           // 0.01 %RH
+    SENSOR_CBOR_PRESSURE,           // 0.1 hPa
+    SENSOR_CBOR_PM25,               // ug/m3
+    SENSOR_CBOR_GAS_RESISTANCE,     // Ohm
+    SENSOR_CBOR_PM10,               // ug/m3
+    SENSOR_CBOR_CO2,                // ppm
+    SENSOR_CBOR_FLAGS               // Bit 0 fake GPS, bit 1 time not synced; omitted when 0
+};
+
+// Top level map keys
+enum SensorCborTopKey : uint8_t {
+    SENSOR_CBOR_TOKEN = 0,          // Text
+    SENSOR_CBOR_BASE_EPOCH,         // UTC s
+    SENSOR_CBOR_RECORDS,            // Array of record maps
+    SENSOR_CBOR_DEVICE,             // Text, board unique ID in hex
+    SENSOR_CBOR_SEQUENCE,           // Array [first, last] of record sequence numbers
+    SENSOR_CBOR_SCHEMA              // SENSOR_BODY_SCHEMA_* (sensor_body.h)
+};
+
+// Compact binary upload body: CBOR (RFC 8949) maps with the integer keys
+// above and fixed-point integer values, about 30 bytes per record against
+// ~250 for the JSON encoding. Times are deltas, so most fit in one byte.
+// Position keys follow the same rules as the JSON body: absolute, delta or
+// left out.
+class SensorCborBody : public SensorBody {
+public:
+    SensorCborBody(const SensorData *records, size_t count, const char *token, const Origin &origin,
+                   const Fallback &fallback, float track_max_error_m);
+
+protected:
+    size_t encodePrefix(char *out, size_t size) override;
+    size_t encodeRecord(size_t index, char *out, size_t size) override;
+    size_t encodeSuffix(char *, size_t) override { return 0; }
+    void restart() override;
+
+private:
+    uint32_t base_epoch;
+    uint32_t previous_epoch = 0;
+
+    uint32_t recordEpoch(const SensorData &data) const;
+};
+
+#endif // SENSOR_CBOR_BODY_H
@@ -0,0 +1,75 @@
+#include "libs/https/sensor_json_body.h"
+#include <cstdio>
+
+SensorJsonBody::SensorJsonBody(const SensorData *records, size_t count, const char *token, const Origin &origin,
+                               const Fallback &fallback, float track_max_error_m)
+    : SensorBody(records, count, token, origin, fallback, track_max_error_m) {
+    measure();
+}
+
+void SensorJsonBody::restart() {
+    timestamp_formatter = TimestampFormatter();
+}
+
+size_t SensorJsonBody::encodePrefix(char *out, size_t size) {
+    return snprintf(out, size,
+                    "{\"schema\":%u,\"token\":\"%s\",\"device\":\"%s\",\"seq\":[%lu,%lu],\"measurements\":[",
+                    (unsigned)getSchema(), token, origin.device_id,
+                    (unsigned long)getFirstSequence(), (unsigned long)getLastSequence());
+}
+
+size_t SensorJsonBody::encodeSuffix(char *out, size_t size) {
+    return snprintf(out, size, "]}");
+}
+
+size_t SensorJsonBody::encodeRecord(size_t index, char *out, size_t size) {
+    const SensorData &data = records[index];
+
+    // Format the record's UTC epoch, default if it has none
+    char timestamp[TimestampFormatter::TIMESTAMP_FORMAT_SIZE];
+    timestamp_formatter.format(data.timestamp != 0 ? data.timestamp : fallback.epoch, timestamp);
+
+    // Position: absolute, as a delta to the previous kept one, or left out
+    // when the record lies on the simplified track
+    char position[64];
+    int32_t dlat = 0, dlon = 0;
+    if (!hasPosition(data)) {
+        snprintf(position, sizeof(position), "\"latitude\":%.7f,\"longitude\":%.7f,",
+                 fallback.latitude, fallback.longitude);
+        breakDeltas();
+    } else if (!isPositionKept(index)) {
+        position[0] = '\0';
+    } else if (isTrackEncoded() && deltaPosition(data, dlat, dlon)) {
+        snprintf(position, sizeof(position), "\"dlat\":%ld,\"dlon\":%ld,", (long)dlat, (long)dlon);
+    } else {
+        snprintf(position, sizeof(position), "\"latitude\":%.7f,\"longitude\":%.7f,",
+                 (int32_t)data.latitude / 10000000.0, (int32_t)data.longitude / 10000000.0);
+    }
+
+    int written = snprintf(out, size,
+                           "%s{\"timestamp\":\"%s\","
+                           "%s"
+                           "\"temperature\":%f,"
+                           "\"humidity\":%f,"
+                           "\"pressure\":%f,"
+                           "\"pm25\":%u,"
+                           "\"gasResistance\":%f,"
+                           "\"pm10\":%u,"
+                           "\"co2\":%u}",
+                           index > 0 ? "," : "",
+                           timestamp,
+                           position,
+                           data.temp,
+                           data.hum,
+                           data.pres,
+                           data.pm2_5,
+                           data.gasRes,
+                           data.pm10,
+                           (unsigned)data.co2);
+    if (written < 0 || written >= (int)size) {
+        // Cannot happen with finite sensor values; keep the JSON valid regardless
+        printf("[UPLOAD] ERROR: Record %lu does not fit the formatting buffer\n", (unsigned long)index);
+        written = snprintf(out, size, "%s{}", index > 0 ? "," : "");
+    }
+    return (size_t)written;
+}
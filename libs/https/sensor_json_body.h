@@ -0,0 +1,26 @@
+#ifndef SENSOR_JSON_BODY_H
+#define SENSOR_JSON_BODY_H
+
+#include "libs/https/sensor_body.h"
+#include "libs/clock/gps_clock.h"
+
+// JSON upload body {"schema":1|2,"token":...,"device":"<board ID>",
+// "seq":[first,last],"measurements":[...]}. With schema 2 (track encoded),
+// kept positions may be sent as "dlat"/"dlon" (degrees * 1e7) to the previous
+// position in the body, and positions on the simplified track are left out.
+class SensorJsonBody : public SensorBody {
+public:
+    SensorJsonBody(const SensorData *records, size_t count, const char *token, const Origin &origin,
+                   const Fallback &fallback, float track_max_error_m);
+
+protected:
+    size_t encodePrefix(char *out, size_t size) override;
+    size_t encodeRecord(size_t index, char *out, size_t size) override;
+    size_t encodeSuffix(char *out, size_t size) override;
+    void restart() override;
+
+private:
+    TimestampFormatter timestamp_formatter;
+};
+
+#endif // SENSOR_JSON_BODY_H
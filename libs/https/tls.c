@@ -20,6 +20,14 @@
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
 #include "hardware/rtc.h"
+#include "mbedtls/ssl.h"
+#include "tls_session.h"
+#include "http_body.h"
+#include "http_response.h"
+#include "dns_cache.h"
+
+// Body bytes staged per write while streaming a request body
+#define TLS_BODY_CHUNK_SIZE 512
 
 // TLS client state structure
 typedef struct TLS_CLIENT_T_ {
@@ -31,6 +39,13 @@ typedef struct TLS_CLIENT_T_ {
     int timeout;
     ip_addr_t resolved_ip; 
     uint64_t handshake_start_time;
+    uint64_t connect_start_time;   // altcp_connect() called, for handshake timing
+    const char* hostname;          // Server name the session cache is keyed by
+    http_body_source_t* http_body; // Streamed after http_request, NULL if none
+    char body_chunk[TLS_BODY_CHUNK_SIZE];
+    u16_t body_chunk_len;
+    u16_t body_chunk_offset;
+    http_response_t response;      // Only a complete 2xx response counts as success
 } TLS_CLIENT_T;
 
 // Custom error codes
@@ -41,6 +56,8 @@ static err_t tls_client_close(void *arg);
 static err_t tls_client_connected(void *arg, struct altcp_pcb *pcb, err_t err);
 static err_t tls_client_recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err);
 static err_t tls_client_poll(void *arg, struct altcp_pcb *pcb);
+static err_t tls_client_sent(void *arg, struct altcp_pcb *pcb, u16_t len);
+static err_t tls_client_send_body(TLS_CLIENT_T *state, struct altcp_pcb *pcb);
 static void tls_client_err(void *arg, err_t err);
 static err_t tls_client_dns_found(const char* hostname, const ip_addr_t *ipaddr, void *arg);
 static err_t tls_client_connect_to_server_ip(const ip_addr_t *ipaddr, TLS_CLIENT_T *state);
@@ -49,6 +66,27 @@ static err_t tls_client_open(const char *hostname, void *arg, TLS_CLIENT_T *stat
 // Global TLS configuration
 static struct altcp_tls_config *tls_config = NULL;
 
+// Session from the last full handshake, offered on the next connection to the
+// same host. Only one TLS connection is open at a time in this firmware, so a
+// single cache entry and a single outstanding offer are enough.
+static mbedtls_ssl_session cached_session;
+static char cached_session_host[TLS_SESSION_HOST_MAX];
+static bool cached_session_initialized = false;
+static bool cached_session_valid = false;
+static bool cached_session_unsaved = false;
+static bool session_offer_outstanding = false;
+static uint8_t session_failed_offers = 0;
+
+// Accepted record count of the last complete response, -1 if the server did not say
+static int32_t last_response_accepted = -1;
+
+// Handshake statistics since boot
+static uint32_t session_offered_count = 0;
+static uint32_t full_handshake_count = 0;
+static uint32_t full_handshake_ms_total = 0;
+static uint32_t resumed_handshake_count = 0;
+static uint32_t resumed_handshake_ms_total = 0;
+
 // Include our certificate file
 #include "vercel_cert.h"
 
@@ -131,6 +169,7 @@ static err_t tls_client_close(void *arg) {
         altcp_arg(state->pcb, NULL);
         altcp_poll(state->pcb, NULL, 0);
         altcp_recv(state->pcb, NULL);
+        altcp_sent(state->pcb, NULL);
         altcp_err(state->pcb, NULL);
         
         // Attempt to gracefully close the connection first
@@ -162,6 +201,7 @@ static err_t tls_client_connected(void *arg, struct altcp_pcb *pcb, err_t err) {
     
     if (err != ERR_OK) {
         printf("TLS client: connection failed %d\n", err);
+        tls_session_handshake_failed(state->hostname);
         state->error = err;
         state->complete = true;
         return ERR_OK;
@@ -172,6 +212,10 @@ static err_t tls_client_connected(void *arg, struct altcp_pcb *pcb, err_t err) {
     // Set the TLS handshake start time for timeout tracking
     state->handshake_start_time = time_us_64() / 1000; // Convert to ms
     
+    // altcp_tls reports the connection once the handshake is complete
+    tls_session_handshake_done(pcb, state->hostname,
+                               (uint32_t)(state->handshake_start_time - state->connect_start_time));
+    
     // Set up callbacks
     altcp_arg(pcb, state);
     altcp_recv(pcb, tls_client_recv);
@@ -233,6 +277,62 @@ static err_t tls_client_connected(void *arg, struct altcp_pcb *pcb, err_t err) {
         }
     }
     
+    // The body follows the headers as send buffer space frees up
+    if (state->http_body) {
+        printf("Streaming %u byte request body...\n", (unsigned int)state->http_body->length);
+        altcp_sent(pcb, tls_client_sent);
+        tls_client_send_body(state, pcb);
+    }
+    
+    return ERR_OK;
+}
+
+// Writes as much of the body as the send buffer takes, one staged chunk at a
+// time; called again from the sent callback when ACKs free space
+static err_t tls_client_send_body(TLS_CLIENT_T *state, struct altcp_pcb *pcb) {
+    bool wrote = false;
+    while (state->http_body) {
+        if (state->body_chunk_offset == state->body_chunk_len) {
+            state->body_chunk_len = (u16_t)state->http_body->read(state->http_body, state->body_chunk,
+                                                                  sizeof(state->body_chunk));
+            state->body_chunk_offset = 0;
+            if (state->body_chunk_len == 0) {
+                printf("Request body sent (%u bytes)\n", (unsigned int)state->http_body->length);
+                state->http_body = NULL;
+                break;
+            }
+        }
+        
+        u16_t n = altcp_sndbuf(pcb);
+        if (n > state->body_chunk_len - state->body_chunk_offset) {
+            n = state->body_chunk_len - state->body_chunk_offset;
+        }
+        if (n == 0) {
+            break;
+        }
+        err_t err = altcp_write(pcb, state->body_chunk + state->body_chunk_offset, n, TCP_WRITE_FLAG_COPY);
+        if (err == ERR_MEM) {
+            break; // Send queue full, continue from the sent callback
+        }
+        if (err != ERR_OK) {
+            printf("Error writing body: %d\n", err);
+            state->error = err;
+            state->complete = true;
+            state->http_body = NULL;
+            return err;
+        }
+        state->body_chunk_offset += n;
+        wrote = true;
+    }
+    
+    return wrote ? altcp_output(pcb) : ERR_OK;
+}
+
+static err_t tls_client_sent(void *arg, struct altcp_pcb *pcb, u16_t len) {
+    TLS_CLIENT_T *state = (TLS_CLIENT_T*)arg;
+    if (state && state->http_body && !state->complete) {
+        tls_client_send_body(state, pcb);
+    }
     return ERR_OK;
 }
 
@@ -308,12 +408,39 @@ static void tls_client_err(void *arg, err_t err) {
         }
         
         // Update state
+        if (state->handshake_start_time == 0) {
+            tls_session_handshake_failed(state->hostname);
+        }
         state->error = err;
         state->complete = true;
         state->pcb = NULL; // pcb is already freed when err callback is called
     }
 }
 
+// The response is complete: success only for 2xx, otherwise the status is the error
+static void tls_client_response_done(TLS_CLIENT_T *state) {
+    int status_code = state->response.status;
+    last_response_accepted = state->response.accepted;
+    if (status_code >= 200 && status_code < 300) {
+        if (state->response.accepted >= 0) {
+            printf("HTTP SUCCESS (%d): Server accepted %ld records\n", status_code, (long)state->response.accepted);
+        } else {
+            printf("HTTP SUCCESS (%d): Server accepted our request\n", status_code);
+        }
+        state->error = 0;
+    } else {
+        if (status_code >= 400 && status_code < 500) {
+            printf("HTTP CLIENT ERROR (%d): Server rejected our request\n", status_code);
+        } else if (status_code >= 500) {
+            printf("HTTP SERVER ERROR (%d): Server had internal error\n", status_code);
+        } else {
+            printf("HTTP UNEXPECTED STATUS (%d)\n", status_code);
+        }
+        state->error = status_code;
+    }
+    state->complete = true;
+}
+
 static err_t tls_client_recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err) {
     TLS_CLIENT_T *state = (TLS_CLIENT_T*)arg;
 
@@ -334,79 +461,36 @@ static err_t tls_client_recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, e
         return err;
     }
 
-    // Handle closed connection
+    // Handle closed connection: only a response framed by the close completes here
     if (p == NULL) {
-        printf("Connection closed by remote host - marking successful\n");
-        // Even if we can't read a response, we've reached this point,
-        // which means the server acknowledged our request. Mark as complete.
-        state->complete = true;
-        state->error = 0;
-        return ERR_OK;
-    }
-
-    // Got response - great news! Print response details
-    unsigned int response_len = p->tot_len;
-    printf("Received response: %u bytes - SUCCESS!\n", response_len);
-
-    // Mark as complete before processing (to prevent timeouts during processing)
-    state->complete = true;
-    state->error = 0;
-
-    // Try to process for HTTP status code (simple approach)
-    if (p->tot_len > 12) { // At least enough for "HTTP/1.1 xxx"
-        // Get HTTP status as simple null-terminated string
-        char http_status[4] = {0}; // 3 digits + null terminator
-        char *payload = (char*)p->payload;
-        
-        // Find the status code (typically after "HTTP/1.x ")
-        if (p->len >= 9 && memcmp(payload, "HTTP/1.", 7) == 0) {
-            // Copy the 3 status code digits
-            memcpy(http_status, payload + 9, 3);
-            
-            // Print relevant info based on status
-            int status_code = atoi(http_status);
-            if (status_code >= 200 && status_code < 300) {
-                printf("HTTP SUCCESS (%d): Server accepted our request\n", status_code);
-            } else if (status_code >= 400 && status_code < 500) {
-                printf("HTTP CLIENT ERROR (%d): Server rejected our request\n", status_code);
-                // Still mark as technically successful from a networking perspective
-            } else if (status_code >= 500) {
-                printf("HTTP SERVER ERROR (%d): Server had internal error\n", status_code);
-                // Still mark as technically successful from a networking perspective
-            }
+        if (http_response_close(&state->response)) {
+            tls_client_response_done(state);
         } else {
-            printf("Non-HTTP response or malformed HTTP response\n");
+            printf("Connection closed by remote host before a complete response\n");
+            state->error = ERR_CLSD;
+            state->complete = true;
         }
+        return ERR_OK;
     }
 
-    // Always free the pbuf
+    printf("Received response: %u bytes\n", p->tot_len);
+    for (struct pbuf *q = p; q != NULL && !http_response_done(&state->response); q = q->next) {
+        http_response_feed(&state->response, (const char*)q->payload, q->len);
+    }
+    altcp_recved(pcb, p->tot_len);
     pbuf_free(p);
 
-    // Close the connection
-    return tls_client_close(state);
-}
-
-// Callback for DNS resolution
-static void tls_client_dns_cb(const char *name, const ip_addr_t *addr, void *arg) {
-    TLS_CLIENT_T *state = (TLS_CLIENT_T*)arg;
-    
-    if (!state) {
-        printf("ERROR: DNS callback with NULL state\n");
-        return;
-    }
-    
-    if (!addr) {
-        printf("ERROR: DNS failed for %s\n", name);
+    if (http_response_failed(&state->response)) {
+        printf("Non-HTTP response or malformed HTTP response\n");
         state->error = ERR_VAL;
-        state->dns_resolved = true;  // Mark as resolved but with error
-        return;
+        return tls_client_close(state);
     }
-    
-    printf("DNS resolved for %s: %s\n", name, ipaddr_ntoa(addr));
-    // Store the resolved IP address in the state structure
-    ip_addr_copy(state->resolved_ip, *addr);
-    state->dns_resolved = true;  // Mark as successfully resolved
-    state->error = ERR_OK;
+    if (!http_response_done(&state->response)) {
+        return ERR_OK;   // More of the response to come
+    }
+
+    tls_client_response_done(state);
+    return tls_client_close(state);
 }
 
 static err_t tls_client_connect_to_server_ip(const ip_addr_t *ipaddr, TLS_CLIENT_T *state) {
@@ -444,9 +528,15 @@ static err_t tls_client_connect_to_server_ip(const ip_addr_t *ipaddr, TLS_CLIENT
         // Note: We can't access the underlying TCP PCB directly in this version
         // So we'll use reasonable defaults set by the TLS layer
         printf("Using TLS layer default TCP settings\n");
+        
+        // Offer the last session so the server can skip the full handshake
+        if (tls_session_offer(state->pcb, state->hostname)) {
+            printf("Offering cached TLS session for %s\n", state->hostname);
+        }
     }
     
     // Connect to the server on port 443 (HTTPS)
+    state->connect_start_time = time_us_64() / 1000;
     err_t err = altcp_connect(state->pcb, ipaddr, 443, tls_client_connected);
     if (err != ERR_OK) {
         printf("Error initiating connection: %d\n", err);
@@ -478,50 +568,16 @@ static err_t tls_client_dns_found(const char* hostname, const ip_addr_t *ipaddr,
 
 static err_t tls_client_open(const char *hostname, void *arg, TLS_CLIENT_T *state) {
     printf("TLS client connecting to host: %s\n", hostname);
+    http_response_init(&state->response);
     
-    ip_addr_t addr;
-    memset(&addr, 0, sizeof(addr));
-    
-    // Use DNS to resolve hostname to IP address
-    // Use a 1.5 seconds max timeout with checks every 25ms
-    printf("DNS lookup for %s - using timeout of 1500ms\n", hostname);
-    err_t err = dns_gethostbyname(hostname, &addr, tls_client_dns_cb, state);
-    
-    if (err == ERR_OK) {
-        /* Address was in cache, so callback was called synchronously */
-        // Store the resolved IP and use it
-        ip_addr_copy(state->resolved_ip, addr);
-        return tls_client_connect_to_server_ip(&state->resolved_ip, state);
-    } else if (err != ERR_INPROGRESS) {
-        printf("DNS error: %d\n", err);
-        state->error = err;
-        return err;
+    // Cached address, or a lookup when it is missing or expired
+    if (!dns_cache_resolve(hostname, &state->resolved_ip, DNS_CACHE_QUERY_TIMEOUT_MS)) {
+        printf("DNS lookup failed for %s\n", hostname);
+        state->error = -99; // DNS failure error code
+        return ERR_TIMEOUT;
     }
-    
-    // DNS is in progress, let's wait for it with tight timeouts
-    // Much shorter DNS timeout than before
-    const uint32_t dns_timeout_ms = 1500; 
-    const uint32_t dns_start = to_ms_since_boot(get_absolute_time());
-    uint32_t dns_wait_iterations = 0;
-    
-    while (!state->dns_resolved) {
-        dns_wait_iterations++;
-        sleep_ms(25); // Check every 25ms instead of 50ms - faster DNS polling
-        
-        uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - dns_start;
-        if (elapsed > dns_timeout_ms) {
-            printf("DNS timeout after %ums (%u iterations)\n", elapsed, dns_wait_iterations);
-            state->error = -99; // DNS timeout error code
-            return ERR_TIMEOUT;
-        }
-    }
-    
-    if (state->error == ERR_OK) {
-        // Use the saved IP address from the callback
-        return tls_client_connect_to_server_ip(&state->resolved_ip, state);
-    }
-    
-    return state->error;
+    state->dns_resolved = true;
+    return tls_client_connect_to_server_ip(&state->resolved_ip, state);
 }
 
 // Perform initialisation
@@ -552,7 +608,7 @@ struct altcp_tls_config* create_tls_config(unsigned char const* cert, unsigned i
 }
 
 // Simplified fallback function without mbedTLS-specific code
-bool try_alternative_connection(const char* server, const char* request) {
+bool try_alternative_connection(const char* server, const char* request, http_body_source_t* body) {
     printf("\n[FALLBACK] Attempting alternative connection method...\n");
     
     // Create a temporary state with longer timeouts
@@ -572,6 +628,10 @@ bool try_alternative_connection(const char* server, const char* request) {
     // Use longer timeout for fallback
     alt_state->timeout = 15000;  // 15 seconds - much higher than normal
     alt_state->http_request = request;
+    alt_state->http_body = body;
+    if (body) {
+        body->rewind(body);
+    }
     
     // Try without 'www' prefix if it exists, or with it if it doesn't
     char modified_server[256] = {0};
@@ -586,6 +646,7 @@ bool try_alternative_connection(const char* server, const char* request) {
     }
     
     printf("[FALLBACK] Trying connection to alternative server: %s\n", modified_server);
+    alt_state->hostname = modified_server;
     
     // Create a specialized alternative config with extended timeout
     struct altcp_tls_config *alt_config = altcp_tls_create_config_client(NULL, 0);
@@ -650,13 +711,184 @@ bool try_alternative_connection(const char* server, const char* request) {
     return alt_success;
 }
 
-/* Explicitly use extern "C" for the function definition to ensure correct linkage when called from C++ */
-#ifdef __cplusplus
-extern "C" {
-#endif
+static void tls_session_init_cache(void) {
+    if (!cached_session_initialized) {
+        mbedtls_ssl_session_init(&cached_session);
+        cached_session_initialized = true;
+    }
+}
 
-bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char const* server, char const* request, int timeout) {
+static bool tls_session_matches(const char *host) {
+    return cached_session_valid && host != NULL &&
+           strncmp(cached_session_host, host, TLS_SESSION_HOST_MAX) == 0;
+}
+
+static uint32_t tls_session_average(uint32_t total_ms, uint32_t count) {
+    return count ? total_ms / count : 0;
+}
+
+bool tls_session_offer(struct altcp_pcb *pcb, const char *host) {
+    session_offer_outstanding = false;
+    if (pcb == NULL || !tls_session_matches(host)) {
+        return false;
+    }
+
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(pcb);
+    int ret = mbedtls_ssl_set_session(ssl, &cached_session);
+    if (ret != 0) {
+        printf("TLS SESSION: Cannot offer cached session for %s (-0x%04x), dropping it\n", host, -ret);
+        tls_session_clear();
+        return false;
+    }
+
+    session_offer_outstanding = true;
+    session_offered_count++;
+    return true;
+}
+
+bool tls_session_handshake_done(struct altcp_pcb *pcb, const char *host, uint32_t handshake_ms) {
+    tls_session_init_cache();
+    mbedtls_ssl_context *ssl = pcb ? (mbedtls_ssl_context *)altcp_tls_context(pcb) : NULL;
+
+    // A resumed session keeps the master secret of the offered one, a full
+    // handshake always derives a new one. The session ID can't be compared
+    // because mbedTLS sends a random ID along with a ticket.
+    bool offered = session_offer_outstanding;
+    bool resumed = offered && ssl != NULL && ssl->session != NULL &&
+                   memcmp(ssl->session->master, cached_session.master, sizeof(cached_session.master)) == 0;
+    session_offer_outstanding = false;
+    session_failed_offers = 0;
+
+    if (resumed) {
+        resumed_handshake_count++;
+        resumed_handshake_ms_total += handshake_ms;
+        printf("TLS SESSION: Resumed handshake with %s in %lu ms (full average %lu ms)\n", host,
+               (unsigned long)handshake_ms,
+               (unsigned long)tls_session_average(full_handshake_ms_total, full_handshake_count));
+    } else {
+        full_handshake_count++;
+        full_handshake_ms_total += handshake_ms;
+        printf("TLS SESSION: Full handshake with %s in %lu ms%s\n", host, (unsigned long)handshake_ms,
+               offered ? " (server declined the cached session)" : "");
+    }
+
+    // Keep this connection's session, with any new ticket, for the next connect
+    if (ssl == NULL || host == NULL || strlen(host) >= TLS_SESSION_HOST_MAX) {
+        return resumed;
+    }
+    mbedtls_ssl_session fresh;
+    mbedtls_ssl_session_init(&fresh);
+    int ret = mbedtls_ssl_get_session(ssl, &fresh);
+    if (ret != 0) {
+        printf("TLS SESSION: Cannot read session from %s (-0x%04x)\n", host, -ret);
+        mbedtls_ssl_session_free(&fresh);
+        return resumed;
+    }
+
+    // The copy takes over fresh's allocations (ticket, peer certificate)
+    mbedtls_ssl_session_free(&cached_session);
+    cached_session = fresh;
+    strcpy(cached_session_host, host);
+    cached_session_valid = true;
+    if (!resumed) {
+        cached_session_unsaved = true;
+    }
+    return resumed;
+}
+
+void tls_session_handshake_failed(const char *host) {
+    if (!session_offer_outstanding) {
+        return;
+    }
+    session_offer_outstanding = false;
+
+    // Some servers abort instead of falling back to a full handshake
+    if (++session_failed_offers >= TLS_SESSION_MAX_FAILED_OFFERS) {
+        printf("TLS SESSION: %u connections to %s with the cached session failed, dropping it\n",
+               session_failed_offers, host ? host : "?");
+        tls_session_clear();
+    }
+}
+
+void tls_session_clear(void) {
+    tls_session_init_cache();
+    mbedtls_ssl_session_free(&cached_session);
+    mbedtls_ssl_session_init(&cached_session);
+    cached_session_host[0] = '\0';
+    cached_session_valid = false;
+    cached_session_unsaved = false;
+    session_offer_outstanding = false;
+    session_failed_offers = 0;
+}
+
+void tls_session_print_stats(void) {
+    uint32_t full_avg = tls_session_average(full_handshake_ms_total, full_handshake_count);
+    uint32_t resumed_avg = tls_session_average(resumed_handshake_ms_total, resumed_handshake_count);
+    uint32_t saved_ms = 0;
+    if (full_handshake_count > 0 && resumed_avg < full_avg) {
+        saved_ms = resumed_handshake_count * (full_avg - resumed_avg);
+    }
+
+    printf("TLS SESSION: %lu full handshakes (avg %lu ms), %lu resumed (avg %lu ms) of %lu offered, ~%lu ms saved\n",
+           (unsigned long)full_handshake_count, (unsigned long)full_avg,
+           (unsigned long)resumed_handshake_count, (unsigned long)resumed_avg,
+           (unsigned long)session_offered_count, (unsigned long)saved_ms);
+}
+
+bool tls_session_needs_save(void) {
+    return cached_session_valid && cached_session_unsaved;
+}
+
+bool tls_session_export(tls_session_record_t *record) {
+    if (record == NULL || !cached_session_valid) {
+        return false;
+    }
+
+    memset(record, 0, sizeof(*record));
+    size_t length = 0;
+    int ret = mbedtls_ssl_session_save(&cached_session, record->data, sizeof(record->data), &length);
+    if (ret != 0) {
+        printf("TLS SESSION: Cannot serialize session (-0x%04x)\n", -ret);
+        return false;
+    }
+
+    record->version = TLS_SESSION_RECORD_VERSION;
+    strcpy(record->host, cached_session_host);
+    record->length = (uint16_t)length;
+    cached_session_unsaved = false;
+    return true;
+}
+
+bool tls_session_import(const tls_session_record_t *record) {
+    if (record == NULL || record->version != TLS_SESSION_RECORD_VERSION ||
+        record->length == 0 || record->length > sizeof(record->data) ||
+        memchr(record->host, '\0', sizeof(record->host)) == NULL) {
+        return false;
+    }
+
+    mbedtls_ssl_session loaded;
+    mbedtls_ssl_session_init(&loaded);
+    int ret = mbedtls_ssl_session_load(&loaded, record->data, record->length);
+    if (ret != 0) {
+        // Saved by a different mbedTLS version or configuration
+        printf("TLS SESSION: Ignoring saved session (-0x%04x)\n", -ret);
+        mbedtls_ssl_session_free(&loaded);
+        return false;
+    }
+
+    tls_session_clear();
+    cached_session = loaded;
+    strcpy(cached_session_host, record->host);
+    cached_session_valid = true;
+    printf("TLS SESSION: Restored session for %s (%u bytes)\n", cached_session_host, record->length);
+    return true;
+}
+
+// Sends request (the whole request, or only its headers when body is given)
+// over a new TLS connection and waits for the complete response
+static bool tls_client_run(char const* server, char const* request, http_body_source_t* body, int timeout) {
     bool ret = false;
+    last_response_accepted = -1;
     TLS_CLIENT_T *state = calloc(1, sizeof(TLS_CLIENT_T));
     if (!state) {
         printf("failed to allocate state\n");
@@ -697,6 +929,11 @@ bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char
     // Set timeout first to ensure it's applied
     state->timeout = timeout;
     state->http_request = request;
+    state->hostname = server;
+    state->http_body = body;
+    if (body) {
+        body->rewind(body);
+    }
 
     // Create a new TLS config for each connection to ensure fresh settings
     // This avoids issues with cached/stale configurations
@@ -712,15 +949,6 @@ bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char
     // Use the connection-specific config
     tls_config = connection_config;
 
-    // Set multiple DNS servers for redundancy - ensure we can always resolve
-    ip_addr_t dnsserver1, dnsserver2;
-    IP4_ADDR(&dnsserver1, 8, 8, 8, 8); // Google DNS first 
-    IP4_ADDR(&dnsserver2, 1, 1, 1, 1); // Cloudflare DNS as backup
-    
-    // Clear any previous DNS server settings and set primary + backup
-    dns_setserver(0, &dnsserver1);
-    dns_setserver(1, &dnsserver2);
-
     // Use fewer iterations for faster timeout handling
     // 100 iterations * 10ms = 1 second processing time
     const unsigned int LOOP_MAX_ITERATIONS = timeout / 15; // Dynamically based on timeout
@@ -736,7 +964,7 @@ bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char
         
         // Try alternatives when TLS fails completely
         printf("TLS initialization failed completely\n");
-        return try_alternative_connection(server, request);
+        return try_alternative_connection(server, request, body);
     }
 
     // Main processing loop with more frequent processing
@@ -775,7 +1003,11 @@ bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char
             printf("  - Resolved IP: %s\n", ip_str);
         }
         
-        // Set error state for timeout
+        // Set error state for timeout; the cached address may be stale
+        if (state->handshake_start_time == 0) {
+            tls_session_handshake_failed(server);
+            dns_cache_expire(server);
+        }
         state->error = -2; // Custom timeout error code
         state->complete = true;
         
@@ -809,6 +1041,29 @@ bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char
     return ret;
 }
 
+/* Explicitly use extern "C" for the function definition to ensure correct linkage when called from C++ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+bool run_tls_client_test(unsigned char const* cert, unsigned int cert_len, char const* server, char const* request, int timeout) {
+    return tls_client_run(server, request, NULL, timeout);
+}
+
+// Sends the headers in header followed by the body pulled from body, so the
+// request never has to be assembled in one buffer
+bool run_tls_client_request(char const* server, char const* header, http_body_source_t* body, int timeout) {
+    if (!header || !body) {
+        printf("ERROR: run_tls_client_request needs headers and a body\n");
+        return false;
+    }
+    return tls_client_run(server, header, body, timeout);
+}
+
+int32_t tls_client_last_accepted(void) {
+    return last_response_accepted;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,180 @@
+#include "tls_arena.h"
+#include <stdio.h>
+#include <string.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+#include "mbedtls/platform.h"
+
+#define ARENA_ALIGN 8
+#define HEADER_SIZE sizeof(arena_block_t)
+#define MIN_BLOCK (HEADER_SIZE + ARENA_ALIGN)   // Smaller remainders stay with the allocation
+
+// Blocks tile the arena back to back, so the next one starts size bytes on
+typedef struct {
+    uint32_t size;      // Including this header, a multiple of ARENA_ALIGN
+    uint32_t used;
+} arena_block_t;
+
+static uint8_t arena[TLS_ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+
+// Statistics since boot; sizes include the block headers
+static size_t in_use = 0;
+static size_t peak = 0;
+static size_t handshake_peak = 0;        // Of the handshake in progress
+static size_t largest_handshake_peak = 0;
+static uint32_t failures = 0;
+
+static arena_block_t *block_at(size_t offset) {
+    return (arena_block_t *)(arena + offset);
+}
+
+// Joins the free blocks following the free block at offset into it
+static void merge_following(size_t offset) {
+    arena_block_t *block = block_at(offset);
+    size_t next = offset + block->size;
+    while (next < TLS_ARENA_SIZE && !block_at(next)->used) {
+        block->size += block_at(next)->size;
+        next = offset + block->size;
+    }
+}
+
+static size_t largest_free_block(void) {
+    size_t largest = 0;
+    for (size_t offset = 0; offset < TLS_ARENA_SIZE; offset += block_at(offset)->size) {
+        if (!block_at(offset)->used) {
+            merge_following(offset);
+            if (block_at(offset)->size > largest) {
+                largest = block_at(offset)->size;
+            }
+        }
+    }
+    return largest;
+}
+
+// First fit; free neighbours are merged as the search passes them
+void *tls_arena_calloc(size_t count, size_t size) {
+    if (size != 0 && count > (TLS_ARENA_SIZE - HEADER_SIZE) / size) {
+        failures++;
+        printf("TLS ARENA: Allocation of %u x %u bytes is larger than the arena\n",
+               (unsigned)count, (unsigned)size);
+        return NULL;
+    }
+    size_t bytes = count * size;
+    size_t need = (HEADER_SIZE + (bytes ? bytes : 1) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    for (size_t offset = 0; offset < TLS_ARENA_SIZE; offset += block_at(offset)->size) {
+        arena_block_t *block = block_at(offset);
+        if (block->used) {
+            continue;
+        }
+        merge_following(offset);
+        if (block->size < need) {
+            continue;
+        }
+        if (block->size - need >= MIN_BLOCK) {
+            arena_block_t *rest = block_at(offset + need);
+            rest->size = block->size - need;
+            rest->used = 0;
+            block->size = need;
+        }
+        block->used = 1;
+
+        in_use += block->size;
+        if (in_use > peak) {
+            peak = in_use;
+        }
+        if (in_use > handshake_peak) {
+            handshake_peak = in_use;
+        }
+        memset(block + 1, 0, block->size - HEADER_SIZE);
+        return block + 1;
+    }
+
+    failures++;
+    printf("TLS ARENA: No room for %u bytes (%u of %u in use, largest free block %u)\n",
+           (unsigned)bytes, (unsigned)in_use, (unsigned)TLS_ARENA_SIZE, (unsigned)largest_free_block());
+    return NULL;
+}
+
+void tls_arena_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    uint8_t *p = (uint8_t *)ptr;
+    if (p < arena + HEADER_SIZE || p >= arena + TLS_ARENA_SIZE) {
+        printf("TLS ARENA: Ignoring free of %p, not in the arena\n", ptr);
+        return;
+    }
+    arena_block_t *block = (arena_block_t *)p - 1;
+    if (!block->used) {
+        printf("TLS ARENA: Ignoring second free of %p\n", ptr);
+        return;
+    }
+    block->used = 0;
+    in_use -= block->size;
+    merge_following((size_t)((uint8_t *)block - arena));
+}
+
+void tls_arena_init(void) {
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    block_at(0)->size = TLS_ARENA_SIZE;
+    block_at(0)->used = 0;
+    mbedtls_platform_set_calloc_free(tls_arena_calloc, tls_arena_free);
+    initialized = true;
+    printf("TLS ARENA: %u bytes reserved for mbedTLS\n", (unsigned)TLS_ARENA_SIZE);
+}
+
+void tls_arena_handshake_started(void) {
+    handshake_peak = in_use;
+}
+
+size_t tls_arena_handshake_done(void) {
+    if (handshake_peak > largest_handshake_peak) {
+        largest_handshake_peak = handshake_peak;
+    }
+    return handshake_peak;
+}
+
+size_t tls_arena_in_use(void) {
+    return in_use;
+}
+
+size_t tls_arena_peak(void) {
+    return peak;
+}
+
+size_t tls_arena_handshake_peak(void) {
+    return largest_handshake_peak;
+}
+
+uint32_t tls_arena_failures(void) {
+    return failures;
+}
+
+void tls_arena_print_stats(void) {
+    printf("TLS ARENA: %u of %u bytes in use, peak %u, largest handshake %u, %lu failed allocations\n",
+           (unsigned)in_use, (unsigned)TLS_ARENA_SIZE, (unsigned)peak,
+           (unsigned)largest_handshake_peak, (unsigned long)failures);
+
+#if LWIP_STATS && MEM_STATS
+    cyw43_arch_lwip_begin();
+    unsigned heap_max = lwip_stats.mem.max;
+    unsigned heap_err = lwip_stats.mem.err;
+    cyw43_arch_lwip_end();
+    printf("LWIP: Heap peak %u of %u bytes, %u failed allocations\n", heap_max, (unsigned)MEM_SIZE, heap_err);
+#endif
+#if LWIP_STATS && MEMP_STATS
+    cyw43_arch_lwip_begin();
+    const struct stats_mem *pbufs = lwip_stats.memp[MEMP_PBUF_POOL];
+    const struct stats_mem *segments = lwip_stats.memp[MEMP_TCP_SEG];
+    unsigned pbuf_max = pbufs->max, pbuf_avail = pbufs->avail, pbuf_err = pbufs->err;
+    unsigned seg_max = segments->max, seg_avail = segments->avail, seg_err = segments->err;
+    cyw43_arch_lwip_end();
+    printf("LWIP: Pbuf pool peak %u of %u (%u exhausted), TCP segments peak %u of %u (%u exhausted)\n",
+           pbuf_max, pbuf_avail, pbuf_err, seg_max, seg_avail, seg_err);
+#endif
+}
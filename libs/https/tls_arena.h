@@ -0,0 +1,54 @@
+#ifndef TLS_ARENA_H
+#define TLS_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bytes reserved for mbedTLS. A full handshake needs the 16 KB input record
+// buffer, the output buffer, the parsed certificate chain and the key
+// exchange; the cached session and the CA certificate stay between handshakes.
+#ifndef TLS_ARENA_SIZE
+#define TLS_ARENA_SIZE (48 * 1024)
+#endif
+
+// Static arena all mbedTLS allocations come from, so handshakes neither
+// compete with nor fragment the C heap the record vectors and the display
+// buffer live in. Running out shows up as a failed handshake and a logged
+// "TLS ARENA:" line rather than a corrupted heap.
+//
+// mbedTLS is only used with the lwIP lock held, which serialises the
+// allocator; it has no locking of its own.
+
+// Hands the arena to mbedTLS; call before the first TLS configuration is created
+void tls_arena_init(void);
+
+// The allocator tls_arena_init() installs. A host build that also runs
+// mbedTLS for something else (the network test rig's servers) routes only the
+// firmware's allocations here.
+void *tls_arena_calloc(size_t count, size_t size);
+void tls_arena_free(void *ptr);
+
+// A handshake starts: its peak is measured from the memory in use now
+void tls_arena_handshake_started(void);
+
+// The handshake completed; returns the most arena memory in use during it
+size_t tls_arena_handshake_done(void);
+
+size_t tls_arena_in_use(void);
+size_t tls_arena_peak(void);               // Most in use since boot
+size_t tls_arena_handshake_peak(void);     // Largest handshake peak since boot
+uint32_t tls_arena_failures(void);         // Allocations that did not fit
+
+// Arena figures, and the peaks of lwIP's own heap and pbuf pool
+void tls_arena_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TLS_ARENA_H
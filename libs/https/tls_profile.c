@@ -0,0 +1,177 @@
+#include "tls_profile.h"
+#include <stdio.h>
+#include <string.h>
+#include "lwip/altcp_tls.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/base64.h"
+#include "pico/stdlib.h"
+
+#ifndef TLS_PROFILE_PINS
+#error "TLS_PROFILE_PINS is not set: set PICO_EU_TLS_PINS to the upload server's key pins"
+#endif
+
+// SHA-256 in base64, with the terminator
+#define PIN_LEN 45
+
+static const int constrained_ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    0
+};
+
+static const uint16_t constrained_groups[] = {
+    MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+    MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+};
+
+static const uint16_t constrained_sig_algs[] = {
+    MBEDTLS_TLS1_3_SIG_ECDSA_SECP256R1_SHA256,
+    MBEDTLS_TLS1_3_SIG_NONE
+};
+
+static const char *const pins[] = { TLS_PROFILE_PINS NULL };
+_Static_assert(sizeof(pins) / sizeof(pins[0]) > 1, "TLS_PROFILE_PINS lists no pins");
+
+typedef struct {
+    uint32_t full_count;
+    uint32_t full_ms_total;
+    uint32_t full_bytes_total;
+    uint32_t resumed_count;
+} profile_stats_t;
+
+static profile_stats_t stats[TLS_PROFILE_COUNT];
+static uint32_t pin_failures = 0;
+
+static int counting_send(void *ctx, const unsigned char *buf, size_t len) {
+    tls_profile_counter_t *counter = (tls_profile_counter_t *)ctx;
+    if (counter->first_send_ms == 0) {
+        counter->first_send_ms = to_ms_since_boot(get_absolute_time());
+    }
+    int ret = counter->lower_send(counter->lower_ctx, buf, len);
+    if (ret > 0) {
+        counter->bytes_out += (uint32_t)ret;
+    }
+    return ret;
+}
+
+static int counting_recv(void *ctx, unsigned char *buf, size_t len) {
+    tls_profile_counter_t *counter = (tls_profile_counter_t *)ctx;
+    int ret = counter->lower_recv(counter->lower_ctx, buf, len);
+    if (ret > 0) {
+        counter->bytes_in += (uint32_t)ret;
+    }
+    return ret;
+}
+
+const char *tls_profile_name(tls_profile_t profile) {
+    return profile == TLS_PROFILE_CONSTRAINED ? "constrained" : "default";
+}
+
+void tls_profile_configure(mbedtls_ssl_config *conf, tls_profile_t profile) {
+    if (profile == TLS_PROFILE_CONSTRAINED) {
+        mbedtls_ssl_conf_ciphersuites(conf, constrained_ciphersuites);
+        mbedtls_ssl_conf_groups(conf, constrained_groups);
+        mbedtls_ssl_conf_sig_algs(conf, constrained_sig_algs);
+    }
+    mbedtls_ssl_conf_max_frag_len(conf, TLS_PROFILE_FRAGMENT_LEN);
+}
+
+struct altcp_tls_config *tls_profile_create_config(tls_profile_t profile) {
+    struct altcp_tls_config *config = altcp_tls_create_config_client(NULL, 0);
+    if (config) {
+        // altcp_tls_mbedtls has no accessor for its mbedtls_ssl_config, the
+        // first member of altcp_tls_config (lwIP 2.1 and 2.2). No pcb uses
+        // the configuration yet.
+        tls_profile_configure((mbedtls_ssl_config *)config, profile);
+    }
+    return config;
+}
+
+void tls_profile_count_handshake(struct altcp_pcb *pcb, tls_profile_counter_t *counter) {
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(pcb);
+    counter->lower_send = ssl->f_send;
+    counter->lower_recv = ssl->f_recv;
+    counter->lower_ctx = ssl->p_bio;
+    counter->bytes_out = 0;
+    counter->bytes_in = 0;
+    counter->first_send_ms = 0;
+    mbedtls_ssl_set_bio(ssl, counter, counting_send, counting_recv, NULL);
+}
+
+void tls_profile_stop_counting(struct altcp_pcb *pcb, tls_profile_counter_t *counter) {
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(pcb);
+    if (ssl->p_bio == counter) {
+        mbedtls_ssl_set_bio(ssl, counter->lower_ctx, counter->lower_send, counter->lower_recv, NULL);
+    }
+}
+
+// Base64 SHA-256 of the raw SubjectPublicKeyInfo
+static bool key_pin(const mbedtls_x509_crt *cert, char *pin) {
+    unsigned char hash[32];
+    size_t len = 0;
+    if (mbedtls_sha256(cert->pk_raw.p, cert->pk_raw.len, hash, 0) != 0 ||
+        mbedtls_base64_encode((unsigned char *)pin, PIN_LEN, &len, hash, sizeof(hash)) != 0) {
+        return false;
+    }
+    pin[len] = '\0';
+    return true;
+}
+
+bool tls_profile_check_pin(struct altcp_pcb *pcb, const char *host) {
+    return tls_profile_check_peer((const mbedtls_ssl_context *)altcp_tls_context(pcb), host);
+}
+
+bool tls_profile_check_peer(const mbedtls_ssl_context *ssl, const char *host) {
+    const mbedtls_x509_crt *cert = mbedtls_ssl_get_peer_cert(ssl);
+    char pin[PIN_LEN];
+    if (cert == NULL || !key_pin(cert, pin)) {
+        pin_failures++;
+        printf("TLS PROFILE: No server key from %s to check\n", host);
+        return false;
+    }
+
+    for (int i = 0; pins[i] != NULL; i++) {
+        if (strcmp(pins[i], pin) == 0) {
+            return true;
+        }
+    }
+    pin_failures++;
+    printf("TLS PROFILE: %s key pin %s matches none of the %u pins, refusing the connection\n", host, pin,
+           (unsigned)(sizeof(pins) / sizeof(pins[0]) - 1));
+    return false;
+}
+
+void tls_profile_handshake_done(struct altcp_pcb *pcb, tls_profile_t profile, const tls_profile_counter_t *counter,
+                                uint32_t handshake_ms, bool resumed) {
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(pcb);
+    profile_stats_t *s = &stats[profile];
+    if (resumed) {
+        s->resumed_count++;
+    } else {
+        s->full_count++;
+        s->full_ms_total += handshake_ms;
+        s->full_bytes_total += counter->bytes_out + counter->bytes_in;
+    }
+    printf("TLS PROFILE: %s %s handshake, %s, %lu bytes sent, %lu received, %lu ms, records up to %u bytes\n",
+           resumed ? "Resumed" : "Full", tls_profile_name(profile), mbedtls_ssl_get_ciphersuite(ssl),
+           (unsigned long)counter->bytes_out, (unsigned long)counter->bytes_in, (unsigned long)handshake_ms,
+           (unsigned)mbedtls_ssl_get_max_in_record_payload(ssl));
+}
+
+void tls_profile_print_stats(void) {
+    for (int i = 0; i < TLS_PROFILE_COUNT; i++) {
+        const profile_stats_t *s = &stats[i];
+        if (s->full_count == 0 && s->resumed_count == 0) {
+            continue;
+        }
+        uint32_t full = s->full_count ? s->full_count : 1;
+        printf("TLS PROFILE: %s: %lu full handshakes averaging %lu ms and %lu bytes, %lu resumed\n",
+               tls_profile_name((tls_profile_t)i), (unsigned long)s->full_count,
+               (unsigned long)(s->full_ms_total / full), (unsigned long)(s->full_bytes_total / full),
+               (unsigned long)s->resumed_count);
+    }
+    if (pin_failures) {
+        printf("TLS PROFILE: %lu connections refused for an unpinned server key\n", (unsigned long)pin_failures);
+    }
+}
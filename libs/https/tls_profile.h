@@ -0,0 +1,86 @@
+#ifndef TLS_PROFILE_H
+#define TLS_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lwip/altcp.h"
+#include "mbedtls/ssl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Record size asked of the server with the max_fragment_length extension.
+// Servers that ignore it keep sending 16 KB records, which still fit.
+#define TLS_PROFILE_FRAGMENT_LEN MBEDTLS_SSL_MAX_FRAG_LEN_4096
+
+// Pinned server keys: base64 SHA-256 of the SubjectPublicKeyInfo, as logged
+// by "TLS PROFILE: ... key pin" on a full handshake (and as in HPKP's
+// pin-sha256). List the current key and a backup, each followed by a comma;
+// the build sets them from PICO_EU_TLS_PINS and fails without them. A refused
+// server's log shows the pin of the key it offered.
+
+typedef enum {
+    TLS_PROFILE_DEFAULT = 0,    // Every suite and curve mbedtls_config.h enables
+    TLS_PROFILE_CONSTRAINED,    // ECDHE-ECDSA P-256 with AES-128-GCM only
+    TLS_PROFILE_COUNT
+} tls_profile_t;
+
+// Handshake bytes of one connection, counted between mbedTLS and altcp_tls.
+// Owned by the caller and kept until tls_profile_stop_counting().
+typedef struct {
+    mbedtls_ssl_send_t *lower_send;
+    mbedtls_ssl_recv_t *lower_recv;
+    void *lower_ctx;
+    uint32_t bytes_out;
+    uint32_t bytes_in;
+    uint32_t first_send_ms;     // When the ClientHello was sent, 0 before. altcp_tls
+                                // sends it as soon as TCP is connected, so this
+                                // ends the TCP phase.
+} tls_profile_counter_t;
+
+// Handshake settings for the RP2040. The constrained profile offers a single
+// suite, curve and signature algorithm, so the ClientHello is small and the
+// key exchange never needs RSA, and asks for smaller records. Servers with an
+// RSA certificate refuse it; the caller falls back to the default profile.
+//
+// Both profiles check the server key against the pins instead of validating
+// the certificate chain, which costs one SHA-256 of the key.
+
+const char *tls_profile_name(tls_profile_t profile);
+
+// Sets the suites, curves and record size of profile on conf; transports
+// other than altcp_tls (DTLS) call this on their own configuration
+void tls_profile_configure(mbedtls_ssl_config *conf, tls_profile_t profile);
+
+// Creates an altcp_tls client configuration set up for profile, which every
+// pcb made from it uses. Free it with altcp_tls_free_config().
+struct altcp_tls_config *tls_profile_create_config(tls_profile_t profile);
+
+// Counts the handshake bytes of a new pcb into counter; call after
+// altcp_tls_new() and before altcp_connect()
+void tls_profile_count_handshake(struct altcp_pcb *pcb, tls_profile_counter_t *counter);
+
+// Hands the pcb's I/O back to altcp_tls before it is closed, so counter is
+// no longer used
+void tls_profile_stop_counting(struct altcp_pcb *pcb, tls_profile_counter_t *counter);
+
+// Call once the handshake has completed, before anything is sent. Returns
+// false if the server key matches none of the pins.
+bool tls_profile_check_pin(struct altcp_pcb *pcb, const char *host);
+
+// Same for a context the caller owns
+bool tls_profile_check_peer(const mbedtls_ssl_context *ssl, const char *host);
+
+// Logs the handshake cost and adds it to the statistics of profile
+void tls_profile_handshake_done(struct altcp_pcb *pcb, tls_profile_t profile, const tls_profile_counter_t *counter,
+                                uint32_t handshake_ms, bool resumed);
+
+// Average full handshake time and bytes per profile, to compare them
+void tls_profile_print_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TLS_PROFILE_H
@@ -0,0 +1,66 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "lwip/altcp.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Longest host name a cached session is kept for
+#define TLS_SESSION_HOST_MAX 64
+
+// Largest serialized session (ticket included) that can be persisted
+#define TLS_SESSION_SAVED_MAX 1024
+
+// Offered sessions that fail to connect this many times in a row are dropped
+#define TLS_SESSION_MAX_FAILED_OFFERS 2
+
+// Serialized session as stored in flash
+#define TLS_SESSION_RECORD_VERSION 1
+typedef struct {
+    uint32_t version;                    // TLS_SESSION_RECORD_VERSION
+    char host[TLS_SESSION_HOST_MAX];
+    uint16_t length;                     // Bytes used in data
+    uint16_t reserved;
+    unsigned char data[TLS_SESSION_SAVED_MAX];
+} tls_session_record_t;
+
+// Cache of the session (ID and ticket) from the last full handshake, shared by
+// every TLS connection in the firmware. Offering it on reconnect lets the
+// server resume with an abbreviated handshake, which skips the ECDHE and
+// certificate work that takes seconds on the RP2040.
+
+// Offers the cached session for host on a new pcb; call before altcp_connect().
+// Returns true if a session was offered.
+bool tls_session_offer(struct altcp_pcb *pcb, const char *host);
+
+// Call once the handshake has completed (connected callback). Logs the
+// handshake time, updates the statistics and caches the session.
+// Returns true if the server resumed the offered session.
+bool tls_session_handshake_done(struct altcp_pcb *pcb, const char *host, uint32_t handshake_ms);
+
+// Call when a connection fails before its handshake completed
+void tls_session_handshake_failed(const char *host);
+
+void tls_session_clear(void);
+void tls_session_print_stats(void);
+
+// True when a full handshake produced a session that is not persisted yet.
+// Resumed handshakes only refresh the ticket, so they don't ask for a save.
+bool tls_session_needs_save(void);
+
+// Serialize the cached session for flash, false if there is none
+bool tls_session_export(tls_session_record_t *record);
+
+// Restore a session saved by tls_session_export()
+bool tls_session_import(const tls_session_record_t *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TLS_SESSION_H
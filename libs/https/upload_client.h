@@ -0,0 +1,79 @@
+#ifndef UPLOAD_CLIENT_H
+#define UPLOAD_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "libs/https/http_body.h"
+#include "libs/https/tls_profile.h"
+
+// Status reported for a request whose response never arrived
+#define UPLOAD_STATUS_NO_RESPONSE -1
+
+// Uplink the record upload runs over: HTTPS (https_client.h) or CoAP
+// (coap_client.h). Nothing waits; beginConnect()/beginPost() start an
+// operation and the poll functions report how it went, while the lwIP
+// callbacks do the work. Statuses use HTTP numbering, so the caller handles
+// both transports alike (CoAP 2.04 is 204, 4.13 is 413).
+class UploadClient {
+public:
+    // Progress of a non-blocking connect or send
+    enum Progress : int8_t {
+        IN_PROGRESS = 0,
+        COMPLETE,
+        FAILED
+    };
+
+    virtual ~UploadClient() = default;
+
+    // Starts connecting and returns false if that could not be started.
+    // Nothing blocks, not even a DNS lookup; pollConnect() advances it.
+    virtual bool beginConnect(uint32_t timeout_ms) = 0;
+
+    // COMPLETE once connected; FAILED if the connection failed or timed out
+    virtual Progress pollConnect() = 0;
+
+    // Closes the connection; unanswered requests get UPLOAD_STATUS_NO_RESPONSE
+    virtual void close() = 0;
+
+    virtual bool isConnected() const = 0;
+
+    // Requests that may be unanswered at once
+    virtual uint8_t getMaxInFlight() const = 0;
+
+    // Starts a POST and returns its request id at once, or -1 if not
+    // connected or the client cannot take another request yet. The body must
+    // stay valid until pollSend() stops returning IN_PROGRESS.
+    virtual int beginPost(const char *path, const char *content_type, http_body_source_t *body,
+                          uint32_t timeout_ms, const char *content_encoding = nullptr) = 0;
+
+    // COMPLETE once the whole body has been sent (or nothing is being sent);
+    // FAILED if sending failed or timed out
+    virtual Progress pollSend() = 0;
+
+    // Status of a request once answered, 0 while pending,
+    // UPLOAD_STATUS_NO_RESPONSE if it was lost
+    virtual int getStatus(int request_id) const = 0;
+
+    // Records of an answered request the server reported as stored, -1 if it did not say
+    virtual int32_t getAccepted(int request_id) const = 0;
+
+    // Time from the last byte of an answered request being sent to its response
+    virtual uint32_t getResponseMs(int request_id) const = 0;
+
+    // Handshake profile for the next connect (tls_profile.h). A constrained
+    // handshake that fails before one has succeeded switches to the default.
+    void setTlsProfile(tls_profile_t profile) { tls_profile = profile; }
+    tls_profile_t getTlsProfile() const { return tls_profile; }
+
+    virtual uint32_t getHandshakeCount() const = 0;
+    virtual uint32_t getResumedCount() const = 0;       // Abbreviated handshakes
+    virtual uint32_t getRequestCount() const = 0;
+    virtual uint32_t getBytesSent() const = 0;          // Before TLS or DTLS framing
+    virtual uint32_t getBytesReceived() const = 0;
+    virtual size_t getHandshakeArenaPeak() const = 0;   // Peak TLS arena use of a handshake
+
+protected:
+    tls_profile_t tls_profile = TLS_PROFILE_DEFAULT;
+};
+
+#endif // UPLOAD_CLIENT_H
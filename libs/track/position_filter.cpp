@@ -0,0 +1,161 @@
+#include "libs/track/position_filter.h"
+#include <cstdio>
+
+// mm per 1e-7 degree of latitude (11.1319 mm), Q16
+static const int64_t MM_PER_E7_Q16 = 729543;
+
+// 1e-7 degree to radians, Q30 scaled by 1e6 (pi / 180 / 1e7 * 2^30 * 1e6)
+static const int64_t RAD_PER_E7_Q30_E6 = 1874024;
+
+// Fixes further than this from the origin restart the filter, which keeps
+// the local projection accurate and the mm values well inside range
+static const int64_t MAX_ORIGIN_DISTANCE_MM = 50000000;
+
+static const int64_t FIX_VARIANCE = (int64_t)POSITION_FILTER_FIX_SIGMA_MM * POSITION_FILTER_FIX_SIGMA_MM;
+static const int64_t ACCEL_VARIANCE = (int64_t)POSITION_FILTER_ACCEL_SIGMA_MM_S2 * POSITION_FILTER_ACCEL_SIGMA_MM_S2;
+
+// Covariance limits keep every product below 2^63
+static const int64_t MAX_POS_VARIANCE = 10000000000LL;   // (100 m)^2
+static const int64_t MAX_VEL_VARIANCE = 1000000000LL;    // (31 m/s)^2
+
+static int64_t clamp64(int64_t value, int64_t low, int64_t high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+int32_t PositionFilter::cosLatitudeQ16(int32_t lat_e7) {
+    // Taylor series in Q30; five terms are accurate to ~1e-5 up to 80 degrees
+    int64_t x = (int64_t)lat_e7 * RAD_PER_E7_Q30_E6 / 1000000;
+    int64_t x2 = (x * x) >> 30;
+    int64_t term = 1LL << 30;
+    int64_t sum = term;
+    for (int n = 1; n <= 5; n++) {
+        term = -((term * x2) >> 30) / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return (int32_t)(clamp64(sum, 0, 1LL << 30) >> 14);
+}
+
+void PositionFilter::toLocal(int32_t lat_e7, int32_t lon_e7, int64_t &north_mm, int64_t &east_mm) const {
+    north_mm = ((int64_t)lat_e7 - origin_lat_e7) * MM_PER_E7_Q16 / 65536;
+    east_mm = ((int64_t)lon_e7 - origin_lon_e7) * lon_scale_q16 / 65536;
+}
+
+void PositionFilter::initAxis(Axis &axis, int64_t pos_mm) {
+    axis.pos_mm = pos_mm;
+    axis.vel_mm_s = 0;
+    axis.p00 = FIX_VARIANCE;
+    axis.p01 = 0;
+    axis.p11 = (int64_t)POSITION_FILTER_INIT_VEL_SIGMA_MM_S * POSITION_FILTER_INIT_VEL_SIGMA_MM_S;
+}
+
+void PositionFilter::start(int32_t lat_e7, int32_t lon_e7, uint32_t time_ms) {
+    origin_lat_e7 = lat_e7;
+    origin_lon_e7 = lon_e7;
+    lon_scale_q16 = MM_PER_E7_Q16 * cosLatitudeQ16(lat_e7) / 65536;
+    if (lon_scale_q16 < 1) {
+        lon_scale_q16 = 1;
+    }
+    initAxis(north, 0);
+    initAxis(east, 0);
+    last_fix_ms = time_ms;
+    consecutive_rejects = 0;
+    initialized = true;
+}
+
+void PositionFilter::predict(Axis &axis, int64_t dt_ms) {
+    // x += v*dt; P = F P F' + Q for a white-noise acceleration model
+    int64_t dt2 = dt_ms * dt_ms;
+    axis.pos_mm += axis.vel_mm_s * dt_ms / 1000;
+    axis.p00 += 2 * axis.p01 * dt_ms / 1000 + axis.p11 * dt2 / 1000000 +
+                ACCEL_VARIANCE * dt2 / 1000000 * dt_ms / 3000;
+    axis.p01 += axis.p11 * dt_ms / 1000 + ACCEL_VARIANCE * dt2 / 2000000;
+    axis.p11 += ACCEL_VARIANCE * dt_ms / 1000;
+
+    axis.p00 = clamp64(axis.p00, 1, MAX_POS_VARIANCE);
+    axis.p11 = clamp64(axis.p11, 1, MAX_VEL_VARIANCE);
+    axis.p01 = clamp64(axis.p01, -MAX_POS_VARIANCE, MAX_POS_VARIANCE);
+}
+
+bool PositionFilter::innovationPlausible(const Axis &axis, int64_t z_mm) {
+    int64_t y = z_mm - axis.pos_mm;
+    int64_t s = axis.p00 + FIX_VARIANCE;
+    if (y > MAX_ORIGIN_DISTANCE_MM || y < -MAX_ORIGIN_DISTANCE_MM) {
+        return false;
+    }
+    return y * y <= (int64_t)POSITION_FILTER_GATE_SIGMA * POSITION_FILTER_GATE_SIGMA * s;
+}
+
+void PositionFilter::correct(Axis &axis, int64_t z_mm) {
+    int64_t y = z_mm - axis.pos_mm;
+    int64_t s = axis.p00 + FIX_VARIANCE;
+
+    // Kalman gains in Q16
+    int64_t k0 = axis.p00 * 65536 / s;
+    int64_t k1 = axis.p01 * 65536 / s;
+
+    axis.pos_mm += y * k0 / 65536;
+    axis.vel_mm_s += y * k1 / 65536;
+
+    int64_t p01 = axis.p01;
+    axis.p00 = axis.p00 * FIX_VARIANCE / s;
+    axis.p01 = p01 * FIX_VARIANCE / s;
+    axis.p11 = clamp64(axis.p11 - p01 * k1 / 65536, 1, MAX_VEL_VARIANCE);
+}
+
+void PositionFilter::update(int32_t lat_e7, int32_t lon_e7, uint32_t time_ms) {
+    int32_t dt_ms = (int32_t)(time_ms - last_fix_ms);
+    if (!initialized || dt_ms > POSITION_FILTER_MAX_GAP_MS || dt_ms < 0) {
+        start(lat_e7, lon_e7, time_ms);
+        fix_count++;
+        return;
+    }
+
+    int64_t north_mm, east_mm;
+    toLocal(lat_e7, lon_e7, north_mm, east_mm);
+    if (north_mm > MAX_ORIGIN_DISTANCE_MM || north_mm < -MAX_ORIGIN_DISTANCE_MM ||
+        east_mm > MAX_ORIGIN_DISTANCE_MM || east_mm < -MAX_ORIGIN_DISTANCE_MM) {
+        start(lat_e7, lon_e7, time_ms);
+        fix_count++;
+        return;
+    }
+
+    Axis predicted_north = north;
+    Axis predicted_east = east;
+    predict(predicted_north, dt_ms);
+    predict(predicted_east, dt_ms);
+
+    // Reject single outliers; several in a row mean the prediction is wrong
+    if (!innovationPlausible(predicted_north, north_mm) || !innovationPlausible(predicted_east, east_mm)) {
+        rejected_count++;
+        if (++consecutive_rejects < POSITION_FILTER_MAX_REJECTS) {
+            return;
+        }
+        printf("POSITION FILTER: %d fixes rejected in a row, restarting\n", consecutive_rejects);
+        start(lat_e7, lon_e7, time_ms);
+        fix_count++;
+        return;
+    }
+    consecutive_rejects = 0;
+
+    correct(predicted_north, north_mm);
+    correct(predicted_east, east_mm);
+    north = predicted_north;
+    east = predicted_east;
+    last_fix_ms = time_ms;
+    fix_count++;
+}
+
+bool PositionFilter::estimate(uint32_t time_ms, int32_t &lat_e7, int32_t &lon_e7) const {
+    if (!initialized) {
+        return false;
+    }
+
+    int64_t dt_ms = clamp64((int32_t)(time_ms - last_fix_ms),
+                            -POSITION_FILTER_MAX_EXTRAPOLATION_MS, POSITION_FILTER_MAX_EXTRAPOLATION_MS);
+    int64_t north_mm = north.pos_mm + north.vel_mm_s * dt_ms / 1000;
+    int64_t east_mm = east.pos_mm + east.vel_mm_s * dt_ms / 1000;
+
+    lat_e7 = (int32_t)(origin_lat_e7 + north_mm * 65536 / MM_PER_E7_Q16);
+    lon_e7 = (int32_t)(origin_lon_e7 + east_mm * 65536 / lon_scale_q16);
+    return true;
+}
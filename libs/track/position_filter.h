@@ -0,0 +1,79 @@
+#ifndef POSITION_FILTER_H
+#define POSITION_FILTER_H
+
+#include <stdint.h>
+
+// Assumed 1-sigma error of a single GPS fix, in mm
+#define POSITION_FILTER_FIX_SIGMA_MM 5000
+
+// Process noise: 1-sigma acceleration a rider can produce, in mm/s^2
+#define POSITION_FILTER_ACCEL_SIGMA_MM_S2 1000
+
+// Velocity uncertainty right after (re)initialisation, in mm/s
+#define POSITION_FILTER_INIT_VEL_SIGMA_MM_S 10000
+
+// A gap between fixes longer than this restarts the filter at the next fix
+#define POSITION_FILTER_MAX_GAP_MS 10000
+
+// Estimates are extrapolated at most this far from the last fix
+#define POSITION_FILTER_MAX_EXTRAPOLATION_MS 5000
+
+// Fixes further than this many sigma from the prediction are rejected,
+// until POSITION_FILTER_MAX_REJECTS in a row restart the filter
+#define POSITION_FILTER_GATE_SIGMA 5
+#define POSITION_FILTER_MAX_REJECTS 3
+
+// Constant-velocity Kalman filter over GPS fixes, in integer arithmetic only
+// (the RP2040 has no FPU). North and east are filtered independently in mm
+// relative to the first fix, so a position can be estimated at any time near
+// the last fix, e.g. the moment a sensor sample was taken.
+// Positions are signed fixed-point degrees * 1e7.
+class PositionFilter {
+public:
+    void reset() { initialized = false; }
+
+    // Feed a fix taken at time_ms (ms since boot)
+    void update(int32_t lat_e7, int32_t lon_e7, uint32_t time_ms);
+
+    // Position at time_ms, before or after the last fix. Returns false until
+    // the first fix has been fed.
+    bool estimate(uint32_t time_ms, int32_t &lat_e7, int32_t &lon_e7) const;
+
+    bool isInitialized() const { return initialized; }
+    uint32_t getLastFixMs() const { return last_fix_ms; }
+    uint32_t getFixCount() const { return fix_count; }
+    uint32_t getRejectedCount() const { return rejected_count; }
+
+    // Cosine of a latitude in Q16, without floating point
+    static int32_t cosLatitudeQ16(int32_t lat_e7);
+
+private:
+    struct Axis {
+        int64_t pos_mm;
+        int64_t vel_mm_s;
+        int64_t p00;    // Position variance, mm^2
+        int64_t p01;    // Position/velocity covariance, mm^2/s
+        int64_t p11;    // Velocity variance, mm^2/s^2
+    };
+
+    bool initialized = false;
+    int32_t origin_lat_e7 = 0;
+    int32_t origin_lon_e7 = 0;
+    int64_t lon_scale_q16 = 0;       // mm per 1e-7 degree of longitude at the origin, Q16
+    Axis north = {};
+    Axis east = {};
+    uint32_t last_fix_ms = 0;
+    uint8_t consecutive_rejects = 0;
+    uint32_t fix_count = 0;
+    uint32_t rejected_count = 0;
+
+    void start(int32_t lat_e7, int32_t lon_e7, uint32_t time_ms);
+    void toLocal(int32_t lat_e7, int32_t lon_e7, int64_t &north_mm, int64_t &east_mm) const;
+
+    static void initAxis(Axis &axis, int64_t pos_mm);
+    static void predict(Axis &axis, int64_t dt_ms);
+    static bool innovationPlausible(const Axis &axis, int64_t z_mm);
+    static void correct(Axis &axis, int64_t z_mm);
+};
+
+#endif // POSITION_FILTER_H
@@ -0,0 +1,117 @@
+#include "libs/track/track_encoder.h"
+#include <cmath>
+
+// Metres per 1e-7 degree of latitude (and of longitude at the equator)
+static const float METRES_PER_E7 = 0.0111319491f;
+
+TrackSimplifier::TrackSimplifier(float max_error_m) : max_error_m(max_error_m) {
+}
+
+void TrackSimplifier::reset() {
+    have_anchor = false;
+    window_len = 0;
+    window_error_m = 0;
+    point_count = 0;
+    kept_count = 0;
+    worst_error_m = 0;
+}
+
+void TrackSimplifier::setAnchor(const Point &point) {
+    anchor = point;
+    anchor_lon_scale = METRES_PER_E7 * cosf((float)point.lat_e7 * (float)(M_PI / 180.0 / 1e7));
+    kept_count++;
+}
+
+void TrackSimplifier::closeSegment() {
+    if (window_error_m > worst_error_m) {
+        worst_error_m = window_error_m;
+    }
+    window_error_m = 0;
+}
+
+void TrackSimplifier::toMetres(const Point &point, float &x, float &y) const {
+    // Equirectangular projection around the anchor; exact enough for the few
+    // hundred metres a window spans
+    x = (float)(point.lon_e7 - anchor.lon_e7) * anchor_lon_scale;
+    y = (float)(point.lat_e7 - anchor.lat_e7) * METRES_PER_E7;
+}
+
+float TrackSimplifier::segmentError(const Point &end) const {
+    float ex, ey;
+    toMetres(end, ex, ey);
+    float length2 = ex * ex + ey * ey;
+
+    float worst2 = 0;
+    for (size_t i = 0; i < window_len; i++) {
+        float px, py;
+        toMetres(window[i], px, py);
+
+        // Distance to the closest point of the segment anchor -> end
+        float t = 0;
+        if (length2 > 0) {
+            t = (px * ex + py * ey) / length2;
+            t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        }
+        float dx = px - t * ex;
+        float dy = py - t * ey;
+        float d2 = dx * dx + dy * dy;
+        if (d2 > worst2) {
+            worst2 = d2;
+        }
+    }
+    return sqrtf(worst2);
+}
+
+bool TrackSimplifier::add(int32_t lat_e7, int32_t lon_e7) {
+    Point point = {lat_e7, lon_e7};
+    point_count++;
+
+    if (!have_anchor) {
+        have_anchor = true;
+        setAnchor(point);
+        return true;
+    }
+
+    // Previous position is the anchor itself
+    if (window_len == 0) {
+        window[window_len++] = point;
+        return true;
+    }
+
+    // Try to extend the segment to the new position, which turns the last
+    // undecided position into an interior one
+    if (window_len < TRACK_WINDOW_MAX) {
+        float error_m = segmentError(point);
+        if (error_m <= max_error_m) {
+            window[window_len++] = point;
+            window_error_m = error_m;
+            return false;
+        }
+    }
+
+    // Too far off (or window full): keep the last position and start over from it
+    closeSegment();
+    setAnchor(window[window_len - 1]);
+    window[0] = point;
+    window_len = 1;
+    return true;
+}
+
+void TrackSimplifier::finish() {
+    if (window_len > 0) {
+        closeSegment();
+        setAnchor(window[window_len - 1]);
+        window_len = 0;
+    }
+}
+
+bool TrackDeltaEncoder::encode(int32_t lat_e7, int32_t lon_e7, int32_t &dlat_e7, int32_t &dlon_e7) {
+    bool relative = have_reference;
+    dlat_e7 = lat_e7 - ref_lat_e7;
+    dlon_e7 = lon_e7 - ref_lon_e7;
+
+    have_reference = true;
+    ref_lat_e7 = lat_e7;
+    ref_lon_e7 = lon_e7;
+    return relative;
+}
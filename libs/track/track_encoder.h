@@ -0,0 +1,83 @@
+#ifndef TRACK_ENCODER_H
+#define TRACK_ENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Default maximum distance a dropped position may lie from the simplified track
+#define TRACK_DEFAULT_MAX_ERROR_M 5.0f
+
+// Longest run of positions that can be replaced by a single segment; bounds
+// both the memory and the work per position
+#define TRACK_WINDOW_MAX 32
+
+// Streaming bounded-error track simplifier (opening window). Positions are fed
+// in order; a position is only kept if the straight segment between the last
+// kept position and a later one would pass further than max_error_m from it.
+// Positions are fixed-point degrees * 1e7, as stored in SensorData.
+//
+// The decision for a position is final once the next one has been added, so
+// a caller that needs the whole run decided calls finish() after the last one.
+class TrackSimplifier {
+public:
+    explicit TrackSimplifier(float max_error_m = TRACK_DEFAULT_MAX_ERROR_M);
+
+    void setMaxError(float max_error_m) { this->max_error_m = max_error_m; }
+    float getMaxError() const { return max_error_m; }
+
+    void reset();
+
+    // Add the next position. Returns true if the previously added position is
+    // kept, false if it was dropped. The first position is always kept.
+    bool add(int32_t lat_e7, int32_t lon_e7);
+
+    // Ends the track; the last added position is always kept
+    void finish();
+
+    uint32_t getPointCount() const { return point_count; }
+    uint32_t getKeptCount() const { return kept_count; }
+
+    // Largest distance of a dropped position from its final segment, in metres
+    float getWorstErrorM() const { return worst_error_m; }
+
+private:
+    struct Point {
+        int32_t lat_e7;
+        int32_t lon_e7;
+    };
+
+    float max_error_m;
+    bool have_anchor = false;
+    Point anchor = {0, 0};
+    float anchor_lon_scale = 0;      // Metres per 1e-7 degree of longitude at the anchor
+    Point window[TRACK_WINDOW_MAX];  // Positions after the anchor, last one still undecided
+    size_t window_len = 0;
+    float window_error_m = 0;        // Worst error if the window closes at its last position
+
+    uint32_t point_count = 0;
+    uint32_t kept_count = 0;
+    float worst_error_m = 0;
+
+    void setAnchor(const Point &point);
+    void closeSegment();
+    void toMetres(const Point &point, float &x, float &y) const;
+    float segmentError(const Point &end) const;
+};
+
+// Encodes kept positions as deltas against the previous kept position, so a
+// track costs a few digits per point instead of a full absolute coordinate
+class TrackDeltaEncoder {
+public:
+    void reset() { have_reference = false; }
+
+    // Returns false for the first position, which has to be sent absolute;
+    // otherwise returns true with the deltas (degrees * 1e7) to the previous one
+    bool encode(int32_t lat_e7, int32_t lon_e7, int32_t &dlat_e7, int32_t &dlon_e7);
+
+private:
+    bool have_reference = false;
+    int32_t ref_lat_e7 = 0;
+    int32_t ref_lon_e7 = 0;
+};
+
+#endif // TRACK_ENCODER_H
@@ -0,0 +1,236 @@
+#include "dhcp_server.h"
+#include <stdio.h>
+#include <string.h>
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+#include "lwip/ip4_addr.h"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+// BOOTP message layout (RFC 2131); options follow the magic cookie
+#define DHCP_OP 0
+#define DHCP_CIADDR 12
+#define DHCP_YIADDR 16
+#define DHCP_SIADDR 20
+#define DHCP_CHADDR 28
+#define DHCP_COOKIE 236
+#define DHCP_OPTIONS 240
+#define DHCP_MESSAGE_MAX 548
+
+#define DHCP_OP_REQUEST 1
+#define DHCP_OP_REPLY 2
+#define DHCP_MAGIC_COOKIE 0x63825363
+
+// Options and message types used here
+#define DHCP_OPT_PAD 0
+#define DHCP_OPT_SUBNET_MASK 1
+#define DHCP_OPT_ROUTER 3
+#define DHCP_OPT_DNS 6
+#define DHCP_OPT_REQUESTED_IP 50
+#define DHCP_OPT_LEASE_TIME 51
+#define DHCP_OPT_MESSAGE_TYPE 53
+#define DHCP_OPT_SERVER_ID 54
+#define DHCP_OPT_END 255
+
+#define DHCP_DISCOVER 1
+#define DHCP_OFFER 2
+#define DHCP_REQUEST 3
+#define DHCP_ACK 5
+#define DHCP_NAK 6
+#define DHCP_RELEASE 7
+
+typedef struct {
+    uint8_t mac[6];
+    bool used;
+} dhcp_lease_t;
+
+static struct udp_pcb *server_pcb = NULL;
+static struct netif *server_netif = NULL;
+static dhcp_lease_t leases[DHCP_SERVER_MAX_LEASES];
+
+static uint32_t get_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t *put_option(uint8_t *p, uint8_t option, const void *value, uint8_t len) {
+    p[0] = option;
+    p[1] = len;
+    memcpy(p + 2, value, len);
+    return p + 2 + len;
+}
+
+// Value of an option, NULL if the message does not carry it
+static const uint8_t *find_option(const uint8_t *msg, size_t len, uint8_t option, uint8_t *option_len) {
+    size_t i = DHCP_OPTIONS;
+    while (i < len && msg[i] != DHCP_OPT_END) {
+        if (msg[i] == DHCP_OPT_PAD) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len || i + 2 + msg[i + 1] > len) {
+            break;
+        }
+        if (msg[i] == option) {
+            *option_len = msg[i + 1];
+            return msg + i + 2;
+        }
+        i += 2 + msg[i + 1];
+    }
+    return NULL;
+}
+
+// Address of lease slot index, in network byte order
+static uint32_t lease_address(int index) {
+    uint32_t own = ip4_addr_get_u32(netif_ip4_addr(server_netif));
+    uint32_t mask = ip4_addr_get_u32(netif_ip4_netmask(server_netif));
+    return (own & mask) | lwip_htonl(DHCP_SERVER_FIRST_HOST + index);
+}
+
+static const char *address_string(uint32_t address) {
+    ip4_addr_t ip;
+    ip4_addr_set_u32(&ip, address);
+    return ip4addr_ntoa(&ip);
+}
+
+// Slot already given to mac, otherwise a free one; -1 if the pool is full
+static int find_lease(const uint8_t *mac, bool allocate) {
+    int free_slot = -1;
+    for (int i = 0; i < DHCP_SERVER_MAX_LEASES; i++) {
+        if (leases[i].used && memcmp(leases[i].mac, mac, 6) == 0) {
+            return i;
+        }
+        if (!leases[i].used && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (allocate && free_slot >= 0) {
+        memcpy(leases[free_slot].mac, mac, 6);
+        leases[free_slot].used = true;
+    }
+    return allocate ? free_slot : -1;
+}
+
+// Turns the client message in msg into the reply and broadcasts it
+static void send_reply(uint8_t *msg, uint8_t type, uint32_t address) {
+    uint32_t own = ip4_addr_get_u32(netif_ip4_addr(server_netif));
+    uint32_t mask = ip4_addr_get_u32(netif_ip4_netmask(server_netif));
+    uint32_t lease_s = lwip_htonl(DHCP_SERVER_LEASE_S);
+
+    msg[DHCP_OP] = DHCP_OP_REPLY;
+    memset(msg + DHCP_CIADDR, 0, 4);
+    memcpy(msg + DHCP_YIADDR, &address, 4);
+    memcpy(msg + DHCP_SIADDR, &own, 4);
+
+    uint8_t *p = msg + DHCP_OPTIONS;
+    p = put_option(p, DHCP_OPT_MESSAGE_TYPE, &type, 1);
+    p = put_option(p, DHCP_OPT_SERVER_ID, &own, 4);
+    if (type != DHCP_NAK) {
+        p = put_option(p, DHCP_OPT_SUBNET_MASK, &mask, 4);
+        p = put_option(p, DHCP_OPT_ROUTER, &own, 4);
+        p = put_option(p, DHCP_OPT_DNS, &own, 4);
+        p = put_option(p, DHCP_OPT_LEASE_TIME, &lease_s, 4);
+    }
+    *p++ = DHCP_OPT_END;
+
+    uint16_t len = (uint16_t)(p - msg);
+    struct pbuf *reply = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (!reply) {
+        return;
+    }
+    memcpy(reply->payload, msg, len);
+    udp_sendto_if(server_pcb, reply, IP_ADDR_BROADCAST, DHCP_CLIENT_PORT, server_netif);
+    pbuf_free(reply);
+}
+
+static void dhcp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    static uint8_t msg[DHCP_MESSAGE_MAX];
+    size_t len = pbuf_copy_partial(p, msg, sizeof(msg), 0);
+    pbuf_free(p);
+    if (len < DHCP_OPTIONS + 3 || msg[DHCP_OP] != DHCP_OP_REQUEST || get_u32(msg + DHCP_COOKIE) != DHCP_MAGIC_COOKIE) {
+        return;
+    }
+
+    uint8_t option_len = 0;
+    const uint8_t *type = find_option(msg, len, DHCP_OPT_MESSAGE_TYPE, &option_len);
+    if (!type || option_len != 1) {
+        return;
+    }
+    const uint8_t *mac = msg + DHCP_CHADDR;
+
+    switch (*type) {
+    case DHCP_DISCOVER: {
+        int lease = find_lease(mac, true);
+        if (lease < 0) {
+            printf("DHCP: No address left for %02x:%02x:%02x:%02x:%02x:%02x\n",
+                   mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            return;
+        }
+        send_reply(msg, DHCP_OFFER, lease_address(lease));
+        break;
+    }
+
+    case DHCP_REQUEST: {
+        int lease = find_lease(mac, true);
+        if (lease < 0) {
+            return;
+        }
+        // A client asking for an address of an earlier session is told to start over
+        uint32_t requested = 0;
+        const uint8_t *value = find_option(msg, len, DHCP_OPT_REQUESTED_IP, &option_len);
+        if (value && option_len == 4) {
+            memcpy(&requested, value, 4);
+        } else {
+            memcpy(&requested, msg + DHCP_CIADDR, 4);
+        }
+        if (requested != 0 && requested != lease_address(lease)) {
+            send_reply(msg, DHCP_NAK, 0);
+            return;
+        }
+        send_reply(msg, DHCP_ACK, lease_address(lease));
+        printf("DHCP: %02x:%02x:%02x:%02x:%02x:%02x got %s\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+               address_string(lease_address(lease)));
+        break;
+    }
+
+    case DHCP_RELEASE: {
+        int lease = find_lease(mac, false);
+        if (lease >= 0) {
+            leases[lease].used = false;
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+bool dhcp_server_start(struct netif *netif) {
+    if (server_pcb) {
+        return true;
+    }
+    server_pcb = udp_new();
+    if (!server_pcb) {
+        return false;
+    }
+    if (udp_bind(server_pcb, IP_ANY_TYPE, DHCP_SERVER_PORT) != ERR_OK) {
+        udp_remove(server_pcb);
+        server_pcb = NULL;
+        return false;
+    }
+    server_netif = netif;
+    memset(leases, 0, sizeof(leases));
+    udp_recv(server_pcb, dhcp_server_recv, NULL);
+    printf("DHCP: Serving %d addresses from %s\n", DHCP_SERVER_MAX_LEASES,
+           address_string(lease_address(0)));
+    return true;
+}
+
+void dhcp_server_stop(void) {
+    if (server_pcb) {
+        udp_remove(server_pcb);
+        server_pcb = NULL;
+        server_netif = NULL;
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef DHCP_SERVER_H
+#define DHCP_SERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lwip/netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Clients served at once; a new client takes the slot of a released lease
+#define DHCP_SERVER_MAX_LEASES 4
+
+// Host part of the first address given out, in the interface's subnet
+#define DHCP_SERVER_FIRST_HOST 16
+
+#define DHCP_SERVER_LEASE_S (24 * 60 * 60)
+
+// Minimal DHCP server for the access point interface, so a phone joining it
+// gets an address without configuration. Each client MAC gets a fixed
+// address from a small pool; the interface's own address is announced as
+// router and DNS server. Uses only lwIP, so it also runs in a host build.
+//
+// Must be called with the lwIP lock held.
+
+// Starts answering on netif, which must already have its address
+bool dhcp_server_start(struct netif *netif);
+
+void dhcp_server_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DHCP_SERVER_H
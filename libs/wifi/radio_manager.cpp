@@ -0,0 +1,123 @@
+#include "radio_manager.h"
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+static const char *const state_names[RADIO_STATE_COUNT] = {"off", "active", "power save", "idle"};
+
+static uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+RadioManager::RadioManager(myWIFI& wifi, uint32_t idle_timeout_ms)
+    : wifi(wifi), idle_timeout_ms(idle_timeout_ms) {
+}
+
+bool RadioManager::acquire(RadioUser user) {
+    if (this->state == RADIO_OFF) {
+        uint32_t start_ms = now_ms();
+        if (this->wifi.init() != 0) {
+            printf("RADIO: CYW43 failed to start\n");
+            return false;
+        }
+        this->power_ups++;
+        this->power_up_ms += now_ms() - start_ms;
+        printf("RADIO: Up in %lu ms\n", (unsigned long)(now_ms() - start_ms));
+    }
+    this->users |= 1u << user;
+    this->waiting &= ~(1u << user);
+    update();
+    return true;
+}
+
+void RadioManager::release(RadioUser user) {
+    this->users &= ~(1u << user);
+    this->waiting &= ~(1u << user);
+    update();
+}
+
+void RadioManager::setWaiting(RadioUser user, bool waiting) {
+    if (!isHeld(user)) {
+        return;
+    }
+    if (waiting) {
+        this->waiting |= 1u << user;
+    } else {
+        this->waiting &= ~(1u << user);
+    }
+    update();
+}
+
+void RadioManager::tick() {
+    if (this->state == RADIO_IDLE && now_ms() - this->state_since_ms >= this->idle_timeout_ms) {
+        printf("RADIO: No users for %lu s, shutting down\n", (unsigned long)(this->idle_timeout_ms / 1000));
+        shutdown();
+    }
+}
+
+void RadioManager::shutdown() {
+    this->users = 0;
+    this->waiting = 0;
+    if (this->state == RADIO_OFF) {
+        return;
+    }
+    this->wifi.stopAccessPoint();
+    this->wifi.powerDown();
+    cyw43_arch_deinit();
+    enterState(RADIO_OFF);
+    printStats();
+}
+
+// Picks the state for the current users while the radio is up
+void RadioManager::update() {
+    if (this->state == RADIO_OFF && this->users == 0) {
+        return;
+    }
+    RadioState next = RADIO_IDLE;
+    if (this->users != 0) {
+        next = this->waiting == this->users ? RADIO_POWER_SAVE : RADIO_ACTIVE;
+    }
+    if (next == this->state) {
+        return;
+    }
+
+    // Idle and waiting users sleep between beacons; the DTIM wake-ups keep
+    // the association and TCP connections alive
+    uint32_t pm = next == RADIO_ACTIVE ? CYW43_DEFAULT_PM : CYW43_AGGRESSIVE_PM;
+    if (this->state == RADIO_OFF || (this->state == RADIO_ACTIVE) != (next == RADIO_ACTIVE)) {
+        cyw43_wifi_pm(&cyw43_state, pm);
+    }
+    enterState(next);
+}
+
+void RadioManager::enterState(RadioState next) {
+    uint32_t now = now_ms();
+    this->residency_ms[this->state] += now - this->state_since_ms;
+    this->state_since_ms = now;
+    this->state = next;
+}
+
+uint32_t RadioManager::getResidencyMs(RadioState state) const {
+    uint32_t ms = this->residency_ms[state];
+    if (state == this->state) {
+        ms += now_ms() - this->state_since_ms;
+    }
+    return ms;
+}
+
+void RadioManager::printStats() const {
+    uint32_t total = 0;
+    for (int i = 0; i < RADIO_STATE_COUNT; i++) {
+        total += getResidencyMs((RadioState)i);
+    }
+    if (total == 0) {
+        total = 1;
+    }
+    printf("RADIO: %lu power-ups (avg %lu ms), residency", (unsigned long)this->power_ups,
+           (unsigned long)(this->power_ups ? this->power_up_ms / this->power_ups : 0));
+    for (int i = 0; i < RADIO_STATE_COUNT; i++) {
+        uint32_t ms = getResidencyMs((RadioState)i);
+        printf("%s %s %lu s (%.1f%%)", i == 0 ? "" : ",", state_names[i], (unsigned long)(ms / 1000),
+               ms * 100.0f / total);
+    }
+    printf("\n");
+}
@@ -0,0 +1,70 @@
+#ifndef RADIO_MANAGER_H
+#define RADIO_MANAGER_H
+
+#include <stdint.h>
+#include "wifi.h"
+
+// Parts of the firmware that need the radio. Each user holds it at most once.
+enum RadioUser : uint8_t {
+    RADIO_USER_UPLOAD = 0,       // Upload session, manual or automatic
+    RADIO_USER_AUTO_UPLOAD,      // Background scan and join of the auto upload
+    RADIO_USER_LOCAL_DOWNLOAD,   // Access point serving the stored records
+    RADIO_USER_COUNT
+};
+
+enum RadioState : uint8_t {
+    RADIO_OFF = 0,               // CYW43 deinitialized, no power drawn
+    RADIO_ACTIVE,                // A user is working; default power management
+    RADIO_POWER_SAVE,            // Every user is waiting; aggressive power management
+    RADIO_IDLE,                  // No users; aggressive power management until the idle timeout
+    RADIO_STATE_COUNT
+};
+
+// Brings the CYW43 up when the first user acquires it and shuts it down
+// completely (cyw43_arch_deinit) once it has had no users for the idle
+// timeout, so a quick second upload does not pay for a restart. While it is
+// up, the station interface sleeps between beacons whenever every user only
+// waits (aggressive PM) and stays responsive while one is working.
+class RadioManager {
+public:
+    RadioManager(myWIFI& wifi, uint32_t idle_timeout_ms);
+
+    // Powers the radio up if needed; returns false if the CYW43 failed to start
+    bool acquire(RadioUser user);
+    void release(RadioUser user);
+    bool isHeld(RadioUser user) const { return (users & (1u << user)) != 0; }
+
+    // A user that only waits (retry backoff, another user's upload) lets the
+    // radio save power until it works again
+    void setWaiting(RadioUser user, bool waiting);
+
+    // Call from the main loop; shuts the radio down after the idle timeout
+    void tick();
+
+    // Shuts the radio down now, dropping all users (e.g. before sleeping)
+    void shutdown();
+
+    RadioState getState() const { return state; }
+
+    // Time spent in a state since boot, including the current stay
+    uint32_t getResidencyMs(RadioState state) const;
+    uint32_t getPowerUpCount() const { return power_ups; }
+
+    void printStats() const;
+
+private:
+    myWIFI& wifi;
+    uint32_t idle_timeout_ms;
+    RadioState state = RADIO_OFF;
+    uint8_t users = 0;           // Bit per RadioUser holding the radio
+    uint8_t waiting = 0;         // Bit per RadioUser that only waits
+    uint32_t state_since_ms = 0;
+    uint32_t residency_ms[RADIO_STATE_COUNT] = {};
+    uint32_t power_ups = 0;
+    uint32_t power_up_ms = 0;    // Total time spent bringing the CYW43 up
+
+    void enterState(RadioState next);
+    void update();
+};
+
+#endif // RADIO_MANAGER_H
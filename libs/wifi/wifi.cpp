@@ -8,11 +8,46 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <string.h>
 #include "password.h"
+#include "dhcp_server.h"
 
 
 std::vector<std::string> scannedSSID;
 
+// Access points of known networks the last scan saw, for directed joins
+struct ScannedAP {
+    std::string ssid;
+    uint8_t bssid[6];
+    uint8_t channel;
+    int16_t rssi;
+    uint8_t auth_mode;   // Bit 1 WPA, bit 2 WPA2
+};
+static std::vector<ScannedAP> scannedAPs;
+
+// Set by the scan callback when a network from password.h is seen
+static volatile bool known_network_seen = false;
+
+static uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+// Strongest access point of ssid in the last scan, nullptr if none was seen
+static const ScannedAP* strongest_ap(const std::string& ssid) {
+    const ScannedAP* best = nullptr;
+    for (const auto& ap : scannedAPs) {
+        if (ap.ssid == ssid && (best == nullptr || ap.rssi > best->rssi)) {
+            best = &ap;
+        }
+    }
+    return best;
+}
+
+// Join auth for the security a scan reported; WPA2 unless only WPA is offered
+static uint32_t scan_auth(uint8_t auth_mode) {
+    return (auth_mode & 0x06) == 0x02 ? CYW43_AUTH_WPA_TKIP_PSK : CYW43_AUTH_WPA2_AES_PSK;
+}
+
 int myWIFI::getConnected() {
     return this->connected;
 }
@@ -82,8 +117,16 @@ int myWIFI::scanAndConnect() {
     cyw43_arch_enable_sta_mode();
     printf("[WIFI DEBUG] STA Mode active\n");
     
+    // The access point of the last connection is tried first, on its channel
+    // and without a scan
+    if (this->joinCached(WIFI_CACHED_JOIN_TIMEOUT_MS)) {
+        return 0;
+    }
+    uint32_t start_ms = now_ms();
+    
     // Clear previous scan results
     scannedSSID.clear();
+    scannedAPs.clear();
     printf("[WIFI DEBUG] Cleared previous scan results\n");
     
     cyw43_wifi_scan_options_t scan_options = {0};
@@ -217,6 +260,7 @@ int myWIFI::scanAndConnect() {
                 if (connect_result == 0) {
                     // Connection successful
                     printf("[WIFI DEBUG] Successfully connected to %s\n", SSID.at(i).c_str());
+                    this->joined(SSID.at(i), CYW43_AUTH_WPA2_AES_PSK, false, now_ms() - start_ms);
                     connected = true;
                     break;
                 } else {
@@ -315,6 +359,7 @@ int myWIFI::connect(std::string ssid, std::string pass) {
     this->trying_to_connect = false;
     
     if (this->connected == CYW43_LINK_UP) {
+        this->ssid = ssid;
         printf("[WIFI DEBUG] -------- Connection Successful --------\n");
         printf("[WIFI DEBUG] Connected to: %s\n", ssid.c_str());
         printf("[WIFI DEBUG] IP address: %s\n", ip4addr_ntoa(netif_ip_addr4(netif_default)));
@@ -361,6 +406,239 @@ void myWIFI::disconnect() {
     }
 }
 
+bool myWIFI::startScan(bool passive) {
+    if (cyw43_wifi_scan_active(&cyw43_state)) {
+        return false;
+    }
+    cyw43_arch_enable_sta_mode();
+    scannedSSID.clear();
+    scannedAPs.clear();
+    known_network_seen = false;
+    
+    cyw43_wifi_scan_options_t scan_options = {0};
+    scan_options.scan_type = passive ? 1 : 0;
+    int scan_start_result = cyw43_wifi_scan(&cyw43_state, &scan_options, nullptr, scan_result);
+    if (scan_start_result != 0) {
+        printf("[WIFI ERROR] Could not start WiFi Scan! Error: %d\n", scan_start_result);
+        return false;
+    }
+    return true;
+}
+
+bool myWIFI::isScanning() {
+    return cyw43_wifi_scan_active(&cyw43_state);
+}
+
+bool myWIFI::sawKnownNetwork() const {
+    return known_network_seen;
+}
+
+bool myWIFI::startJoinKnownNetwork() {
+    for (size_t i = 0; i < SSID.size(); i++) {
+        if (std::find(scannedSSID.begin(), scannedSSID.end(), SSID.at(i)) == scannedSSID.end()) {
+            continue;
+        }
+        printf("[WIFI DEBUG] Joining %s in the background...\n", SSID.at(i).c_str());
+        cyw43_arch_enable_sta_mode();
+        
+        // The scan found the access point, so the join skips its own scan
+        const ScannedAP* ap = strongest_ap(SSID.at(i));
+        uint32_t auth = ap ? scan_auth(ap->auth_mode) : CYW43_AUTH_WPA2_AES_PSK;
+        const std::string& pass = PASS.at(i);
+        if (cyw43_wifi_join(&cyw43_state, SSID.at(i).size(), (const uint8_t *)SSID.at(i).c_str(),
+                            pass.size(), (const uint8_t *)pass.c_str(), auth,
+                            ap ? ap->bssid : nullptr, ap ? ap->channel : CYW43_CHANNEL_NONE) == 0) {
+            this->joining_ssid = SSID.at(i);
+            this->joining_auth = auth;
+            this->join_start_ms = now_ms();
+            this->trying_to_connect = true;
+            return true;
+        }
+        printf("[WIFI ERROR] Could not start joining %s\n", SSID.at(i).c_str());
+    }
+    return false;
+}
+
+int myWIFI::pollJoin() {
+    int status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+    if (status == CYW43_LINK_UP) {
+        this->connected = CYW43_LINK_UP;
+        this->trying_to_connect = false;
+        printf("[WIFI DEBUG] Connected to: %s\n", this->joining_ssid.c_str());
+        this->joined(this->joining_ssid, this->joining_auth, false, now_ms() - this->join_start_ms);
+        return 1;
+    }
+    if (status == CYW43_LINK_FAIL || status == CYW43_LINK_NONET || status == CYW43_LINK_BADAUTH) {
+        printf("[WIFI ERROR] Joining %s failed (status=%d)\n", this->joining_ssid.c_str(), status);
+        this->connected = CYW43_LINK_DOWN;
+        this->trying_to_connect = false;
+        return -1;
+    }
+    return 0;
+}
+
+void myWIFI::powerDown() {
+    if (this->connected == CYW43_LINK_UP) {
+        disconnect();
+    } else {
+        cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+    }
+    this->trying_to_connect = false;
+    cyw43_arch_disable_sta_mode();
+    printf("[WIFI DEBUG] Station interface off\n");
+}
+
+bool myWIFI::startAccessPoint(const char* ssid, const char* password) {
+    if (this->ap_active) {
+        return true;
+    }
+    if (!cyw43_is_initialized(&cyw43_state)) {
+        printf("[WIFI ERROR] CYW43 not initialized, cannot open access point\n");
+        return false;
+    }
+    cyw43_arch_enable_ap_mode(ssid, password, password ? CYW43_AUTH_WPA2_AES_PSK : CYW43_AUTH_OPEN);
+    
+    cyw43_arch_lwip_begin();
+    bool dhcp_started = dhcp_server_start(&cyw43_state.netif[CYW43_ITF_AP]);
+    cyw43_arch_lwip_end();
+    if (!dhcp_started) {
+        printf("[WIFI ERROR] DHCP server failed to start\n");
+        cyw43_arch_disable_ap_mode();
+        return false;
+    }
+    this->ap_active = true;
+    printf("[WIFI DEBUG] Access point %s up at %s\n", ssid, getAccessPointAddress());
+    return true;
+}
+
+void myWIFI::stopAccessPoint() {
+    if (!this->ap_active) {
+        return;
+    }
+    cyw43_arch_lwip_begin();
+    dhcp_server_stop();
+    cyw43_arch_lwip_end();
+    cyw43_arch_disable_ap_mode();
+    this->ap_active = false;
+    printf("[WIFI DEBUG] Access point off\n");
+}
+
+const char* myWIFI::getAccessPointAddress() const {
+    return ip4addr_ntoa(netif_ip4_addr(&cyw43_state.netif[CYW43_ITF_AP]));
+}
+
+void myWIFI::setCachedAP(const WifiApCache& cache) {
+    this->ap_cache = cache;
+    this->ap_cache.ssid[sizeof(this->ap_cache.ssid) - 1] = '\0';
+    this->ap_cache_changed = false;
+    if (this->ap_cache.ssid[0] != '\0') {
+        printf("[WIFI DEBUG] Cached access point %02x:%02x:%02x:%02x:%02x:%02x of %s on channel %u\n",
+               cache.bssid[0], cache.bssid[1], cache.bssid[2], cache.bssid[3], cache.bssid[4], cache.bssid[5],
+               this->ap_cache.ssid, cache.channel);
+    }
+}
+
+// Joins the cached access point on its channel, waiting up to timeout_ms.
+// Returns false at once if nothing usable is cached.
+bool myWIFI::joinCached(uint32_t timeout_ms) {
+    if (this->ap_cache.ssid[0] == '\0' || this->ap_cache.channel == 0) {
+        return false;
+    }
+    // The network may have been removed from password.h since
+    auto known = std::find(SSID.begin(), SSID.end(), std::string(this->ap_cache.ssid));
+    if (known == SSID.end()) {
+        return false;
+    }
+    const std::string& ssid = *known;
+    const std::string& pass = PASS.at(known - SSID.begin());
+    
+    printf("[WIFI DEBUG] Directed join of %s on channel %u...\n", ssid.c_str(), this->ap_cache.channel);
+    cyw43_arch_enable_sta_mode();
+    uint32_t start_ms = now_ms();
+    int ret = cyw43_wifi_join(&cyw43_state, ssid.size(), (const uint8_t *)ssid.c_str(),
+                              pass.size(), (const uint8_t *)pass.c_str(), this->ap_cache.auth,
+                              this->ap_cache.bssid, this->ap_cache.channel);
+    int status = ret == 0 ? CYW43_LINK_JOIN : CYW43_LINK_FAIL;
+    while (ret == 0 && now_ms() - start_ms < timeout_ms) {
+        status = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+        if (status == CYW43_LINK_UP || status == CYW43_LINK_FAIL ||
+            status == CYW43_LINK_NONET || status == CYW43_LINK_BADAUTH) {
+            break;
+        }
+        cyw43_arch_poll();
+        sleep_ms(10);
+    }
+    
+    uint32_t elapsed_ms = now_ms() - start_ms;
+    if (status != CYW43_LINK_UP) {
+        printf("[WIFI DEBUG] Directed join of %s failed after %lu ms (status=%d), scanning instead\n",
+               ssid.c_str(), (unsigned long)elapsed_ms, status);
+        cyw43_wifi_leave(&cyw43_state, CYW43_ITF_STA);
+        this->directed_failures++;
+        this->connected = CYW43_LINK_DOWN;
+        return false;
+    }
+    this->connected = CYW43_LINK_UP;
+    this->trying_to_connect = false;
+    this->joined(ssid, this->ap_cache.auth, true, elapsed_ms);
+    printf("[WIFI DEBUG] IP address: %s\n", ip4addr_ntoa(netif_ip_addr4(netif_default)));
+    return true;
+}
+
+// Records a successful join and caches the access point it reached
+void myWIFI::joined(const std::string& ssid, uint32_t auth, bool directed, uint32_t elapsed_ms) {
+    this->ssid = ssid;
+    if (directed) {
+        this->directed_joins++;
+        this->directed_join_ms += elapsed_ms;
+    } else {
+        this->scan_joins++;
+        this->scan_join_ms += elapsed_ms;
+    }
+    printf("[WIFI DEBUG] Associated with %s in %lu ms (%s)\n", ssid.c_str(), (unsigned long)elapsed_ms,
+           directed ? "directed join" : "after a scan");
+    
+    // The channel comes from the scan that found the joined BSSID; a directed
+    // join keeps the cached one
+    WifiApCache cache = {};
+    strncpy(cache.ssid, ssid.c_str(), sizeof(cache.ssid) - 1);
+    cache.auth = auth;
+    if (directed) {
+        memcpy(cache.bssid, this->ap_cache.bssid, sizeof(cache.bssid));
+        cache.channel = this->ap_cache.channel;
+    } else {
+        const ScannedAP* ap = nullptr;
+        if (cyw43_wifi_get_bssid(&cyw43_state, cache.bssid) == 0) {
+            for (const auto& scanned : scannedAPs) {
+                if (memcmp(scanned.bssid, cache.bssid, sizeof(cache.bssid)) == 0) {
+                    ap = &scanned;
+                    break;
+                }
+            }
+        }
+        if (ap == nullptr) {
+            ap = strongest_ap(ssid);
+        }
+        if (ap == nullptr) {
+            return;     // Channel unknown; keep what is cached
+        }
+        memcpy(cache.bssid, ap->bssid, sizeof(cache.bssid));
+        cache.channel = ap->channel;
+    }
+    if (memcmp(&cache, &this->ap_cache, sizeof(cache)) != 0) {
+        this->ap_cache = cache;
+        this->ap_cache_changed = true;
+    }
+}
+
+void myWIFI::printJoinStats() const {
+    printf("[WIFI DEBUG] Joins: %lu directed (avg %lu ms, %lu fell back to a scan), %lu after a scan (avg %lu ms)\n",
+           (unsigned long)this->directed_joins,
+           (unsigned long)(this->directed_joins ? this->directed_join_ms / this->directed_joins : 0),
+           (unsigned long)this->directed_failures, (unsigned long)this->scan_joins,
+           (unsigned long)(this->scan_joins ? this->scan_join_ms / this->scan_joins : 0));
+}
+
 static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
     if(result) {
         char buffer[33];
@@ -369,6 +647,16 @@ static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
         while (!ssidString.empty() && std::isspace(ssidString.back())) {
             ssidString.pop_back();
         }
+        if (std::find(SSID.begin(), SSID.end(), ssidString) != SSID.end()) {
+            known_network_seen = true;
+            ScannedAP ap;
+            ap.ssid = ssidString;
+            memcpy(ap.bssid, result->bssid, sizeof(ap.bssid));
+            ap.channel = (uint8_t)result->channel;
+            ap.rssi = result->rssi;
+            ap.auth_mode = result->auth_mode;
+            scannedAPs.push_back(ap);
+        }
         scannedSSID.push_back(ssidString);
     }
 
@@ -417,6 +705,7 @@ bool myWIFI::connectToAP(const char* ssid, const char* password) {
         if (connect_result == 0) {
             printf("[WIFI DEBUG] Successfully connected to %s\n", ssid);
             this->connected = CYW43_LINK_UP;
+            this->ssid = ssid;
             return true;
         }
         
@@ -29,14 +29,47 @@
 #define DEBUG_WIFI(fmt, ...)
 #endif
 
+// A directed join that gets no answer on the cached channel gives up after
+// this long and falls back to a scan
+#define WIFI_CACHED_JOIN_TIMEOUT_MS 4000
+
+// Access point of the last successful connection, persisted by the caller so
+// the next join can go straight to its BSSID and channel without a scan
+#pragma pack(push, 1)
+struct WifiApCache {
+    char ssid[33];       // Empty if nothing is cached
+    uint8_t bssid[6];
+    uint8_t channel;     // 0 if unknown
+    uint32_t auth;       // CYW43_AUTH_* the join used
+};
+#pragma pack(pop)
 
 class myWIFI {
 private:
     bool trying_to_connect = false;
     int connected = CYW43_LINK_DOWN;
+    std::string ssid;   // Network of the last successful connection
+    std::string joining_ssid;
+    WifiApCache ap_cache = {};
+    bool ap_cache_changed = false;
+    uint32_t joining_auth = 0;
+    uint32_t join_start_ms = 0;
+    bool ap_active = false;
+    
+    // Association times, directed joins and joins after a scan
+    uint32_t directed_joins = 0;
+    uint32_t directed_join_ms = 0;
+    uint32_t directed_failures = 0;
+    uint32_t scan_joins = 0;
+    uint32_t scan_join_ms = 0;
+    
+    bool joinCached(uint32_t timeout_ms);
+    void joined(const std::string& ssid, uint32_t auth, bool directed, uint32_t elapsed_ms);
 public:
     myWIFI() = default;
     int getConnected();
+    // SSID of the network joined last, empty before the first connection
+    const std::string& getSSID() const { return ssid; }
     void poll();
     int init();
     int scanAndConnect();
@@ -44,6 +77,38 @@ public:
     void disconnect();
     void emergencyReset();
     bool connectToAP(const char* ssid, const char* password);
+
+    // Starts a scan and returns without waiting for it. A passive scan only
+    // listens for beacons instead of probing, which costs less power.
+    bool startScan(bool passive);
+    bool isScanning();
+    // A known network (password.h) was seen by the running or last scan
+    bool sawKnownNetwork() const;
+
+    // Starts joining the first known network the last scan saw; pollJoin()
+    // returns 1 once connected, -1 if the join failed, 0 while in progress
+    bool startJoinKnownNetwork();
+    int pollJoin();
+
+    // Leaves the network and switches the station interface off
+    void powerDown();
+    
+    // Opens an access point (WPA2, or open if password is NULL) with a DHCP
+    // server on it, next to the station interface
+    bool startAccessPoint(const char* ssid, const char* password);
+    void stopAccessPoint();
+    bool isAccessPointActive() const { return ap_active; }
+    // Own address on the access point, e.g. "192.168.4.1"
+    const char* getAccessPointAddress() const;
+    
+    // Cached access point, restored from flash at boot; cachedAPChanged() is
+    // true once a join has replaced it, until it is read again
+    void setCachedAP(const WifiApCache& cache);
+    const WifiApCache& getCachedAP() { ap_cache_changed = false; return ap_cache; }
+    bool cachedAPChanged() const { return ap_cache_changed; }
+    
+    // Association times of directed joins and of joins after a scan
+    void printJoinStats() const;
 };
 
 static int scan_result(void *env, const cyw43_ev_scan_result_t *result);
@@ -91,6 +91,21 @@
 #undef TCP_WND
 #define TCP_WND  16384
 
+/* Static memory layout: lwIP's own heap and fixed pools, never the C heap.
+ * The heap holds the copied TCP segments of a full send buffer and the
+ * altcp_tls state; mbedTLS allocates from the TLS arena (tls_arena.h). */
+#undef MEM_LIBC_MALLOC
+#define MEM_LIBC_MALLOC          0
+#define MEMP_MEM_MALLOC          0
+#undef MEM_SIZE
+#define MEM_SIZE                 (TCP_SND_BUF + 4096)
+
+/* Heap and pool high-water marks, reported after uploads */
+#undef MEM_STATS
+#define MEM_STATS                1
+#undef MEMP_STATS
+#define MEMP_STATS               1
+
 /* Enable ALTCP API */
 #define LWIP_ALTCP               1
 #define LWIP_ALTCP_TLS           1
@@ -100,6 +115,9 @@
 #define MEMP_NUM_ALTCP_PCB       16
 #define MEMP_NUM_SSL_PCB         16
 
+/* Keep mbedTLS on the TLS arena rather than the lwIP heap */
+#define ALTCP_MBEDTLS_PLATFORM_ALLOC 0
+
 /* Debug for ALTCP */
 #define ALTCP_MBEDTLS_DEBUG      LWIP_DBG_ON
 
@@ -19,4 +19,31 @@
 #define MBEDTLS_MD_C
 #define MBEDTLS_PK_C
 
+// Let servers resume sessions from a ticket, which CDN front ends accept far
+// more reliably than a session ID looked up in a per-server cache
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+// Ask for smaller records (tls_profile.h) and shrink the record buffers to
+// what was negotiated once the handshake is done
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+#define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+
+// Leave out what no current server needs, which also shortens the ClientHello:
+// static RSA key exchange and the small, Koblitz and Brainpool curves
+#undef MBEDTLS_KEY_EXCHANGE_RSA_ENABLED
+#undef MBEDTLS_ECP_DP_SECP192R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP224R1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP192K1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP224K1_ENABLED
+#undef MBEDTLS_ECP_DP_SECP256K1_ENABLED
+#undef MBEDTLS_ECP_DP_BP256R1_ENABLED
+#undef MBEDTLS_ECP_DP_BP384R1_ENABLED
+#undef MBEDTLS_ECP_DP_BP512R1_ENABLED
+
+// DTLS for CoAP uploads (coap_client.h)
+#define MBEDTLS_SSL_PROTO_DTLS
+
+// Allocate from the static TLS arena set with mbedtls_platform_set_calloc_free()
+#define MBEDTLS_PLATFORM_MEMORY
+
 #endif /* MBEDTLS_CONFIG_TLS_CLIENT_H */ 
\ No newline at end of file
@@ -4,6 +4,10 @@
 #include <math.h>
 #include <time.h>
 #include <vector>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <malloc.h>
 #include "pico/stdlib.h"
 #include "hardware/spi.h"
 #include "hardware/i2c.h"
@@ -26,6 +30,21 @@
 // Set to 1 to enable fake GPS data (for indoor testing)
 #define USE_FAKE_GPS 0
 
+// Set to 1 to replay a recorded NMEA log or GPX track instead of the receiver.
+// Load the file into flash at the playback offset, e.g.:
+//   picotool load -o 0x10180000 ride.nmea
+// GPS_PLAYBACK_SPEED N replays N times faster and collects data N times as often
+#define USE_GPS_PLAYBACK 0
+#define GPS_PLAYBACK_FLASH_OFFSET (1536 * 1024)  // Below the data storage area
+#define GPS_PLAYBACK_MAX_SIZE (256 * 1024)
+#define GPS_PLAYBACK_SPEED 1
+
+#if USE_GPS_PLAYBACK
+#define DATA_COLLECTION_TIME_SCALE GPS_PLAYBACK_SPEED
+#else
+#define DATA_COLLECTION_TIME_SCALE 1
+#endif
+
 // Debug helper defines to identify where code is getting stuck
 #define DEBUG_POINT(name) printf("DEBUG [%8lu ms]: %s\n", to_ms_since_boot(get_absolute_time()), name)
 #define DEBUG_LOOP_COUNT(var) static uint32_t var = 0; printf("DEBUG [%8lu ms]: Loop %s count %lu\n", to_ms_since_boot(get_absolute_time()), #var, ++var)
@@ -50,38 +69,47 @@ void check_for_hang();
 #include "libs/pas_co2/pas_co2.h"
 #include "libs/adc/adc.h"
 #include "libs/wifi/wifi.h"
+#include "libs/wifi/radio_manager.h"
 #include "libs/eInk/GUI/GUI_Paint.h"
 #include "libs/eInk/EPD_1in54_V2/EPD_1in54_V2.h"
 #include "libs/eInk/Fonts/fonts.h"
 #include "libs/gps/myGPS.h"
+#include "libs/gps/gps_playback.h"
 #include "libs/flash/flash.h"
+#include "libs/clock/gps_clock.h"
+#include "libs/track/track_encoder.h"
+#include "libs/track/position_filter.h"
+#include "libs/https/https_client.h"
+#include "libs/https/coap_client.h"
+#include "libs/https/tls_session.h"
+#include "libs/https/dns_cache.h"
+#include "libs/https/tls_arena.h"
+#include "libs/https/net_timing.h"
+#include "libs/https/download_server.h"
+#include "libs/https/http_body.h"
+#include "libs/https/sensor_json_body.h"
+#include "libs/https/sensor_cbor_body.h"
+#include "libs/https/deflate_body.h"
+#include "libs/https/batch_controller.h"
+#include "mbedtls/sha256.h"
 #include <cstdio>
 
 // Add this with other defines at the top of the file
 #define ENABLE_GPS_DEBUG 0  // Set to 1 to enable verbose GPS debugging
 
-// Time offset for system time (seconds since Jan 1, 1970)
-// We'll set this to a reasonable value to avoid 1970 timestamps
-static time_t time_offset = 0;
+// System clock: monotonic timebase disciplined from GPS RMC time, RTC kept in sync
+GpsClock gps_clock;
+
+// Used until GPS or the persisted state provide something better (2024-01-31 00:00:00 UTC)
+#define CLOCK_DEFAULT_EPOCH 1706745600
 
 // Custom time function to override weak time() from SDK
 extern "C" time_t time(time_t* t) {
-    time_t current = to_ms_since_boot(get_absolute_time()) / 1000 + time_offset;
+    time_t current = gps_clock.now();
     if (t) *t = current;
     return current;
 }
 
-// Function to set system time based on offset from 1970
-void set_system_time(time_t new_time) {
-    time_offset = new_time - (to_ms_since_boot(get_absolute_time()) / 1000);
-    // Print the updated system time
-    time_t current = time(NULL);
-    struct tm *timeinfo = gmtime(&current);
-    printf("System time set to: %04d-%02d-%02d %02d:%02d:%02d UTC\n",
-           timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
-           timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
-}
-
 // Flash and display constants
 #define I2C_PORT i2c0
 #define I2C_SDA 4
@@ -122,11 +150,117 @@ void set_system_time(time_t new_time) {
                                  "\"temp\":27.79,\"part_2_5\":2,\"part_5\":3,\"part_10\":55555555}" \
                                  "]}"
 #define TLS_CLIENT_TIMEOUT_SECS  6000
+#define UPLOAD_TOKEN "REPLACE_a6805463-2aff-4344-8dfa-6731b16f9154"
 
 // Set to 1 to upload all sensor data in a single batch instead of chunks
 #define UPLOAD_ALL_AT_ONCE 1  
-// Maximum number of records per batch when using bulk upload
-#define UPLOAD_MAX_BATCH_SIZE 1  // Extremely reduced to single record for absolute reliability
+// Records per upload request are tuned while uploading (batch_controller.h)
+// and remembered per WiFi network; an unknown network starts at
+// UPLOAD_BATCH_INITIAL. Responses slower than UPLOAD_BATCH_SLOW_RESPONSE_MS
+// shrink the batch, and no batch may exceed the server's body size limit.
+#define UPLOAD_BATCH_INITIAL 4
+#define UPLOAD_BATCH_MAX 250
+#define UPLOAD_BATCH_SLOW_RESPONSE_MS 3000
+#define UPLOAD_MAX_BODY_BYTES (4 * 1024 * 1024)  // Vercel functions take 4.5 MB
+#define UPLOAD_BATCH_NETWORKS 4                  // Networks a learned size is kept for
+
+// TLS handshake profile for uploads (libs/https/tls_profile.h). The
+// constrained profile only offers ECDHE-ECDSA P-256 with AES-128-GCM; if the
+// server refuses it, the rest of the session uses the default profile.
+#define UPLOAD_TLS_PROFILE TLS_PROFILE_CONSTRAINED
+
+// Set to 1 to upload over confirmable CoAP POSTs (libs/https/coap_client.h)
+// instead of HTTPS, to a CoAP server on UPLOAD_SERVER taking the same paths
+// and bodies. Bodies go block-wise in 1 KB datagrams, over DTLS with the same
+// TLS profile and key pins unless UPLOAD_COAP_DTLS is 0.
+#define UPLOAD_COAP 0
+#define UPLOAD_COAP_DTLS 1
+#if UPLOAD_COAP_DTLS
+#define UPLOAD_COAP_PORT COAPS_PORT
+#else
+#define UPLOAD_COAP_PORT COAP_PORT
+#endif
+
+// Store-and-forward: while the device runs, a passive scan every
+// AUTO_UPLOAD_SCAN_INTERVAL_MS looks for a known network. When one is in
+// range, the battery is at AUTO_UPLOAD_MIN_BATTERY percent or more and records
+// are waiting, it is joined in the background, the backlog is uploaded and
+// the radio is switched off again. Set AUTO_UPLOAD to 0 for manual uploads only.
+#define AUTO_UPLOAD 1
+#define AUTO_UPLOAD_SCAN_INTERVAL_MS 60000
+#define AUTO_UPLOAD_SCAN_TIMEOUT_MS 10000
+#define AUTO_UPLOAD_JOIN_TIMEOUT_MS 15000
+#define AUTO_UPLOAD_MIN_BATTERY 30
+#define AUTO_UPLOAD_MIN_RECORDS 1
+
+// The CYW43 is switched off completely (libs/wifi/radio_manager.h) once
+// nothing has needed it for this long; an upload started before then reuses
+// the connection instead of restarting the chip and joining again
+#define RADIO_IDLE_TIMEOUT_MS 30000
+
+// Local download without internet: a long press on the next page button
+// while the settings page is shown opens an access point with an HTTP server
+// (libs/https/download_server.h) that serves the stored records as CSV or as
+// stored, plus a status JSON; another long press there closes it. Uploads
+// wait while it is open, and records stay in RAM while the stored ones are
+// being sent, up to LOCAL_DOWNLOAD_BUFFER_MAX before the download is closed.
+// The WPA2 password is shown on the display; it is derived from the board ID
+// and LOCAL_DOWNLOAD_SECRET, which the build sets from PICO_EU_DOWNLOAD_SECRET.
+#define LOCAL_DOWNLOAD_PAGE 3
+#define LOCAL_DOWNLOAD_SSID_PREFIX "pico_eu-"    // Followed by the end of the board ID
+#define LOCAL_DOWNLOAD_PASSWORD_LENGTH 12        // 60 bits
+#define LOCAL_DOWNLOAD_PORT 80
+#define LOCAL_DOWNLOAD_BUFFER_MAX 120
+#ifndef LOCAL_DOWNLOAD_SECRET
+#error "LOCAL_DOWNLOAD_SECRET is not set; CMakeLists.txt sets it from PICO_EU_DOWNLOAD_SECRET"
+#endif
+// Chunked uploads share one keep-alive connection and pipeline their POSTs
+#define UPLOAD_CONNECT_TIMEOUT_MS 10000
+#define UPLOAD_RESPONSE_TIMEOUT_MS 10000
+// Uploads run in the background from the main loop. A range is tried this many
+// times without progress before it is left for the next upload; after
+// UPLOAD_CONNECT_ATTEMPTS failed connects the backup server is tried.
+// Reconnects back off from UPLOAD_RETRY_DELAY_MS, doubling per failure.
+#define UPLOAD_RANGE_ATTEMPTS 3
+#define UPLOAD_CONNECT_ATTEMPTS 2
+#define UPLOAD_RETRY_DELAY_MS 500
+#define UPLOAD_EVENT_QUEUE_SIZE 8
+#define UPLOAD_PROGRESS_DISPLAY_MS 10000
+// Keep the TLS session in flash so the first upload after a reboot can still
+// resume it instead of doing a full handshake
+#define TLS_SESSION_PERSIST 1
+
+// Track encoding for uploads: positions on a straight stretch are dropped if the
+// simplified track passes within TRACK_MAX_ERROR_M of them, and kept positions
+// are sent as deltas ("dlat"/"dlon", degrees * 1e7) to the previous position in
+// the body. The first one of each upload, and the first after a record without
+// a position, are absolute. Bodies name their schema
+// (sensor_body.h): 2 with track encoding, 1 with absolute positions on every
+// record. Off until the server decodes schema 2.
+#define UPLOAD_TRACK_DELTAS 0
+#define TRACK_MAX_ERROR_M 5.0f
+#if UPLOAD_TRACK_DELTAS
+#define UPLOAD_TRACK_MAX_ERROR_M TRACK_MAX_ERROR_M
+#else
+#define UPLOAD_TRACK_MAX_ERROR_M 0.0f
+#endif
+
+// Chunked uploads are sent as CBOR ("application/cbor", see sensor_cbor_body.h)
+// instead of JSON, deflated when that makes the chunk smaller. A server that
+// answers 415 gets JSON for the rest of the session. Set to 0 for JSON only.
+#define UPLOAD_BINARY 1
+#define UPLOAD_DEFLATE 1
+
+// Request payloads are built in one static arena (PayloadArena) of at most
+// this many bytes, checked at compile time, instead of on the main loop stack
+// or the heap
+#define UPLOAD_PAYLOAD_ARENA_MAX (24 * 1024)
+
+// A chunk prepared ahead is kept encoded in its body slot when it is at most
+// this long (UPLOAD_BATCH_MAX records of deflated CBOR), so sending it copies
+// bytes instead of encoding and deflating the records a second time. Longer
+// chunks are encoded again while they are sent.
+#define UPLOAD_PREPARED_BODY_MAX (8 * 1024)
 
 // Add bike mode constant to make it clear this is a bike-specific configuration
 #define BIKE_MODE 1
@@ -160,6 +294,7 @@ bool base_image_set = false;  // Tracks if we've set the base image for partial
 int refresh_counter = 0;     // Counter to track when to do a full refresh
 
 myWIFI wifi;
+RadioManager radio(wifi, RADIO_IDLE_TIMEOUT_MS);
 myADC batteryADC(ADC, 10);
 HM3301 hm3301_sensor(I2C_PORT, HM3301_ADDRESS, I2C_SDA, I2C_SCL);
 BME688 bme688_sensor(I2C_PORT, BME688_ADDRESS, I2C_SDA, I2C_SCL);
@@ -175,6 +310,46 @@ absolute_time_t gps_start_time;  // GPS start time for displaying time since fir
 int fix_status = 2;              // GPS fix status (0=valid, 2=invalid)
 int satellites_visible = 0;      // Number of satellites currently visible
 
+// Persisted GPS aiding state (last fix, UTC time, TTFF statistics)
+#define GPS_STATE_SAVE_INTERVAL_MS 600000  // Refresh the persisted fix every 10 minutes
+GpsAidingState gps_aiding_state;
+bool gps_aiding_state_valid = false;   // Loaded from flash or filled by a fix this boot
+bool gps_ttff_recorded = false;        // TTFF of this boot already added to the statistics
+uint32_t last_gps_state_save_ms = 0;
+
+#if TLS_SESSION_PERSIST
+tls_session_record_t tls_session_record;   // Staging buffer for the persisted TLS session
+#endif
+
+// Stored records before this index were acknowledged by the server and are
+// skipped by later uploads. The last acknowledged record is kept as a
+// fingerprint, so an erased or rewritten storage resets the cursor.
+struct UploadCursor {
+    uint32_t acknowledged;
+    uint32_t last_timestamp;
+    uint32_t last_latitude;
+    uint32_t last_longitude;
+};
+
+// Sequence number of stored record 0; record i is sent as first_stored + i.
+// It only grows, by the records each erase removes, so a number is never
+// given to two different records and the server can drop repeated ones.
+struct UploadSequence {
+    uint32_t first_stored;
+};
+
+// Learned upload batch size per WiFi network, most recently used first
+struct UploadBatchSizes {
+    struct {
+        char ssid[33];
+        uint8_t reserved;
+        uint16_t batch_size;     // 0 for an unused entry
+    } networks[UPLOAD_BATCH_NETWORKS];
+};
+
+// Smooths GPS fixes so sensor samples are geo-tagged at the time they were taken
+PositionFilter position_filter;
+
 // Variables for sensor data storage
 SensorData sensor_data_obj = {0,0,0,0,0,0,0,0,0,0,0};
 std::vector<SensorData> sensor_data;
@@ -200,6 +375,9 @@ bool initializationComplete = false; // Overall initialization state
 
 // Forward declaration
 void displayUploadStatus(const char* msg);
+void prefetchUploadHosts();
+bool isUploadRunning();
+void stopLocalDownload();
 
 // Forward declaration
 void displayPage(int page, absolute_time_t gps_start_time, int fix_status, int satellites_visible, bool is_fake_gps);
@@ -921,171 +1099,107 @@ void prepareDataForTransmission(const SensorData& data, char* json_buffer, size_
              data.pm10);
 }
 
-// Format multiple sensor data records as a JSON array for transmission
-void prepareBatchDataForTransmission(const std::vector<SensorData>& data_vec, char* json_buffer, size_t buffer_size, myGPS& gps) {
-    if (!json_buffer || buffer_size < 100) {
-        printf("[UPLOAD] ERROR: Invalid buffer provided for JSON data\n");
-        if (json_buffer && buffer_size > 0) {
-            json_buffer[0] = '\0'; // Zero the buffer if it exists
-        }
-        return;
-    }
-    
-    // Track how many records we've processed and will process
-    size_t total_records = data_vec.size();
-    if (total_records == 0) {
-        printf("[UPLOAD] ERROR: No records provided for transmission\n");
-        json_buffer[0] = '\0';
-        return;
-    }
-    
-    printf("[UPLOAD] Processing %lu records for transmission (max buffer size: %lu bytes)\n", 
-           total_records, buffer_size);
-    
-    // Start with the opening part of the JSON
-    int written = snprintf(json_buffer, buffer_size,
-                         "{\"token\":\"REPLACE_a6805463-2aff-4344-8dfa-6731b16f9154\","
-                         "\"measurements\":[");
-    
-    size_t remaining = buffer_size - written;
-    char* current_pos = json_buffer + written;
-    
-    // Get the current time once for all records to prevent repeated GPS queries
-    time_t current_time = time(NULL);
-    struct tm *timeinfo = gmtime(&current_time);
-    
-    // Format a single timestamp to use if GPS time isn't available
-    char default_timestamp[64];
-    snprintf(default_timestamp, sizeof(default_timestamp), 
-             "%04d-%02d-%02d %02d:%02d:%02d+00:00",
-             timeinfo->tm_year + 1900, 
-             timeinfo->tm_mon + 1, 
-             timeinfo->tm_mday,
-             timeinfo->tm_hour, 
-             timeinfo->tm_min, 
-             timeinfo->tm_sec);
-    
-    printf("[UPLOAD] Using default timestamp if needed: %s\n", default_timestamp);
-    
-    // Get GPS position and date information once before processing records
-    std::string gps_line_save;
-    double lon_save = 0, lat_save = 0;
-    char ns_save = ' ', ew_save = ' ';
-    std::string time_str_save;
-    std::string date_str_save;
+// Fallback time and position for records stored without them, read once per upload
+SensorBody::Fallback getUploadFallback(myGPS& gps) {
+    SensorBody::Fallback fallback;
+    fallback.epoch = gps_clock.now();
     
-    // Try to get time from GPS (only once)
-    bool valid_gps_data = (gps.readLine(gps_line_save, lon_save, ew_save, lat_save, ns_save, time_str_save, date_str_save) == 0);
+    std::string gps_line;
+    double lon = 0, lat = 0;
+    char ns = ' ', ew = ' ';
+    std::string time_str;
+    std::string date_str;
     
-    if (valid_gps_data) {
+    if (gps.readLine(gps_line, lon, ew, lat, ns, time_str, date_str) == 0) {
         printf("[UPLOAD] Using valid GPS data: Lat=%f%c, Long=%f%c, Time=%s, Date=%s\n", 
-               lat_save, ns_save, lon_save, ew_save, time_str_save.c_str(), date_str_save.c_str());
+               lat, ns, lon, ew, time_str.c_str(), date_str.c_str());
+        fallback.latitude = (ns == 'S') ? -lat : lat;
+        fallback.longitude = (ew == 'W') ? -lon : lon;
     } else {
         // If failed to get GPS data, use fake data for demonstration
         printf("FAKE GPS: Position: 48.206640,N 15.617299,E (random variation)\n");
-        lat_save = 48.206640 + ((float)rand() / RAND_MAX - 0.5) * 0.0005;  // Small random variation
-        lon_save = 15.617299 + ((float)rand() / RAND_MAX - 0.5) * 0.0005;  // Small random variation
-        ns_save = 'N';
-        ew_save = 'E';
-        time_str_save = default_timestamp;
-        date_str_save = "010224";  // 2024-02-01 in DDMMYY format
-    }
-    
-    // Process each record
-    size_t processed_count = 0;
-    
-    for (const auto& data : data_vec) {
-        // Check if we have enough space for a record (approximate estimate)
-        if (remaining < 400) {
-            printf("[UPLOAD] WARNING: Buffer approaching capacity - truncating to %lu/%lu records\n", 
-                   processed_count, total_records);
-            break;
-        }
-        
-        // Add a comma if this isn't the first record
-        if (processed_count > 0) {
-            written = snprintf(current_pos, remaining, ",");
-            remaining -= written;
-            current_pos += written;
-        }
-        
-        // Format timestamp using GPS time if available, default if not
-        char formatted_timestamp[64];
-        if (data.timestamp != 0) {
-            // Use the timestamp from the record
-            time_t record_time = data.timestamp;
-            struct tm *record_timeinfo = gmtime(&record_time);
-            snprintf(formatted_timestamp, sizeof(formatted_timestamp), 
-                     "%04d-%02d-%02d %02d:%02d:%02d+00:00",
-                     record_timeinfo->tm_year + 1900, 
-                     record_timeinfo->tm_mon + 1, 
-                     record_timeinfo->tm_mday,
-                     record_timeinfo->tm_hour, 
-                     record_timeinfo->tm_min, 
-                     record_timeinfo->tm_sec);
-        } else {
-            // Use the default timestamp
-            strncpy(formatted_timestamp, default_timestamp, sizeof(formatted_timestamp));
-        }
-        
-        // Add this record to the JSON
-        written = snprintf(current_pos, remaining,
-                         "{\"timestamp\":\"%s\","
-                         "\"latitude\":%f,"
-                         "\"longitude\":%f,"
-                         "\"temperature\":%f,"
-                         "\"humidity\":%f,"
-                         "\"pressure\":%f,"
-                         "\"pm25\":%u,"
-                         "\"gasResistance\":%f,"
-                         "\"pm10\":%u,"
-                         "\"co2\":%u}",
-                         formatted_timestamp,
-                         data.latitude != 0 ? data.latitude / 1000000.0 : lat_save,
-                         data.longitude != 0 ? data.longitude / 1000000.0 : lon_save,
-                         data.temp,
-                         data.hum,
-                         data.pres,
-                         data.pm2_5,
-                         data.gasRes,
-                         data.pm10,
-                         data.co2);
-        
-        // Ensure we didn't overflow the buffer
-        if (written >= remaining) {
-            printf("[UPLOAD] ERROR: Buffer exceeded while adding record %lu\n", processed_count + 1);
-            // Terminate properly, but stop adding more records
-            strcpy(current_pos, "]}"); // Close the incomplete array and object
-            return;
-        }
-        
-        remaining -= written;
-        current_pos += written;
-        processed_count++;
-        
-        // Periodically report progress
-        if (processed_count % 5 == 0 || processed_count == total_records) {
-            printf("[UPLOAD] Processed %lu/%lu records (remaining buffer: %lu bytes)\n", 
-                   processed_count, total_records, remaining);
-        }
+        fallback.latitude = 48.206640 + ((float)rand() / RAND_MAX - 0.5) * 0.0005;  // Small random variation
+        fallback.longitude = 15.617299 + ((float)rand() / RAND_MAX - 0.5) * 0.0005;  // Small random variation
     }
+    return fallback;
+}
+
+// Board unique ID in hex, sent with every upload
+char board_id[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+
+// Upload encoding of the current session; cleared when the server refuses
+// CBOR and set again by startUploadSession(), so a 415 does not last until reboot
+static bool upload_binary = UPLOAD_BINARY;
+
+// One chunk's body in the current upload encoding. The encoders are built in
+// place in the body's own storage, which every chunk reuses.
+struct UploadBody {
+    SensorBody* records = nullptr;
+    DeflateBody* deflated = nullptr;
+    http_body_source_t* source = nullptr;
+    const char* content_type = nullptr;
+    const char* content_encoding = nullptr;
+    alignas(8) uint8_t records_storage[std::max(sizeof(SensorJsonBody), sizeof(SensorCborBody))];
+#if UPLOAD_DEFLATE
+    alignas(8) uint8_t deflate_storage[sizeof(DeflateBody)];
+#endif
+    http_string_body_t encoded_body;        // Reads encoded[] once the body is captured
+    char encoded[UPLOAD_PREPARED_BODY_MAX];
     
-    // Close the JSON array and object
-    written = snprintf(current_pos, remaining, "]}");
-    
-    // Ensure null termination
-    if (written >= remaining) {
-        json_buffer[buffer_size - 1] = '\0';
-        printf("[UPLOAD] WARNING: Final JSON may be truncated\n");
+    void reset() {
+        if (deflated) {
+            deflated->~DeflateBody();
+            deflated = nullptr;
+        }
+        if (records) {
+            records->~SensorBody();
+            records = nullptr;
+        }
+        source = nullptr;
+    }
+};
+
+// Every request payload is built here. The upload session alternates between
+// the two bodies.
+struct PayloadArena {
+    UploadBody bodies[2];
+};
+
+static_assert(sizeof(PayloadArena) <= UPLOAD_PAYLOAD_ARENA_MAX, "Payload arena exceeds UPLOAD_PAYLOAD_ARENA_MAX");
+
+PayloadArena payload_arena;
+
+void makeUploadBody(UploadBody& body, const SensorData* records, size_t count, uint32_t first_sequence,
+                    const SensorBody::Fallback& fallback, bool binary) {
+    SensorBody::Origin origin = {board_id, first_sequence};
+    body.reset();
+    body.content_encoding = nullptr;
+    if (!binary) {
+        body.records = new (body.records_storage) SensorJsonBody(records, count, UPLOAD_TOKEN, origin, fallback,
+                                                                 UPLOAD_TRACK_MAX_ERROR_M);
+        body.source = body.records;
+        body.content_type = "application/json";
+        return;
     }
-    
-    size_t final_size = strlen(json_buffer);
-    printf("[UPLOAD] Final JSON payload: %lu bytes with %lu records\n", final_size, processed_count);
-    
-    // Add warning if payload is large
-    if (final_size > 5000) {
-        printf("[UPLOAD] WARNING: Large payload size (%lu bytes) - transmission may be unstable\n", final_size);
+
+    body.records = new (body.records_storage) SensorCborBody(records, count, UPLOAD_TOKEN, origin, fallback,
+                                                             UPLOAD_TRACK_MAX_ERROR_M);
+    body.source = body.records;
+    body.content_type = "application/cbor";
+#if UPLOAD_DEFLATE
+    // Small chunks can grow by the zlib framing; send those as they are
+    body.deflated = new (body.deflate_storage) DeflateBody(body.records);
+    if (body.deflated->getLength() < body.records->getLength()) {
+        body.source = body.deflated;
+        body.content_encoding = "deflate";
+    } else {
+        body.deflated->~DeflateBody();
+        body.deflated = nullptr;
     }
+#endif
+    printf("[UPLOAD] %lu records as %lu bytes of %s%s (%.1f bytes/record)\n",
+           (unsigned long)count, (unsigned long)body.source->length, body.content_type,
+           body.content_encoding ? " + deflate" : "", count ? (float)body.source->length / count : 0.0f);
 }
 
 // Save the data buffer before sleeping
@@ -1107,10 +1221,217 @@ void saveBufferBeforeSleep() {
     }
 }
 
+// Discipline the system clock from the latest GPS RMC time
+void updateClockFromGps(myGPS& gps) {
+    uint32_t rmc_utc;
+    uint64_t rmc_capture_us;
+    if (!gps.takeRmcTime(rmc_utc, rmc_capture_us) || !gps_clock.discipline(rmc_utc, rmc_capture_us)) {
+        return;
+    }
+    
+    // First sync: records still in RAM were stamped from the fallback clock,
+    // shift them by the same step so they carry exact UTC
+    int64_t step_us = gps_clock.getSyncStepUs();
+    int32_t step_s = (int32_t)((step_us >= 0 ? step_us + 500000 : step_us - 500000) / 1000000);
+    int corrected = 0;
+    for (auto& record : data_buffer) {
+        if (record.time_unsynced) {
+            record.timestamp += step_s;
+            record.time_unsynced = false;
+            corrected++;
+        }
+    }
+    if (corrected > 0) {
+        printf("CLOCK: Corrected %d buffered records by %ld s\n", corrected, (long)step_s);
+    }
+}
+
+// Feed the latest decoded GPS fix into the position filter
+void updatePositionFilter(myGPS& gps) {
+    int32_t lat_e7, lon_e7;
+    uint64_t capture_us;
+    if (gps.takeFix(lat_e7, lon_e7, capture_us)) {
+        position_filter.update(lat_e7, lon_e7, (uint32_t)(capture_us / 1000));
+    }
+}
+
+// Persist the last fix and time so the next boot can hot/warm start the receiver
+void saveGpsAidingState() {
+    if (!gps_aiding_state_valid || gps_aiding_state.utc_epoch == 0) {
+        return;
+    }
+    
+    if (flash_storage.saveState(FLASH_STATE_GPS, &gps_aiding_state, sizeof(gps_aiding_state))) {
+        last_gps_state_save_ms = to_ms_since_boot(get_absolute_time());
+    }
+}
+
+// Restore the TLS session of the last boot
+void loadTlsSession() {
+#if TLS_SESSION_PERSIST
+    if (flash_storage.loadState(FLASH_STATE_TLS_SESSION, &tls_session_record, sizeof(tls_session_record))) {
+        tls_session_import(&tls_session_record);
+    }
+#endif
+}
+
+// Persist the TLS session after a full handshake replaced it; resumed
+// handshakes don't write flash
+void saveTlsSession() {
+    tls_session_print_stats();
+#if TLS_SESSION_PERSIST
+    if (tls_session_needs_save() && tls_session_export(&tls_session_record)) {
+        flash_storage.saveState(FLASH_STATE_TLS_SESSION, &tls_session_record, sizeof(tls_session_record));
+    }
+#endif
+}
+
+// Restore the access point of the last boot, for a directed join without a scan
+void loadWifiAp() {
+    WifiApCache cache;
+    if (flash_storage.loadState(FLASH_STATE_WIFI_AP, &cache, sizeof(cache))) {
+        wifi.setCachedAP(cache);
+    }
+}
+
+// Persist the access point after a join reached a different one
+void saveWifiAp() {
+    wifi.printJoinStats();
+    if (wifi.cachedAPChanged()) {
+        flash_storage.saveState(FLASH_STATE_WIFI_AP, &wifi.getCachedAP(), sizeof(WifiApCache));
+    }
+}
+
+// Number of leading records the server already acknowledged, 0 if the cursor
+// does not belong to these records
+size_t loadUploadCursor(const std::vector<SensorData>& records) {
+    UploadCursor cursor;
+    if (!flash_storage.loadState(FLASH_STATE_UPLOAD_CURSOR, &cursor, sizeof(cursor)) ||
+        cursor.acknowledged == 0 || cursor.acknowledged > records.size()) {
+        return 0;
+    }
+    const SensorData& last = records[cursor.acknowledged - 1];
+    if (last.timestamp != cursor.last_timestamp || last.latitude != cursor.last_latitude ||
+        last.longitude != cursor.last_longitude) {
+        printf("[UPLOAD] Upload cursor does not match the stored records, starting over\n");
+        return 0;
+    }
+    return cursor.acknowledged;
+}
+
+void saveUploadCursor(const std::vector<SensorData>& records, size_t acknowledged) {
+    UploadCursor cursor = {};
+    cursor.acknowledged = acknowledged;
+    if (acknowledged > 0) {
+        const SensorData& last = records[acknowledged - 1];
+        cursor.last_timestamp = last.timestamp;
+        cursor.last_latitude = last.latitude;
+        cursor.last_longitude = last.longitude;
+    }
+    flash_storage.saveState(FLASH_STATE_UPLOAD_CURSOR, &cursor, sizeof(cursor));
+}
+
+uint32_t loadUploadSequence() {
+    UploadSequence sequence;
+    if (!flash_storage.loadState(FLASH_STATE_UPLOAD_SEQUENCE, &sequence, sizeof(sequence))) {
+        return 0;
+    }
+    return sequence.first_stored;
+}
+
+// Call before erasing stored records: if the erase is interrupted the
+// numbers of the erased records are skipped, never reused
+void advanceUploadSequence(size_t erased) {
+    UploadSequence sequence = {loadUploadSequence() + (uint32_t)erased};
+    flash_storage.saveState(FLASH_STATE_UPLOAD_SEQUENCE, &sequence, sizeof(sequence));
+}
+
+// Batch size learned on this network, UPLOAD_BATCH_INITIAL if there is none
+uint16_t loadUploadBatchSize(const std::string& ssid) {
+    UploadBatchSizes sizes;
+    if (!ssid.empty() && flash_storage.loadState(FLASH_STATE_UPLOAD_BATCH, &sizes, sizeof(sizes))) {
+        for (const auto& network : sizes.networks) {
+            if (network.batch_size > 0 && ssid == network.ssid) {
+                return network.batch_size;
+            }
+        }
+    }
+    return UPLOAD_BATCH_INITIAL;
+}
+
+void saveUploadBatchSize(const std::string& ssid, uint16_t batch_size) {
+    if (ssid.empty()) {
+        return;
+    }
+    UploadBatchSizes sizes;
+    if (!flash_storage.loadState(FLASH_STATE_UPLOAD_BATCH, &sizes, sizeof(sizes))) {
+        memset(&sizes, 0, sizeof(sizes));
+    }
+    
+    // Move this network to the front; the least recently used one drops out
+    int index = UPLOAD_BATCH_NETWORKS - 1;
+    for (int i = 0; i < UPLOAD_BATCH_NETWORKS; i++) {
+        if (sizes.networks[i].batch_size > 0 && ssid == sizes.networks[i].ssid) {
+            index = i;
+            break;
+        }
+    }
+    memmove(&sizes.networks[1], &sizes.networks[0], index * sizeof(sizes.networks[0]));
+    memset(&sizes.networks[0], 0, sizeof(sizes.networks[0]));
+    strncpy(sizes.networks[0].ssid, ssid.c_str(), sizeof(sizes.networks[0].ssid) - 1);
+    sizes.networks[0].batch_size = batch_size;
+    flash_storage.saveState(FLASH_STATE_UPLOAD_BATCH, &sizes, sizeof(sizes));
+}
+
+// Records of a 2xx response that count as stored: all of them unless the
+// server reported fewer
+size_t acknowledgedRecords(size_t sent, int32_t accepted) {
+    return (accepted < 0 || (size_t)accepted > sent) ? sent : (size_t)accepted;
+}
+
+// Record a valid fix in the aiding state, log TTFF once per boot and persist periodically
+void updateGpsAidingState(myGPS& gps, double lat, char ns, double lon, char ew) {
+    uint32_t fix_utc;
+    if (gps.isFakeGPSEnabled() || gps.isPlaybackEnabled() || !gps.getUtcEpoch(fix_utc)) {
+        return; // Simulated/replayed fixes and fixes without a date are useless as aiding
+    }
+    
+    gps_aiding_state.latitude_e7 = (int32_t)((ns == 'S' ? -lat : lat) * 10000000);
+    gps_aiding_state.longitude_e7 = (int32_t)((ew == 'W' ? -lon : lon) * 10000000);
+    gps_aiding_state.utc_epoch = fix_utc;
+    gps_aiding_state_valid = true;
+    
+    bool save_now = false;
+    if (!gps_ttff_recorded && gps.getTimeToFirstFixMs() >= 0) {
+        GpsStartType type = gps.getLastStartType();
+        gps_aiding_state.ttff_count[type]++;
+        gps_aiding_state.ttff_total_ms[type] += gps.getTimeToFirstFixMs();
+        gps_ttff_recorded = true;
+        save_now = true;
+        
+        printf("GPS TTFF: %ld ms (%s start)\n", (long)gps.getTimeToFirstFixMs(), myGPS::startTypeName(type));
+        for (int t = 0; t < GPS_START_TYPE_COUNT; t++) {
+            if (gps_aiding_state.ttff_count[t] > 0) {
+                printf("GPS TTFF average (%s start): %lu ms over %lu starts\n",
+                       myGPS::startTypeName((GpsStartType)t),
+                       gps_aiding_state.ttff_total_ms[t] / gps_aiding_state.ttff_count[t],
+                       gps_aiding_state.ttff_count[t]);
+            }
+        }
+    }
+    
+    uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+    if (save_now || now_ms - last_gps_state_save_ms >= GPS_STATE_SAVE_INTERVAL_MS) {
+        saveGpsAidingState();
+    }
+}
+
 // Enter low power sleep mode
 void enterSleepMode() {
-    // First save any buffered data to flash
+    // First save any buffered data to flash, with nothing reading it
+    stopLocalDownload();
     saveBufferBeforeSleep();
+    saveGpsAidingState();
     
     // Display sleep notification
     resetImageBuffer();
@@ -1120,6 +1441,7 @@ void enterSleepMode() {
     EPD_1IN54_V2_Display(ImageBuffer);
     
     // Disable all peripherals that consume power
+    radio.shutdown();
     printf("Entering sleep mode...\n");
     sleep_ms(500); // Ensure the message is printed
     
@@ -1207,360 +1529,13 @@ void setFastRefreshMode(bool enable) {
 volatile uint32_t btn1_events = 0;  // Add missing variable for button events
 #define SAVE_INTERVAL_MS 180000  // Add missing constant for save interval (3 minutes instead of 60 seconds)
 
-// Add a super simple direct HTTP upload function for maximum reliability and speed
-bool uploadDataDirectHTTP(const char* json_data) {
-    if (!json_data || strlen(json_data) == 0) {
-        printf("ERROR: Invalid JSON data for direct HTTP upload\n");
-        return false;
-    }
-    
-    // Check if WiFi is connected
-    if (wifi.getConnected() != CYW43_LINK_UP) {
-        printf("ERROR: WiFi not connected for direct HTTP upload\n");
-        return false;
-    }
-    
-    // Simple IP address for the server (hardcoded from previous DNS resolution)
-    uint32_t server_ip = IPADDR4_INIT_BYTES(76, 76, 21, 21); // gm4s.eu
-    
-    printf("FAST UPLOAD: Using direct IP 76.76.21.21 (gm4s.eu)\n");
-    displayUploadStatus("Fast direct upload");
-    
-    // Construct a minimal HTTP request
-    size_t json_size = strlen(json_data);
-    char request_buffer[15360];
-    snprintf(request_buffer, sizeof(request_buffer),
-           "POST /api/addMarkers HTTP/1.1\r\n"
-           "Host: gm4s.eu\r\n"
-           "Content-Type: application/json\r\n"
-           "Content-Length: %lu\r\n"
-           "Connection: close\r\n"
-           "\r\n"
-           "%s",
-           json_size, json_data);
-    
-    printf("FAST UPLOAD: Request prepared (%lu bytes)\n", strlen(request_buffer));
-    
-    // Use WiFi library to send a raw UDP packet to port 80
-    // This is a simplification and won't actually work as HTTP/TCP, but demonstrates the approach
-    printf("FAST UPLOAD: Attempting direct upload...\n");
-    
-    // Instead of trying to implement a full TCP client, we'll use TLS client
-    // with very short timeout as it's already implemented and tested
-    bool result = run_tls_client_test(NULL, 0, "gm4s.eu", request_buffer, 6000);
-    
-    if (result) {
-        printf("FAST UPLOAD: Direct upload succeeded!\n");
-        displayUploadStatus("Fast upload OK!");
-        return true;
-    } else {
-        printf("FAST UPLOAD: Direct upload failed, but continuing anyway\n");
-        displayUploadStatus("Fast upload sent");
-        
-        // We'll return true anyway to keep the data flow moving
-        // This is a "fire and forget" approach - we assume it worked
-        return true;
-    }
-}
-
-// Modify uploadDataWithRetry to try the direct HTTP upload first for maximum speed
-bool uploadDataWithRetry(const char* json_data, int max_retries, int retry_delay_ms) {
-    // Add better input validation
-    if (!json_data) {
-        printf("ERROR: JSON data is NULL\n");
-        return false;
-    }
-    
-    size_t json_size = strlen(json_data);
-    if (json_size == 0) {
-        printf("ERROR: JSON data is empty\n");
-        return false;
-    }
-    
-    if (json_size > 15000) {
-        printf("ERROR: JSON data size (%lu bytes) exceeds maximum allowed (15000 bytes)\n", json_size);
-        return false;
-    }
-    
-    // Basic JSON validation - check for opening/closing braces
-    if (json_data[0] != '{' || json_data[json_size-1] != '}') {
-        printf("ERROR: JSON data appears to be malformed (does not start with { and end with })\n");
-        printf("JSON starts with: %.20s...\n", json_data);
-        printf("JSON ends with: ...%.20s\n", json_data + (json_size > 20 ? json_size - 20 : 0));
-        return false;
-    }
-    
-    printf("Prepared HTTP request with %d bytes of JSON data\n", (int)json_size);
-    
-    // Try a faster approach first - direct TLS connection to the server with a short timeout
-    printf("OPTIMIZED: Trying fast upload first...\n");
-    displayUploadStatus("Fast upload...");
-    
-    // Format a more streamlined request for direct upload
-    char fast_request[15360];
-    snprintf(fast_request, sizeof(fast_request),
-           "POST /api/addMarkers HTTP/1.1\r\n"
-           "Host: gm4s.eu\r\n"  // Always use domain without www for faster DNS
-           "Content-Type: application/json\r\n"
-           "Content-Length: %lu\r\n"
-           "Connection: close\r\n"
-           "\r\n"
-           "%s",
-           json_size, json_data);
-    
-    // Try the fastest upload method with the direct domain and short timeout
-    bool fast_success = run_tls_client_test(NULL, 0, "gm4s.eu", fast_request, 6000);
-    
-    if (fast_success) {
-        printf("OPTIMIZED: Fast upload succeeded!\n");
-        displayUploadStatus("Upload success!");
-        sleep_ms(1000);
-        return true;
-    }
-    
-    printf("OPTIMIZED: Fast upload failed, trying normal method\n");
-    displayUploadStatus("Trying again...");
-    
-    // Prepare the HTTP request (15K max buffer)
-    char request_buffer[15000];
-    
-    // Format the request with proper headers - MORE MODERN VERSION
-    // Add User-Agent, Accept headers, and use HTTP/1.1 explicitly
-    // Updated for Vercel compatibility with more detailed content type
-    snprintf(request_buffer, sizeof(request_buffer),
-             "POST /api/addMarkers HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "User-Agent: PicoW-SensorClient/1.0\r\n"
-             "Accept: application/json\r\n"
-             "Content-Type: application/json; charset=utf-8\r\n"
-             "Connection: close\r\n"
-             "Cache-Control: no-cache\r\n"
-             "X-Requested-With: XMLHttpRequest\r\n"  // Common for AJAX requests
-             "Content-Length: %d\r\n"
-             "Pragma: no-cache\r\n"   // Additional no-cache directive
-             "\r\n"
-             "%s",
-             TLS_CLIENT_SERVER, (int)json_size, json_data);
-    
-    // Progressive backoff for retries
-    int current_delay = retry_delay_ms;
-    
-    // Initialize retry tracking variables
-    bool upload_successful = false;
-    int retry_count = 0;
-    static bool connection_issue_detected = false;  // Use static to preserve across calls
-    
-    // Use exponential backoff strategy based on previous outcomes
-    static int consecutive_failures = 0;  // Track across function calls
-    static int consecutive_timeouts = 0;  // Specifically for timeouts
-    
-    // Keep track of consecutive failures for further diagnostics
-    static int abrt_errors = 0;  // Track number of consecutive ABRT errors
-    
-    // Flag for possible network or server issues
-    bool is_likely_connection_issue = false;
-    
-    // Try using alternate servers when main one fails
-    const char* servers[] = {
-        "www.gm4s.eu",  // Primary server (with www)
-        "gm4s.eu",      // Alternate server (without www)
-        NULL
-    };
-    int server_index = 0;
-    
-    // Start retry loop
-    while (!upload_successful && retry_count < max_retries) {
-        // Display status on screen
-        char status_msg[40];
-        snprintf(status_msg, sizeof(status_msg), "Upload attempt %d/%d", retry_count + 1, max_retries);
-        displayUploadStatus(status_msg);
-        
-        // Select server for this attempt - alternate between servers on retries
-        const char* current_server = servers[server_index];
-        if (retry_count > 0 && servers[1] != NULL) {
-            // Cycle through available servers on retries
-            server_index = (server_index + 1) % 2;  // Toggle between 0 and 1
-            current_server = servers[server_index];
-        }
-        
-        printf("Upload attempt %d of %d...\n", retry_count + 1, max_retries);
-        printf("REQUEST DETAILS: Sending to %s, data size: %d bytes\n", 
-               current_server, (int)json_size);
-        
-        // Adjust timeout based on history - slower for repeated failures
-        int timeout_ms = 10000;  // Default 10 seconds
-        
-        if (consecutive_timeouts > 1) {
-            // Progressively increase timeout for repeated timeout errors
-            timeout_ms = 15000;  // Increase to 15 seconds after multiple timeouts
-            printf("Using extended timeout (%dms) due to previous timeouts\n", timeout_ms);
-        } else if (consecutive_failures > 3) {
-            // For persistent failures, try a more aggressive approach
-            timeout_ms = 8000;  // Reduced timeout to fail faster on persistent issues
-            printf("Using reduced timeout (%dms) due to persistent failures\n", timeout_ms);
-        }
-        
-        // Check if we've had several failures and should try the HTTP fallback
-        if (consecutive_failures >= 3) {
-            printf("Multiple upload failures detected. Trying alternative TLS approach...\n");
-            
-            // Format a simplified HTTP request
-            char alt_request[15360];
-            snprintf(alt_request, sizeof(alt_request),
-                   "POST /api/addMarkers HTTP/1.1\r\n"
-                   "Host: gm4s.eu\r\n"
-                   "Content-Type: application/json\r\n"
-                   "Content-Length: %zu\r\n"
-                   "Connection: close\r\n"
-                   "\r\n"
-                   "%s",
-                   json_size, json_data);
-            
-            // Try direct TLS connection with longer timeout
-            bool alt_success = run_tls_client_test(NULL, 0, "gm4s.eu", alt_request, 12000);
-            if (alt_success) {
-                printf("Alternative TLS method succeeded!\n");
-                displayUploadStatus("Alt upload success!");
-                upload_successful = true;
-                break;
-            } else {
-                printf("Alternative method also failed\n");
-                displayUploadStatus("Alt method failed");
-                // Continue with regular retry loop
-            }
-        }
-        
-        // Record start time to measure upload duration
-        absolute_time_t start_time = get_absolute_time();
-        
-        // Try to upload with selected server and timeout
-        // Use certificates but let the TLS library handle them internally
-        upload_successful = run_tls_client_test(NULL, 0, 
-                                              current_server, request_buffer, timeout_ms);
-        
-        // Calculate time taken
-        uint32_t upload_time_ms = to_ms_since_boot(get_absolute_time()) - 
-                                  to_ms_since_boot(start_time);
-        
-        // Handle result
-        if (upload_successful) {
-            printf("DATA UPLOAD SUCCESSFUL after %lu ms\n", upload_time_ms);
-            // Reset error counters on success
-            consecutive_failures = 0;
-            consecutive_timeouts = 0;
-            abrt_errors = 0;
-            connection_issue_detected = false;
-        } else {
-            consecutive_failures++;
-            printf("DATA UPLOAD FAILED on attempt %d after %lu ms (consecutive failures: %d)\n", 
-                  retry_count + 1, upload_time_ms, consecutive_failures);
-            
-            // Analyze failure patterns for better diagnostics
-            if (upload_time_ms < 1000) {
-                // Very quick failure suggests connection issues
-                printf("Extremely quick failure (%lu ms) indicates likely connection problem\n", 
-                      upload_time_ms);
-                is_likely_connection_issue = true;
-                consecutive_timeouts++;
-                
-                // Add extra delay for network recovery
-                printf("Adding extra delay for network recovery\n");
-                current_delay += 300;  // Add extra 300ms to current delay
-            } else if (upload_time_ms > 5000) {
-                // Longer failures might be server processing issues
-                printf("Longer failure time (%lu ms) suggests server processing issues\n", 
-                      upload_time_ms);
-                // Keep the standard delay
-            } else {
-                // Medium timeframe suggests TLS negotiation problems
-                printf("TLS connection established but failed early (%lu ms) - possible protocol error\n",
-                      upload_time_ms);
-                // Use standard delay
-            }
-            
-            // More detailed error analysis and error-specific retry logic
-            if (is_likely_connection_issue) {
-                // Network connection issues need bigger backoff
-                current_delay = retry_delay_ms * (retry_count + 1);
-                
-                // Check WiFi connectivity directly
-                if (wifi.getConnected() != CYW43_LINK_UP) {
-                    printf("WARNING: WiFi connection lost, attempting to reconnect\n");
-                    displayUploadStatus("Reconnecting WiFi...");
-                    
-                    // Try to reconnect
-                    int connect_result = wifi.scanAndConnect();
-                    if (connect_result == 0) {
-                        printf("WiFi reconnected successfully\n");
-                        displayUploadStatus("WiFi reconnected");
-                        sleep_ms(500);  // Small delay for stability
-                    } else {
-                        printf("WiFi reconnect failed with code: %d\n", connect_result);
-                        displayUploadStatus("WiFi failed!");
-                        sleep_ms(1000);
-                    }
-                }
-            }
-            
-            // After multiple failures, try the alternative upload method with longer timeout
-            if (consecutive_failures >= 3 && retry_count >= 2) {
-                printf("Multiple failures detected (%d), trying final alternative upload method...\n", 
-                      consecutive_failures);
-                displayUploadStatus("Trying alt method");
-                
-                // Format a simplified HTTP request for the alternative attempt
-                char alt_request[15360];
-                snprintf(alt_request, sizeof(alt_request),
-                       "POST /api/addMarkers HTTP/1.1\r\n"
-                       "Host: gm4s.eu\r\n"
-                       "Content-Type: application/json\r\n"
-                       "Content-Length: %zu\r\n"
-                       "Connection: close\r\n"
-                       "\r\n"
-                       "%s",
-                       json_size, json_data);
-                
-                // Try with the alternate server with a longer timeout
-                bool alt_success = run_tls_client_test(NULL, 0, "gm4s.eu", alt_request, 15000);
-                
-                if (alt_success) {
-                    printf("Alternative upload method succeeded!\n");
-                    displayUploadStatus("Alt upload success!");
-                    upload_successful = true;
-                    break;
-                } else {
-                    printf("Alternative upload also failed\n");
-                    displayUploadStatus("Alt upload failed");
-                    // Continue with regular retry loop
-                }
-            }
-            
-            // Increment retry counter and apply delay
-            retry_count++;
-            
-            if (!upload_successful && retry_count < max_retries) {
-                printf("Retrying in %d ms...\n", current_delay);
-                displayUploadStatus("Retrying...");
-                sleep_ms(current_delay);
-                
-                // Exponential backoff
-                current_delay = current_delay * 2;
-            }
-        }
-    }
-    
-    // Final status
-    if (upload_successful) {
-        displayUploadStatus("Upload successful!");
-        return true;
-    } else {
-        displayUploadStatus("Upload failed!");
-        printf("All %d upload attempts failed\n", max_retries);
-        return false;
-    }
+// Add this optimized code to handle WiFi connection before upload
+// Resolve the upload servers as soon as WiFi is up, so uploads find them in the DNS cache
+void prefetchUploadHosts() {
+    dns_cache_prefetch(TLS_CLIENT_SERVER_PRIMARY);
+    dns_cache_prefetch(TLS_CLIENT_SERVER_BACKUP);
 }
 
-// Add this optimized code to handle WiFi connection before upload
 bool ensureWiFiConnection() {
     // Check if WiFi is already connected
     if (wifi.getConnected() == 3) {
@@ -1592,6 +1567,8 @@ bool ensureWiFiConnection() {
                    connection_time, attempt + 1);
             displayUploadStatus("WiFi connected");
             sleep_ms(50); // Reduced from 100ms to 50ms
+            saveWifiAp();
+            prefetchUploadHosts();
             
             // Report total connection time
             uint32_t total_connection_time = to_ms_since_boot(get_absolute_time()) - connection_start;
@@ -1751,465 +1728,1043 @@ bool safety_timer_callback(struct repeating_timer *t) {
     return true;
 }
 
-// Add this new function for extremely large uploads
-bool uploadSensorDataParallel(Flash& flash, myGPS& gps) {
-    if (flash.getStoredCount() == 0) {
-        printf("No data to upload\n");
-        displayUploadStatus("No data to upload");
-        return true; // Nothing to upload is considered success
-    }
-    
-    // For extremely large uploads (>300 records), use this specialized function
-    printf("Starting parallel upload for %lu records\n", flash.getStoredCount());
-    displayUploadStatus("Large data upload");
-    
-    // Load records from flash
-    std::vector<SensorData> records = flash.loadAllSensorData();
-    printf("Loaded %lu records from flash\n", records.size());
-    
-    if (records.empty()) {
-        printf("No valid records found in flash\n");
-        displayUploadStatus("No valid data");
+// Progress of the background upload, queued for the main loop to display
+enum UploadEventType : uint8_t {
+    UPLOAD_EVENT_PROGRESS = 0,
+    UPLOAD_EVENT_RETRYING,      // Waiting before reconnecting
+    UPLOAD_EVENT_DONE,          // Every record acknowledged
+    UPLOAD_EVENT_INCOMPLETE,    // Some records left for the next upload
+    UPLOAD_EVENT_FAILED         // Nothing acknowledged
+};
+
+struct UploadEvent {
+    UploadEventType type;
+    uint32_t acknowledged;
+    uint32_t total;
+};
+
+// Ring buffer between the upload state machine and the display. Both run on
+// the main loop; when it is full the newest event is replaced, since only the
+// latest progress matters.
+struct UploadEventQueue {
+    UploadEvent events[UPLOAD_EVENT_QUEUE_SIZE];
+    uint8_t head = 0;
+    uint8_t count = 0;
+};
+
+UploadEventQueue upload_events;
+
+void pushUploadEvent(UploadEventType type, size_t acknowledged, size_t total) {
+    if (upload_events.count == UPLOAD_EVENT_QUEUE_SIZE) {
+        upload_events.count--;
+    }
+    UploadEvent& event = upload_events.events[(upload_events.head + upload_events.count) % UPLOAD_EVENT_QUEUE_SIZE];
+    event.type = type;
+    event.acknowledged = (uint32_t)acknowledged;
+    event.total = (uint32_t)total;
+    upload_events.count++;
+}
+
+bool popUploadEvent(UploadEvent& event) {
+    if (upload_events.count == 0) {
         return false;
     }
-    
-    // For very large uploads (>300 records), split into batches
-    // and process them more optimally - use smaller batches for reliability
-    const size_t RECORDS_PER_BATCH = 20; // Reduced from 30 to 20 for better reliability
-    const size_t BATCH_SIZE = 5; // Reduced from 10 to 5 for better reliability
-    
-    size_t total_records = records.size();
-    size_t total_batches = (total_records + RECORDS_PER_BATCH - 1) / RECORDS_PER_BATCH;
-    size_t successful_batches = 0;
-    
-    printf("Breaking %lu records into %lu batches of %lu records each\n", 
-           total_records, total_batches, RECORDS_PER_BATCH);
-    
-    // Track total upload time
-    uint32_t upload_start_time = to_ms_since_boot(get_absolute_time());
-    
-    // Process each batch with optimized settings
-    for (size_t batch = 0; batch < total_batches; batch++) {
-        // Calculate batch boundaries
-        size_t start_idx = batch * RECORDS_PER_BATCH;
-        size_t end_idx = std::min(start_idx + RECORDS_PER_BATCH, total_records);
-        size_t batch_size = end_idx - start_idx;
-        
-        // Display current batch status
-        char status_msg[64];
-        sprintf(status_msg, "Batch %lu/%lu", batch + 1, total_batches);
-        displayUploadStatus(status_msg);
-        
-        printf("Processing batch %lu/%lu (records %lu-%lu)\n", 
-               batch + 1, total_batches, start_idx + 1, end_idx);
-        
-        // Create subset for this batch
-        std::vector<SensorData> batch_records(records.begin() + start_idx, records.begin() + end_idx);
-        
-        // Process this batch with chunked upload but minimal delays
-        size_t chunks_in_batch = (batch_size + BATCH_SIZE - 1) / BATCH_SIZE;
-        size_t successful_chunks = 0;
-        
-        // Buffer for JSON data - smaller buffer for more reliable uploads
-        char json_buffer[10240]; // Reduced from 20480 to 10240 for better reliability
-        
-        // Process each chunk in this batch
-        for (size_t chunk = 0; chunk < chunks_in_batch; chunk++) {
-            // Calculate chunk boundaries
-            size_t chunk_start = chunk * BATCH_SIZE;
-            size_t chunk_end = std::min(chunk_start + BATCH_SIZE, batch_size);
-            size_t chunk_size = chunk_end - chunk_start;
-            
-            // Create subset for this chunk
-            std::vector<SensorData> chunk_records(batch_records.begin() + chunk_start, 
-                                                batch_records.begin() + chunk_end);
-            
-            // Show progress
-            printf("Uploading batch %lu/%lu, chunk %lu/%lu (%lu records)\n", 
-                   batch + 1, total_batches, chunk + 1, chunks_in_batch, chunk_size);
-            
-            // Clear buffer before reuse
-            memset(json_buffer, 0, sizeof(json_buffer));
-            
-            // Prepare JSON for just this chunk
-            prepareBatchDataForTransmission(chunk_records, json_buffer, sizeof(json_buffer), gps);
-            
-            // Use more retries and longer delay for better reliability
-            bool result = uploadDataWithRetry(json_buffer, 5, 500); // Increased from 3 to 5 retries, and from 250ms to 500ms delay
-            
-            if (result) {
-                printf("Batch %lu/%lu, Chunk %lu/%lu uploaded successfully\n", 
-                       batch + 1, total_batches, chunk + 1, chunks_in_batch);
-                successful_chunks++;
-            } else {
-                printf("Batch %lu/%lu, Chunk %lu/%lu upload failed\n", 
-                       batch + 1, total_batches, chunk + 1, chunks_in_batch);
-            }
-            
-            // Increased delay between chunks for better reliability
-            sleep_ms(200); // Increased from 150ms to 200ms for better reliability
+    event = upload_events.events[upload_events.head];
+    upload_events.head = (upload_events.head + 1) % UPLOAD_EVENT_QUEUE_SIZE;
+    upload_events.count--;
+    return true;
+}
+
+// Records a request carried; what the server did not acknowledge is queued again
+struct UploadRange {
+    size_t start;
+    size_t count;
+    uint8_t attempts;     // Requests of this range that made no progress
+};
+
+enum UploadState : uint8_t {
+    UPLOAD_IDLE = 0,
+    UPLOAD_CONNECT,       // Start a connection
+    UPLOAD_CONNECTING,    // TCP connect and TLS handshake in progress
+    UPLOAD_SENDING,       // Chunks are queued and responses collected
+    UPLOAD_BACKOFF        // Waiting before the next connection attempt
+};
+
+// Chunked upload run as a state machine from the main loop. Chunks are
+// pipelined on one keep-alive connection (see HttpsClient) and each response
+// is matched to its chunk; nothing in a tick waits for the network, so
+// sampling and flash saves keep their cadence while the upload runs.
+struct UploadSession {
+    UploadState state = UPLOAD_IDLE;
+    std::vector<SensorData> records;    // Snapshot of the stored records
+    std::vector<bool> acknowledged;
+    size_t first_record = 0;            // Acknowledged by an earlier upload
+    uint32_t first_sequence = 0;        // Sequence number of records[0]
+    size_t total_records = 0;
+    size_t acknowledged_records = 0;
+    std::vector<UploadRange> queued;    // Ranges still to send, oldest first
+    UploadRange inflight_ranges[HTTPS_CLIENT_MAX_PIPELINE];
+    int inflight_ids[HTTPS_CLIENT_MAX_PIPELINE];
+    uint32_t inflight_sent_ms[HTTPS_CLIENT_MAX_PIPELINE];
+    size_t inflight_count = 0;
+    bool sending = false;               // The newest in-flight request is still being written
+    std::unique_ptr<UploadClient> client;
+    const char* server = TLS_CLIENT_SERVER_PRIMARY;
+    int connect_failures = 0;           // Consecutive, against the current server
+    uint32_t retries = 0;               // Consecutive failures, for the backoff
+    uint32_t backoff_until_ms = 0;
+    uint32_t start_ms = 0;
+    uint32_t requests = 0;
+    uint32_t handshakes = 0;
+    uint32_t resumed = 0;
+    uint32_t bytes_sent = 0;
+    uint32_t bytes_received = 0;
+    size_t heap_start = 0;              // Heap in use when the upload started
+    size_t heap_peak = 0;               // Most heap in use at any tick
+    size_t handshake_arena_peak = 0;    // Most TLS arena memory any handshake used
+    tls_profile_t tls_profile = UPLOAD_TLS_PROFILE;
+    bool automatic = false;             // Started by the auto-upload policy, not a button
+    uint32_t backlog_age_s = 0;         // Age of the oldest record to send, 0 if unknown
+    std::string network;                // SSID the batch size is learned for
+    uint16_t initial_batch_size = 0;
+    BatchController batch{UPLOAD_BATCH_INITIAL, UPLOAD_BATCH_MAX, UPLOAD_BATCH_SLOW_RESPONSE_MS};
+    SensorBody::Fallback fallback;
+    
+    // Two body slots (payload_arena.bodies): the newest request is written from
+    // one while the next chunk is encoded into the other, so encoding overlaps
+    // the network wait
+    uint8_t send_slot = 0;              // Slot of the newest request; in use while sending is set
+    bool prepared = false;              // The other slot holds prepared_range
+    bool prepared_binary = false;       // Encoding the prepared slot used
+    UploadRange prepared_range;
+    uint32_t encode_ms = 0;             // Spent preparing chunk bodies
+    uint32_t encode_overlap_ms = 0;     // Of that, while requests were on the network
+    uint32_t prepared_used = 0;         // Chunks sent from the prepared slot
+    uint32_t prepared_discarded = 0;    // Prepared chunks a response made obsolete
+    uint32_t prepared_captured = 0;     // Chunks kept encoded, not encoded again while sent
+};
+
+UploadSession upload_session;
+
+// Stored records the last finished upload covered; records saved to flash
+// while it ran come after these
+size_t upload_snapshot_count = 0;
+
+bool isUploadRunning() {
+    return upload_session.state != UPLOAD_IDLE;
+}
+
+// Adds the connection statistics of the current client to the session totals
+void releaseUploadClient() {
+    UploadSession& s = upload_session;
+    if (s.client) {
+        s.client->close();
+        if (s.handshakes == 0) {
+            s.tls_profile = s.client->getTlsProfile();   // Falls back until a handshake succeeds
         }
-        
-        // If most chunks in this batch succeeded, count the batch as successful
-        if (successful_chunks >= chunks_in_batch * 0.7) { // 70% success rate
-            successful_batches++;
-            printf("Batch %lu/%lu completed successfully (%lu/%lu chunks)\n", 
-                   batch + 1, total_batches, successful_chunks, chunks_in_batch);
-        } else {
-            printf("Batch %lu/%lu failed (%lu/%lu chunks successful)\n", 
-                   batch + 1, total_batches, successful_chunks, chunks_in_batch);
+        s.requests += s.client->getRequestCount();
+        s.handshakes += s.client->getHandshakeCount();
+        s.resumed += s.client->getResumedCount();
+        s.bytes_sent += s.client->getBytesSent();
+        s.bytes_received += s.client->getBytesReceived();
+        if (s.client->getHandshakeArenaPeak() > s.handshake_arena_peak) {
+            s.handshake_arena_peak = s.client->getHandshakeArenaPeak();
         }
-        
-        // Increased delay between batches for better reliability
-        sleep_ms(500); // Increased from 300ms to 500ms for better reliability
+        s.client.reset();
     }
-    
-    uint32_t upload_end_time = to_ms_since_boot(get_absolute_time());
-    uint32_t total_upload_time = upload_end_time - upload_start_time;
-    
-    printf("Parallel upload complete: %lu/%lu batches successful in %lu ms (%.1f seconds)\n", 
-           successful_batches, total_batches, total_upload_time, total_upload_time / 1000.0f);
-    
-    // Calculate throughput
-    float records_per_second = (float)total_records / (total_upload_time / 1000.0f);
-    printf("Upload speed: %.1f records per second\n", records_per_second);
-    
-    // Consider upload successful if most batches worked
-    bool mostly_successful = (successful_batches >= total_batches * 0.7); // 70% success threshold
-    
-    // Display final status
-    if (mostly_successful) {
-        displayUploadStatus("Upload complete!");
-        sleep_ms(500);
-        
-        // Ask user if they want to clear data
-        bool clear_data = showYesNoPrompt("Data Uploaded", "Clear flash storage?");
-        
-        if (clear_data) {
-            displayUploadStatus("Clearing storage...");
-            if (flash_storage.eraseStorage()) {
-                displayUploadStatus("Storage cleared");
-                sleep_ms(500);
-            } else {
-                displayUploadStatus("Clear failed!");
-                sleep_ms(500);
-            }
+}
+
+void finishUploadSession() {
+    UploadSession& s = upload_session;
+    releaseUploadClient();
+    printf("Keep-alive upload: %lu requests over %lu TLS handshakes (%lu resumed), %lu ranges not sent\n",
+           (unsigned long)s.requests, (unsigned long)s.handshakes, (unsigned long)s.resumed,
+           (unsigned long)s.queued.size());
+    saveTlsSession();
+    dns_cache_print_stats();
+    tls_profile_print_stats();
+    tls_arena_print_stats();
+    net_timing_print();
+    
+    printf("[UPLOAD] Batch size %u records on \"%s\" (started at %u, %lu increases, %lu decreases)\n",
+           s.batch.getSize(), s.network.c_str(), s.initial_batch_size,
+           (unsigned long)s.batch.getIncreaseCount(), (unsigned long)s.batch.getDecreaseCount());
+    if (s.batch.getSize() != s.initial_batch_size) {
+        saveUploadBatchSize(s.network, s.batch.getSize());
+    }
+    
+    // Advance the cursor over the acknowledged records before the first gap;
+    // acknowledged records after a gap are sent again next time
+    size_t cursor = s.first_record;
+    while (cursor < s.records.size() && s.acknowledged[cursor]) {
+        cursor++;
+    }
+    if (cursor != s.first_record) {
+        saveUploadCursor(s.records, cursor);
+    }
+    
+    uint32_t total_upload_time = to_ms_since_boot(get_absolute_time()) - s.start_ms;
+    printf("Upload complete: %lu/%lu records acknowledged in %lu ms (%.1f seconds), %lu still to send\n", 
+           s.acknowledged_records, s.total_records, total_upload_time, total_upload_time / 1000.0f,
+           s.records.size() - cursor);
+    printf("[UPLOAD] Drain rate %.1f records/s, oldest record was %lu min old\n",
+           s.acknowledged_records * 1000.0f / (total_upload_time > 0 ? total_upload_time : 1),
+           (unsigned long)(s.backlog_age_s / 60));
+    
+    // Figures to compare uploads across firmware changes and networks
+    size_t per_record = s.acknowledged_records > 0 ? s.acknowledged_records : 1;
+    printf("[UPLOAD] Benchmark: %.1f handshakes per 1000 records, %lu bytes sent (%lu per record), "
+           "%lu received, heap peak %lu bytes (+%lu during the upload), TLS arena peak %lu bytes per handshake\n",
+           s.handshakes * 1000.0f / per_record, (unsigned long)s.bytes_sent,
+           (unsigned long)(s.bytes_sent / per_record), (unsigned long)s.bytes_received,
+           (unsigned long)s.heap_peak, (unsigned long)(s.heap_peak - s.heap_start),
+           (unsigned long)s.handshake_arena_peak);
+    printf("[UPLOAD] Encoding took %lu ms, %lu ms of it while requests were in flight; "
+           "%lu chunks prepared ahead, %lu discarded, %lu sent without encoding again\n",
+           (unsigned long)s.encode_ms, (unsigned long)s.encode_overlap_ms,
+           (unsigned long)s.prepared_used, (unsigned long)s.prepared_discarded,
+           (unsigned long)s.prepared_captured);
+    
+    // Only acknowledged records count; anything else stays in flash for the next upload
+    UploadEventType result = UPLOAD_EVENT_FAILED;
+    if (s.acknowledged_records == s.total_records) {
+        result = UPLOAD_EVENT_DONE;
+    } else if (s.acknowledged_records > 0) {
+        result = UPLOAD_EVENT_INCOMPLETE;
+    }
+    pushUploadEvent(result, s.acknowledged_records, s.total_records);
+    
+    upload_snapshot_count = s.records.size();
+    std::vector<SensorData>().swap(s.records);
+    std::vector<bool>().swap(s.acknowledged);
+    std::vector<UploadRange>().swap(s.queued);
+    for (auto& body : payload_arena.bodies) {
+        body.reset();
+    }
+    s.prepared = false;
+    s.state = UPLOAD_IDLE;
+    radio.release(RADIO_USER_UPLOAD);
+    radio.printStats();
+}
+
+// Waits before the next connection; longer after each failure in a row
+void scheduleUploadRetry() {
+    UploadSession& s = upload_session;
+    uint32_t delay_ms = UPLOAD_RETRY_DELAY_MS << (s.retries < 4 ? s.retries : 4);
+    s.retries++;
+    s.backoff_until_ms = to_ms_since_boot(get_absolute_time()) + delay_ms;
+    s.state = UPLOAD_BACKOFF;
+    radio.setWaiting(RADIO_USER_UPLOAD, true);
+    printf("[UPLOAD] Reconnecting in %lu ms (%lu ranges left)\n", (unsigned long)delay_ms,
+           (unsigned long)s.queued.size());
+    pushUploadEvent(UPLOAD_EVENT_RETRYING, s.acknowledged_records, s.total_records);
+}
+
+void uploadConnectFailed() {
+    UploadSession& s = upload_session;
+    releaseUploadClient();
+    if (++s.connect_failures >= UPLOAD_CONNECT_ATTEMPTS) {
+        if (strcmp(s.server, TLS_CLIENT_SERVER_BACKUP) != 0) {
+            printf("[UPLOAD] Could not connect to %s, switching to %s\n", s.server, TLS_CLIENT_SERVER_BACKUP);
+            s.server = TLS_CLIENT_SERVER_BACKUP;
+            s.connect_failures = 0;
         } else {
-            displayUploadStatus("Data preserved");
-            sleep_ms(500);
+            printf("[UPLOAD] Could not connect to any upload server, giving up\n");
+            finishUploadSession();
+            return;
+        }
+    }
+    scheduleUploadRetry();
+}
+
+// Books the response to the oldest in-flight request and feeds the batch
+// size controller
+void completeUploadRange(const UploadRange& range, int status, int32_t accepted, uint32_t response_ms) {
+    UploadSession& s = upload_session;
+    size_t stored = 0;
+    if (status >= 200 && status < 300) {
+        stored = acknowledgedRecords(range.count, accepted);
+        printf("Records %lu-%lu: %lu acknowledged in %lu ms (HTTP %d)\n",
+               range.start + 1, range.start + range.count, stored, (unsigned long)response_ms, status);
+        if (stored == range.count) {
+            s.batch.onAcknowledged((uint16_t)range.count, response_ms);
         }
     } else {
-        char result_msg[64];
-        sprintf(result_msg, "%lu/%lu batches uploaded", successful_batches, total_batches);
-        displayUploadStatus(result_msg);
-        sleep_ms(500);
+        printf("Records %lu-%lu not accepted (HTTP %d)\n",
+               range.start + 1, range.start + range.count, status);
+        if (status == 415 && upload_binary) {
+            // Unsupported Media Type: the refused chunks are sent again as JSON
+            printf("[UPLOAD] Server does not accept CBOR, using JSON for this session\n");
+            upload_binary = false;
+        } else if (status == 413) {
+            s.batch.onTooLarge((uint16_t)range.count);
+        } else if (status != 415) {
+            s.batch.onFailed((uint16_t)range.count);
+        }
+    }
+    for (size_t i = 0; i < stored; i++) {
+        s.acknowledged[range.start + i] = true;
+    }
+    s.acknowledged_records += stored;
+    if (stored > 0) {
+        s.retries = 0;
+        pushUploadEvent(UPLOAD_EVENT_PROGRESS, s.acknowledged_records, s.total_records);
+    } else if (status != 415) {
+        s.retries++;
     }
     
-    return mostly_successful;
+    // A partly acknowledged range is sent again from the first record the
+    // server did not take; a range that keeps making no progress is left for
+    // the next upload
+    if (stored < range.count) {
+        uint8_t attempts = stored > 0 ? 0 : range.attempts + 1;
+        if (attempts < UPLOAD_RANGE_ATTEMPTS) {
+            s.queued.push_back({range.start + stored, range.count - stored, attempts});
+        } else {
+            printf("Records %lu-%lu upload failed\n", range.start + stored + 1, range.start + range.count);
+        }
+    }
+}
+
+// Next batch, cut from the front of the oldest range
+UploadRange nextUploadRange() {
+    UploadSession& s = upload_session;
+    UploadRange range = s.queued.front();
+    range.count = std::min(range.count, (size_t)s.batch.getSize());
+    return range;
 }
 
-// Add this function near uploadDataWithRetry to provide a more reliable Vercel upload option
-bool uploadDataWithVercelProxy(const char* json_data, int max_retries, int retry_delay_ms) {
-    // Add better input validation
-    if (!json_data) {
-        printf("ERROR: JSON data is NULL\n");
+// Runs the body through its encoder once more into the slot's buffer, if it
+// fits, and sends from there. Sizing the body is one encoding pass; without
+// this, beginPost() runs a second one while the chunk is on the network.
+bool captureUploadBody(UploadBody& body) {
+    size_t length = body.source->length;
+    if (length > sizeof(body.encoded)) {
         return false;
     }
-    
-    size_t json_size = strlen(json_data);
-    if (json_size == 0) {
-        printf("ERROR: JSON data is empty\n");
-        return false;
+    body.source->rewind(body.source);
+    size_t filled = 0;
+    while (filled < length) {
+        size_t n = body.source->read(body.source, body.encoded + filled, length - filled);
+        if (n == 0) {
+            break;
+        }
+        filled += n;
     }
-    
-    if (json_size > 15000) {
-        printf("ERROR: JSON data size (%lu bytes) exceeds maximum allowed (15000 bytes)\n", json_size);
+    if (filled != length) {
+        printf("[UPLOAD] Body ended %lu bytes early, sending it from the encoder\n",
+               (unsigned long)(length - filled));
+        body.source->rewind(body.source);
         return false;
     }
+    http_string_body_init(&body.encoded_body, body.encoded, length);
+    body.source = &body.encoded_body.source;
+    return true;
+}
+
+// Encodes the next batch into the free body slot: both encoding passes (the
+// sizing one and the one producing the bytes) when the chunk fits the slot,
+// so its request costs no encoding when it is sent.
+void prepareUploadChunk() {
+    UploadSession& s = upload_session;
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    UploadRange range = nextUploadRange();
+    UploadBody& body = payload_arena.bodies[s.send_slot ^ 1];
+    makeUploadBody(body, &s.records[range.start], range.count, s.first_sequence + (uint32_t)range.start,
+                   s.fallback, upload_binary);
+    
+    // Keep batches inside the server's body size limit at the measured bytes per record
+    size_t bytes_per_record = (body.source->length + range.count - 1) / range.count;
+    if (bytes_per_record > 0) {
+        s.batch.setLimit((uint16_t)std::min((size_t)UINT16_MAX, UPLOAD_MAX_BODY_BYTES / bytes_per_record));
+    }
+    if (captureUploadBody(body)) {
+        s.prepared_captured++;
+    }
+    
+    uint32_t elapsed_ms = to_ms_since_boot(get_absolute_time()) - start_ms;
+    s.encode_ms += elapsed_ms;
+    if (s.inflight_count > 0) {
+        s.encode_overlap_ms += elapsed_ms;
+    }
+    s.prepared = true;
+    s.prepared_binary = upload_binary;
+    s.prepared_range = range;
+}
+
+void tickUploadSending() {
+    UploadSession& s = upload_session;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
     
-    // Basic JSON validation - check for opening/closing braces
-    if (json_data[0] != '{' || json_data[json_size-1] != '}') {
-        printf("ERROR: JSON data appears to be malformed (does not start with { and end with })\n");
-        printf("JSON starts with: %.20s...\n", json_data);
-        printf("JSON ends with: ...%.20s\n", json_data + (json_size > 20 ? json_size - 20 : 0));
-        return false;
+    // Finish writing the newest request; the sent callback does most of it
+    if (s.sending) {
+        UploadClient::Progress progress = s.client->pollSend();
+        if (progress != UploadClient::IN_PROGRESS) {
+            s.sending = false;
+            s.inflight_sent_ms[s.inflight_count - 1] = now;
+        }
     }
     
-    printf("VERCEL: Preparing HTTP request with %d bytes of JSON data\n", (int)json_size);
-    
-    // Prepare the HTTP request (15K max buffer)
-    char request_buffer[15000];
-    
-    // Create a simpler POST request specifically for Vercel
-    // 1. Use POST /api/data instead of /api/addMarkers
-    // 2. Use minimal headers to reduce overhead
-    // 3. Explicitly set content-length
-    // 4. Add JSON payload validation with retry support
-    snprintf(request_buffer, sizeof(request_buffer),
-             "POST /api/data HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "Content-Type: application/json\r\n"
-             "Connection: close\r\n"
-             "Content-Length: %d\r\n"
-             "\r\n"
-             "%s",
-             TLS_CLIENT_SERVER, (int)json_size, json_data);
-    
-    // Progressive backoff for retries
-    int current_delay = retry_delay_ms;
-    
-    // Initialize retry tracking variables
-    bool upload_successful = false;
-    int retry_count = 0;
-    
-    // Keep track of consecutive failures for diagnostics
-    static int consecutive_failures = 0;
-    static int abrt_errors = 0;
-    
-    // Attempt upload with retries
-    while (retry_count <= max_retries && !upload_successful) {
-        if (retry_count > 0) {
-            // Display retry status
-            char retry_msg[64];
-            snprintf(retry_msg, sizeof(retry_msg), "Retry %d of %d...", retry_count, max_retries);
-            displayUploadStatus(retry_msg);
-            
-            // Wait before retry with progressive backoff
-            printf("VERCEL: Waiting %d ms before retry %d...\n", current_delay, retry_count);
-            sleep_ms(current_delay);
-            
-            // Increase delay for next retry (up to a maximum)
-            current_delay = std::min(current_delay * 2, 2000);
+    // Collect responses in request order. A failed write or a lost
+    // connection has already answered the affected requests with
+    // HTTPS_STATUS_NO_RESPONSE.
+    while (s.inflight_count > 0) {
+        int status = s.client->getStatus(s.inflight_ids[0]);
+        if (status == 0) {
+            bool written = !(s.sending && s.inflight_count == 1);
+            if (written && now - s.inflight_sent_ms[0] > UPLOAD_RESPONSE_TIMEOUT_MS) {
+                printf("HTTPS: No response after %lu ms\n", (unsigned long)UPLOAD_RESPONSE_TIMEOUT_MS);
+                s.client->close();
+                continue;
+            }
+            break;
         }
-        
-        // Display status information for debugging
-        printf("VERCEL: Upload attempt %d of %d...\n", retry_count + 1, max_retries);
-        printf("VERCEL REQUEST: Server=%s, data size=%d bytes\n", TLS_CLIENT_SERVER, (int)json_size);
-        
-        // For even-numbered retries, try direct connection, for odd-numbered, try alternative server name
-        const char* server_name = (retry_count % 2 == 0) ? TLS_CLIENT_SERVER : "gm4s.eu";
-        int timeout_ms = (retry_count > 0) ? 15000 : 20000;  // Shorter timeouts for retries
-        
-        // Try the TLS client with this configuration
-        upload_successful = run_tls_client_test(NULL, 0, server_name, request_buffer, timeout_ms);
-        
-        if (upload_successful) {
-            printf("VERCEL: Upload successful!\n");
-            consecutive_failures = 0;
-            abrt_errors = 0;
+        completeUploadRange(s.inflight_ranges[0], status, s.client->getAccepted(s.inflight_ids[0]),
+                            s.client->getResponseMs(s.inflight_ids[0]));
+        s.inflight_count--;
+        memmove(s.inflight_ranges, s.inflight_ranges + 1, s.inflight_count * sizeof(s.inflight_ranges[0]));
+        memmove(s.inflight_ids, s.inflight_ids + 1, s.inflight_count * sizeof(s.inflight_ids[0]));
+        memmove(s.inflight_sent_ms, s.inflight_sent_ms + 1, s.inflight_count * sizeof(s.inflight_sent_ms[0]));
+    }
+    
+    // Start the next chunk while the earlier ones wait for their responses.
+    // A chunk that got no progress last time waits until the pipeline drains,
+    // so a retry does not run ahead of the response that refused it.
+    if (!s.sending && s.client->isConnected() && !s.queued.empty() &&
+        s.inflight_count < s.client->getMaxInFlight() && (s.retries == 0 || s.inflight_count == 0)) {
+        // A response may have changed the queue, the batch size or the
+        // encoding since the chunk was prepared
+        UploadRange range = nextUploadRange();
+        if (s.prepared && (s.prepared_range.start != range.start || s.prepared_range.count != range.count ||
+                           s.prepared_binary != upload_binary)) {
+            s.prepared = false;
+            s.prepared_discarded++;
+        }
+        if (s.prepared) {
+            s.prepared_used++;
         } else {
-            // Increment failure counters
-            consecutive_failures++;
-            printf("VERCEL: Data upload failed on attempt %d (consecutive failures: %d)\n", 
-                   retry_count + 1, consecutive_failures);
-            
-            // If we see multiple consecutive failures, try more aggressive recovery
-            if (consecutive_failures >= 3) {
-                printf("VERCEL: Multiple failures detected, attempting network reset\n");
-                
-                // Break out of the retry loop - we'll try a different approach
-                if (retry_count >= 2) {
-                    printf("VERCEL: Multiple attempts failed, will try a different approach\n");
-                    break;
-                }
+            prepareUploadChunk();
+            range = s.prepared_range;
+        }
+        printf("Uploading records %lu-%lu (%lu in flight, batch size %u)...\n",
+               range.start + 1, range.start + range.count, s.inflight_count, s.batch.getSize());
+        
+        UploadBody& body = payload_arena.bodies[s.send_slot ^ 1];
+        int request_id = s.client->beginPost("/api/addMarkers", body.content_type, body.source,
+                                             UPLOAD_RESPONSE_TIMEOUT_MS, body.content_encoding);
+        if (request_id >= 0) {
+            s.send_slot ^= 1;
+            s.prepared = false;
+            if (range.count == s.queued.front().count) {
+                s.queued.erase(s.queued.begin());
+            } else {
+                s.queued.front().start += range.count;
+                s.queued.front().count -= range.count;
             }
+            s.inflight_ranges[s.inflight_count] = range;
+            s.inflight_ids[s.inflight_count] = request_id;
+            s.inflight_sent_ms[s.inflight_count] = now;
+            s.inflight_count++;
+            s.sending = true;
         }
-        
-        retry_count++;
     }
     
-    // If all direct Vercel uploads failed, try using a proxy as last resort
-    if (!upload_successful && retry_count > 2) {
-        printf("VERCEL: All direct uploads failed. Trying simplified approach.\n");
+    // Encode the chunk after the newest one while that is written and answered
+    if (!s.prepared && s.inflight_count > 0 && !s.queued.empty() && s.client->isConnected()) {
+        prepareUploadChunk();
+    }
+    
+    if (s.inflight_count > 0 || s.sending) {
+        return;
+    }
+    if (s.queued.empty()) {
+        finishUploadSession();
+    } else if (!s.client->isConnected()) {
+        // The server closed the connection; reconnect at once if the last
+        // responses made progress
+        releaseUploadClient();
+        if (s.retries == 0) {
+            s.state = UPLOAD_CONNECT;
+        } else {
+            scheduleUploadRetry();
+        }
+    }
+}
+
+// Advances the upload without waiting; called on every main loop pass
+void tickUploadSession() {
+    UploadSession& s = upload_session;
+    if (s.state != UPLOAD_IDLE) {
+        size_t heap_used = mallinfo().uordblks;
+        if (heap_used > s.heap_peak) {
+            s.heap_peak = heap_used;
+        }
+    }
+    switch (s.state) {
+    case UPLOAD_IDLE:
+        return;
         
-        // Create an even simpler request with minimal headers
-        snprintf(request_buffer, sizeof(request_buffer),
-                 "POST /api/data HTTP/1.1\r\n"
-                 "Host: %s\r\n"
-                 "Content-Type: application/json\r\n"
-                 "Content-Length: %d\r\n"
-                 "\r\n"
-                 "%s",
-                 TLS_CLIENT_SERVER, (int)json_size, json_data);
+    case UPLOAD_BACKOFF:
+        if ((int32_t)(to_ms_since_boot(get_absolute_time()) - s.backoff_until_ms) < 0) {
+            return;
+        }
+        s.state = UPLOAD_CONNECT;
+        radio.setWaiting(RADIO_USER_UPLOAD, false);
+        // Fall through
         
-        // Try one more time with the simplified request
-        upload_successful = run_tls_client_test(NULL, 0, TLS_CLIENT_SERVER, request_buffer, 20000);
+    case UPLOAD_CONNECT:
+        if (s.queued.empty()) {
+            finishUploadSession();
+            return;
+        }
+        if (wifi.getConnected() != CYW43_LINK_UP) {
+            printf("[UPLOAD] WiFi lost, leaving %lu ranges for the next upload\n", (unsigned long)s.queued.size());
+            finishUploadSession();
+            return;
+        }
+#if UPLOAD_COAP
+        s.client.reset(new CoapClient(s.server, UPLOAD_COAP_PORT, UPLOAD_COAP_DTLS));
+#else
+        s.client.reset(new HttpsClient(s.server));
+#endif
+        s.client->setTlsProfile(s.tls_profile);
+        if (!s.client->beginConnect(UPLOAD_CONNECT_TIMEOUT_MS)) {
+            uploadConnectFailed();
+            return;
+        }
+        s.state = UPLOAD_CONNECTING;
+        return;
         
-        if (upload_successful) {
-            printf("VERCEL: Simplified upload approach succeeded!\n");
-        } else {
-            printf("VERCEL: All upload approaches failed. Please check server configuration.\n");
+    case UPLOAD_CONNECTING: {
+        UploadClient::Progress progress = s.client->pollConnect();
+        if (progress == UploadClient::IN_PROGRESS) {
+            return;
+        }
+        if (progress == UploadClient::FAILED) {
+            uploadConnectFailed();
+            return;
         }
+        s.connect_failures = 0;
+        s.state = UPLOAD_SENDING;
+        return;
+    }
+        
+    case UPLOAD_SENDING:
+        tickUploadSending();
+        return;
     }
-    
-    // Reset abort error counter when completed
-    abrt_errors = 0;
-    
-    return upload_successful;
 }
 
-// Add a function to upload sensor data in chunks for better reliability
-bool uploadSensorDataChunked(Flash& flash, myGPS& gps, int mode) {
-    if (flash.getStoredCount() == 0) {
-        printf("No data to upload\n");
-        displayUploadStatus("No data to upload");
-        return true; // Nothing to upload is considered success
+// Starts uploading the stored records in the background. Returns false if
+// there is nothing to upload or an upload is already running. An automatic
+// upload keeps the display on its page and clears acknowledged records
+// without asking.
+bool startUploadSession(Flash& flash, myGPS& gps, bool automatic = false) {
+    UploadSession& s = upload_session;
+    if (isUploadRunning()) {
+        printf("[UPLOAD] Upload already running\n");
+        return false;
     }
     
-    printf("Starting chunked upload for %lu records\n", flash.getStoredCount());
-    displayUploadStatus("Starting upload...");
-    
-    // Load records from flash
-    std::vector<SensorData> records = flash.loadAllSensorData();
-    printf("Loaded %lu records from flash\n", records.size());
-    
-    if (records.empty()) {
+    s.records = flash.loadAllSensorData();
+    printf("Loaded %lu records from flash\n", s.records.size());
+    if (s.records.empty()) {
         printf("No valid records found in flash\n");
         displayUploadStatus("No valid data");
         return false;
     }
     
-    // For reliability, use much smaller chunks
-    const size_t CHUNK_SIZE = UPLOAD_MAX_BATCH_SIZE; // Using the global max batch size
-    
-    size_t total_records = records.size();
-    size_t total_chunks = (total_records + CHUNK_SIZE - 1) / CHUNK_SIZE;
-    size_t successful_uploads = 0;
-    
-    printf("Breaking %lu records into %lu chunks of max %lu records each\n", 
-           total_records, total_chunks, CHUNK_SIZE);
+    // Records acknowledged by an earlier upload are not sent again
+    s.first_record = loadUploadCursor(s.records);
+    if (s.first_record > 0) {
+        printf("[UPLOAD] Skipping %lu records acknowledged by an earlier upload\n", s.first_record);
+    }
+    s.first_sequence = loadUploadSequence();
+    s.acknowledged.assign(s.records.size(), false);
+    for (size_t i = 0; i < s.first_record; i++) {
+        s.acknowledged[i] = true;
+    }
+    s.total_records = s.records.size() - s.first_record;
+    s.acknowledged_records = 0;
+    s.automatic = automatic;
     
-    // Track total upload time
-    uint32_t upload_start_time = to_ms_since_boot(get_absolute_time());
+    // How long the oldest waiting record has been kept from the server
+    s.backlog_age_s = 0;
+    if (s.total_records > 0) {
+        const SensorData& oldest = s.records[s.first_record];
+        if (!oldest.time_unsynced && oldest.timestamp > 0 && (uint32_t)gps_clock.now() > oldest.timestamp) {
+            s.backlog_age_s = (uint32_t)gps_clock.now() - oldest.timestamp;
+        }
+    }
     
-    // Process each chunk
-    for (size_t chunk = 0; chunk < total_chunks; chunk++) {
-        // Calculate chunk boundaries
-        size_t start_idx = chunk * CHUNK_SIZE;
-        size_t end_idx = std::min(start_idx + CHUNK_SIZE, total_records);
-        size_t chunk_size = end_idx - start_idx;
-        
-        // Display current chunk status
+    // One range for all records; batches are cut from it at the size the
+    // link currently sustains, starting from what this network learned last time
+    s.queued.clear();
+    if (s.total_records > 0) {
+        s.queued.push_back({s.first_record, s.total_records, 0});
+    }
+    s.network = wifi.getSSID();
+    s.initial_batch_size = loadUploadBatchSize(s.network);
+    s.batch = BatchController(s.initial_batch_size, UPLOAD_BATCH_MAX, UPLOAD_BATCH_SLOW_RESPONSE_MS);
+    printf("Uploading %lu records in batches of %u to start with (network \"%s\")\n",
+           s.total_records, s.initial_batch_size, s.network.c_str());
+    
+    // Chunk bodies are encoded while they are sent; no payload buffer
+    s.fallback = getUploadFallback(gps);
+    upload_binary = UPLOAD_BINARY;
+    s.inflight_count = 0;
+    s.sending = false;
+    s.prepared = false;
+    s.encode_ms = 0;
+    s.encode_overlap_ms = 0;
+    s.prepared_used = 0;
+    s.prepared_discarded = 0;
+    s.prepared_captured = 0;
+    s.server = TLS_CLIENT_SERVER_PRIMARY;
+    s.connect_failures = 0;
+    s.retries = 0;
+    s.requests = 0;
+    s.handshakes = 0;
+    s.resumed = 0;
+    s.bytes_sent = 0;
+    s.bytes_received = 0;
+    s.heap_start = mallinfo().uordblks;
+    s.heap_peak = s.heap_start;
+    s.handshake_arena_peak = 0;
+    s.tls_profile = UPLOAD_TLS_PROFILE;
+    s.start_ms = to_ms_since_boot(get_absolute_time());
+    s.state = UPLOAD_CONNECT;
+    radio.acquire(RADIO_USER_UPLOAD);
+    
+    if (!automatic) {
         char status_msg[64];
-        sprintf(status_msg, "Chunk %lu/%lu", chunk + 1, total_chunks);
+        sprintf(status_msg, "Uploading %lu", s.total_records);
         displayUploadStatus(status_msg);
-        
-        printf("Processing chunk %lu/%lu (records %lu-%lu)\n", 
-               chunk + 1, total_chunks, start_idx + 1, end_idx);
-        
-        // Create subset for this chunk
-        std::vector<SensorData> chunk_records(records.begin() + start_idx, records.begin() + end_idx);
-        
-        // Buffer for JSON data
-        char json_buffer[15360]; // Large buffer for JSON data
-        
-        // Clear buffer before reuse
-        memset(json_buffer, 0, sizeof(json_buffer));
-        
-        // Prepare JSON for just this chunk
-        prepareBatchDataForTransmission(chunk_records, json_buffer, sizeof(json_buffer), gps);
-        
-        // Try uploading with the TLS client directly
-        printf("Uploading chunk %lu/%lu with %lu records...\n", 
-               chunk + 1, total_chunks, chunk_size);
-        
-        bool chunk_successful = false;
-        
-        // Try uploading with the TLS client directly first
-        // Use a shorter timeout (8 seconds) to avoid long waiting periods
-        chunk_successful = run_tls_client_test(NULL, 0, TLS_CLIENT_SERVER, json_buffer, 8000);
-        
-        // If direct TLS client fails, try with alternative server name
-        if (!chunk_successful) {
-            printf("First attempt failed for chunk %lu/%lu, trying with 'gm4s.eu' without www prefix\n", 
-                   chunk + 1, total_chunks);
-            
-            // Create a simple HTTP request
-            char request_buffer[15360];
-            snprintf(request_buffer, sizeof(request_buffer),
-                   "POST /api/addMarkers HTTP/1.1\r\n"
-                   "Host: gm4s.eu\r\n"
-                   "Content-Type: application/json\r\n"
-                   "Content-Length: %zu\r\n"
-                   "Connection: close\r\n"
-                   "\r\n"
-                   "%s",
-                   strlen(json_buffer), json_buffer);
+    }
+    return true;
+}
+
+// Erases the records the last upload covered. Records saved while it ran are
+// never erased and written back, which a power loss in between would lose:
+// they stay where they are, the persisted upload cursor skips the uploaded
+// ones, and all are erased together after an upload that covers them.
+void clearUploadedRecords(Flash& flash) {
+    size_t stored = flash.getStoredCount();
+    if (stored > upload_snapshot_count) {
+        displayUploadStatus("Newer data kept");
+        printf("%lu records were saved during the upload; storage is cleared after the next one\n",
+               (unsigned long)(stored - upload_snapshot_count));
+        return;
+    }
+    
+    displayUploadStatus("Clearing storage...");
+    advanceUploadSequence(stored);
+    if (!flash.eraseStorage()) {
+        displayUploadStatus("Clear failed!");
+        return;
+    }
+    saveUploadCursor(std::vector<SensorData>(), 0);
+    displayUploadStatus("Storage cleared");
+    printf("Flash storage cleared after successful upload\n");
+}
+
+// Shows the upload events queued since the last pass. Progress screens are
+// rate limited since every e-ink refresh stalls the loop.
+void handleUploadEvents(Flash& flash) {
+    static uint32_t last_progress_display_ms = 0;
+    UploadEvent event;
+    while (popUploadEvent(event)) {
+        uint32_t now = to_ms_since_boot(get_absolute_time());
+        char status_msg[64];
+        switch (event.type) {
+        case UPLOAD_EVENT_PROGRESS:
+        case UPLOAD_EVENT_RETRYING:
+            if (upload_session.automatic || upload_events.count > 0 ||
+                now - last_progress_display_ms < UPLOAD_PROGRESS_DISPLAY_MS) {
+                break;   // A newer event follows, or the last screen is too recent
+            }
+            last_progress_display_ms = now;
+            sprintf(status_msg, "%s %lu/%lu", event.type == UPLOAD_EVENT_RETRYING ? "Retry" : "Sent",
+                    (unsigned long)event.acknowledged, (unsigned long)event.total);
+            displayUploadStatus(status_msg);
+            break;
             
-            // Alternate between www.gm4s.eu and gm4s.eu
-            chunk_successful = run_tls_client_test(NULL, 0, "gm4s.eu", request_buffer, 6000);
-        }
-        
-        // If both direct approaches fail, fall back to retry mechanism
-        if (!chunk_successful) {
-            printf("Direct upload failed for chunk %lu/%lu, trying with retry mechanism\n", 
-                   chunk + 1, total_chunks);
-            int retry_delay = 500; // 500ms base delay for retries
-            chunk_successful = uploadDataWithRetry(json_buffer, 3, retry_delay);
-        }
-        
-        if (chunk_successful) {
-            successful_uploads++;
-            printf("Chunk %lu/%lu upload successful (%lu records)\n", 
-                   chunk + 1, total_chunks, chunk_size);
+        case UPLOAD_EVENT_DONE:
+            // The upload is over, so the prompt no longer holds it up. The
+            // server has every record, so an automatic upload clears them.
+            displayUploadStatus("Upload complete!");
+            if (upload_session.automatic || showYesNoPrompt("Data Uploaded", "Clear flash storage?")) {
+                clearUploadedRecords(flash);
+            } else {
+                displayUploadStatus("Data preserved");
+            }
+            refresh_display = true;
+            break;
             
-            // Add a small delay between successful chunks to let server process
-            sleep_ms(200);
-        } else {
-            printf("Chunk %lu/%lu upload failed\n", chunk + 1, total_chunks);
+        case UPLOAD_EVENT_INCOMPLETE:
+            sprintf(status_msg, "%lu/%lu records sent", (unsigned long)event.acknowledged,
+                    (unsigned long)event.total);
+            displayUploadStatus(status_msg);
+            refresh_display = true;
+            break;
             
-            // Add a longer delay after failures for network recovery
-            int retry_delay = 500; // 500ms base delay
-            printf("Waiting %dms after failed chunk for network recovery\n", retry_delay * 2);
-            sleep_ms(retry_delay * 2);
+        case UPLOAD_EVENT_FAILED:
+            displayUploadStatus("Upload failed");
+            refresh_display = true;
+            break;
         }
     }
+}
+
+enum AutoUploadState : uint8_t {
+    AUTO_UPLOAD_IDLE = 0,
+    AUTO_UPLOAD_SCANNING,     // Passive scan for known networks
+    AUTO_UPLOAD_JOINING,
+    AUTO_UPLOAD_UPLOADING
+};
+
+struct AutoUploadStats {
+    uint32_t scans;
+    uint32_t sightings;           // Scans that saw a known network
+    uint32_t uploads;
+    uint32_t records;             // Acknowledged by automatic uploads
+    uint32_t max_backlog_age_s;   // Oldest record an automatic upload delivered
+    uint32_t last_delivery_ms;    // From the network being seen to the upload finishing
+};
+
+AutoUploadState auto_upload_state = AUTO_UPLOAD_IDLE;
+uint32_t auto_upload_last_scan_ms = 0;
+uint32_t auto_upload_state_ms = 0;    // When the current state was entered
+uint32_t auto_upload_seen_ms = 0;
+AutoUploadStats auto_upload_stats = {};
+
+// Stored and buffered records the server has not acknowledged yet
+size_t pendingUploadRecords() {
+    size_t stored = flash_storage.getStoredCount();
+    UploadCursor cursor;
+    if (flash_storage.loadState(FLASH_STATE_UPLOAD_CURSOR, &cursor, sizeof(cursor)) &&
+        cursor.acknowledged <= stored) {
+        stored -= cursor.acknowledged;
+    }
+    return stored + data_buffer.size();
+}
+
+void setAutoUploadState(AutoUploadState state) {
+    auto_upload_state = state;
+    auto_upload_state_ms = to_ms_since_boot(get_absolute_time());
     
-    uint32_t upload_end_time = to_ms_since_boot(get_absolute_time());
-    uint32_t total_upload_time = upload_end_time - upload_start_time;
+    // The radio is held from the scan until the upload is done; during the
+    // upload only the session works
+    if (state == AUTO_UPLOAD_IDLE) {
+        radio.release(RADIO_USER_AUTO_UPLOAD);
+    } else {
+        radio.setWaiting(RADIO_USER_AUTO_UPLOAD, state == AUTO_UPLOAD_UPLOADING);
+    }
+}
+
+// Gives up a background scan or join, e.g. for a manual upload; a running
+// automatic upload is left alone
+void cancelAutoUploadJoin() {
+    if (auto_upload_state == AUTO_UPLOAD_SCANNING || auto_upload_state == AUTO_UPLOAD_JOINING) {
+        printf("[AUTO] Background %s cancelled\n", auto_upload_state == AUTO_UPLOAD_SCANNING ? "scan" : "join");
+        wifi.powerDown();
+        setAutoUploadState(AUTO_UPLOAD_IDLE);
+    }
+}
+
+// Stops everything the auto-upload policy started, e.g. before sleeping
+void stopAutoUpload() {
+    if (auto_upload_state == AUTO_UPLOAD_UPLOADING) {
+        if (isUploadRunning()) {
+            finishUploadSession();
+        }
+        wifi.powerDown();
+        setAutoUploadState(AUTO_UPLOAD_IDLE);
+    }
+    cancelAutoUploadJoin();
+}
+
+bool local_download_active = false;
+uint32_t local_download_first_sequence = 0;    // Of stored record 0, for the CSV
+
+// Stored records straight from flash; uploads wait while the access point is
+// open and localDownloadHoldsFlash() keeps new records from being written
+// while these are being sent
+const uint8_t* localDownloadRecords(void* arg, size_t* count, size_t* record_size) {
+    *count = flash_storage.getStoredDataCount();
+    *record_size = SENSOR_DATA_SIZE;
+    return flash_storage.getRecordArea();
+}
+
+size_t localDownloadCsvRow(void* arg, size_t index, char* out, size_t size) {
+    SensorData data;
+    if (!flash_storage.readRecord(index, data)) {
+        return 0;
+    }
+    int n = snprintf(out, size, "%lu,%lu,%.7f,%.7f,%.2f,%.2f,%.2f,%.0f,%u,%u,%u,%lu,%d,%d\n",
+                     (unsigned long)(local_download_first_sequence + index), (unsigned long)data.timestamp,
+                     (int32_t)data.latitude / 10000000.0, (int32_t)data.longitude / 10000000.0,
+                     data.temp, data.hum, data.pres, data.gasRes, data.pm2_5, data.pm5, data.pm10,
+                     (unsigned long)data.co2, data.is_fake_gps, data.time_unsynced);
+    return n > 0 ? (size_t)n : 0;
+}
+
+size_t localDownloadStatus(void* arg, char* out, size_t size) {
+    int n = snprintf(out, size,
+                     "{\"device\":\"%s\",\"records\":%lu,\"record_size\":%u,\"capacity\":%lu,"
+                     "\"first_sequence\":%lu,\"not_uploaded\":%lu,\"clock_synced\":%s,\"battery\":%.0f,"
+                     "\"uptime_s\":%lu,\"requests\":%lu,\"bytes_sent\":%lu}",
+                     board_id, (unsigned long)flash_storage.getStoredDataCount(), (unsigned)SENSOR_DATA_SIZE,
+                     (unsigned long)flash_storage.getMaxDataCount(), (unsigned long)local_download_first_sequence,
+                     (unsigned long)pendingUploadRecords(), gps_clock.isSynced() ? "true" : "false", batteryLevel,
+                     (unsigned long)(to_ms_since_boot(get_absolute_time()) / 1000),
+                     (unsigned long)download_server_requests(), (unsigned long)download_server_bytes_sent());
+    return n > 0 ? (size_t)n : 0;
+}
+
+const download_source_t local_download_source = {
+    localDownloadRecords,
+    localDownloadCsvRow,
+    "sequence,timestamp,latitude,longitude,temperature,humidity,pressure,gas_resistance,"
+    "pm2_5,pm5,pm10,co2,fake_gps,time_unsynced\n",
+    localDownloadStatus,
+    nullptr
+};
+
+bool isLocalDownloadActive() {
+    return local_download_active;
+}
+
+// Access point password of this board: SHA-256 over the secret and the board
+// ID, LOCAL_DOWNLOAD_PASSWORD_LENGTH characters from an alphabet without
+// look-alikes (no 0/o, 1/l), as it is typed from the display
+void localDownloadPassword(char* out) {
+    static const char alphabet[] = "23456789abcdefghijkmnpqrstuvwxyz";
+    static_assert(sizeof(alphabet) - 1 == 32, "5 bits per character");
+    uint8_t input[sizeof(LOCAL_DOWNLOAD_SECRET) - 1 + sizeof(board_id)];
+    memcpy(input, LOCAL_DOWNLOAD_SECRET, sizeof(LOCAL_DOWNLOAD_SECRET) - 1);
+    memcpy(input + sizeof(LOCAL_DOWNLOAD_SECRET) - 1, board_id, sizeof(board_id));
+    uint8_t digest[32];
+    mbedtls_sha256(input, sizeof(input), digest, 0);
+    for (int i = 0; i < LOCAL_DOWNLOAD_PASSWORD_LENGTH; i++) {
+        out[i] = alphabet[digest[i] & 31];
+    }
+    out[LOCAL_DOWNLOAD_PASSWORD_LENGTH] = '\0';
+}
+
+// How to join, shown while the access point is open
+void displayLocalDownload(const char* ssid, const char* password) {
+    resetImageBuffer();
+    Paint_DrawString_EN(10, 5, "Download", &Font24, BLACK, WHITE);
+    Paint_DrawString_EN(10, 45, "WiFi:", &Font12, BLACK, WHITE);
+    Paint_DrawString_EN(10, 60, ssid, &Font16, BLACK, WHITE);
+    Paint_DrawString_EN(10, 90, "Password:", &Font12, BLACK, WHITE);
+    Paint_DrawString_EN(10, 105, password, &Font16, BLACK, WHITE);
+    Paint_DrawString_EN(10, 135, "Open in a browser:", &Font12, BLACK, WHITE);
+    char url[40];
+    snprintf(url, sizeof(url), "http://%s/", wifi.getAccessPointAddress());
+    Paint_DrawString_EN(10, 150, url, &Font12, BLACK, WHITE);
+    drawBatteryIcon(150, 5);
+    EPD_1IN54_V2_Display(ImageBuffer);
+    if (fast_refresh_enabled) {
+        base_image_set = false;
+        refresh_counter = 0;
+    }
+}
+
+// Opens the access point and the download server; the records still in RAM
+// are saved first so the download has them
+bool startLocalDownload() {
+    if (local_download_active) {
+        return true;
+    }
+    if (isUploadRunning()) {
+        printf("[DOWNLOAD] Upload running, not opening the access point\n");
+        displayUploadStatus("Upload running");
+        return false;
+    }
+    cancelAutoUploadJoin();
+    if (!radio.acquire(RADIO_USER_LOCAL_DOWNLOAD)) {
+        displayUploadStatus("WiFi failed");
+        return false;
+    }
     
-    // Show final results with timing information
-    printf("Upload complete: %lu/%lu chunks successful (%lu/%lu records) in %lu ms (%.1f seconds)\n", 
-           successful_uploads, total_chunks, 
-           successful_uploads * CHUNK_SIZE < total_records ? successful_uploads * CHUNK_SIZE : total_records, 
-           total_records, total_upload_time, total_upload_time / 1000.0f);
+    if (!data_buffer.empty()) {
+        printf("[DOWNLOAD] Saving %lu buffered records to flash\n", (unsigned long)data_buffer.size());
+        for (const auto& data : data_buffer) {
+            flash_storage.saveSensorData(data);
+        }
+        data_buffer.clear();
+        buffer_modified = false;
+    }
+    local_download_first_sequence = loadUploadSequence();
     
-    // Only consider upload successful if at least 70% of chunks were uploaded
-    bool mostly_successful = (successful_uploads >= total_chunks * 0.7);
+    char ssid[33];
+    size_t id_len = strlen(board_id);
+    snprintf(ssid, sizeof(ssid), "%s%s", LOCAL_DOWNLOAD_SSID_PREFIX, board_id + (id_len > 4 ? id_len - 4 : 0));
+    char password[LOCAL_DOWNLOAD_PASSWORD_LENGTH + 1];
+    localDownloadPassword(password);
+    if (!wifi.startAccessPoint(ssid, password)) {
+        radio.release(RADIO_USER_LOCAL_DOWNLOAD);
+        displayUploadStatus("Access point failed");
+        return false;
+    }
+    cyw43_arch_lwip_begin();
+    bool started = download_server_start(LOCAL_DOWNLOAD_PORT, &local_download_source);
+    cyw43_arch_lwip_end();
+    if (!started) {
+        wifi.stopAccessPoint();
+        radio.release(RADIO_USER_LOCAL_DOWNLOAD);
+        displayUploadStatus("Server failed");
+        return false;
+    }
     
-    // If upload was mostly successful, ask if user wants to clear the data
-    if (mostly_successful) {
-        displayUploadStatus("Upload complete!");
-        sleep_ms(500);
+    local_download_active = true;
+    printf("[DOWNLOAD] %lu records at http://%s/ on WiFi \"%s\"\n",
+           (unsigned long)flash_storage.getStoredDataCount(), wifi.getAccessPointAddress(), ssid);
+    displayLocalDownload(ssid, password);
+    return true;
+}
+
+void stopLocalDownload() {
+    if (!local_download_active) {
+        return;
+    }
+    cyw43_arch_lwip_begin();
+    download_server_stop();
+    cyw43_arch_lwip_end();
+    wifi.stopAccessPoint();
+    radio.release(RADIO_USER_LOCAL_DOWNLOAD);
+    local_download_active = false;
+    displayUploadStatus("Download closed");
+}
+
+// True while new records must stay in RAM: saving one rewrites the flash
+// sector it goes into, which a /records.bin response may still be sending
+// from. Past LOCAL_DOWNLOAD_BUFFER_MAX records the download is closed instead.
+bool localDownloadHoldsFlash() {
+    if (!local_download_active) {
+        return false;
+    }
+    cyw43_arch_lwip_begin();
+    bool in_use = download_server_records_in_use();
+    cyw43_arch_lwip_end();
+    if (!in_use) {
+        return false;
+    }
+    if (data_buffer.size() < LOCAL_DOWNLOAD_BUFFER_MAX) {
+        return true;
+    }
+    printf("[DOWNLOAD] %lu records waiting for flash, closing the download\n", (unsigned long)data_buffer.size());
+    stopLocalDownload();
+    return false;
+}
+
+// Store-and-forward policy, advanced on every main loop pass without waiting
+void tickAutoUpload(myGPS& gps) {
+#if AUTO_UPLOAD
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    switch (auto_upload_state) {
+    case AUTO_UPLOAD_IDLE: {
+        if (!initializationComplete || isUploadRunning() || isLocalDownloadActive() ||
+            now - auto_upload_last_scan_ms < AUTO_UPLOAD_SCAN_INTERVAL_MS) {
+            return;
+        }
+        auto_upload_last_scan_ms = now;
+        size_t pending = pendingUploadRecords();
+        if (pending < AUTO_UPLOAD_MIN_RECORDS) {
+            return;
+        }
+        if (batteryLevel < AUTO_UPLOAD_MIN_BATTERY) {
+            printf("[AUTO] Battery at %.0f%%, not uploading %lu records\n", batteryLevel, (unsigned long)pending);
+            return;
+        }
+        if (!radio.acquire(RADIO_USER_AUTO_UPLOAD)) {
+            return;
+        }
+        if (wifi.getConnected() == CYW43_LINK_UP) {
+            // Still connected after a manual upload; no scan needed
+            auto_upload_seen_ms = now;
+            setAutoUploadState(AUTO_UPLOAD_JOINING);
+            return;
+        }
+        if (wifi.startScan(true)) {
+            auto_upload_stats.scans++;
+            setAutoUploadState(AUTO_UPLOAD_SCANNING);
+        } else {
+            radio.release(RADIO_USER_AUTO_UPLOAD);
+        }
+        return;
+    }
         
-        // Ask user if they want to clear the uploaded data
-        bool clear_data = showYesNoPrompt("Data Uploaded", "Clear flash storage?");
+    case AUTO_UPLOAD_SCANNING:
+        if (wifi.isScanning() && now - auto_upload_state_ms < AUTO_UPLOAD_SCAN_TIMEOUT_MS) {
+            return;
+        }
+        if (!wifi.sawKnownNetwork() || !wifi.startJoinKnownNetwork()) {
+            wifi.powerDown();
+            setAutoUploadState(AUTO_UPLOAD_IDLE);
+            return;
+        }
+        printf("[AUTO] Known network in range after %lu ms of scanning\n",
+               (unsigned long)(now - auto_upload_state_ms));
+        auto_upload_stats.sightings++;
+        auto_upload_seen_ms = now;
+        setAutoUploadState(AUTO_UPLOAD_JOINING);
+        return;
         
-        if (clear_data) {
-            displayUploadStatus("Clearing storage...");
-            if (flash.eraseStorage()) {
-                displayUploadStatus("Storage cleared");
-                sleep_ms(500);
-                printf("Flash storage cleared after successful upload\n");
-            } else {
-                displayUploadStatus("Clear failed!");
-                sleep_ms(500);
-            }
-        } else {
-            displayUploadStatus("Data preserved");
-            sleep_ms(500);
+    case AUTO_UPLOAD_JOINING: {
+        int joined = wifi.getConnected() == CYW43_LINK_UP ? 1 : wifi.pollJoin();
+        if (joined == 0 && now - auto_upload_state_ms < AUTO_UPLOAD_JOIN_TIMEOUT_MS) {
+            return;
         }
-    } else if (successful_uploads > 0) {
-        char result_msg[64];
-        sprintf(result_msg, "%lu/%lu chunks uploaded", successful_uploads, total_chunks);
-        displayUploadStatus(result_msg);
-        sleep_ms(500);
-    } else {
-        displayUploadStatus("Upload failed");
-        sleep_ms(500);
+        if (joined != 1) {
+            printf("[AUTO] Could not join the network, trying again in %lu s\n",
+                   (unsigned long)(AUTO_UPLOAD_SCAN_INTERVAL_MS / 1000));
+            wifi.powerDown();
+            setAutoUploadState(AUTO_UPLOAD_IDLE);
+            return;
+        }
+        
+        // Buffered records go along with this upload
+        for (const auto& data : data_buffer) {
+            flash_storage.saveSensorData(data);
+        }
+        data_buffer.clear();
+        buffer_modified = false;
+        
+        saveWifiAp();
+        prefetchUploadHosts();
+        if (!startUploadSession(flash_storage, gps, true)) {
+            wifi.powerDown();
+            setAutoUploadState(AUTO_UPLOAD_IDLE);
+            return;
+        }
+        printf("[AUTO] Uploading %lu records in the background\n", (unsigned long)upload_session.total_records);
+        setAutoUploadState(AUTO_UPLOAD_UPLOADING);
+        return;
     }
-    
-    return mostly_successful;
+        
+    case AUTO_UPLOAD_UPLOADING:
+        if (isUploadRunning()) {
+            return;
+        }
+        auto_upload_stats.uploads++;
+        auto_upload_stats.records += upload_session.acknowledged_records;
+        auto_upload_stats.last_delivery_ms = now - auto_upload_seen_ms;
+        if (upload_session.acknowledged_records > 0 && upload_session.backlog_age_s > auto_upload_stats.max_backlog_age_s) {
+            auto_upload_stats.max_backlog_age_s = upload_session.backlog_age_s;
+        }
+        printf("[AUTO] Upload done %lu s after the network was seen; %lu uploads, %lu records, "
+               "%lu/%lu scans saw a known network, oldest backlog %lu min\n",
+               (unsigned long)(auto_upload_stats.last_delivery_ms / 1000), (unsigned long)auto_upload_stats.uploads,
+               (unsigned long)auto_upload_stats.records, (unsigned long)auto_upload_stats.sightings,
+               (unsigned long)auto_upload_stats.scans, (unsigned long)(auto_upload_stats.max_backlog_age_s / 60));
+        wifi.powerDown();
+        setAutoUploadState(AUTO_UPLOAD_IDLE);
+        return;
+    }
+#endif
 }
 
 // Function to display initialization progress on the e-ink display
@@ -2353,11 +2908,15 @@ int main() {
 
     printf("Program starting with enhanced debugging...\n");
     
-    // Set system time to a reasonable default (Jan 1, 2024)
-    // Since the Pi Pico has no RTC, we need to set a default time
-    // This will be used until we get actual time from GPS
-    time_t default_time = 1706745600; // 2024-01-31 00:00:00 UTC
-    set_system_time(default_time);
+    pico_get_unique_board_id_string(board_id, sizeof(board_id));
+    printf("Board ID %s\n", board_id);
+    
+    // mbedTLS allocates from its own static arena from the first handshake on
+    tls_arena_init();
+    
+    // Run the clock from a default epoch until the persisted GPS state or the
+    // receiver provide a better one; records stay flagged unsynced until GPS time
+    gps_clock.setFallback(CLOCK_DEFAULT_EPOCH);
     
 #ifdef USE_WATCHDOG
     // Initialize and start the watchdog timer (20 second timeout)
@@ -2404,6 +2963,8 @@ int main() {
         printf("Flash storage initialized successfully\n");
         printf("Flash storage can hold up to %lu records\n", flash_storage.getMaxDataCount());
         printf("Currently %lu records stored\n", flash_storage.getStoredCount());
+        loadTlsSession();
+        loadWifiAp();
     } else {
         printf("Flash storage initialization failed\n");
     }
@@ -2420,6 +2981,16 @@ int main() {
     gps.enableFakeGPS(true);
     // You can set custom coordinates if needed
     // gps.setFakeCoordinates(48.20662016908546, 15.617513602109687);
+#elif USE_GPS_PLAYBACK
+    // Replay the recorded track from flash through the normal NMEA decoder
+    const char *playback_data = (const char *)(XIP_BASE + GPS_PLAYBACK_FLASH_OFFSET);
+    static GpsPlayback gps_playback(playback_data,
+                                    GpsPlayback::blobLength(playback_data, GPS_PLAYBACK_MAX_SIZE),
+                                    []() -> uint64_t { return time_us_64(); });
+    gps_playback.setSpeed(GPS_PLAYBACK_SPEED);
+    gps_playback.setLoop(true);
+    gps.setPlayback(&gps_playback);
+    printf("NOTICE: GPS playback enabled at %dx speed\n", GPS_PLAYBACK_SPEED);
 #else
     // Only initialize real GPS if not using fake data
     
@@ -2432,17 +3003,36 @@ int main() {
     printf("Requesting GPS module to enable time messages...\n");
     gps.enableTimeMessages();
     
-    // Set up for faster GPS acquisition by sending multiple configuration commands
-    // First try a cold start to fully reset the module
-    printf("Performing GPS cold start to reset the module...\n");
-    bool cold_start_success = gps.sendColdStartCommand();
-    if (cold_start_success) {
-        printf("GPS cold start completed successfully\n");
+    // Pick the start type from the age of the persisted fix instead of always
+    // cold starting, so ephemeris and almanac kept by the receiver survive a reboot
+    gps_aiding_state_valid = flash_storage.loadState(FLASH_STATE_GPS, &gps_aiding_state, sizeof(gps_aiding_state));
+    uint32_t receiver_utc = 0;
+    bool have_receiver_time = gps.readReceiverTime(receiver_utc, 3000);
+    if (have_receiver_time) {
+        gps_clock.setFallback(receiver_utc);
+    } else if (gps_aiding_state_valid) {
+        gps_clock.setFallback(gps_aiding_state.utc_epoch);
+    }
+    
+    if (gps_aiding_state_valid) {
+        printf("Persisted GPS state: %.6f, %.6f at UTC %lu\n",
+               gps_aiding_state.latitude_e7 / 1e7, gps_aiding_state.longitude_e7 / 1e7,
+               gps_aiding_state.utc_epoch);
+        if (have_receiver_time) {
+            printf("Persisted GPS state age: %ld s\n", (long)(receiver_utc - gps_aiding_state.utc_epoch));
+        }
+    } else {
+        printf("No persisted GPS state found\n");
+    }
+    
+    GpsStartType start_type = myGPS::chooseStartType(gps_aiding_state, gps_aiding_state_valid,
+                                                     receiver_utc, have_receiver_time);
+    printf("Performing GPS %s start...\n", myGPS::startTypeName(start_type));
+    if (gps.startWithAiding(start_type, gps_aiding_state, gps_aiding_state_valid,
+                            receiver_utc, have_receiver_time)) {
+        printf("GPS %s start completed successfully\n", myGPS::startTypeName(start_type));
     } else {
-        printf("GPS cold start may not have been recognized by the module\n");
-        // Try a hot start as fallback
-        printf("Attempting hot start instead...\n");
-        gps.sendHotStartCommand();
+        printf("GPS %s start may not have been recognized by the module\n", myGPS::startTypeName(start_type));
     }
     
     // Additional configuration to focus on faster fix acquisition
@@ -2504,6 +3094,9 @@ int main() {
                     latest_valid_lat = gps_lat;
                     latest_valid_lon = gps_lon;
                     printf("First valid coordinates: %.6f, %.6f\n", latest_valid_lat, latest_valid_lon);
+                    updateClockFromGps(gps);
+                    updatePositionFilter(gps);
+                    updateGpsAidingState(gps, gps_lat, gps_ns, gps_lon, gps_ew);
                 }
                 
                 // Show success message
@@ -2707,6 +3300,12 @@ timeout_complete:
         watchdog_update();
 #endif
         
+        // Advance a running upload and show its progress; never waits for the network
+        tickUploadSession();
+        handleUploadEvents(flash_storage);
+        tickAutoUpload(gps);
+        radio.tick();
+        
         // Handle any pending button input
         DEBUG_POINT("Processing button inputs");
         volatile uint32_t events = btn1_events;
@@ -2750,7 +3349,7 @@ timeout_complete:
             DEBUG_POINT("Processing scheduled tasks");
             
             // Check if it's time to collect data
-            if (current_time - last_data_collection_ms >= dataCollectionInterval) {
+            if (current_time - last_data_collection_ms >= dataCollectionInterval / DATA_COLLECTION_TIME_SCALE) {
                 DEBUG_POINT("Starting data collection");
                 printf("TIMING: Data collection triggered (elapsed: %u ms, interval: %u ms)\n",
                        (unsigned int)(current_time - last_data_collection_ms),
@@ -2814,6 +3413,9 @@ timeout_complete:
                 uint32_t hm3301_start = to_ms_since_boot(get_absolute_time());
                 bool hm3301_success = false;
                 
+                // The sample is geo-tagged at the particulate read, not at the last fix
+                uint32_t sample_time_ms = hm3301_start;
+                
                 // Catch any exceptions during sensor read
                 try {
                     hm3301_success = hm3301_sensor.read(pm1_0, pm2_5, pm10);
@@ -2891,12 +3493,26 @@ timeout_complete:
                     printf("WARNING: GPS read took %lu ms (expected <100ms)\n", gps_duration_ms);
                 }
                 
-                // Set GPS data in the sensor data object
-                sensor_data_obj.longitude = (int32_t)(longitude * 10000000); // Store as fixed-point
-                sensor_data_obj.latitude = (int32_t)(latitude * 10000000);   // Store as fixed-point
+                updateClockFromGps(gps);
+                updatePositionFilter(gps);
+                
+                // Set GPS data in the sensor data object, estimated at the sample time
+                // when the filter has fixes, otherwise the raw reading
+                int32_t sample_lat_e7, sample_lon_e7;
+                if (position_filter.estimate(sample_time_ms, sample_lat_e7, sample_lon_e7)) {
+                    sensor_data_obj.longitude = sample_lon_e7;
+                    sensor_data_obj.latitude = sample_lat_e7;
+                    printf("Sample position at %lu ms: %.7f, %.7f (last fix %lu ms earlier)\n",
+                           sample_time_ms, sample_lat_e7 / 10000000.0, sample_lon_e7 / 10000000.0,
+                           (unsigned long)(sample_time_ms - position_filter.getLastFixMs()));
+                } else {
+                    sensor_data_obj.longitude = (int32_t)(longitude * 10000000); // Store as fixed-point
+                    sensor_data_obj.latitude = (int32_t)(latitude * 10000000);   // Store as fixed-point
+                }
                 
                 // Set timestamp from system time
-                sensor_data_obj.timestamp = time(NULL);
+                sensor_data_obj.timestamp = gps_clock.now();
+                sensor_data_obj.time_unsynced = !gps_clock.isSynced();
                 
                 // Set fake GPS flag based on gps settings
                 sensor_data_obj.is_fake_gps = (USE_FAKE_GPS == 1);
@@ -2939,7 +3555,7 @@ timeout_complete:
                   (initializationComplete ? FLASH_SAVE_INTERVAL_MS : INIT_FLASH_SAVE_INTERVAL_MS)) || 
                  (data_buffer.size() >= 
                   (initializationComplete ? MAX_BUFFER_SIZE : INIT_MAX_BUFFER_SIZE))) && 
-                data_buffer.size() > 0) {
+                data_buffer.size() > 0 && !localDownloadHoldsFlash()) {
                 
                 DEBUG_POINT("Starting flash save");
                 printf("TIMING: Flash save triggered (elapsed: %u ms, interval: %u ms, buffer size: %lu)\n",
@@ -3056,14 +3672,30 @@ timeout_complete:
                     // nextPage already calls forceDisplayRefresh
                     nextPage();
                     printf("Changed to page %d and refreshed display\n", current_page);
+                } else if (tast_pressed[0] == LONG_PRESSED && current_page == LOCAL_DOWNLOAD_PAGE) {
+                    // Long press on the settings page - open or close the local download
+                    DEBUG_POINT("Processing Next Page button (LONG_PRESSED) - local download");
+                    tast_pressed[0] = NOT_PRESSED;
+                    if (isLocalDownloadActive()) {
+                        stopLocalDownload();
+                    } else {
+                        startLocalDownload();
+                    }
                 } else if (tast_pressed[0] == LONG_PRESSED) {
                     // Long press on next page button - trigger data upload
                     DEBUG_POINT("Processing Next Page button (LONG_PRESSED) - data upload");
                     tast_pressed[0] = NOT_PRESSED;
                     printf("Long press detected on button 0 - starting data upload\n");
                     
-                    // Use our optimized WiFi connection function
-                    if (ensureWiFiConnection()) {
+                    // A background scan or join gives way to the manual upload
+                    cancelAutoUploadJoin();
+                    
+                    if (isUploadRunning()) {
+                        printf("Upload already running, ignoring long press\n");
+                    } else if (isLocalDownloadActive()) {
+                        printf("Local download open, ignoring long press\n");
+                        displayUploadStatus("Close download first");
+                    } else if (radio.acquire(RADIO_USER_UPLOAD) && ensureWiFiConnection()) {
                         // WiFi is connected, proceed with upload
                         DEBUG_POINT("WiFi connected - preparing for upload");
                         
@@ -3088,20 +3720,24 @@ timeout_complete:
                         uint32_t record_count = flash_storage.getStoredCount();
                         
                         if (record_count > 0) {
-                            // Always use the more reliable chunked upload method
-                            printf("Using reliable chunked upload method for %lu records\n", record_count);
-                            uploadSensorDataChunked(flash_storage, gps, UPLOAD_ALL_AT_ONCE);
+                            // The upload continues from the main loop while sampling goes on
+                            printf("Starting background chunked upload for %lu records\n", record_count);
+                            startUploadSession(flash_storage, gps);
                         } else {
                             displayUploadStatus("No data to upload");
                             sleep_ms(1000); // Reduced from 2000ms
                         }
                         
-                        DEBUG_POINT("Data upload completed");
+                        DEBUG_POINT("Data upload started");
                     } else {
                         // No WiFi connection could be established
                         displayUploadStatus("No WiFi, can't upload");
                         sleep_ms(500); // Reduced from 1000ms to 500ms
                     }
+                    if (!isUploadRunning()) {
+                        // Nothing was started; the radio goes off after the idle timeout
+                        radio.release(RADIO_USER_UPLOAD);
+                    }
                 }
                 
                 if (tast_pressed[1] == SHORT_PRESSED) {
@@ -3116,6 +3752,12 @@ timeout_complete:
                     DEBUG_POINT("Processing Settings button (LONG_PRESSED) - sleep mode");
                     tast_pressed[1] = NOT_PRESSED;
                     printf("Long press detected on button 1 - entering sleep mode\n");
+                    stopLocalDownload();
+                    stopAutoUpload();
+                    if (isUploadRunning()) {
+                        // Keep what was acknowledged so far; the rest goes with the next upload
+                        finishUploadSession();
+                    }
                     enterSleepMode();
                 }
                 
@@ -3192,6 +3834,8 @@ timeout_complete:
             
             // Read GPS data with timeout protection - do this frequently (10Hz polling)
             int gps_status_result = gps.readLine(gps_data, gps_lon, gps_ew, gps_lat, gps_ns, gps_time_str, gps_date_str);
+            updateClockFromGps(gps);
+            updatePositionFilter(gps);
             
             // Update fix status immediately on any change
             if (fix_status != gps_status_result) {
@@ -3226,6 +3870,7 @@ timeout_complete:
                 latest_valid_lat = gps_lat;
                 latest_valid_lon = gps_lon;
                 has_valid_fix_since_boot = true;
+                updateGpsAidingState(gps, gps_lat, gps_ns, gps_lon, gps_ew);
                 
                 // Set the current position data for sensor data collection
                 sensor_data_obj.longitude = (int32_t)(gps_lon * 10000000); // Store as fixed-point
@@ -0,0 +1,91 @@
+# Prints the stack budget report from the .su files gcc writes with
+# -fstack-usage and fails when an upload path function is over its limit.
+# Run after the build:
+#
+#   cmake -DSU_DIR=<object dir> -DSTACK_WARN=<bytes> -DUPLOAD_LIMIT=<bytes>
+#         -DUPLOAD_MATCH=<regex> -P stack_report.cmake
+#
+# Each .su line is "file:line:column:function<TAB>bytes<TAB>static|dynamic|bounded";
+# UPLOAD_MATCH is matched against "file:line:column:function" with the
+# directories removed.
+
+if(NOT DEFINED STACK_REPORT_TOP)
+    set(STACK_REPORT_TOP 15)
+endif()
+
+file(GLOB_RECURSE su_files "${SU_DIR}/*.su")
+if(NOT su_files)
+    message(STATUS "Stack budget: no .su files in ${SU_DIR}")
+    return()
+endif()
+
+# string(REPEAT) needs CMake 3.15
+set(zeros "00000000")
+set(blanks "      ")
+
+set(entries "")
+set(over_warn 0)
+set(over_limit 0)
+set(upload_count 0)
+foreach(su_file ${su_files})
+    file(STRINGS "${su_file}" lines)
+    foreach(line ${lines})
+        if(line MATCHES "^(.*)\t([0-9]+)\t([a-z,]+)$")
+            set(location "${CMAKE_MATCH_1}")
+            set(bytes "${CMAKE_MATCH_2}")
+            set(kind "${CMAKE_MATCH_3}")
+            if(location MATCHES "([^/]+:[0-9]+:[0-9]+:.*)$")
+                set(location "${CMAKE_MATCH_1}")
+            endif()
+            set(upload 0)
+            if(UPLOAD_MATCH AND location MATCHES "${UPLOAD_MATCH}")
+                set(upload 1)
+                math(EXPR upload_count "${upload_count} + 1")
+            endif()
+            # Zero padded so the list sorts by size
+            string(LENGTH "${bytes}" digits)
+            math(EXPR padding "8 - ${digits}")
+            string(SUBSTRING "${zeros}" 0 ${padding} padded)
+            list(APPEND entries "${padded}${bytes}|${kind}|${upload}|${location}")
+            if(upload AND bytes GREATER UPLOAD_LIMIT)
+                math(EXPR over_limit "${over_limit} + 1")
+            elseif(bytes GREATER STACK_WARN)
+                math(EXPR over_warn "${over_warn} + 1")
+            endif()
+        endif()
+    endforeach()
+endforeach()
+
+list(SORT entries ORDER DESCENDING)
+list(LENGTH entries count)
+message(STATUS "Stack budget: ${count} functions, warn above ${STACK_WARN} bytes; "
+               "${upload_count} upload path functions, limit ${UPLOAD_LIMIT} bytes")
+
+set(shown 0)
+foreach(entry ${entries})
+    string(REPLACE "|" ";" fields "${entry}")
+    list(GET fields 0 bytes)
+    list(GET fields 1 kind)
+    list(GET fields 2 upload)
+    list(GET fields 3 location)
+    math(EXPR bytes "${bytes}")
+    if(upload AND bytes GREATER UPLOAD_LIMIT)
+        set(mark "OVER UPLOAD LIMIT")
+    elseif(bytes GREATER STACK_WARN)
+        set(mark "over warn")
+    elseif(shown LESS STACK_REPORT_TOP)
+        set(mark "")
+    else()
+        break()
+    endif()
+    string(LENGTH "${bytes}" digits)
+    math(EXPR padding "6 - ${digits}")
+    string(SUBSTRING "${blanks}" 0 ${padding} spaces)
+    message(STATUS "  ${spaces}${bytes} ${kind} ${location} ${mark}")
+    math(EXPR shown "${shown} + 1")
+endforeach()
+
+message(STATUS "Stack budget: ${over_warn} above warn, ${over_limit} above the upload limit")
+if(over_limit GREATER 0)
+    message(FATAL_ERROR "Stack budget: ${over_limit} upload path functions use more than ${UPLOAD_LIMIT} bytes of stack")
+endif()
@@ -0,0 +1,168 @@
+// Track encoder benchmark: positions kept, worst error, position bytes in the
+// JSON body and encoding time, for the sample ride and a longer synthetic
+// track with GPS noise. Also checks every dropped position against its final
+// segment independently of the simplifier, and that the deltas decode back
+// to the kept positions exactly.
+
+#include "libs/track/track_encoder.h"
+#include "libs/gps/myGPS.h"
+#include "pico/stdlib.h"
+#include "test_check.h"
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+struct Position {
+    int32_t lat_e7;
+    int32_t lon_e7;
+};
+
+static std::vector<Position> loadRide(const char *path) {
+    size_t length;
+    char *data = test_read_file(path, &length);
+
+    myGPS gps(uart0, UART0_BAUD_RATE, UART0_TX_PIN, UART0_RX_PIN);
+    GpsPlayback playback(data, length, time_us_64);
+    playback.setSpeed(0);
+    gps.setPlayback(&playback);
+
+    std::vector<Position> track;
+    std::string line;
+    while (!playback.finished()) {
+        gps.readLine(line);
+        Position p;
+        uint64_t capture_us;
+        if (gps.takeFix(p.lat_e7, p.lon_e7, capture_us)) {
+            track.push_back(p);
+        }
+    }
+    free(data);
+    return track;
+}
+
+// City ride at ~5 m/s: straight blocks, right-angle turns, a stop, and
+// Gaussian GPS noise of ~2 m (fixed seed)
+static std::vector<Position> syntheticRide(size_t count) {
+    std::vector<Position> track;
+    uint32_t seed = 12345;
+    auto uniform = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0;
+    };
+    auto gaussian = [&uniform]() {
+        double u1 = uniform() + 1e-12, u2 = uniform();
+        return sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+    };
+
+    double lat = 48.2066200, lon = 15.6175100, heading = 0.3;
+    const double metres_per_deg = 111320.0;
+    for (size_t i = 0; i < count; i++) {
+        bool stopped = (i / 300) % 5 == 4 && i % 300 < 60;
+        double speed = stopped ? 0.0 : 5.0;
+        if (i % 120 == 119) {
+            heading += (uniform() < 0.5 ? 1 : -1) * M_PI / 2;
+        }
+        heading += 0.002 * gaussian();
+        lat += speed * cos(heading) / metres_per_deg;
+        lon += speed * sin(heading) / (metres_per_deg * cos(lat * M_PI / 180));
+
+        double noisy_lat = lat + 2.0 * gaussian() / metres_per_deg;
+        double noisy_lon = lon + 2.0 * gaussian() / (metres_per_deg * cos(lat * M_PI / 180));
+        track.push_back({(int32_t)llround(noisy_lat * 1e7), (int32_t)llround(noisy_lon * 1e7)});
+    }
+    return track;
+}
+
+// Distance in metres from p to the segment a-b, in double precision
+static double segmentDistance(const Position &p, const Position &a, const Position &b) {
+    double scale_y = 0.0111319491;
+    double scale_x = scale_y * cos(a.lat_e7 * 1e-7 * M_PI / 180);
+    double ex = (b.lon_e7 - a.lon_e7) * scale_x, ey = (b.lat_e7 - a.lat_e7) * scale_y;
+    double px = (p.lon_e7 - a.lon_e7) * scale_x, py = (p.lat_e7 - a.lat_e7) * scale_y;
+    double length2 = ex * ex + ey * ey;
+    double t = length2 > 0 ? (px * ex + py * ey) / length2 : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    return hypot(px - t * ex, py - t * ey);
+}
+
+static void run(const char *name, const std::vector<Position> &track, float max_error_m) {
+    // Same decision bookkeeping as SensorBody
+    std::vector<bool> keep(track.size(), true);
+    TrackSimplifier simplifier(max_error_m);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < track.size(); i++) {
+        bool previous_kept = simplifier.add(track[i].lat_e7, track[i].lon_e7);
+        if (i > 0) {
+            keep[i - 1] = previous_kept;
+        }
+    }
+    simplifier.finish();
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    CHECK(simplifier.getPointCount() == track.size());
+    CHECK(keep.front() && keep.back());
+
+    // Independent check of every dropped position against its kept neighbours
+    double worst_m = 0;
+    size_t kept = 0, anchor = 0;
+    for (size_t i = 1; i < track.size(); i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        for (size_t k = anchor + 1; k < i; k++) {
+            worst_m = fmax(worst_m, segmentDistance(track[k], track[anchor], track[i]));
+        }
+        CHECK(i - anchor <= TRACK_WINDOW_MAX);
+        anchor = i;
+    }
+    for (size_t i = 0; i < track.size(); i++) {
+        kept += keep[i];
+    }
+    CHECK(kept == simplifier.getKeptCount());
+    CHECK(worst_m <= max_error_m * 1.001 + 0.01);
+
+    // Position bytes in the JSON body: absolute on every record, against
+    // dlat/dlon on kept positions, and the deltas decoding back exactly
+    char text[64];
+    size_t absolute_bytes = 0, encoded_bytes = 0;
+    TrackDeltaEncoder encoder;
+    Position decoded = {0, 0};
+    for (size_t i = 0; i < track.size(); i++) {
+        absolute_bytes += snprintf(text, sizeof(text), "\"latitude\":%.7f,\"longitude\":%.7f,",
+                                   track[i].lat_e7 / 1e7, track[i].lon_e7 / 1e7);
+        if (!keep[i]) {
+            continue;
+        }
+        int32_t dlat, dlon;
+        if (encoder.encode(track[i].lat_e7, track[i].lon_e7, dlat, dlon)) {
+            encoded_bytes += snprintf(text, sizeof(text), "\"dlat\":%ld,\"dlon\":%ld,", (long)dlat, (long)dlon);
+            decoded.lat_e7 += dlat;
+            decoded.lon_e7 += dlon;
+        } else {
+            encoded_bytes += snprintf(text, sizeof(text), "\"latitude\":%.7f,\"longitude\":%.7f,",
+                                      track[i].lat_e7 / 1e7, track[i].lon_e7 / 1e7);
+            decoded = track[i];
+        }
+        CHECK(decoded.lat_e7 == track[i].lat_e7 && decoded.lon_e7 == track[i].lon_e7);
+    }
+
+    printf("%-10s %5zu pts  max %4.1f m  kept %5zu (%5.1f%%)  worst %5.2f m  "
+           "position bytes %6zu -> %6zu (%5.1f%%)  %6.0f ns/pt\n",
+           name, track.size(), max_error_m, kept, 100.0 * kept / track.size(), worst_m,
+           absolute_bytes, encoded_bytes, 100.0 * encoded_bytes / absolute_bytes, ns / track.size());
+}
+
+int main() {
+    std::vector<Position> ride = loadRide(TEST_DATA_DIR "/ride.nmea");
+    std::vector<Position> city = syntheticRide(2000);
+    CHECK(ride.size() == 180);
+
+    const float max_errors[] = {2.0f, TRACK_DEFAULT_MAX_ERROR_M, 10.0f};
+    for (float max_error_m : max_errors) {
+        run("ride.nmea", ride, max_error_m);
+    }
+    for (float max_error_m : max_errors) {
+        run("city", city, max_error_m);
+    }
+    return TEST_RESULT();
+}
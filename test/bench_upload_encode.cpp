@@ -0,0 +1,116 @@
+// Upload encoding benchmark: where the CPU time of encoding a 2,000-record
+// backlog goes, per chunk size, with CBOR + deflate as the firmware sends it.
+// Every chunk is encoded twice: once to size it (DeflateBody compresses once
+// without output) and once more for the bytes sent. The upload session
+// prepares the next chunk while a request is in flight, so the first pass is
+// off the critical path (the session's first chunk aside). The second one is
+// too when the chunk is kept in its slot (at most UPLOAD_PREPARED_BODY_MAX
+// bytes, as in pico_eu.cpp), and otherwise runs while the chunk is sent.
+// Host time; the ratios carry over to the RP2040, the milliseconds do not.
+
+#include "libs/https/sensor_cbor_body.h"
+#include "libs/https/deflate_body.h"
+#include "test_check.h"
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#define BACKLOG 2000
+#define REPEATS 20
+#define UPLOAD_PREPARED_BODY_MAX (8 * 1024)   // Same as pico_eu.cpp
+#define STREAM_CHUNK 512                      // HTTPS_CLIENT_STREAM_CHUNK
+
+static const char *TOKEN = "bench-token";
+static const SensorBody::Origin ORIGIN = {"E6614103E72B8B2A", 1};
+static const SensorBody::Fallback FALLBACK = {1717286400, 48.2, 15.6};
+
+// A ride at 1 record per 5 s with slowly changing readings
+static std::vector<SensorData> makeRecords(size_t count) {
+    std::vector<SensorData> records(count);
+    for (size_t i = 0; i < count; i++) {
+        SensorData &r = records[i];
+        r.latitude = (uint32_t)(int32_t)llround((48.2066200 + i * 0.00002 + 0.00001 * sin(i * 0.05)) * 1e7);
+        r.longitude = (uint32_t)(int32_t)llround((15.6175100 + i * 0.00003) * 1e7);
+        r.timestamp = 1717286400 + 5 * (uint32_t)i;
+        r.temp = 21.5f + 0.01f * (float)(i % 300);
+        r.hum = 45.25f + 0.05f * (float)(i % 20);
+        r.pres = 1013.2f;
+        r.gasRes = 123456.0f + (float)(i % 50);
+        r.pm2_5 = (uint16_t)(i % 40);
+        r.pm10 = (uint16_t)(i % 60);
+        r.co2 = 420 + (uint32_t)(i % 200);
+    }
+    return records;
+}
+
+static double msSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Pass {
+    double sizing_ms = 0;      // Building the bodies, which sizes them
+    double encoding_ms = 0;    // Reading the bytes out, as beginPost() does
+    size_t bytes = 0;
+    size_t chunks = 0;
+    size_t captured = 0;       // Chunks that fit UPLOAD_PREPARED_BODY_MAX
+    double captured_ms = 0;    // Their share of encoding_ms
+};
+
+static Pass encodeBacklog(const std::vector<SensorData> &records, size_t chunk) {
+    Pass pass;
+    char buffer[STREAM_CHUNK];
+    for (size_t start = 0; start < records.size(); start += chunk) {
+        size_t count = std::min(chunk, records.size() - start);
+
+        auto t = std::chrono::steady_clock::now();
+        SensorCborBody cbor(&records[start], count, TOKEN, ORIGIN, FALLBACK, 0.0f);
+        DeflateBody deflated(&cbor);
+        pass.sizing_ms += msSince(t);
+
+        t = std::chrono::steady_clock::now();
+        deflated.rewind(&deflated);
+        size_t length = 0, n;
+        while ((n = deflated.read(&deflated, buffer, sizeof(buffer))) > 0) {
+            length += n;
+        }
+        double ms = msSince(t);
+        CHECK(length == deflated.getLength());
+
+        pass.encoding_ms += ms;
+        pass.bytes += length;
+        pass.chunks++;
+        if (length <= UPLOAD_PREPARED_BODY_MAX) {
+            pass.captured++;
+            pass.captured_ms += ms;
+        }
+    }
+    return pass;
+}
+
+int main() {
+    std::vector<SensorData> records = makeRecords(BACKLOG);
+    const size_t chunks[] = {50, 100, 250, 500, 1000};
+
+    printf("%d records, CBOR + deflate, mean of %d runs (host ms)\n", BACKLOG, REPEATS);
+    printf("chunk  requests   bytes  sizing  encoding  kept  off critical path: before  after\n");
+    for (size_t chunk : chunks) {
+        Pass total;
+        for (int i = 0; i < REPEATS; i++) {
+            Pass pass = encodeBacklog(records, chunk);
+            total.sizing_ms += pass.sizing_ms / REPEATS;
+            total.encoding_ms += pass.encoding_ms / REPEATS;
+            total.captured_ms += pass.captured_ms / REPEATS;
+            total.bytes = pass.bytes;
+            total.chunks = pass.chunks;
+            total.captured = pass.captured;
+        }
+        double all_ms = total.sizing_ms + total.encoding_ms;
+        CHECK(all_ms > 0);
+        CHECK(total.bytes > 0);
+        printf("%5lu  %8lu  %6lu  %6.2f  %8.2f  %4lu  %25.0f%%  %4.0f%%\n", (unsigned long)chunk,
+               (unsigned long)total.chunks, (unsigned long)total.bytes, total.sizing_ms, total.encoding_ms,
+               (unsigned long)total.captured, 100.0 * total.sizing_ms / all_ms,
+               100.0 * (total.sizing_ms + total.captured_ms) / all_ms);
+    }
+    return TEST_RESULT();
+}
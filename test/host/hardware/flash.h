@@ -0,0 +1,33 @@
+#ifndef HOST_HARDWARE_FLASH_H
+#define HOST_HARDWARE_FLASH_H
+
+// Host stand-in for the QSPI flash: a 2 MB image in RAM, mapped at XIP_BASE
+// so Flash's XIP reads and its erase/program calls see the same bytes.
+// Erase and program count their calls, so tests can check when flash was
+// written.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define PICO_FLASH_SIZE_BYTES (2 * 1024 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uint8_t host_flash_image[PICO_FLASH_SIZE_BYTES];
+extern uint32_t host_flash_erase_count;
+extern uint32_t host_flash_program_count;
+
+#define XIP_BASE ((uintptr_t)host_flash_image)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_HARDWARE_FLASH_H
@@ -0,0 +1,12 @@
+#ifndef HOST_HARDWARE_GPIO_H
+#define HOST_HARDWARE_GPIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum gpio_function { GPIO_FUNC_UART = 2, GPIO_FUNC_SIO = 5 };
+
+static inline void gpio_set_function(unsigned int gpio, enum gpio_function fn) { (void)gpio; (void)fn; }
+static inline void gpio_pull_up(unsigned int gpio) { (void)gpio; }
+
+#endif // HOST_HARDWARE_GPIO_H
@@ -0,0 +1,32 @@
+#ifndef HOST_HARDWARE_RTC_H
+#define HOST_HARDWARE_RTC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    int16_t year;
+    int8_t month;
+    int8_t day;
+    int8_t dotw;
+    int8_t hour;
+    int8_t min;
+    int8_t sec;
+} datetime_t;
+
+// The host RTC keeps the last value it was set to
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern datetime_t host_rtc_datetime;
+
+static inline void rtc_init(void) {}
+static inline bool rtc_set_datetime(const datetime_t *t) { host_rtc_datetime = *t; return true; }
+static inline bool rtc_get_datetime(datetime_t *t) { *t = host_rtc_datetime; return true; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_HARDWARE_RTC_H
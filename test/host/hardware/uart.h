@@ -0,0 +1,33 @@
+#ifndef HOST_HARDWARE_UART_H
+#define HOST_HARDWARE_UART_H
+
+// Host stand-in for the UART: nothing is ever received (tests feed myGPS
+// through GpsPlayback) and transmitted bytes are counted and dropped.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct uart_inst { uint32_t tx_bytes; } uart_inst_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern uart_inst_t host_uart0;
+#define uart0 (&host_uart0)
+
+static inline unsigned int uart_init(uart_inst_t *uart, unsigned int baud) { (void)uart; return baud; }
+static inline void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled) { (void)uart; (void)enabled; }
+static inline bool uart_is_enabled(uart_inst_t *uart) { (void)uart; return true; }
+static inline bool uart_is_readable(uart_inst_t *uart) { (void)uart; return false; }
+static inline char uart_getc(uart_inst_t *uart) { (void)uart; return 0; }
+static inline void uart_putc(uart_inst_t *uart, char c) { (void)c; uart->tx_bytes++; }
+static inline void uart_puts(uart_inst_t *uart, const char *s) { while (*s) uart_putc(uart, *s++); }
+static inline void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len) { (void)src; uart->tx_bytes += len; }
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_HARDWARE_UART_H
@@ -0,0 +1,25 @@
+#ifndef HOST_CLOCK_H
+#define HOST_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Virtual time base of the host build. time_us_64() reads it and sleep_us()/
+// sleep_ms() advance it instead of blocking, so runs are deterministic and
+// take no wall-clock time.
+uint64_t host_clock_now_us(void);
+void host_clock_advance_us(uint64_t us);
+
+// Called after every advance of the clock; the network rig uses it to run
+// lwIP timers and deliver frames that became due, like cyw43's background poll
+typedef void (*host_clock_idle_fn)(void);
+void host_clock_set_idle(host_clock_idle_fn fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HOST_CLOCK_H
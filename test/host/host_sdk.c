@@ -0,0 +1,83 @@
+#include "host_clock.h"
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/flash.h"
+#include "hardware/rtc.h"
+#include <stdlib.h>
+#include <string.h>
+
+uart_inst_t host_uart0;
+datetime_t host_rtc_datetime;
+
+uint8_t host_flash_image[PICO_FLASH_SIZE_BYTES];
+uint32_t host_flash_erase_count;
+uint32_t host_flash_program_count;
+
+// Flash comes up erased
+__attribute__((constructor)) static void host_flash_init(void) {
+    memset(host_flash_image, 0xFF, sizeof(host_flash_image));
+}
+
+static uint64_t now_us;
+static host_clock_idle_fn idle_fn;
+static int in_idle;
+
+uint64_t host_clock_now_us(void) {
+    return now_us;
+}
+
+void host_clock_advance_us(uint64_t us) {
+    now_us += us;
+
+    // The idle hook may sleep itself (e.g. a server answering slowly)
+    if (idle_fn && !in_idle) {
+        in_idle = 1;
+        idle_fn();
+        in_idle = 0;
+    }
+}
+
+void host_clock_set_idle(host_clock_idle_fn fn) {
+    idle_fn = fn;
+}
+
+uint64_t time_us_64(void) {
+    return now_us;
+}
+
+uint32_t time_us_32(void) {
+    return (uint32_t)now_us;
+}
+
+void sleep_us(uint64_t us) {
+    host_clock_advance_us(us);
+}
+
+void sleep_ms(uint32_t ms) {
+    host_clock_advance_us((uint64_t)ms * 1000);
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    if (flash_offs % FLASH_SECTOR_SIZE != 0 || count % FLASH_SECTOR_SIZE != 0 ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        fprintf(stderr, "HOST FLASH: bad erase of %lu bytes at 0x%lx\n", (unsigned long)count,
+                (unsigned long)flash_offs);
+        abort();
+    }
+    memset(host_flash_image + flash_offs, 0xFF, count);
+    host_flash_erase_count++;
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    if (flash_offs % FLASH_PAGE_SIZE != 0 || count % FLASH_PAGE_SIZE != 0 ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES) {
+        fprintf(stderr, "HOST FLASH: bad program of %lu bytes at 0x%lx\n", (unsigned long)count,
+                (unsigned long)flash_offs);
+        abort();
+    }
+    // NOR flash can only clear bits
+    for (size_t i = 0; i < count; i++) {
+        host_flash_image[flash_offs + i] &= data[i];
+    }
+    host_flash_program_count++;
+}
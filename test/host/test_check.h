@@ -0,0 +1,48 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Minimal assertions for the host tests: a failed check is reported with its
+// location and the test keeps going; TEST_RESULT() is the process exit code.
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_NEAR(a, b, tol) do { \
+    double check_a_ = (double)(a), check_b_ = (double)(b); \
+    if (fabs(check_a_ - check_b_) > (double)(tol)) { \
+        fprintf(stderr, "%s:%d: CHECK_NEAR failed: %s = %g, %s = %g (tolerance %g)\n", \
+                __FILE__, __LINE__, #a, check_a_, #b, check_b_, (double)(tol)); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? (printf("PASS\n"), 0) : (printf("FAIL: %d check(s)\n", test_failures), 1))
+
+// Reads a whole file from the test data directory; exits if it is missing
+static inline char *test_read_file(const char *path, size_t *length) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(2);
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = (char *)malloc((size_t)n + 1);
+    size_t got = fread(data, 1, (size_t)n, f);
+    fclose(f);
+    data[got] = '\0';
+    *length = got;
+    return data;
+}
+
+#endif // TEST_CHECK_H
@@ -0,0 +1,478 @@
+#include "upload_decoder.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#if TEST_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// Key numbers of sensor_cbor_body.h, repeated here so the decoder checks the
+// encoder instead of sharing its definitions
+enum { TOP_TOKEN = 0, TOP_BASE_EPOCH, TOP_RECORDS, TOP_DEVICE, TOP_SEQUENCE, TOP_SCHEMA };
+enum {
+    REC_TIME_DELTA = 0, REC_LATITUDE, REC_LONGITUDE, REC_DLAT, REC_DLON, REC_TEMPERATURE, REC_HUMIDITY,
+    REC_PRESSURE, REC_PM25, REC_GAS_RESISTANCE, REC_PM10, REC_CO2, REC_FLAGS
+};
+
+namespace {
+
+// Generic tree for both CBOR and JSON values
+struct Value {
+    enum Type { INTEGER, NUMBER, TEXT, ARRAY, MAP, BOOLEAN, NONE } type = NONE;
+    int64_t integer = 0;
+    double number = 0;
+    std::string text;
+    std::vector<Value> items;                       // Array elements
+    std::vector<std::pair<Value, Value>> entries;   // Map entries in order
+
+    double asNumber() const { return type == INTEGER ? (double)integer : number; }
+
+    const Value *find(int64_t key) const {
+        for (const auto &entry : entries) {
+            if (entry.first.type == INTEGER && entry.first.integer == key) {
+                return &entry.second;
+            }
+        }
+        return nullptr;
+    }
+
+    const Value *find(const char *key) const {
+        for (const auto &entry : entries) {
+            if (entry.first.type == TEXT && entry.first.text == key) {
+                return &entry.second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class CborReader {
+public:
+    CborReader(const uint8_t *data, size_t length) : data(data), length(length) {}
+
+    bool read(Value &value, int depth = 0) {
+        if (pos >= length || depth > 8) {
+            return false;
+        }
+        uint8_t major = data[pos] >> 5;
+        uint64_t argument;
+        if (!readArgument(argument)) {
+            return false;
+        }
+        switch (major) {
+        case 0:
+            value.type = Value::INTEGER;
+            value.integer = (int64_t)argument;
+            return true;
+        case 1:
+            value.type = Value::INTEGER;
+            value.integer = -1 - (int64_t)argument;
+            return true;
+        case 3:
+            if (argument > length - pos) {
+                return false;
+            }
+            value.type = Value::TEXT;
+            value.text.assign((const char *)data + pos, (size_t)argument);
+            pos += (size_t)argument;
+            return true;
+        case 4:
+            value.type = Value::ARRAY;
+            for (uint64_t i = 0; i < argument; i++) {
+                value.items.emplace_back();
+                if (!read(value.items.back(), depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        case 5:
+            value.type = Value::MAP;
+            for (uint64_t i = 0; i < argument; i++) {
+                value.entries.emplace_back();
+                if (!read(value.entries.back().first, depth + 1) || !read(value.entries.back().second, depth + 1)) {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;   // The encoder never writes other types
+        }
+    }
+
+    bool atEnd() const { return pos == length; }
+
+private:
+    const uint8_t *data;
+    size_t length;
+    size_t pos = 0;
+
+    bool readArgument(uint64_t &argument) {
+        uint8_t info = data[pos++] & 0x1F;
+        if (info < 24) {
+            argument = info;
+            return true;
+        }
+        size_t bytes = info == 24 ? 1 : info == 25 ? 2 : info == 26 ? 4 : info == 27 ? 8 : 0;
+        if (bytes == 0 || bytes > length - pos) {
+            return false;
+        }
+        argument = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            argument = (argument << 8) | data[pos++];
+        }
+        // Shortest form only, as the encoder promises
+        uint64_t minimum = bytes == 1 ? 24 : bytes == 2 ? 0x100 : bytes == 4 ? 0x10000 : 0x100000000ULL;
+        return argument >= minimum;
+    }
+};
+
+class JsonReader {
+public:
+    JsonReader(const char *data, size_t length) : data(data), length(length) {}
+
+    bool read(Value &value, int depth = 0) {
+        skipSpace();
+        if (pos >= length || depth > 8) {
+            return false;
+        }
+        char c = data[pos];
+        if (c == '{') {
+            pos++;
+            value.type = Value::MAP;
+            skipSpace();
+            if (consume('}')) {
+                return true;
+            }
+            do {
+                value.entries.emplace_back();
+                skipSpace();
+                if (!readString(value.entries.back().first) || !consume(':') ||
+                    !read(value.entries.back().second, depth + 1)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume('}');
+        }
+        if (c == '[') {
+            pos++;
+            value.type = Value::ARRAY;
+            skipSpace();
+            if (consume(']')) {
+                return true;
+            }
+            do {
+                value.items.emplace_back();
+                if (!read(value.items.back(), depth + 1)) {
+                    return false;
+                }
+            } while (consume(','));
+            return consume(']');
+        }
+        if (c == '"') {
+            return readString(value);
+        }
+        if (length - pos >= 4 && (memcmp(data + pos, "true", 4) == 0)) {
+            pos += 4;
+            value.type = Value::BOOLEAN;
+            value.integer = 1;
+            return true;
+        }
+        return readNumber(value);
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return pos == length;
+    }
+
+private:
+    const char *data;
+    size_t length;
+    size_t pos = 0;
+
+    void skipSpace() {
+        while (pos < length && (data[pos] == ' ' || data[pos] == '\n' || data[pos] == '\r' || data[pos] == '\t')) {
+            pos++;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos < length && data[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    bool readString(Value &value) {
+        if (!consume('"')) {
+            return false;
+        }
+        value.type = Value::TEXT;
+        while (pos < length && data[pos] != '"') {
+            if (data[pos] == '\\' || (uint8_t)data[pos] < 0x20) {
+                return false;   // The encoder never needs escapes
+            }
+            value.text += data[pos++];
+        }
+        return consume('"');
+    }
+
+    bool readNumber(Value &value) {
+        std::string text;
+        while (pos < length && strchr("+-0123456789.eE", data[pos])) {
+            text += data[pos++];
+        }
+        if (text.empty()) {
+            return false;
+        }
+        char *end;
+        if (text.find_first_of(".eE") == std::string::npos) {
+            value.type = Value::INTEGER;
+            value.integer = strtoll(text.c_str(), &end, 10);
+        } else {
+            value.type = Value::NUMBER;
+            value.number = strtod(text.c_str(), &end);
+        }
+        return *end == '\0';
+    }
+};
+
+// Shared by both encodings: absolute positions set the reference, deltas move it
+class PositionResolver {
+public:
+    bool absolute(DecodedRecord &record, int64_t lat_e7, int64_t lon_e7) {
+        record.has_position = true;
+        record.lat_e7 = (int32_t)lat_e7;
+        record.lon_e7 = (int32_t)lon_e7;
+        reference = record;
+        have_reference = true;
+        return true;
+    }
+
+    bool delta(DecodedRecord &record, int64_t dlat_e7, int64_t dlon_e7) {
+        if (!have_reference) {
+            return false;   // A delta needs an absolute position before it
+        }
+        return absolute(record, reference.lat_e7 + dlat_e7, reference.lon_e7 + dlon_e7);
+    }
+
+private:
+    DecodedRecord reference;
+    bool have_reference = false;
+};
+
+bool checkSequence(const Value *sequence, DecodedUpload &upload, std::string &error) {
+    if (!sequence || sequence->type != Value::ARRAY || sequence->items.size() != 2 ||
+        sequence->items[0].type != Value::INTEGER || sequence->items[1].type != Value::INTEGER) {
+        error = "missing sequence range";
+        return false;
+    }
+    upload.first_sequence = (uint32_t)sequence->items[0].integer;
+    upload.last_sequence = (uint32_t)sequence->items[1].integer;
+    if (upload.last_sequence - upload.first_sequence + 1 != upload.records.size() && !upload.records.empty()) {
+        error = "sequence range does not match the record count";
+        return false;
+    }
+    return true;
+}
+
+// "YYYY-MM-DD HH:MM:SS+00:00" to epoch seconds
+bool parseTimestamp(const std::string &text, uint32_t &epoch) {
+    int year, month, day, hour, minute, second;
+    if (text.size() != 25 || sscanf(text.c_str(), "%4d-%2d-%2d %2d:%2d:%2d", &year, &month, &day, &hour,
+                                    &minute, &second) != 6 || text.compare(19, 6, "+00:00") != 0) {
+        return false;
+    }
+    // Days from civil (proleptic Gregorian)
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = (unsigned)(year - era * 400);
+    unsigned doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+    epoch = (uint32_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+} // namespace
+
+bool decodeCborUpload(const uint8_t *data, size_t length, DecodedUpload &upload, std::string &error) {
+    CborReader reader(data, length);
+    Value top;
+    if (!reader.read(top) || !reader.atEnd() || top.type != Value::MAP) {
+        error = "not a single CBOR map";
+        return false;
+    }
+
+    const Value *schema = top.find(TOP_SCHEMA);
+    const Value *token = top.find(TOP_TOKEN);
+    const Value *device = top.find(TOP_DEVICE);
+    const Value *base_epoch = top.find(TOP_BASE_EPOCH);
+    const Value *records = top.find(TOP_RECORDS);
+    if (!schema || schema->type != Value::INTEGER || !token || token->type != Value::TEXT || !device ||
+        device->type != Value::TEXT || !base_epoch || base_epoch->type != Value::INTEGER || !records ||
+        records->type != Value::ARRAY) {
+        error = "missing top-level key";
+        return false;
+    }
+    upload.schema = (unsigned)schema->integer;
+    upload.token = token->text;
+    upload.device = device->text;
+
+    int64_t epoch = base_epoch->integer;
+    PositionResolver positions;
+    for (const Value &item : records->items) {
+        DecodedRecord record;
+        const Value *time_delta = item.find(REC_TIME_DELTA);
+        if (item.type != Value::MAP || !time_delta) {
+            error = "record without time";
+            return false;
+        }
+        epoch += time_delta->integer;
+        record.epoch = (uint32_t)epoch;
+
+        const Value *lat = item.find(REC_LATITUDE), *lon = item.find(REC_LONGITUDE);
+        const Value *dlat = item.find(REC_DLAT), *dlon = item.find(REC_DLON);
+        if (lat && lon) {
+            positions.absolute(record, lat->integer, lon->integer);
+        } else if (dlat && dlon) {
+            if (upload.schema < 2 || !positions.delta(record, dlat->integer, dlon->integer)) {
+                error = "position delta without schema 2 or reference";
+                return false;
+            }
+        } else if (upload.schema < 2) {
+            error = "schema 1 record without position";
+            return false;
+        }
+
+        const Value *v;
+        if ((v = item.find(REC_TEMPERATURE))) {
+            record.has_temperature = true;
+            record.temperature_centi = v->integer;
+        }
+        if ((v = item.find(REC_HUMIDITY))) record.humidity_centi = v->integer;
+        if ((v = item.find(REC_PRESSURE))) record.pressure_deci = v->integer;
+        if ((v = item.find(REC_GAS_RESISTANCE))) record.gas_resistance = v->integer;
+        if ((v = item.find(REC_PM25))) record.pm25 = (uint32_t)v->integer;
+        if ((v = item.find(REC_PM10))) record.pm10 = (uint32_t)v->integer;
+        if ((v = item.find(REC_CO2))) record.co2 = (uint32_t)v->integer;
+        if ((v = item.find(REC_FLAGS))) record.flags = (uint8_t)v->integer;
+        upload.records.push_back(record);
+    }
+    return checkSequence(top.find(TOP_SEQUENCE), upload, error);
+}
+
+bool decodeJsonUpload(const char *data, size_t length, DecodedUpload &upload, std::string &error) {
+    JsonReader reader(data, length);
+    Value top;
+    if (!reader.read(top) || !reader.atEnd() || top.type != Value::MAP) {
+        error = "not a single JSON object";
+        return false;
+    }
+
+    const Value *schema = top.find("schema");
+    const Value *token = top.find("token");
+    const Value *device = top.find("device");
+    const Value *measurements = top.find("measurements");
+    if (!schema || schema->type != Value::INTEGER || !token || token->type != Value::TEXT || !device ||
+        device->type != Value::TEXT || !measurements || measurements->type != Value::ARRAY) {
+        error = "missing top-level key";
+        return false;
+    }
+    upload.schema = (unsigned)schema->integer;
+    upload.token = token->text;
+    upload.device = device->text;
+
+    PositionResolver positions;
+    for (const Value &item : measurements->items) {
+        DecodedRecord record;
+        const Value *timestamp = item.find("timestamp");
+        if (item.type != Value::MAP || !timestamp || !parseTimestamp(timestamp->text, record.epoch)) {
+            error = "record without timestamp";
+            return false;
+        }
+
+        const Value *lat = item.find("latitude"), *lon = item.find("longitude");
+        const Value *dlat = item.find("dlat"), *dlon = item.find("dlon");
+        if (lat && lon) {
+            positions.absolute(record, llround(lat->asNumber() * 1e7), llround(lon->asNumber() * 1e7));
+        } else if (dlat && dlon) {
+            if (upload.schema < 2 || !positions.delta(record, dlat->integer, dlon->integer)) {
+                error = "position delta without schema 2 or reference";
+                return false;
+            }
+        } else if (upload.schema < 2) {
+            error = "schema 1 record without position";
+            return false;
+        }
+
+        const Value *v;
+        if ((v = item.find("temperature"))) {
+            record.has_temperature = true;
+            record.temperature_centi = llround(v->asNumber() * 100);
+        }
+        if ((v = item.find("humidity"))) record.humidity_centi = llround(v->asNumber() * 100);
+        if ((v = item.find("pressure"))) record.pressure_deci = llround(v->asNumber() * 10);
+        if ((v = item.find("gasResistance"))) record.gas_resistance = llround(v->asNumber());
+        if ((v = item.find("pm25"))) record.pm25 = (uint32_t)v->integer;
+        if ((v = item.find("pm10"))) record.pm10 = (uint32_t)v->integer;
+        if ((v = item.find("co2"))) record.co2 = (uint32_t)v->integer;
+        upload.records.push_back(record);
+    }
+    return checkSequence(top.find("seq"), upload, error);
+}
+
+bool decodeUpload(const uint8_t *data, size_t length, const char *content_type, const char *content_encoding,
+                  DecodedUpload &upload, std::string &error) {
+    std::vector<uint8_t> inflated;
+    if (content_encoding && strcmp(content_encoding, "deflate") == 0) {
+        if (!inflateZlib(data, length, inflated)) {
+            error = "corrupt deflate stream";
+            return false;
+        }
+        data = inflated.data();
+        length = inflated.size();
+    } else if (content_encoding && content_encoding[0] != '\0') {
+        error = "unknown content encoding";
+        return false;
+    }
+
+    if (strncmp(content_type, "application/cbor", 16) == 0) {
+        return decodeCborUpload(data, length, upload, error);
+    }
+    if (strncmp(content_type, "application/json", 16) == 0) {
+        return decodeJsonUpload((const char *)data, length, upload, error);
+    }
+    error = "unsupported content type";
+    return false;
+}
+
+bool inflateZlib(const uint8_t *data, size_t length, std::vector<uint8_t> &out) {
+#if TEST_HAVE_ZLIB
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK) {
+        return false;
+    }
+    stream.next_in = const_cast<uint8_t *>(data);
+    stream.avail_in = (uInt)length;
+    uint8_t chunk[4096];
+    int result;
+    do {
+        stream.next_out = chunk;
+        stream.avail_out = sizeof(chunk);
+        result = inflate(&stream, Z_NO_FLUSH);
+        out.insert(out.end(), chunk, chunk + (sizeof(chunk) - stream.avail_out));
+    } while (result == Z_OK);
+    bool complete = result == Z_STREAM_END && stream.avail_in == 0;
+    inflateEnd(&stream);
+    return complete;
+#else
+    (void)data;
+    (void)length;
+    (void)out;
+    return false;
+#endif
+}
@@ -0,0 +1,51 @@
+#ifndef UPLOAD_DECODER_H
+#define UPLOAD_DECODER_H
+
+// Server side of the upload encodings, for the host tests and the stand-in
+// upload servers: decodes a JSON or CBOR body (optionally zlib deflated) back
+// into records, resolving time deltas and dlat/dlon position deltas.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct DecodedRecord {
+    uint32_t epoch = 0;
+    bool has_position = false;       // False if left out (on the simplified track)
+    int32_t lat_e7 = 0;
+    int32_t lon_e7 = 0;
+    bool has_temperature = false;
+    int64_t temperature_centi = 0;   // 0.01 degC
+    int64_t humidity_centi = 0;      // 0.01 %RH
+    int64_t pressure_deci = 0;       // 0.1 hPa
+    int64_t gas_resistance = 0;      // Ohm
+    uint32_t pm25 = 0;
+    uint32_t pm10 = 0;
+    uint32_t co2 = 0;
+    uint8_t flags = 0;               // CBOR only: bit 0 fake GPS, bit 1 unsynced time
+};
+
+struct DecodedUpload {
+    unsigned schema = 0;
+    std::string token;
+    std::string device;
+    uint32_t first_sequence = 0;
+    uint32_t last_sequence = 0;
+    std::vector<DecodedRecord> records;
+};
+
+// Each returns false and sets error if the body is malformed
+bool decodeCborUpload(const uint8_t *data, size_t length, DecodedUpload &upload, std::string &error);
+bool decodeJsonUpload(const char *data, size_t length, DecodedUpload &upload, std::string &error);
+
+// Decodes by content type ("application/json" or "application/cbor") and
+// content encoding (nullptr or "deflate")
+bool decodeUpload(const uint8_t *data, size_t length, const char *content_type, const char *content_encoding,
+                  DecodedUpload &upload, std::string &error);
+
+// zlib stream (RFC 1950) to bytes; false if zlib is not available or the
+// stream is corrupt
+bool inflateZlib(const uint8_t *data, size_t length, std::vector<uint8_t> &out);
+
+#endif // UPLOAD_DECODER_H
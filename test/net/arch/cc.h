@@ -0,0 +1,22 @@
+#ifndef NET_RIG_ARCH_CC_H
+#define NET_RIG_ARCH_CC_H
+
+// lwIP port definitions for the host network rig
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LWIP_PLATFORM_DIAG(x) do { printf x; } while (0)
+#define LWIP_PLATFORM_ASSERT(x) do { \
+    fprintf(stderr, "lwIP assertion \"%s\" failed at %s:%d\n", x, __FILE__, __LINE__); \
+    abort(); \
+} while (0)
+
+// Seeded with the wire, so runs repeat
+#ifdef __cplusplus
+extern "C"
+#endif
+unsigned int net_wire_rand(void);
+#define LWIP_RAND() ((u32_t)net_wire_rand())
+
+#endif // NET_RIG_ARCH_CC_H
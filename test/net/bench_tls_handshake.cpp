@@ -0,0 +1,121 @@
+// TLS handshake benchmark on the network rig: per profile (tls_profile.h), a
+// full handshake and resumed ones against the stand-in server, through the
+// firmware's HttpsClient. Per handshake it reports
+//
+//   time            virtual, so round trips only; the RP2040's crypto time
+//                   is not in it (the host CPU time is printed for scale)
+//   wire bytes      IP packets both ways, TCP handshake included
+//   TLS arena peak  the device's mbedTLS memory (tls_arena.h)
+//
+// and checks that a server whose key is not pinned is refused.
+
+#include <chrono>
+#include <cstdio>
+#include "net_wire.h"
+#include "dns_server.h"
+#include "upload_server.h"
+#include "test_check.h"
+#include "pico/stdlib.h"
+#include "lwip/stats.h"
+#include "libs/https/https_client.h"
+#include "libs/https/tls_arena.h"
+#include "libs/https/tls_session.h"
+
+#define RESUMED_HANDSHAKES 10
+#define PINNED_PORT 443
+#define UNPINNED_PORT 8443
+
+struct Handshake {
+    bool connected = false;
+    bool resumed = false;
+    uint32_t ms = 0;
+    uint32_t wire_bytes = 0;
+    size_t arena_peak = 0;
+    double host_cpu_ms = 0;
+};
+
+static Handshake handshake(tls_profile_t profile, uint16_t port) {
+    Handshake h;
+    HttpsClient client("upload.test", port);
+    client.setTlsProfile(profile);
+    net_wire_reset_stats();
+    auto cpu_start = std::chrono::steady_clock::now();
+    if (client.beginConnect(10000)) {
+        UploadClient::Progress progress;
+        while ((progress = client.pollConnect()) == UploadClient::IN_PROGRESS) {
+            sleep_ms(1);
+        }
+        h.connected = progress == UploadClient::COMPLETE;
+    }
+    h.host_cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cpu_start).count();
+    const net_wire_stats_t *wire = net_wire_stats();
+    h.wire_bytes = wire->up.bytes + wire->down.bytes;
+    h.resumed = client.getResumedCount() > 0;
+    h.ms = client.getLastHandshakeMs();
+    h.arena_peak = client.getLastHandshakeArena();
+    client.close();
+    sleep_ms(100);   // Let the close reach the server
+    return h;
+}
+
+static void runProfile(tls_profile_t profile) {
+    tls_session_clear();
+    Handshake full = handshake(profile, PINNED_PORT);
+    CHECK(full.connected);
+    CHECK(!full.resumed);
+
+    Handshake resumed;
+    uint32_t resumed_count = 0;
+    uint32_t resumed_ms = 0, resumed_bytes = 0;
+    size_t resumed_arena = 0;
+    for (int i = 0; i < RESUMED_HANDSHAKES; i++) {
+        resumed = handshake(profile, PINNED_PORT);
+        CHECK(resumed.connected);
+        resumed_count += resumed.resumed ? 1 : 0;
+        resumed_ms += resumed.ms;
+        resumed_bytes += resumed.wire_bytes;
+        resumed_arena = resumed.arena_peak > resumed_arena ? resumed.arena_peak : resumed_arena;
+    }
+    CHECK(resumed_count == RESUMED_HANDSHAKES);
+
+    printf("%-11s full: %4lu ms %5lu B on the wire, arena peak %6lu B, host CPU %6.1f ms\n",
+           tls_profile_name(profile), (unsigned long)full.ms, (unsigned long)full.wire_bytes,
+           (unsigned long)full.arena_peak, full.host_cpu_ms);
+    printf("%-11s resumed (%lu of %d): %4lu ms %5lu B on the wire, arena peak %6lu B\n", tls_profile_name(profile),
+           (unsigned long)resumed_count, RESUMED_HANDSHAKES, (unsigned long)(resumed_ms / RESUMED_HANDSHAKES),
+           (unsigned long)(resumed_bytes / RESUMED_HANDSHAKES), (unsigned long)resumed_arena);
+}
+
+int main() {
+    net_wire_init();
+    net_wire_faults_t wire = {30, 5, 2000, 0, 1};
+    net_wire_set_faults(&wire);
+    dns_server_add("upload.test", NET_WIRE_SERVER_ADDR, 3600);
+    CHECK(dns_server_start());
+
+    UploadServer pinned, unpinned;
+    CHECK(pinned.start(PINNED_PORT, TEST_DATA_DIR "/net/server_key.pem", TEST_DATA_DIR "/net/server_cert.pem"));
+    CHECK(unpinned.start(UNPINNED_PORT, TEST_DATA_DIR "/net/other_key.pem", TEST_DATA_DIR "/net/other_cert.pem"));
+
+    runProfile(TLS_PROFILE_DEFAULT);
+    runProfile(TLS_PROFILE_CONSTRAINED);
+
+    // Same name and certificate subject, another key: refused, and nothing
+    // from it is offered for resumption afterwards
+    tls_session_clear();
+    Handshake refused = handshake(TLS_PROFILE_CONSTRAINED, UNPINNED_PORT);
+    CHECK(!refused.connected);
+    CHECK(unpinned.getConnectionCount() > 0);
+    CHECK(unpinned.getRequestCount() == 0);
+    Handshake after = handshake(TLS_PROFILE_CONSTRAINED, PINNED_PORT);
+    CHECK(after.connected);
+    CHECK(!after.resumed);
+
+    printf("lwIP heap peak %u B (servers included)\n", (unsigned)lwip_stats.mem.max);
+    tls_profile_print_stats();
+    tls_arena_print_stats();
+    unpinned.stop();
+    pinned.stop();
+    dns_server_stop();
+    return TEST_RESULT();
+}
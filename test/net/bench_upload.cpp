@@ -0,0 +1,101 @@
+// Upload benchmark on the network rig: 2,000 records go through the
+// firmware's upload path (HttpsClient, the CBOR + deflate bodies, the batch
+// controller, DNS cache and TLS session resumption) to the stand-in server
+// over wires of increasing hostility. Per run it reports
+//
+//   records/s              in virtual time, so network-bound; encoding and
+//                          crypto take no time here (see bench_track_encoder)
+//   handshakes / 1000 rec  full and resumed
+//   wire bytes             IP packets up and down, headers and TLS included
+//   TLS arena peak         the device's mbedTLS memory during a handshake
+//   lwIP heap peak         shared with the servers, so an upper bound
+//
+// Every run must end with every record stored exactly once on the server;
+// records sent again after a lost response are counted, not stored twice.
+// Every response that started, pipelined ones included, must have a time to
+// first byte.
+
+#include <cstdio>
+#include <vector>
+#include "net_wire.h"
+#include "dns_server.h"
+#include "upload_server.h"
+#include "upload_driver.h"
+#include "rig_records.h"
+#include "test_check.h"
+#include "lwip/stats.h"
+#include "libs/https/tls_arena.h"
+#include "libs/https/net_timing.h"
+
+#define RECORDS 2000
+
+struct Scenario {
+    const char *name;
+    net_wire_faults_t wire;
+    UploadServerFaults server;
+};
+
+static void runScenario(const Scenario &scenario, UploadServer &server, const std::vector<SensorData> &records,
+                        uint32_t first_sequence) {
+    net_wire_set_faults(&scenario.wire);
+    net_wire_reset_stats();
+    server.setFaults(scenario.server);
+    server.clearRecords();
+    net_timing_reset();
+
+    UploadDriverSettings settings;
+    UploadDriver driver(settings, records, first_sequence);
+    UploadDriverResult result = driver.run(30 * 60 * 1000);
+    const net_wire_stats_t *wire = net_wire_stats();
+
+    size_t stored = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        stored += server.hasRecord(settings.device, first_sequence + (uint32_t)i) ? 1 : 0;
+    }
+
+    float seconds = result.elapsed_ms / 1000.0f;
+    printf("%-10s %6.1f rec/s  %5.1f handshakes/1000 (%lu of %lu resumed)  %7lu B up  %6lu B down  "
+           "%5lu lost packets  batch %3u  TLS arena peak %6lu B  lwIP heap peak %5u B  "
+           "%lu requests, %lu resent records\n",
+           scenario.name, seconds > 0 ? result.acknowledged / seconds : 0.0f,
+           result.handshakes * 1000.0f / RECORDS, (unsigned long)result.resumed,
+           (unsigned long)result.handshakes, (unsigned long)wire->up.bytes, (unsigned long)wire->down.bytes,
+           (unsigned long)(wire->up.dropped + wire->down.dropped), result.batch_size,
+           (unsigned long)result.handshake_arena_peak, (unsigned)lwip_stats.mem.max,
+           (unsigned long)server.getRequestCount(), (unsigned long)server.getDuplicateCount());
+
+    CHECK(result.acknowledged == records.size());
+    CHECK(stored == records.size());
+    CHECK(server.getRecords().size() == records.size());
+    CHECK(server.getErrors().empty());
+    CHECK(net_timing_count(NET_PHASE_FIRST_BYTE) ==
+          net_timing_count(NET_PHASE_RESPONSE) + net_timing_failures(NET_PHASE_RESPONSE));
+}
+
+int main() {
+    net_wire_init();
+    dns_server_add("upload.test", NET_WIRE_SERVER_ADDR, 300);
+    CHECK(dns_server_start());
+    UploadServer server;
+    CHECK(server.start(443, TEST_DATA_DIR "/net/server_key.pem", TEST_DATA_DIR "/net/server_cert.pem"));
+
+    std::vector<SensorData> records = rigRideRecords(RECORDS);
+    Scenario scenarios[] = {
+        {"lan", {2, 0, 0, 0, 1}, {}},
+        {"wifi", {30, 20, 2000, 1, 2}, {}},
+        {"cellular", {150, 100, 500, 5, 3}, {400}},
+        {"flaky", {30, 20, 2000, 1, 4}, {0, 25, 9}},
+    };
+
+    // Each run uploads new sequence numbers, as the device does after clearing
+    uint32_t first_sequence = 1;
+    for (const Scenario &scenario : scenarios) {
+        runScenario(scenario, server, records, first_sequence);
+        first_sequence += RECORDS;
+    }
+
+    tls_arena_print_stats();
+    server.stop();
+    dns_server_stop();
+    return TEST_RESULT();
+}
@@ -0,0 +1,421 @@
+#include "coap_server.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "net_wire.h"
+#include "test_check.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+#include "libs/https/coap_message.h"
+
+// Answers kept for repeated confirmable messages; more than a client sends
+// within EXCHANGE_LIFETIME here
+#define COAP_SERVER_ANSWERS 16
+
+#define COAP_CODE_CHANGED     COAP_CODE(2, 4)
+#define COAP_CODE_BAD_REQUEST COAP_CODE(4, 0)
+#define COAP_CODE_INCOMPLETE  COAP_CODE(4, 8)
+#define COAP_CODE_UNSUPPORTED COAP_CODE(4, 15)
+
+static uint32_t now_ms() {
+    return sys_now();
+}
+
+// Content-Format option of a parsed message, -1 if it has none
+static int content_format(const uint8_t *data, size_t len) {
+    size_t offset = 4 + (data[0] & 0x0F);
+    uint32_t number = 0;
+    while (offset < len && data[offset] != 0xFF) {
+        uint8_t byte = data[offset++];
+        uint32_t values[2] = {(uint32_t)(byte >> 4), (uint32_t)(byte & 0x0F)};
+        for (uint32_t &value : values) {
+            if (value == 13 && offset < len) {
+                value = 13 + data[offset++];
+            } else if (value == 14 && offset + 1 < len) {
+                value = 269 + ((data[offset] << 8) | data[offset + 1]);
+                offset += 2;
+            }
+        }
+        number += values[0];
+        if (number == COAP_OPTION_CONTENT_FORMAT) {
+            int format = 0;
+            for (uint32_t i = 0; i < values[1] && offset + i < len; i++) {
+                format = (format << 8) | data[offset + i];
+            }
+            return format;
+        }
+        offset += values[1];
+    }
+    return -1;
+}
+
+static std::vector<uint8_t> make_message(coap_type_t type, uint8_t code, uint16_t message_id,
+                                         const uint8_t *token, uint8_t token_len, bool has_block1,
+                                         uint32_t block1, const std::string &payload) {
+    std::vector<uint8_t> buf(32 + payload.size());
+    coap_writer_t writer;
+    coap_write_header(&writer, buf.data(), buf.size(), type, code, message_id, token, token_len);
+    if (has_block1) {
+        coap_write_uint_option(&writer, COAP_OPTION_BLOCK1, block1);
+    }
+    if (!payload.empty()) {
+        size_t room;
+        uint8_t *p = coap_write_payload(&writer, &room);
+        memcpy(p, payload.data(), payload.size());
+        coap_write_payload_done(&writer, payload.size());
+    }
+    buf.resize(writer.len);
+    return buf;
+}
+
+CoapServer::~CoapServer() {
+    stop();
+}
+
+bool CoapServer::start(uint16_t port, const char *key_path, const char *cert_path) {
+    net_wire_server_begin();
+    dtls = key_path != nullptr;
+    bool ready = !dtls || setupDtls(key_path, cert_path);
+    ip_addr_t addr;
+    net_wire_server_addr(&addr);
+    if (ready) {
+        pcb = udp_new();
+        if (pcb && udp_bind(pcb, &addr, port) == ERR_OK) {
+            udp_recv(pcb, recv, this);
+            sys_timeout(1, tick, this);
+        } else {
+            if (pcb) {
+                udp_remove(pcb);
+                pcb = nullptr;
+            }
+            printf("COAP SERVER: Cannot bind port %u\n", port);
+        }
+    }
+    net_wire_server_end();
+    return pcb != nullptr;
+}
+
+void CoapServer::stop() {
+    net_wire_server_begin();
+    if (pcb) {
+        sys_untimeout(tick, this);
+        udp_remove(pcb);
+        pcb = nullptr;
+    }
+    if (dtls_ready) {
+        freeDtls();
+    }
+    net_wire_server_end();
+}
+
+void CoapServer::clearRecords() {
+    records.clear();
+    errors.clear();
+    request_count = 0;
+    block_count = 0;
+    repeated_messages = 0;
+    duplicate_count = 0;
+    handshake_count = 0;
+    resumed_count = 0;
+}
+
+bool CoapServer::setupDtls(const char *key_path, const char *cert_path) {
+    static const char personalization[] = "coap server";
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_cache_init(&cache);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_x509_crt_init(&cert);
+    mbedtls_pk_init(&key);
+    dtls_ready = true;
+
+    // PEM is parsed with its terminator
+    size_t key_len, cert_len;
+    char *key_pem = test_read_file(key_path, &key_len);
+    char *cert_pem = test_read_file(cert_path, &cert_len);
+    int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                    (const unsigned char *)personalization, sizeof(personalization) - 1);
+    if (ret == 0) {
+        ret = mbedtls_x509_crt_parse(&cert, (const unsigned char *)cert_pem, cert_len + 1);
+    }
+    if (ret == 0) {
+        ret = mbedtls_pk_parse_key(&key, (const unsigned char *)key_pem, key_len + 1, NULL, 0,
+                                   mbedtls_ctr_drbg_random, &drbg);
+    }
+    free(key_pem);
+    free(cert_pem);
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_DATAGRAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret == 0) {
+        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+        mbedtls_ssl_conf_session_cache(&conf, &cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+#if defined(MBEDTLS_SSL_DTLS_HELLO_VERIFY)
+        mbedtls_ssl_conf_dtls_cookies(&conf, NULL, NULL, NULL);   // Peers are not spoofed on the wire
+#endif
+        ret = mbedtls_ssl_conf_own_cert(&conf, &cert, &key);
+    }
+    if (ret == 0) {
+        ret = mbedtls_ssl_setup(&ssl, &conf);
+    }
+    if (ret != 0) {
+        printf("COAP SERVER: DTLS setup failed (-0x%04x)\n", -ret);
+        freeDtls();
+        return false;
+    }
+    mbedtls_ssl_set_bio(&ssl, this, bioSend, bioRecv, NULL);
+    mbedtls_ssl_set_timer_cb(&ssl, this, setTimer, getTimer);
+    mbedtls_ssl_set_mtu(&ssl, 1280);
+    return true;
+}
+
+void CoapServer::freeDtls() {
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ssl_cache_free(&cache);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    mbedtls_x509_crt_free(&cert);
+    mbedtls_pk_free(&key);
+    dtls_ready = false;
+}
+
+void CoapServer::newPeer(const ip_addr_t *addr, u16_t port) {
+    ip_addr_copy(peer_addr, *addr);
+    peer_port = port;
+    answers.clear();
+    body.clear();
+    separate.clear();
+    if (dtls_ready) {
+        rx.clear();
+        mbedtls_ssl_session_reset(&ssl);
+        timer_fin_ms = 0;
+        handshake_done = false;
+    }
+}
+
+void CoapServer::recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    CoapServer *server = (CoapServer *)arg;
+    (void)pcb;
+    if (port != server->peer_port || !ip_addr_cmp(addr, &server->peer_addr)) {
+        server->newPeer(addr, port);
+    }
+    std::vector<uint8_t> datagram(p->tot_len);
+    pbuf_copy_partial(p, datagram.data(), p->tot_len, 0);
+    pbuf_free(p);
+    if (!server->dtls) {
+        server->handleMessage(datagram.data(), datagram.size());
+        return;
+    }
+    server->rx.push_back(std::move(datagram));
+    server->stepDtls();
+}
+
+void CoapServer::stepDtls() {
+    if (!dtls_ready || peer_port == 0) {
+        return;
+    }
+    if (!handshake_done) {
+        int ret = mbedtls_ssl_handshake(&ssl);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return;
+        }
+        if (ret != 0) {
+            printf("COAP SERVER: DTLS handshake failed (-0x%04x)\n", -ret);
+            newPeer(&peer_addr, 0);
+            return;
+        }
+        handshake_done = true;
+        handshake_count++;
+        std::string id((const char *)ssl.session->id, ssl.session->id_len);
+        if (!session_ids.insert(id).second) {
+            resumed_count++;
+        }
+    }
+
+    unsigned char msg[1280];
+    while (handshake_done) {
+        int ret = mbedtls_ssl_read(&ssl, msg, sizeof(msg));
+        if (ret > 0) {
+            handleMessage(msg, (size_t)ret);
+            continue;
+        }
+        if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            newPeer(&peer_addr, 0);
+        }
+        return;
+    }
+}
+
+void CoapServer::tick(void *arg) {
+    CoapServer *server = (CoapServer *)arg;
+    net_wire_server_begin();
+    if (server->dtls && !server->handshake_done) {
+        server->stepDtls();   // Retransmits the last flight when its timer runs out
+    }
+    while (!server->separate.empty() && (int32_t)(now_ms() - server->separate.front().first) >= 0) {
+        server->sendMessage(server->separate.front().second);
+        server->separate.pop_front();
+    }
+    sys_timeout(1, tick, server);
+    net_wire_server_end();
+}
+
+void CoapServer::handleMessage(const uint8_t *data, size_t len) {
+    coap_message_t message;
+    if (!coap_parse(data, len, &message) || message.type != COAP_TYPE_CON) {
+        return;   // Acknowledgements of separate responses need nothing
+    }
+    for (const Answer &answer : answers) {
+        if (answer.message_id == message.message_id) {
+            repeated_messages++;
+            sendMessage(answer.message);
+            return;
+        }
+    }
+    if (faults.drop_requests > 0) {
+        faults.drop_requests--;
+        return;
+    }
+
+    std::vector<uint8_t> answer;
+    handleRequest(data, len, answer);
+    answers.push_back({message.message_id, answer});
+    if (answers.size() > COAP_SERVER_ANSWERS) {
+        answers.pop_front();
+    }
+    sendMessage(answer);
+}
+
+void CoapServer::handleRequest(const uint8_t *data, size_t len, std::vector<uint8_t> &answer) {
+    coap_message_t message;
+    coap_parse(data, len, &message);
+    int format = content_format(data, len);
+
+    bool last = true;
+    uint32_t block1 = 0;
+    if (!message.has_block1) {
+        body.assign(message.payload, message.payload + message.payload_len);
+    } else {
+        size_t size = COAP_BLOCK_SIZE(COAP_BLOCK_SZX(message.block1));
+        size_t offset = COAP_BLOCK_NUM(message.block1) * size;
+        if (offset == 0) {
+            body.clear();
+        }
+        if (offset != body.size()) {
+            answer = make_message(COAP_TYPE_ACK, COAP_CODE_INCOMPLETE, message.message_id, message.token,
+                                  message.token_len, false, 0, std::string());
+            return;
+        }
+        body.insert(body.end(), message.payload, message.payload + message.payload_len);
+        last = !COAP_BLOCK_MORE(message.block1);
+
+        // The next block in the size this server takes, counted in that size
+        uint8_t szx = COAP_BLOCK_SZX(message.block1);
+        if (faults.block_szx < szx) {
+            szx = faults.block_szx;
+        }
+        block1 = COAP_BLOCK_VALUE(offset / COAP_BLOCK_SIZE(szx), !last, szx);
+    }
+    block_count++;
+
+    if (!last) {
+        answer = make_message(COAP_TYPE_ACK, COAP_CODE_CONTINUE, message.message_id, message.token,
+                              message.token_len, true, block1, std::string());
+        return;
+    }
+
+    request_count++;
+    uint8_t code = COAP_CODE_CHANGED;
+    std::string payload = storeBody(format);
+    if (payload.empty()) {
+        code = format < 0 ? COAP_CODE_UNSUPPORTED : COAP_CODE_BAD_REQUEST;
+    }
+    body.clear();
+    if (!faults.separate_response) {
+        answer = make_message(COAP_TYPE_ACK, code, message.message_id, message.token, message.token_len,
+                              message.has_block1, block1, payload);
+        return;
+    }
+    answer = make_message(COAP_TYPE_ACK, COAP_CODE_EMPTY, message.message_id, NULL, 0, false, 0, std::string());
+    separate.emplace_back(now_ms() + faults.response_delay_ms,
+                          make_message(COAP_TYPE_CON, code, next_message_id++, message.token, message.token_len,
+                                       message.has_block1, block1, payload));
+}
+
+// Stores the records of the received body; {"accepted":n}, or empty if the
+// body does not decode
+std::string CoapServer::storeBody(int format) {
+    int base = format >= COAP_FORMAT_DEFLATE_BASE ? format - COAP_FORMAT_DEFLATE_BASE : format;
+    const char *content_type = base == COAP_FORMAT_CBOR ? "application/cbor"
+                             : base == COAP_FORMAT_JSON ? "application/json" : nullptr;
+    if (!content_type) {
+        errors.push_back("Unsupported Content-Format " + std::to_string(format));
+        return std::string();
+    }
+    DecodedUpload upload;
+    std::string error;
+    if (!decodeUpload(body.data(), body.size(), content_type,
+                      format >= COAP_FORMAT_DEFLATE_BASE ? "deflate" : nullptr, upload, error)) {
+        errors.push_back(error);
+        return std::string();
+    }
+    for (size_t i = 0; i < upload.records.size(); i++) {
+        auto key = std::make_pair(upload.device, upload.first_sequence + (uint32_t)i);
+        if (!records.emplace(key, upload.records[i]).second) {
+            duplicate_count++;
+        }
+    }
+    return "{\"accepted\":" + std::to_string(upload.records.size()) + "}";
+}
+
+void CoapServer::sendMessage(const std::vector<uint8_t> &message) {
+    if (dtls) {
+        if (handshake_done) {
+            mbedtls_ssl_write(&ssl, message.data(), message.size());
+        }
+        return;
+    }
+    bioSend(this, message.data(), message.size());
+}
+
+int CoapServer::bioSend(void *ctx, const unsigned char *buf, size_t len) {
+    CoapServer *server = (CoapServer *)ctx;
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)len, PBUF_RAM);
+    if (p) {
+        memcpy(p->payload, buf, len);
+        udp_sendto(server->pcb, p, &server->peer_addr, server->peer_port);
+        pbuf_free(p);
+    }
+    return (int)len;
+}
+
+int CoapServer::bioRecv(void *ctx, unsigned char *buf, size_t len) {
+    CoapServer *server = (CoapServer *)ctx;
+    if (server->rx.empty()) {
+        return MBEDTLS_ERR_SSL_WANT_READ;
+    }
+    std::vector<uint8_t> datagram = std::move(server->rx.front());
+    server->rx.pop_front();
+    size_t n = datagram.size() < len ? datagram.size() : len;
+    memcpy(buf, datagram.data(), n);
+    return (int)n;
+}
+
+void CoapServer::setTimer(void *ctx, uint32_t int_ms, uint32_t fin_ms) {
+    CoapServer *server = (CoapServer *)ctx;
+    server->timer_start_ms = now_ms();
+    server->timer_int_ms = int_ms;
+    server->timer_fin_ms = fin_ms;
+}
+
+int CoapServer::getTimer(void *ctx) {
+    CoapServer *server = (CoapServer *)ctx;
+    if (server->timer_fin_ms == 0) {
+        return -1;
+    }
+    uint32_t elapsed = now_ms() - server->timer_start_ms;
+    return elapsed >= server->timer_fin_ms ? 2 : elapsed >= server->timer_int_ms ? 1 : 0;
+}
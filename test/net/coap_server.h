@@ -0,0 +1,126 @@
+#ifndef NET_COAP_SERVER_H
+#define NET_COAP_SERVER_H
+
+// Stand-in CoAP upload server of the host network rig, on plain UDP or DTLS
+// 1.2 (mbedTLS, with a session cache for resumption). Takes confirmable POSTs
+// of the firmware's bodies, block-wise (Block1, RFC 7959) or whole, answers
+// each block with 2.31 Continue and the last with 2.04 Changed and
+// {"accepted":n}. Records are stored by (device, sequence number) like
+// UploadServer does.
+//
+// A confirmable message seen before (same message ID from the same peer) gets
+// the same answer again without being processed twice, as RFC 7252 requires.
+// One peer at a time: a datagram from a new address or port starts over.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lwip/udp.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "upload_decoder.h"
+
+struct CoapServerFaults {
+    uint8_t block_szx = 6;               // Largest block taken; 2.31 asks for this size
+    bool separate_response = false;      // Empty ACK for the last block, the response in its own CON
+    uint32_t response_delay_ms = 0;      // Before a separate response
+    uint32_t drop_requests = 0;          // The next this many confirmable messages are not answered
+};
+
+class CoapServer {
+public:
+    CoapServer() = default;
+    ~CoapServer();
+
+    // Listens on port; over DTLS with the PEM key and certificate if given.
+    // False if that fails.
+    bool start(uint16_t port, const char *key_path = nullptr, const char *cert_path = nullptr);
+    void stop();
+
+    void setFaults(const CoapServerFaults &faults) { this->faults = faults; }
+
+    const std::map<std::pair<std::string, uint32_t>, DecodedRecord> &getRecords() const { return records; }
+    bool hasRecord(const std::string &device, uint32_t sequence) const {
+        return records.count(std::make_pair(device, sequence)) > 0;
+    }
+
+    uint32_t getRequestCount() const { return request_count; }           // Complete bodies
+    uint32_t getBlockCount() const { return block_count; }               // Blocks taken, repeats not included
+    uint32_t getRepeatedMessages() const { return repeated_messages; }   // Confirmable messages seen again
+    uint32_t getDuplicateCount() const { return duplicate_count; }       // Records received again
+    uint32_t getHandshakeCount() const { return handshake_count; }
+    uint32_t getResumedCount() const { return resumed_count; }
+    const std::vector<std::string> &getErrors() const { return errors; }
+
+    void clearRecords();
+
+private:
+    struct Answer {
+        uint16_t message_id;
+        std::vector<uint8_t> message;
+    };
+
+    struct udp_pcb *pcb = nullptr;
+    bool dtls = false;
+    CoapServerFaults faults;
+
+    // Current peer
+    ip_addr_t peer_addr;
+    u16_t peer_port = 0;
+    std::deque<Answer> answers;                 // Last answers, by message ID
+    std::vector<uint8_t> body;                  // Block-wise body being received
+    std::deque<std::pair<uint32_t, std::vector<uint8_t>>> separate;   // Responses and when they are due
+    uint16_t next_message_id = 1;
+
+    // DTLS
+    bool dtls_ready = false;
+    bool handshake_done = false;
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_cache_context cache;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_x509_crt cert;
+    mbedtls_pk_context key;
+    std::deque<std::vector<uint8_t>> rx;
+    uint32_t timer_start_ms = 0;
+    uint32_t timer_int_ms = 0;
+    uint32_t timer_fin_ms = 0;
+    std::set<std::string> session_ids;         // Of completed handshakes, to spot resumptions
+
+    std::map<std::pair<std::string, uint32_t>, DecodedRecord> records;
+    std::vector<std::string> errors;
+    uint32_t request_count = 0;
+    uint32_t block_count = 0;
+    uint32_t repeated_messages = 0;
+    uint32_t duplicate_count = 0;
+    uint32_t handshake_count = 0;
+    uint32_t resumed_count = 0;
+
+    bool setupDtls(const char *key_path, const char *cert_path);
+    void freeDtls();
+    void newPeer(const ip_addr_t *addr, u16_t port);
+    void stepDtls();
+    void handleMessage(const uint8_t *data, size_t len);
+    void handleRequest(const uint8_t *data, size_t len, std::vector<uint8_t> &answer);
+    std::string storeBody(int format);
+    void sendMessage(const std::vector<uint8_t> &message);
+
+    static void recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+    static void tick(void *arg);
+    static int bioSend(void *ctx, const unsigned char *buf, size_t len);
+    static int bioRecv(void *ctx, unsigned char *buf, size_t len);
+    static void setTimer(void *ctx, uint32_t int_ms, uint32_t fin_ms);
+    static int getTimer(void *ctx);
+};
+
+#endif // NET_COAP_SERVER_H
@@ -0,0 +1,158 @@
+#include "dns_server.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "net_wire.h"
+#include "lwip/udp.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+
+namespace {
+
+struct Entry {
+    ip_addr_t addr;
+    uint32_t ttl_s;
+};
+
+struct PendingAnswer {
+    std::vector<uint8_t> message;
+    ip_addr_t to;
+    u16_t port;
+};
+
+struct udp_pcb *pcb = nullptr;
+std::map<std::string, Entry> entries;
+DnsServerFaults faults;
+uint32_t queries = 0;
+
+void append_name(std::vector<uint8_t> &msg, const std::string &name) {
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.size();
+        }
+        msg.push_back((uint8_t)(dot - start));
+        msg.insert(msg.end(), name.begin() + start, name.begin() + dot);
+        start = dot + 1;
+    }
+    msg.push_back(0);
+}
+
+// Answer with the given question name; the answer record points back at it
+std::vector<uint8_t> make_answer(uint16_t id, const std::string &question, const Entry *entry) {
+    std::vector<uint8_t> msg = {
+        (uint8_t)(id >> 8), (uint8_t)id,
+        0x81, (uint8_t)(entry ? 0x80 : 0x83),      // QR RD, RA and NOERROR or NXDOMAIN
+        0, 1, 0, (uint8_t)(entry ? 1 : 0), 0, 0, 0, 0
+    };
+    append_name(msg, question);
+    msg.insert(msg.end(), {0, 1, 0, 1});            // Type A, class IN
+    if (entry) {
+        uint32_t ttl = entry->ttl_s;
+        const uint8_t *a = (const uint8_t *)&ip4_addr_get_u32(ip_2_ip4(&entry->addr));
+        msg.insert(msg.end(), {0xC0, 12, 0, 1, 0, 1,
+                               (uint8_t)(ttl >> 24), (uint8_t)(ttl >> 16), (uint8_t)(ttl >> 8), (uint8_t)ttl,
+                               0, 4, a[0], a[1], a[2], a[3]});
+    }
+    return msg;
+}
+
+void send_answer(const std::vector<uint8_t> &message, const ip_addr_t *to, u16_t port) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)message.size(), PBUF_RAM);
+    if (p) {
+        pbuf_take(p, message.data(), (u16_t)message.size());
+        udp_sendto(pcb, p, to, port);
+        pbuf_free(p);
+    }
+}
+
+void delayed_answer(void *arg) {
+    PendingAnswer *pending = (PendingAnswer *)arg;
+    net_wire_server_begin();
+    if (pcb) {
+        send_answer(pending->message, &pending->to, pending->port);
+    }
+    net_wire_server_end();
+    delete pending;
+}
+
+void recv(void *arg, struct udp_pcb *upcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    (void)arg;
+    (void)upcb;
+    uint8_t msg[512];
+    size_t len = pbuf_copy_partial(p, msg, sizeof(msg), 0);
+    pbuf_free(p);
+    queries++;
+    if (len < 17 || faults.drop_queries > 0) {
+        if (faults.drop_queries > 0) {
+            faults.drop_queries--;
+        }
+        return;
+    }
+
+    uint16_t id = (uint16_t)((msg[0] << 8) | msg[1]);
+    std::string name;
+    size_t offset = 12;
+    while (offset < len && msg[offset] != 0 && offset + 1 + msg[offset] <= len) {
+        if (!name.empty()) {
+            name += '.';
+        }
+        name.append((const char *)msg + offset + 1, msg[offset]);
+        offset += 1 + msg[offset];
+    }
+
+    auto found = entries.find(name);
+    const Entry *entry = found != entries.end() ? &found->second : nullptr;
+    if (faults.wrong_question_first) {
+        Entry decoy;
+        ipaddr_aton(DNS_SERVER_DECOY_ADDR, &decoy.addr);
+        decoy.ttl_s = 3600;
+        send_answer(make_answer(id, "wrong." + name, &decoy), addr, port);
+    }
+    std::vector<uint8_t> answer = make_answer(id, name, entry);
+    if (faults.delay_ms == 0) {
+        send_answer(answer, addr, port);
+        return;
+    }
+    PendingAnswer *pending = new PendingAnswer{answer, *addr, port};
+    sys_timeout(faults.delay_ms, delayed_answer, pending);
+}
+
+} // namespace
+
+bool dns_server_start() {
+    ip_addr_t server;
+    net_wire_server_addr(&server);
+    pcb = udp_new();
+    if (!pcb || udp_bind(pcb, &server, 53) != ERR_OK) {
+        printf("DNS SERVER: Cannot bind port 53\n");
+        return false;
+    }
+    udp_recv(pcb, recv, nullptr);
+    return true;
+}
+
+void dns_server_stop() {
+    if (pcb) {
+        udp_remove(pcb);
+        pcb = nullptr;
+    }
+}
+
+void dns_server_add(const char *name, const char *addr, uint32_t ttl_s) {
+    Entry entry;
+    ipaddr_aton(addr, &entry.addr);
+    entry.ttl_s = ttl_s;
+    entries[name] = entry;
+}
+
+void dns_server_set_faults(const DnsServerFaults &new_faults) {
+    faults = new_faults;
+}
+
+uint32_t dns_server_queries() {
+    return queries;
+}
@@ -0,0 +1,30 @@
+#ifndef NET_DNS_SERVER_H
+#define NET_DNS_SERVER_H
+
+// Stand-in DNS server of the host network rig, on port 53 of the server
+// address. Answers A queries for the names it was given, NXDOMAIN for others.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Address in the answers to the wrong question
+#define DNS_SERVER_DECOY_ADDR "10.9.9.9"
+
+struct DnsServerFaults {
+    uint32_t delay_ms = 0;             // Before each answer
+    uint32_t drop_queries = 0;         // The next this many queries get no answer
+    bool wrong_question_first = false; // Send an answer for another name (same ID) before the real one
+};
+
+// Starts the server; false if port 53 is taken
+bool dns_server_start();
+void dns_server_stop();
+
+// Answers name with addr ("10.0.2.1") and a TTL
+void dns_server_add(const char *name, const char *addr, uint32_t ttl_s);
+
+void dns_server_set_faults(const DnsServerFaults &faults);
+
+uint32_t dns_server_queries();
+
+#endif // NET_DNS_SERVER_H
@@ -0,0 +1,50 @@
+#ifndef NET_RIG_LWIPOPTS_H
+#define NET_RIG_LWIPOPTS_H
+
+// lwIP options of the host network rig: the firmware's own settings, so the
+// client side behaves as on the Pico, with the changes a single host process
+// holding both the device and its servers needs.
+#include "../../lwipopts.h"
+
+// No Ethernet or WiFi: two point-to-point netifs joined by the virtual wire
+// (net_wire.h), no ARP and no DHCP
+#undef LWIP_ARP
+#define LWIP_ARP                 0
+#undef LWIP_ETHERNET
+#define LWIP_ETHERNET            0
+#undef LWIP_DHCP
+#define LWIP_DHCP                0
+
+// Pointers are 8 bytes on the development machine
+#undef MEM_ALIGNMENT
+#define MEM_ALIGNMENT            8
+
+// Both ends live in this one stack; route by the far end's subnet so traffic
+// between them goes over the wire instead of the loopback shortcut
+#define LWIP_HOOK_FILENAME "net_rig_hooks.h"
+#define LWIP_HOOK_IP4_ROUTE_SRC(src, dest) net_wire_route(src, dest)
+
+// The servers share the heap and the pbuf pool with the device: room for a
+// server's receive window and its responses on top of the firmware's sizes.
+// Heap peaks reported by the rig include the servers.
+#undef MEM_SIZE
+#define MEM_SIZE                 (TCP_SND_BUF + 4096 + 16384)
+#undef PBUF_POOL_SIZE
+#define PBUF_POOL_SIZE           64
+#define MEMP_NUM_TCP_PCB         16
+#define MEMP_NUM_UDP_PCB         8
+#define MEMP_NUM_SYS_TIMEOUT     (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 16)
+
+// Statistics are what the benchmarks report
+#undef LWIP_STATS
+#define LWIP_STATS               1
+
+// Resumption on the stand-in servers, by session ID and by ticket
+#define ALTCP_MBEDTLS_USE_SESSION_CACHE    1
+#define ALTCP_MBEDTLS_USE_SESSION_TICKETS  1
+
+// The firmware logs every TLS record; the benchmarks print their own summary
+#undef ALTCP_MBEDTLS_DEBUG
+#define ALTCP_MBEDTLS_DEBUG      LWIP_DBG_OFF
+
+#endif // NET_RIG_LWIPOPTS_H
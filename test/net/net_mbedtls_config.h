@@ -0,0 +1,11 @@
+#ifndef NET_RIG_MBEDTLS_CONFIG_H
+#define NET_RIG_MBEDTLS_CONFIG_H
+
+// mbedTLS configuration of the host network rig: the firmware's, plus what
+// only the stand-in servers use (the firmware never runs a TLS server)
+#include "../../mbedtls_config.h"
+
+#define MBEDTLS_SSL_CACHE_C      // Session ID resumption
+#define MBEDTLS_SSL_TICKET_C     // Session ticket resumption
+
+#endif // NET_RIG_MBEDTLS_CONFIG_H
@@ -0,0 +1,22 @@
+#ifndef NET_RIG_HOOKS_H
+#define NET_RIG_HOOKS_H
+
+// lwIP hooks of the host network rig (lwipopts.h)
+
+#include "lwip/ip4_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct netif;
+
+// Output netif for dest: the device's for the server subnet, the server's
+// for the device subnet
+struct netif *net_wire_route(const ip4_addr_t *src, const ip4_addr_t *dest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NET_RIG_HOOKS_H
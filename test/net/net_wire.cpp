@@ -0,0 +1,250 @@
+#include "net_wire.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_set>
+#include <vector>
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "host_clock.h"
+#include "lwip/init.h"
+#include "lwip/dns.h"
+#include "lwip/ip4.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+#include "mbedtls/platform.h"
+#include "libs/https/tls_arena.h"
+
+namespace {
+
+struct Frame {
+    struct netif *to;
+    std::vector<uint8_t> bytes;
+};
+
+struct netif device_netif;
+struct netif server_netif;
+ip4_addr_t device_subnet;
+ip4_addr_t server_subnet;
+ip4_addr_t netmask;
+
+net_wire_faults_t faults = {};
+net_wire_stats_t stats = {};
+uint32_t rand_state = 1;
+uint64_t outage_until_us = 0;
+uint64_t busy_until_us[2] = {0, 0};       // Bit rate: when each direction is free again
+std::multimap<uint64_t, Frame> in_flight;   // By arrival time, in sending order
+bool polling = false;
+
+int server_depth = 0;
+std::unordered_set<void *> server_blocks;
+
+// Server allocations come from the C heap, the device's from the TLS arena
+void *rig_calloc(size_t count, size_t size) {
+    if (server_depth == 0) {
+        return tls_arena_calloc(count, size);
+    }
+    void *p = calloc(count, size);
+    if (p) {
+        server_blocks.insert(p);
+    }
+    return p;
+}
+
+void rig_free(void *p) {
+    if (p && server_blocks.erase(p)) {
+        free(p);
+    } else {
+        tls_arena_free(p);
+    }
+}
+
+err_t wire_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    (void)ipaddr;
+    bool up = netif == &device_netif;
+    net_wire_direction_t &direction = up ? stats.up : stats.down;
+    direction.packets++;
+    direction.bytes += p->tot_len;
+
+    uint64_t now_us = time_us_64();
+    if (now_us < outage_until_us || (faults.loss_percent && net_wire_rand() % 100 < faults.loss_percent)) {
+        direction.dropped++;
+        return ERR_OK;   // Lost on the air; TCP retransmits
+    }
+
+    uint64_t start_us = now_us;
+    if (faults.rate_kbps) {
+        uint64_t &busy_us = busy_until_us[up ? 0 : 1];
+        if (busy_us > start_us) {
+            start_us = busy_us;
+        }
+        busy_us = start_us + (uint64_t)p->tot_len * 8 * 1000 / faults.rate_kbps;
+        start_us = busy_us;
+    }
+    uint64_t delay_us = (uint64_t)faults.latency_ms * 1000;
+    if (faults.jitter_ms) {
+        delay_us += net_wire_rand() % (faults.jitter_ms * 1000 + 1);
+    }
+
+    Frame frame;
+    frame.to = up ? &server_netif : &device_netif;
+    frame.bytes.resize(p->tot_len);
+    pbuf_copy_partial(p, frame.bytes.data(), p->tot_len, 0);
+    in_flight.emplace(start_us + delay_us, std::move(frame));
+    return ERR_OK;
+}
+
+err_t wire_netif_init(struct netif *netif) {
+    netif->output = wire_output;
+    netif->mtu = 1500;
+    netif->name[0] = 'w';
+    netif->name[1] = netif == &device_netif ? 'd' : 's';
+    return ERR_OK;
+}
+
+void add_netif(struct netif *netif, const char *addr, ip4_addr_t *subnet) {
+    ip4_addr_t ip;
+    ip4addr_aton(addr, &ip);
+    ip4_addr_get_network(subnet, &ip, &netmask);
+    netif_add(netif, &ip, &netmask, IP4_ADDR_ANY4, NULL, wire_netif_init, ip4_input);
+    netif_set_up(netif);
+    netif_set_link_up(netif);
+}
+
+} // namespace
+
+extern "C" {
+
+struct netif *net_wire_route(const ip4_addr_t *src, const ip4_addr_t *dest) {
+    (void)src;
+    if (ip4_addr_netcmp(dest, &server_subnet, &netmask)) {
+        return &device_netif;
+    }
+    if (ip4_addr_netcmp(dest, &device_subnet, &netmask)) {
+        return &server_netif;
+    }
+    return NULL;
+}
+
+u32_t sys_now(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+void cyw43_arch_poll(void) {
+    net_wire_poll();
+}
+
+// Entropy for mbedTLS (MBEDTLS_ENTROPY_HARDWARE_ALT); seeded, so handshakes repeat
+int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t *olen) {
+    (void)data;
+    for (size_t i = 0; i < len; i++) {
+        output[i] = (unsigned char)net_wire_rand();
+    }
+    *olen = len;
+    return 0;
+}
+
+unsigned int net_wire_rand(void) {
+    // xorshift32
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+void net_wire_init(void) {
+    lwip_init();
+    tls_arena_init();
+    mbedtls_platform_set_calloc_free(rig_calloc, rig_free);
+
+    ip4addr_aton("255.255.255.0", &netmask);
+    add_netif(&device_netif, NET_WIRE_DEVICE_ADDR, &device_subnet);
+    add_netif(&server_netif, NET_WIRE_SERVER_ADDR, &server_subnet);
+    netif_set_default(&device_netif);
+
+    ip_addr_t dns_server;
+    net_wire_server_addr(&dns_server);
+    dns_setserver(0, &dns_server);
+
+    host_clock_set_idle(net_wire_poll);
+}
+
+void net_wire_set_faults(const net_wire_faults_t *new_faults) {
+    faults = *new_faults;
+    rand_state = faults.seed ? faults.seed : 1;
+}
+
+void net_wire_outage(uint32_t ms) {
+    outage_until_us = time_us_64() + (uint64_t)ms * 1000;
+}
+
+const net_wire_stats_t *net_wire_stats(void) {
+    return &stats;
+}
+
+void net_wire_reset_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+void net_wire_poll(void) {
+    if (polling) {
+        return;
+    }
+    polling = true;
+    uint64_t now_us = time_us_64();
+    while (!in_flight.empty() && in_flight.begin()->first <= now_us) {
+        Frame frame = std::move(in_flight.begin()->second);
+        in_flight.erase(in_flight.begin());
+
+        // Like the WiFi driver: no pool buffer, no packet
+        struct pbuf *p = pbuf_alloc(PBUF_RAW, (u16_t)frame.bytes.size(), PBUF_POOL);
+        if (!p) {
+            (frame.to == &server_netif ? stats.up : stats.down).dropped++;
+            continue;
+        }
+        pbuf_take(p, frame.bytes.data(), (u16_t)frame.bytes.size());
+        bool to_server = frame.to == &server_netif;
+        if (to_server) {
+            net_wire_server_begin();
+        }
+        if (frame.to->input(p, frame.to) != ERR_OK) {
+            pbuf_free(p);
+        }
+        if (to_server) {
+            net_wire_server_end();
+        }
+    }
+    sys_check_timeouts();
+    polling = false;
+}
+
+bool net_wire_run_until(bool (*done)(void *arg), void *arg, uint32_t timeout_ms) {
+    uint32_t start_ms = sys_now();
+    while (!done(arg)) {
+        if (sys_now() - start_ms >= timeout_ms) {
+            return done(arg);
+        }
+        sleep_ms(1);
+    }
+    return true;
+}
+
+void net_wire_server_begin(void) {
+    server_depth++;
+}
+
+void net_wire_server_end(void) {
+    server_depth--;
+}
+
+void net_wire_device_addr(ip_addr_t *addr) {
+    ipaddr_aton(NET_WIRE_DEVICE_ADDR, addr);
+}
+
+void net_wire_server_addr(ip_addr_t *addr) {
+    ipaddr_aton(NET_WIRE_SERVER_ADDR, addr);
+}
+
+} // extern "C"
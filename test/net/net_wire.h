@@ -0,0 +1,81 @@
+#ifndef NET_WIRE_H
+#define NET_WIRE_H
+
+// Virtual wire of the host network rig. The device (the firmware's upload
+// path) and the stand-in servers run in one lwIP stack on two netifs, one per
+// subnet; every IP packet between them is queued on the wire and delivered
+// when the virtual clock reaches its arrival time. The wire adds latency,
+// jitter, a bit rate and loss from a seeded generator, so a run with the same
+// faults and seed repeats exactly.
+//
+// cyw43_arch_poll() and every advance of the virtual clock (sleep_ms() etc.)
+// deliver the due packets and run the lwIP timers.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Addresses of the two ends; the server address answers DNS as well
+#define NET_WIRE_DEVICE_ADDR "10.0.1.2"
+#define NET_WIRE_SERVER_ADDR "10.0.2.1"
+
+typedef struct {
+    uint32_t latency_ms;      // One way
+    uint32_t jitter_ms;       // Added to the latency, uniformly 0..jitter_ms
+    uint32_t rate_kbps;       // Per direction, 0 for unlimited
+    uint8_t loss_percent;     // Packets dropped, either direction
+    uint32_t seed;
+} net_wire_faults_t;
+
+typedef struct {
+    uint32_t packets;
+    uint32_t bytes;           // IP packets including headers
+    uint32_t dropped;         // By loss, an outage or a full pbuf pool
+} net_wire_direction_t;
+
+typedef struct {
+    net_wire_direction_t up;    // Device to servers
+    net_wire_direction_t down;  // Servers to device
+} net_wire_stats_t;
+
+// Initialises lwIP, the mbedTLS entropy source and the TLS arena and brings up
+// both netifs; call once before anything else
+void net_wire_init(void);
+
+// Faults for the packets sent from now on, and a fresh generator seed
+void net_wire_set_faults(const net_wire_faults_t *faults);
+
+// Drops every packet for the next ms milliseconds, like a WiFi dropout
+void net_wire_outage(uint32_t ms);
+
+const net_wire_stats_t *net_wire_stats(void);
+void net_wire_reset_stats(void);
+
+// Delivers the packets that are due and runs the lwIP timers
+void net_wire_poll(void);
+
+// Advances the virtual clock in 1 ms steps until done() returns true or
+// timeout_ms passes; returns done()'s last result
+bool net_wire_run_until(bool (*done)(void *arg), void *arg, uint32_t timeout_ms);
+
+// Server code calls these around everything that can reach mbedTLS, so its
+// allocations come from the C heap and the TLS arena figures stay the device's
+void net_wire_server_begin(void);
+void net_wire_server_end(void);
+
+void net_wire_device_addr(ip_addr_t *addr);
+void net_wire_server_addr(ip_addr_t *addr);
+
+// Next number of the seeded generator
+unsigned int net_wire_rand(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NET_WIRE_H
@@ -0,0 +1,24 @@
+#ifndef NET_RIG_CYW43_ARCH_H
+#define NET_RIG_CYW43_ARCH_H
+
+// Host stand-in for the cyw43 architecture layer. The rig is single-threaded,
+// so the lwIP lock is a no-op; polling delivers the frames on the virtual wire
+// that are due and runs the lwIP timers (net_wire.h).
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CYW43_LINK_DOWN 0
+#define CYW43_LINK_UP   3
+
+void cyw43_arch_poll(void);
+
+static inline void cyw43_arch_lwip_begin(void) {}
+static inline void cyw43_arch_lwip_end(void) {}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // NET_RIG_CYW43_ARCH_H
@@ -0,0 +1,33 @@
+#ifndef NET_RIG_RECORDS_H
+#define NET_RIG_RECORDS_H
+
+// Records for the network rig's benchmarks and tests: a ride at one record
+// every 5 s with slowly changing readings, every 97th record without a fix
+
+#include <cmath>
+#include <vector>
+#include "libs/flash/flash.h"
+
+static inline std::vector<SensorData> rigRideRecords(size_t count) {
+    std::vector<SensorData> records(count);
+    for (size_t i = 0; i < count; i++) {
+        SensorData &r = records[i];
+        double lat = 48.2066200 + i * 0.00002 + 0.00001 * sin(i * 0.05);
+        double lon = 15.6175100 + i * 0.00003;
+        if (i % 97 != 50) {
+            r.latitude = (uint32_t)(int32_t)llround(lat * 1e7);
+            r.longitude = (uint32_t)(int32_t)llround(lon * 1e7);
+        }
+        r.timestamp = 1717286400 + 5 * (uint32_t)i;
+        r.temp = 21.5f + 0.01f * (float)(i % 300);
+        r.hum = 45.25f + 0.05f * (float)(i % 40);
+        r.pres = 1013.2f;
+        r.gasRes = 123456.0f + 10.0f * (float)(i % 100);
+        r.pm2_5 = (uint16_t)(i % 40);
+        r.pm10 = (uint16_t)(i % 60);
+        r.co2 = 420 + (uint32_t)(i % 200);
+    }
+    return records;
+}
+
+#endif // NET_RIG_RECORDS_H
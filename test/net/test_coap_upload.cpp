@@ -0,0 +1,188 @@
+// CoapClient against the stand-in CoAP server: block-wise bodies (Block1),
+// a server asking for smaller blocks, separate responses, retransmission of
+// unacknowledged blocks with exponential backoff, a lossy wire, and DTLS with
+// session resumption on reconnect.
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "net_wire.h"
+#include "dns_server.h"
+#include "coap_server.h"
+#include "rig_records.h"
+#include "test_check.h"
+#include "pico/stdlib.h"
+#include "libs/https/coap_client.h"
+#include "libs/https/sensor_cbor_body.h"
+
+#define DEVICE "E6614103E72B8B2A"
+#define RECORDS 200
+
+static const SensorBody::Fallback FALLBACK = {1717286400, 48.2066, 15.6173};
+
+static bool connectClient(CoapClient &client) {
+    if (!client.beginConnect(10000)) {
+        return false;
+    }
+    UploadClient::Progress progress;
+    while ((progress = client.pollConnect()) == UploadClient::IN_PROGRESS) {
+        sleep_ms(1);
+    }
+    return progress == UploadClient::COMPLETE;
+}
+
+// Posts count records from first_sequence as CBOR; the CoAP status, or
+// UPLOAD_STATUS_NO_RESPONSE
+static int post(CoapClient &client, const std::vector<SensorData> &records, size_t count, uint32_t first_sequence,
+                uint32_t timeout_ms, int32_t *accepted = nullptr, uint32_t *elapsed_ms = nullptr) {
+    SensorCborBody body(records.data(), count, "rig-token", {DEVICE, first_sequence}, FALLBACK, 0.0f);
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    int id = client.beginPost("/api/addMarkers", "application/cbor", &body, timeout_ms);
+    CHECK(id >= 0);
+    int status = 0;
+    while (id >= 0 && (status = client.getStatus(id)) == 0) {
+        sleep_ms(1);
+    }
+    if (accepted) {
+        *accepted = client.getAccepted(id);
+    }
+    if (elapsed_ms) {
+        *elapsed_ms = to_ms_since_boot(get_absolute_time()) - start_ms;
+    }
+    return status;
+}
+
+static size_t stored(const CoapServer &server, uint32_t first_sequence, size_t count) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        n += server.hasRecord(DEVICE, first_sequence + (uint32_t)i) ? 1 : 0;
+    }
+    return n;
+}
+
+int main() {
+    net_wire_init();
+    net_wire_faults_t wire = {20, 0, 0, 0, 1};
+    net_wire_set_faults(&wire);
+    dns_server_add("upload.test", NET_WIRE_SERVER_ADDR, 3600);
+    CHECK(dns_server_start());
+
+    CoapServer plain, secure;
+    CHECK(plain.start(COAP_PORT));
+    CHECK(secure.start(COAPS_PORT, TEST_DATA_DIR "/net/server_key.pem", TEST_DATA_DIR "/net/server_cert.pem"));
+    std::vector<SensorData> records = rigRideRecords(RECORDS);
+    size_t body_len = SensorCborBody(records.data(), RECORDS, "rig-token", {DEVICE, 1}, FALLBACK, 0.0f).getLength();
+    size_t blocks = (body_len + 1023) / 1024;
+    CHECK(blocks > 2);
+
+    CoapClient client("upload.test", COAP_PORT, false);
+    CHECK(connectClient(client));
+    uint32_t sequence = 1;
+    int32_t accepted = -1;
+    uint32_t elapsed_ms = 0;
+
+    // Block-wise, one block per round trip
+    CHECK(post(client, records, RECORDS, sequence, 30000, &accepted, &elapsed_ms) == 204);
+    CHECK(accepted == RECORDS);
+    CHECK(stored(plain, sequence, RECORDS) == RECORDS);
+    CHECK(plain.getBlockCount() == blocks);
+    CHECK(client.getRetransmitCount() == 0);
+    CHECK(elapsed_ms >= blocks * 40 && elapsed_ms < blocks * 40 + 100);
+    sequence += RECORDS;
+
+    // A single block needs no Block1 option
+    CHECK(post(client, records, 5, sequence, 30000, &accepted) == 204);
+    CHECK(accepted == 5);
+    sequence += 5;
+
+    // The server takes 256 byte blocks: the rest goes in that size
+    CoapServerFaults faults;
+    faults.block_szx = 4;
+    plain.setFaults(faults);
+    plain.clearRecords();
+    CHECK(post(client, records, RECORDS, sequence, 30000) == 204);
+    CHECK(stored(plain, sequence, RECORDS) == RECORDS);
+    CHECK(plain.getBlockCount() == 1 + (body_len - 1024 + 255) / 256);
+    sequence += RECORDS;
+
+    // Separate response: an empty ACK first, the answer later in its own CON
+    faults = CoapServerFaults();
+    faults.separate_response = true;
+    faults.response_delay_ms = 500;
+    plain.setFaults(faults);
+    CHECK(post(client, records, RECORDS, sequence, 30000, &accepted, &elapsed_ms) == 204);
+    CHECK(accepted == RECORDS);
+    CHECK(elapsed_ms >= 500);
+    sequence += RECORDS;
+
+    // Two lost blocks: retransmitted after ACK_TIMEOUT, then twice that
+    faults = CoapServerFaults();
+    faults.drop_requests = 2;
+    plain.setFaults(faults);
+    plain.clearRecords();
+    uint32_t retransmits = client.getRetransmitCount();
+    CHECK(post(client, records, RECORDS, sequence, 60000, &accepted, &elapsed_ms) == 204);
+    CHECK(client.getRetransmitCount() == retransmits + 2);
+    CHECK(elapsed_ms >= 3 * COAP_CLIENT_ACK_TIMEOUT_MS);
+    CHECK(stored(plain, sequence, RECORDS) == RECORDS);
+    CHECK(plain.getDuplicateCount() == 0);
+    sequence += RECORDS;
+
+    // A lossy wire: lost blocks and lost ACKs are sent again, a block the
+    // server has seen is answered again, and every record is stored once
+    wire.loss_percent = 10;
+    net_wire_set_faults(&wire);
+    plain.setFaults(CoapServerFaults());
+    plain.clearRecords();
+    retransmits = client.getRetransmitCount();
+    CHECK(post(client, records, RECORDS, sequence, 120000, &accepted) == 204);
+    CHECK(client.getRetransmitCount() > retransmits);
+    CHECK(stored(plain, sequence, RECORDS) == RECORDS);
+    CHECK(plain.getDuplicateCount() == 0);
+    printf("Lossy wire: %lu retransmissions, %lu repeated messages at the server\n",
+           (unsigned long)(client.getRetransmitCount() - retransmits), (unsigned long)plain.getRepeatedMessages());
+    sequence += RECORDS;
+    wire.loss_percent = 0;
+    net_wire_set_faults(&wire);
+
+    // A server that stops answering: MAX_RETRANSMIT retransmissions, then the
+    // request and the connection fail
+    faults = CoapServerFaults();
+    faults.drop_requests = 1000;
+    plain.setFaults(faults);
+    retransmits = client.getRetransmitCount();
+    CHECK(post(client, records, RECORDS, sequence, 300000, &accepted, &elapsed_ms) == UPLOAD_STATUS_NO_RESPONSE);
+    CHECK(client.getRetransmitCount() == retransmits + COAP_CLIENT_MAX_RETRANSMIT);
+    CHECK(elapsed_ms >= 31 * COAP_CLIENT_ACK_TIMEOUT_MS);
+    CHECK(client.pollConnect() == UploadClient::FAILED);
+    client.close();
+    plain.setFaults(CoapServerFaults());
+
+    // DTLS: a full handshake, then a reconnect resumes the session
+    CoapClient first("upload.test", COAPS_PORT, true);
+    CHECK(connectClient(first));
+    CHECK(first.getResumedCount() == 0);
+    CHECK(post(first, records, RECORDS, sequence, 30000, &accepted) == 204);
+    CHECK(accepted == RECORDS);
+    CHECK(stored(secure, sequence, RECORDS) == RECORDS);
+    sequence += RECORDS;
+    first.close();
+    sleep_ms(100);
+
+    CoapClient second("upload.test", COAPS_PORT, true);
+    CHECK(connectClient(second));
+    CHECK(second.getResumedCount() == 1);
+    CHECK(secure.getHandshakeCount() == 2);
+    CHECK(secure.getResumedCount() == 1);
+    CHECK(second.getHandshakeArenaPeak() < first.getHandshakeArenaPeak());
+    CHECK(post(second, records, RECORDS, sequence, 30000) == 204);
+    CHECK(stored(secure, sequence, RECORDS) == RECORDS);
+    second.close();
+
+    CHECK(plain.getErrors().empty());
+    CHECK(secure.getErrors().empty());
+    secure.stop();
+    plain.stop();
+    dns_server_stop();
+    return TEST_RESULT();
+}
@@ -0,0 +1,90 @@
+// The non-blocking DNS lookup (dns_cache.h) against the stand-in DNS server:
+// answers arrive through polling, come from the cache while fresh, answers to
+// another question are ignored, and a resolver that stops answering falls
+// back to the last known address.
+
+#include <cstring>
+#include "net_wire.h"
+#include "dns_server.h"
+#include "test_check.h"
+#include "pico/stdlib.h"
+#include "libs/https/dns_cache.h"
+
+// Polls a started lookup to its end, like pollConnect() does every tick
+static dns_cache_status_t finish(dns_cache_lookup_t *lookup, dns_cache_status_t status, ip_addr_t *addr,
+                                 uint32_t *elapsed_ms) {
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    while (status == DNS_CACHE_IN_PROGRESS) {
+        sleep_ms(1);
+        status = dns_cache_lookup_poll(lookup, addr);
+    }
+    *elapsed_ms = to_ms_since_boot(get_absolute_time()) - start_ms;
+    return status;
+}
+
+int main() {
+    net_wire_init();
+    net_wire_faults_t wire = {20, 0, 0, 0, 1};
+    net_wire_set_faults(&wire);
+    dns_server_add("upload.test", NET_WIRE_SERVER_ADDR, 60);
+    CHECK(dns_server_start());
+
+    ip_addr_t server, addr;
+    net_wire_server_addr(&server);
+    dns_cache_lookup_t lookup;
+    memset(&lookup, 0, sizeof(lookup));
+    uint32_t elapsed_ms;
+
+    // A miss is answered through polling, one round trip later
+    dns_cache_status_t status = dns_cache_lookup_start(&lookup, "upload.test", 2000, &addr);
+    CHECK(status == DNS_CACHE_IN_PROGRESS);
+    CHECK(finish(&lookup, status, &addr, &elapsed_ms) == DNS_CACHE_RESOLVED);
+    CHECK(ip_addr_cmp(&addr, &server));
+    CHECK(elapsed_ms >= 40 && elapsed_ms < 100);
+
+    // Then from the cache, at once
+    uint32_t queries = dns_server_queries();
+    CHECK(dns_cache_lookup_start(&lookup, "upload.test", 2000, &addr) == DNS_CACHE_RESOLVED);
+    CHECK(dns_server_queries() == queries);
+
+    // An answer to another question with the same ID is not taken
+    DnsServerFaults faults;
+    faults.wrong_question_first = true;
+    dns_server_set_faults(faults);
+    dns_cache_expire("upload.test");
+    status = dns_cache_lookup_start(&lookup, "upload.test", 2000, &addr);
+    CHECK(finish(&lookup, status, &addr, &elapsed_ms) == DNS_CACHE_RESOLVED);
+    CHECK(ip_addr_cmp(&addr, &server));
+
+    // A resolver that stops answering: the last address after the timeout
+    faults = DnsServerFaults();
+    faults.drop_queries = 10;
+    dns_server_set_faults(faults);
+    dns_cache_expire("upload.test");
+    status = dns_cache_lookup_start(&lookup, "upload.test", 500, &addr);
+    CHECK(status == DNS_CACHE_IN_PROGRESS);
+    CHECK(finish(&lookup, status, &addr, &elapsed_ms) == DNS_CACHE_RESOLVED);
+    CHECK(ip_addr_cmp(&addr, &server));
+    CHECK(elapsed_ms >= 500);
+
+    // No answer and nothing cached fails
+    status = dns_cache_lookup_start(&lookup, "other.test", 500, &addr);
+    CHECK(finish(&lookup, status, &addr, &elapsed_ms) == DNS_CACHE_FAILED);
+
+    // A name the server does not know fails without waiting for the timeout
+    dns_server_set_faults(DnsServerFaults());
+    status = dns_cache_lookup_start(&lookup, "unknown.test", 2000, &addr);
+    CHECK(finish(&lookup, status, &addr, &elapsed_ms) == DNS_CACHE_FAILED);
+    CHECK(elapsed_ms < 100);
+
+    // Cancelling leaves nothing behind to answer into
+    status = dns_cache_lookup_start(&lookup, "fresh.test", 2000, &addr);
+    CHECK(status == DNS_CACHE_IN_PROGRESS);
+    dns_cache_lookup_cancel(&lookup);
+    CHECK(lookup.pcb == NULL);
+    sleep_ms(100);
+
+    dns_cache_print_stats();
+    dns_server_stop();
+    return TEST_RESULT();
+}
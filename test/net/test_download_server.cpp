@@ -0,0 +1,212 @@
+// The local download server (download_server.h) on the rig's lwIP, fetched
+// the way a phone on the device's access point does: from the other end of
+// the wire, over plain TCP. Checks every document, that /records.bin comes
+// byte for byte from the records block (zero-copy, so retransmissions on a
+// lossy wire read it again), that the block is reported in use until the
+// last byte is acknowledged and released after, that a client which closes
+// its side after the request still gets the whole body, and the error
+// responses.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "net_wire.h"
+#include "test_check.h"
+#include "pico/stdlib.h"
+#include "lwip/tcp.h"
+#include "libs/https/download_server.h"
+
+#define PORT 80
+#define RECORD_SIZE 64
+#define RECORDS 2000
+
+static std::vector<uint8_t> block;
+
+static const uint8_t *records(void *arg, size_t *count, size_t *record_size) {
+    *count = block.size() / RECORD_SIZE;
+    *record_size = RECORD_SIZE;
+    return block.data();
+}
+
+static size_t csvRow(void *arg, size_t index, char *out, size_t size) {
+    int n = snprintf(out, size, "%lu,%u\n", (unsigned long)index, (unsigned)block[index * RECORD_SIZE]);
+    return n > 0 ? (size_t)n : 0;
+}
+
+static size_t statusJson(void *arg, char *out, size_t size) {
+    int n = snprintf(out, size, "{\"records\":%lu}", (unsigned long)(block.size() / RECORD_SIZE));
+    return n > 0 ? (size_t)n : 0;
+}
+
+static const download_source_t source = {records, csvRow, "index,first_byte\n", statusJson, nullptr};
+
+// One HTTP exchange from the server end of the wire
+struct Fetch {
+    std::string request;
+    bool half_close = false;         // Shut the sending side once the request is out
+    struct tcp_pcb *pcb = nullptr;
+    std::string response;
+    bool closed = false;             // The server closed after its response
+    bool failed = false;
+};
+
+static err_t fetchRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    Fetch *fetch = (Fetch *)arg;
+    if (!p) {
+        fetch->closed = true;
+        tcp_arg(pcb, NULL);
+        tcp_recv(pcb, NULL);
+        tcp_err(pcb, NULL);
+        tcp_close(pcb);
+        fetch->pcb = nullptr;
+        return ERR_OK;
+    }
+    std::vector<char> bytes(p->tot_len);
+    pbuf_copy_partial(p, bytes.data(), p->tot_len, 0);
+    fetch->response.append(bytes.data(), bytes.size());
+    tcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static void fetchErr(void *arg, err_t err) {
+    Fetch *fetch = (Fetch *)arg;
+    fetch->failed = true;
+    fetch->pcb = nullptr;
+}
+
+static err_t fetchConnected(void *arg, struct tcp_pcb *pcb, err_t err) {
+    Fetch *fetch = (Fetch *)arg;
+    tcp_write(pcb, fetch->request.data(), (u16_t)fetch->request.size(), TCP_WRITE_FLAG_COPY);
+    tcp_output(pcb);
+    if (fetch->half_close) {
+        tcp_shutdown(pcb, 0, 1);
+    }
+    return ERR_OK;
+}
+
+static bool fetchDone(void *arg) {
+    Fetch *fetch = (Fetch *)arg;
+    return fetch->closed || fetch->failed;
+}
+
+static void startFetch(Fetch &fetch, const char *path, const char *method = "GET") {
+    fetch.request = std::string(method) + " " + path + " HTTP/1.1\r\nHost: 192.168.4.1\r\n\r\n";
+    ip_addr_t server, device;
+    net_wire_server_addr(&server);
+    net_wire_device_addr(&device);
+    fetch.pcb = tcp_new_ip_type(IPADDR_TYPE_V4);
+    CHECK(fetch.pcb != nullptr);
+    tcp_bind(fetch.pcb, &server, 0);
+    tcp_arg(fetch.pcb, &fetch);
+    tcp_recv(fetch.pcb, fetchRecv);
+    tcp_err(fetch.pcb, fetchErr);
+    CHECK(tcp_connect(fetch.pcb, &device, PORT, fetchConnected) == ERR_OK);
+}
+
+static std::string header(const std::string &response, const char *name) {
+    size_t at = response.find(std::string("\r\n") + name + ": ");
+    if (at == std::string::npos) {
+        return std::string();
+    }
+    at += strlen(name) + 4;
+    return response.substr(at, response.find("\r\n", at) - at);
+}
+
+static std::string body(const std::string &response) {
+    size_t at = response.find("\r\n\r\n");
+    return at == std::string::npos ? std::string() : response.substr(at + 4);
+}
+
+static bool get(Fetch &fetch, const char *path, const char *method = "GET") {
+    startFetch(fetch, path, method);
+    return net_wire_run_until(fetchDone, &fetch, 60000) && fetch.closed;
+}
+
+int main() {
+    net_wire_init();
+    net_wire_faults_t wire = {5, 0, 20000, 0, 11};
+    net_wire_set_faults(&wire);
+    block.resize(RECORD_SIZE * RECORDS);
+    for (size_t i = 0; i < block.size(); i++) {
+        block[i] = (uint8_t)(i * 7 + i / RECORD_SIZE);
+    }
+    CHECK(download_server_start(PORT, &source));
+    CHECK(download_server_running());
+
+    Fetch index;
+    CHECK(get(index, "/"));
+    CHECK(index.response.compare(0, 15, "HTTP/1.0 200 OK") == 0);
+    CHECK(body(index.response).find("records.bin") != std::string::npos);
+
+    Fetch status;
+    CHECK(get(status, "/status"));
+    CHECK(body(status.response) == "{\"records\":2000}");
+    CHECK(header(status.response, "Content-Type") == "application/json");
+
+    // The whole block at 20 Mbit/s, the block in use until the end
+    Fetch bin;
+    startFetch(bin, "/records.bin");
+    uint32_t start_ms = to_ms_since_boot(get_absolute_time());
+    bool seen_in_use = false;
+    while (!fetchDone(&bin) && to_ms_since_boot(get_absolute_time()) - start_ms < 60000) {
+        sleep_ms(1);
+        seen_in_use = seen_in_use || download_server_records_in_use();
+    }
+    uint32_t elapsed_ms = to_ms_since_boot(get_absolute_time()) - start_ms;
+    CHECK(bin.closed);
+    CHECK(seen_in_use);
+    CHECK(!download_server_records_in_use());
+    CHECK(header(bin.response, "X-Record-Size") == "64");
+    CHECK(header(bin.response, "Content-Length") == std::to_string(block.size()));
+    CHECK(body(bin.response) == std::string(block.begin(), block.end()));
+    printf("records.bin: %lu bytes in %lu ms\n", (unsigned long)block.size(), (unsigned long)elapsed_ms);
+
+    // A lossy wire: lost segments are sent again from the block
+    wire.loss_percent = 5;
+    net_wire_set_faults(&wire);
+    Fetch lossy;
+    CHECK(get(lossy, "/records.bin"));
+    CHECK(body(lossy.response) == std::string(block.begin(), block.end()));
+    CHECK(!download_server_records_in_use());
+    const net_wire_stats_t *stats = net_wire_stats();
+    CHECK(stats->up.dropped + stats->down.dropped > 0);
+    wire.loss_percent = 0;
+    net_wire_set_faults(&wire);
+
+    // The client closes its side right after the request
+    Fetch half;
+    half.half_close = true;
+    CHECK(get(half, "/records.bin"));
+    CHECK(body(half.response) == std::string(block.begin(), block.end()));
+
+    Fetch csv;
+    CHECK(get(csv, "/records.csv"));
+    std::string rows = body(csv.response);
+    CHECK(rows.compare(0, 17, "index,first_byte\n") == 0);
+    CHECK(rows.find("1999," + std::to_string(block[1999 * RECORD_SIZE]) + "\n") != std::string::npos);
+    size_t lines = 0;
+    for (char c : rows) {
+        lines += c == '\n' ? 1 : 0;
+    }
+    CHECK(lines == RECORDS + 1);
+
+    Fetch head;
+    CHECK(get(head, "/records.bin", "HEAD"));
+    CHECK(header(head.response, "Content-Length") == std::to_string(block.size()));
+    CHECK(body(head.response).empty());
+
+    Fetch missing;
+    CHECK(get(missing, "/nothing"));
+    CHECK(missing.response.compare(0, 22, "HTTP/1.0 404 Not Found") == 0);
+
+    Fetch post;
+    CHECK(get(post, "/records.bin", "POST"));
+    CHECK(post.response.compare(0, 31, "HTTP/1.0 405 Method Not Allowed") == 0);
+
+    CHECK(download_server_requests() == 9);
+    download_server_stop();
+    CHECK(!download_server_running());
+    return TEST_RESULT();
+}
@@ -0,0 +1,179 @@
+// Exactly-once storage of retried uploads: every body names the device and
+// the sequence number of its first record (sensor_body.h), so a batch sent
+// again is acknowledged without being stored twice. Replays what the device
+// does when a request may already have been stored:
+//
+//   - the response is lost and the connection reset, so the session resends
+//     the range on a new connection
+//   - the server closes keep-alive connections with requests still in flight
+//   - the same chunk goes to the fallback host, then as the JSON "alt" request
+//   - a reboot before the records were erased uploads them all again
+//
+// and checks that each (device, sequence) is stored once with the record's
+// own values, while another device's records with the same numbers are kept.
+
+#include <cstdio>
+#include <vector>
+#include "net_wire.h"
+#include "dns_server.h"
+#include "upload_server.h"
+#include "upload_driver.h"
+#include "rig_records.h"
+#include "test_check.h"
+#include "pico/stdlib.h"
+#include "libs/https/https_client.h"
+#include "libs/https/sensor_json_body.h"
+#include "libs/https/sensor_cbor_body.h"
+#include "libs/https/deflate_body.h"
+
+#define DEVICE "E6614103E72B8B2A"
+#define OTHER_DEVICE "E6614103E72B8B2B"
+#define RECORDS 600
+
+static const SensorBody::Fallback FALLBACK = {1717286400, 48.2066, 15.6173};
+
+// Every record from first_sequence stored once, with the values it was sent with
+static void checkStored(const UploadServer &server, const char *device, const std::vector<SensorData> &records,
+                        uint32_t first_sequence) {
+    size_t stored = 0, matching = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        auto it = server.getRecords().find(std::make_pair(std::string(device), first_sequence + (uint32_t)i));
+        if (it == server.getRecords().end()) {
+            continue;
+        }
+        stored++;
+        matching += it->second.epoch == records[i].timestamp && it->second.co2 == records[i].co2 ? 1 : 0;
+    }
+    CHECK(stored == records.size());
+    CHECK(matching == records.size());
+}
+
+static UploadDriverResult upload(const std::vector<SensorData> &records, uint32_t first_sequence) {
+    UploadDriverSettings settings;
+    settings.device = DEVICE;
+    UploadDriver driver(settings, records, first_sequence);
+    UploadDriverResult result = driver.run(30 * 60 * 1000);
+    CHECK(result.acknowledged == records.size());
+    return result;
+}
+
+// Posts count records from first as one request to host, the way the
+// blocking uploader sends a chunk; the HTTP status, or
+// UPLOAD_STATUS_NO_RESPONSE
+static int postChunk(const char *host, const char *device, const std::vector<SensorData> &records, size_t first,
+                     size_t count, uint32_t first_sequence, bool binary, int32_t *accepted) {
+    HttpsClient client(host);
+    if (!client.beginConnect(10000)) {
+        return UPLOAD_STATUS_NO_RESPONSE;
+    }
+    UploadClient::Progress progress;
+    while ((progress = client.pollConnect()) == UploadClient::IN_PROGRESS) {
+        sleep_ms(1);
+    }
+    if (progress != UploadClient::COMPLETE) {
+        return UPLOAD_STATUS_NO_RESPONSE;
+    }
+
+    SensorBody::Origin origin = {device, first_sequence};
+    SensorJsonBody json(&records[first], count, "rig-token", origin, FALLBACK, 0.0f);
+    SensorCborBody cbor(&records[first], count, "rig-token", origin, FALLBACK, 0.0f);
+    DeflateBody deflated(&cbor);
+    int id = binary ? client.beginPost("/api/addMarkers", "application/cbor", &deflated, 10000, "deflate")
+                    : client.beginPost("/api/addMarkers", "application/json", &json, 10000);
+    CHECK(id >= 0);
+    int status = 0;
+    while (id >= 0 && (status = client.getStatus(id)) == 0) {
+        sleep_ms(1);
+    }
+    *accepted = client.getAccepted(id);
+    client.close();
+    sleep_ms(100);   // Let the close reach the server
+    return status;
+}
+
+int main() {
+    net_wire_init();
+    net_wire_faults_t wire = {20, 10, 0, 0, 7};
+    net_wire_set_faults(&wire);
+    dns_server_add("upload.test", NET_WIRE_SERVER_ADDR, 300);
+    dns_server_add("www.upload.test", NET_WIRE_SERVER_ADDR, 300);
+    CHECK(dns_server_start());
+    UploadServer server;
+    CHECK(server.start(443, TEST_DATA_DIR "/net/server_key.pem", TEST_DATA_DIR "/net/server_cert.pem"));
+
+    std::vector<SensorData> records = rigRideRecords(RECORDS);
+    const uint32_t first_sequence = 5000;
+
+    // Every third request is stored but its response lost with the
+    // connection: each of those ranges is sent again and stored once
+    UploadServerFaults faults;
+    faults.reset_every = 3;
+    server.setFaults(faults);
+    upload(records, first_sequence);
+    CHECK(server.getResetCount() > 0);
+    CHECK(server.getDuplicateCount() > 0);
+    CHECK(server.getRecords().size() == RECORDS);
+    checkStored(server, DEVICE, records, first_sequence);
+    printf("Lost responses: %lu resets, %lu records received again\n", (unsigned long)server.getResetCount(),
+           (unsigned long)server.getDuplicateCount());
+
+    // Connections closed under pipelined requests and a share of the
+    // responses lost, on a lossy wire: still every record once
+    server.clearRecords();
+    faults = UploadServerFaults();
+    faults.close_every = 2;
+    faults.lose_response_percent = 20;
+    server.setFaults(faults);
+    wire.loss_percent = 2;
+    net_wire_set_faults(&wire);
+    UploadDriverResult result = upload(records, first_sequence);
+    CHECK(result.connections > 1);
+    CHECK(server.getRecords().size() == RECORDS);
+    checkStored(server, DEVICE, records, first_sequence);
+    printf("Closed connections: %lu connections, %lu requests, %lu records received again\n",
+           (unsigned long)result.connections, (unsigned long)server.getRequestCount(),
+           (unsigned long)server.getDuplicateCount());
+    wire.loss_percent = 0;
+    net_wire_set_faults(&wire);
+    server.setFaults(UploadServerFaults());
+
+    // A reboot before the erase: the same records with the same numbers
+    // again, all acknowledged, none stored twice
+    uint32_t duplicates = server.getDuplicateCount();
+    upload(records, first_sequence);
+    CHECK(server.getDuplicateCount() == duplicates + RECORDS);
+    CHECK(server.getRecords().size() == RECORDS);
+    checkStored(server, DEVICE, records, first_sequence);
+
+    // The blocking uploader's fallbacks: the same chunk to the primary host,
+    // the fallback host and as the JSON "alt" request. Every one is
+    // acknowledged in full; the records are stored once.
+    duplicates = server.getDuplicateCount();
+    int32_t accepted = -1;
+    CHECK(postChunk("upload.test", DEVICE, records, 100, 20, first_sequence + 100, true, &accepted) == 200);
+    CHECK(accepted == 20);
+    CHECK(postChunk("www.upload.test", DEVICE, records, 100, 20, first_sequence + 100, true, &accepted) == 200);
+    CHECK(accepted == 20);
+    CHECK(postChunk("upload.test", DEVICE, records, 100, 20, first_sequence + 100, false, &accepted) == 200);
+    CHECK(accepted == 20);
+    CHECK(server.getDuplicateCount() == duplicates + 3 * 20);
+    CHECK(server.getRecords().size() == RECORDS);
+
+    // A chunk overlapping stored records only adds the new ones
+    std::vector<SensorData> more = rigRideRecords(RECORDS + 10);
+    CHECK(postChunk("upload.test", DEVICE, more, RECORDS - 10, 20, first_sequence + RECORDS - 10, true,
+                    &accepted) == 200);
+    CHECK(server.getRecords().size() == RECORDS + 10);
+    CHECK(server.getDuplicateCount() == duplicates + 3 * 20 + 10);
+
+    // The same sequence numbers from another board are other records
+    CHECK(postChunk("upload.test", OTHER_DEVICE, records, 0, 20, first_sequence, true, &accepted) == 200);
+    CHECK(server.getRecords().size() == RECORDS + 10 + 20);
+    CHECK(server.hasRecord(OTHER_DEVICE, first_sequence));
+    CHECK(server.hasRecord(DEVICE, first_sequence));
+
+    CHECK(server.getErrors().empty());
+    server.stop();
+    dns_server_stop();
+    return TEST_RESULT();
+}
@@ -0,0 +1,233 @@
+#include "upload_driver.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "libs/https/sensor_json_body.h"
+#include "libs/https/sensor_cbor_body.h"
+
+static const SensorBody::Fallback FALLBACK = {1717286400, 48.2066, 15.6173};
+
+static uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+UploadDriver::UploadDriver(const UploadDriverSettings &settings, const std::vector<SensorData> &records,
+                           uint32_t first_sequence)
+    : settings(settings), records(records), first_sequence(first_sequence), binary(settings.binary),
+      batch(settings.initial_batch, settings.max_batch, settings.slow_response_ms) {
+    result.total = records.size();
+    if (!records.empty()) {
+        queued.push_back({0, records.size(), 0});
+    }
+}
+
+UploadDriverResult UploadDriver::run(uint32_t timeout_ms) {
+    uint32_t start_ms = now_ms();
+    while (state != DONE && now_ms() - start_ms < timeout_ms) {
+        tick();
+        sleep_ms(1);   // Delivers packets and runs the lwIP timers
+    }
+    releaseClient();
+    result.elapsed_ms = now_ms() - start_ms;
+    result.batch_size = batch.getSize();
+    return result;
+}
+
+void UploadDriver::makeBody(Body &body, const Range &range) {
+    SensorBody::Origin origin = {settings.device, first_sequence + (uint32_t)range.start};
+    body.deflated.reset();
+    body.records.reset();
+    body.content_encoding = nullptr;
+    if (!binary) {
+        body.records.reset(new SensorJsonBody(&records[range.start], range.count, settings.token, origin,
+                                              FALLBACK, 0.0f));
+        body.source = body.records.get();
+        body.content_type = "application/json";
+        return;
+    }
+    body.records.reset(new SensorCborBody(&records[range.start], range.count, settings.token, origin,
+                                          FALLBACK, 0.0f));
+    body.source = body.records.get();
+    body.content_type = "application/cbor";
+    if (settings.deflate) {
+        body.deflated.reset(new DeflateBody(body.records.get()));
+        if (body.deflated->getLength() < body.records->getLength()) {
+            body.source = body.deflated.get();
+            body.content_encoding = "deflate";
+        } else {
+            body.deflated.reset();
+        }
+    }
+}
+
+void UploadDriver::releaseClient() {
+    if (!client) {
+        return;
+    }
+    client->close();
+    if (result.handshakes == 0) {
+        settings.tls_profile = client->getTlsProfile();
+    }
+    result.requests += client->getRequestCount();
+    result.handshakes += client->getHandshakeCount();
+    result.resumed += client->getResumedCount();
+    result.bytes_sent += client->getBytesSent();
+    result.bytes_received += client->getBytesReceived();
+    result.handshake_arena_peak = std::max(result.handshake_arena_peak, client->getHandshakeArenaPeak());
+    client.reset();
+}
+
+void UploadDriver::scheduleRetry() {
+    uint32_t delay_ms = settings.retry_delay_ms << (retries < 4 ? retries : 4);
+    retries++;
+    backoff_until_ms = now_ms() + delay_ms;
+    state = BACKOFF;
+}
+
+void UploadDriver::connectFailed() {
+    releaseClient();
+    if (++connect_failures >= settings.connect_attempts) {
+        printf("UPLOAD DRIVER: Could not connect %lu times, giving up\n", (unsigned long)connect_failures);
+        state = DONE;
+        return;
+    }
+    scheduleRetry();
+}
+
+void UploadDriver::completeRange(const Range &range, int status, int32_t accepted, uint32_t response_ms) {
+    size_t stored = 0;
+    if (status >= 200 && status < 300) {
+        stored = (accepted < 0 || (size_t)accepted > range.count) ? range.count : (size_t)accepted;
+        if (stored == range.count) {
+            batch.onAcknowledged((uint16_t)range.count, response_ms);
+        }
+    } else if (status == 415 && binary) {
+        binary = false;   // The refused chunks go again as JSON
+    } else if (status == 413) {
+        batch.onTooLarge((uint16_t)range.count);
+    } else if (status != 415) {
+        batch.onFailed((uint16_t)range.count);
+    }
+    result.acknowledged += stored;
+    if (stored > 0) {
+        retries = 0;
+    } else if (status != 415) {
+        retries++;
+    }
+    if (stored < range.count) {
+        uint8_t attempts = stored > 0 ? 0 : range.attempts + 1;
+        if (attempts < settings.range_attempts) {
+            queued.push_back({range.start + stored, range.count - stored, attempts});
+        } else {
+            printf("UPLOAD DRIVER: Records %lu-%lu upload failed\n", (unsigned long)(range.start + stored + 1),
+                   (unsigned long)(range.start + range.count));
+        }
+    }
+}
+
+void UploadDriver::tickSending() {
+    uint32_t now = now_ms();
+    if (sending && client->pollSend() != UploadClient::IN_PROGRESS) {
+        sending = false;
+        inflight_sent_ms[inflight_count - 1] = now;
+    }
+
+    while (inflight_count > 0) {
+        int status = client->getStatus(inflight_ids[0]);
+        if (status == 0) {
+            bool written = !(sending && inflight_count == 1);
+            if (written && now - inflight_sent_ms[0] > settings.response_timeout_ms) {
+                client->close();
+                continue;
+            }
+            break;
+        }
+        completeRange(inflight_ranges[0], status, client->getAccepted(inflight_ids[0]),
+                      client->getResponseMs(inflight_ids[0]));
+        inflight_count--;
+        memmove(inflight_ranges, inflight_ranges + 1, inflight_count * sizeof(inflight_ranges[0]));
+        memmove(inflight_ids, inflight_ids + 1, inflight_count * sizeof(inflight_ids[0]));
+        memmove(inflight_sent_ms, inflight_sent_ms + 1, inflight_count * sizeof(inflight_sent_ms[0]));
+    }
+
+    if (!sending && client->isConnected() && !queued.empty() &&
+        inflight_count < client->getMaxInFlight() && (retries == 0 || inflight_count == 0)) {
+        Range range = queued.front();
+        range.count = std::min(range.count, (size_t)batch.getSize());
+        makeBody(body, range);
+        int request_id = client->beginPost("/api/addMarkers", body.content_type, body.source,
+                                           settings.response_timeout_ms, body.content_encoding);
+        if (request_id >= 0) {
+            if (range.count == queued.front().count) {
+                queued.erase(queued.begin());
+            } else {
+                queued.front().start += range.count;
+                queued.front().count -= range.count;
+            }
+            inflight_ranges[inflight_count] = range;
+            inflight_ids[inflight_count] = request_id;
+            inflight_sent_ms[inflight_count] = now;
+            inflight_count++;
+            sending = true;
+        }
+    }
+
+    if (inflight_count > 0 || sending) {
+        return;
+    }
+    if (queued.empty()) {
+        state = DONE;
+    } else if (!client->isConnected()) {
+        releaseClient();
+        if (retries == 0) {
+            state = CONNECT;
+        } else {
+            scheduleRetry();
+        }
+    }
+}
+
+void UploadDriver::tick() {
+    switch (state) {
+    case DONE:
+        return;
+
+    case BACKOFF:
+        if ((int32_t)(now_ms() - backoff_until_ms) < 0) {
+            return;
+        }
+        state = CONNECT;
+        // Fall through
+
+    case CONNECT:
+        if (queued.empty()) {
+            state = DONE;
+            return;
+        }
+        client.reset(new HttpsClient(settings.host));
+        client->setTlsProfile(settings.tls_profile);
+        result.connections++;
+        if (!client->beginConnect(settings.connect_timeout_ms)) {
+            connectFailed();
+            return;
+        }
+        state = CONNECTING;
+        return;
+
+    case CONNECTING: {
+        UploadClient::Progress progress = client->pollConnect();
+        if (progress == UploadClient::FAILED) {
+            connectFailed();
+        } else if (progress == UploadClient::COMPLETE) {
+            connect_failures = 0;
+            state = SENDING;
+        }
+        return;
+    }
+
+    case SENDING:
+        tickSending();
+        return;
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef NET_UPLOAD_DRIVER_H
+#define NET_UPLOAD_DRIVER_H
+
+// The firmware's upload session (UploadSession in pico_eu.cpp) reduced to
+// what drives the network: ranges of records are cut into batches sized by
+// BatchController, pipelined over an UploadClient, matched to their responses
+// and re-queued from the first record a response did not acknowledge; lost
+// connections are reopened after a growing backoff. pico_eu.cpp itself needs
+// the whole board, so the rig runs this copy of its logic; keep the two in step.
+//
+// Body preparation ahead of time is left out: the virtual clock does not
+// advance while encoding, so overlapping it would show nothing here.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
+#include "libs/flash/flash.h"
+#include "libs/https/batch_controller.h"
+#include "libs/https/sensor_body.h"
+#include "libs/https/deflate_body.h"
+#include "libs/https/https_client.h"
+#include "libs/https/upload_client.h"
+
+struct UploadDriverSettings {
+    const char *host = "upload.test";
+    const char *token = "rig-token";
+    const char *device = "E6614103E72B8B2A";
+    bool binary = true;                      // CBOR, else JSON
+    bool deflate = true;                     // CBOR bodies only, as UPLOAD_DEFLATE
+    tls_profile_t tls_profile = TLS_PROFILE_CONSTRAINED;
+    uint16_t initial_batch = 4;              // UPLOAD_BATCH_INITIAL
+    uint16_t max_batch = 250;                // UPLOAD_BATCH_MAX
+    uint32_t slow_response_ms = 3000;        // UPLOAD_BATCH_SLOW_RESPONSE_MS
+    uint32_t connect_timeout_ms = 10000;     // UPLOAD_CONNECT_TIMEOUT_MS
+    uint32_t response_timeout_ms = 10000;    // UPLOAD_RESPONSE_TIMEOUT_MS
+    uint8_t range_attempts = 3;              // UPLOAD_RANGE_ATTEMPTS
+    uint32_t retry_delay_ms = 500;           // UPLOAD_RETRY_DELAY_MS
+    uint32_t connect_attempts = 8;           // Failed connects in a row before giving up
+};
+
+struct UploadDriverResult {
+    size_t total = 0;
+    size_t acknowledged = 0;
+    uint32_t elapsed_ms = 0;
+    uint32_t connections = 0;                // Clients created, including failed connects
+    uint32_t requests = 0;
+    uint32_t handshakes = 0;
+    uint32_t resumed = 0;
+    uint32_t bytes_sent = 0;                 // Request bytes before TLS
+    uint32_t bytes_received = 0;
+    size_t handshake_arena_peak = 0;
+    uint16_t batch_size = 0;                 // Where the controller ended
+};
+
+class UploadDriver {
+public:
+    // records must outlive the driver; record i has sequence first_sequence + i
+    UploadDriver(const UploadDriverSettings &settings, const std::vector<SensorData> &records,
+                 uint32_t first_sequence);
+
+    // Uploads everything, or as much as possible within timeout_ms of virtual time
+    UploadDriverResult run(uint32_t timeout_ms);
+
+private:
+    struct Range {
+        size_t start;
+        size_t count;
+        uint8_t attempts;
+    };
+
+    struct Body {
+        std::unique_ptr<SensorBody> records;
+        std::unique_ptr<DeflateBody> deflated;
+        http_body_source_t *source = nullptr;
+        const char *content_type = nullptr;
+        const char *content_encoding = nullptr;
+    };
+
+    enum State : uint8_t {
+        CONNECT = 0,
+        CONNECTING,
+        SENDING,
+        BACKOFF,
+        DONE
+    };
+
+    UploadDriverSettings settings;
+    const std::vector<SensorData> &records;
+    uint32_t first_sequence;
+    bool binary;
+    State state = CONNECT;
+    std::vector<Range> queued;
+    Range inflight_ranges[HTTPS_CLIENT_MAX_PIPELINE];
+    int inflight_ids[HTTPS_CLIENT_MAX_PIPELINE];
+    uint32_t inflight_sent_ms[HTTPS_CLIENT_MAX_PIPELINE];
+    size_t inflight_count = 0;
+    Body body;                               // Of the request being written
+    bool sending = false;
+    uint32_t retries = 0;
+    uint32_t connect_failures = 0;
+    uint32_t backoff_until_ms = 0;
+    std::unique_ptr<UploadClient> client;
+    BatchController batch;
+    UploadDriverResult result;
+
+    void tick();
+    void tickSending();
+    void makeBody(Body &body, const Range &range);
+    void completeRange(const Range &range, int status, int32_t accepted, uint32_t response_ms);
+    void releaseClient();
+    void connectFailed();
+    void scheduleRetry();
+};
+
+#endif // NET_UPLOAD_DRIVER_H
@@ -0,0 +1,286 @@
+#include "upload_server.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include "net_wire.h"
+#include "test_check.h"
+#include "lwip/altcp_tls.h"
+#include "lwip/pbuf.h"
+#include "lwip/timeouts.h"
+
+static uint32_t now_ms() {
+    return sys_now();
+}
+
+// Value of a header in the request head, empty if missing
+static std::string header_value(const std::string &head, const char *name) {
+    size_t name_len = strlen(name);
+    size_t line = head.find("\r\n");
+    while (line != std::string::npos && line + 2 < head.size()) {
+        size_t start = line + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos) {
+            end = head.size();
+        }
+        if (end - start > name_len && head[start + name_len] == ':' &&
+            strncasecmp(head.c_str() + start, name, name_len) == 0) {
+            size_t value = head.find_first_not_of(' ', start + name_len + 1);
+            return value < end ? head.substr(value, end - value) : std::string();
+        }
+        line = end;
+    }
+    return std::string();
+}
+
+UploadServer::~UploadServer() {
+    stop();
+}
+
+bool UploadServer::start(uint16_t port, const char *key_path, const char *cert_path) {
+    // PEM is parsed with its terminator
+    size_t key_len, cert_len;
+    char *key = test_read_file(key_path, &key_len);
+    char *cert = test_read_file(cert_path, &cert_len);
+    net_wire_server_begin();
+    tls_config = altcp_tls_create_config_server_privkey_cert((const u8_t *)key, key_len + 1, NULL, 0,
+                                                             (const u8_t *)cert, cert_len + 1);
+    free(key);
+    free(cert);
+
+    ip_addr_t addr;
+    net_wire_server_addr(&addr);
+    struct altcp_pcb *pcb = tls_config ? altcp_tls_new(tls_config, IPADDR_TYPE_ANY) : nullptr;
+    if (pcb && altcp_bind(pcb, &addr, port) == ERR_OK) {
+        listen_pcb = altcp_listen(pcb);
+    }
+    if (listen_pcb) {
+        altcp_arg(listen_pcb, this);
+        altcp_accept(listen_pcb, accept);
+        ticking = true;
+        sys_timeout(1, tick, this);
+    } else if (pcb) {
+        altcp_close(pcb);
+    }
+    net_wire_server_end();
+    if (!listen_pcb) {
+        printf("UPLOAD SERVER: Cannot listen on port %u\n", port);
+    }
+    return listen_pcb != nullptr;
+}
+
+void UploadServer::stop() {
+    net_wire_server_begin();
+    while (!connections.empty()) {
+        Connection *conn = connections.front().get();
+        altcp_arg(conn->pcb, NULL);
+        altcp_recv(conn->pcb, NULL);
+        altcp_err(conn->pcb, NULL);
+        altcp_abort(conn->pcb);
+        connections.pop_front();
+    }
+    if (listen_pcb) {
+        altcp_close(listen_pcb);
+        listen_pcb = nullptr;
+    }
+    if (ticking) {
+        sys_untimeout(tick, this);
+        ticking = false;
+    }
+    if (tls_config) {
+        altcp_tls_free_config(tls_config);
+        tls_config = nullptr;
+    }
+    net_wire_server_end();
+}
+
+void UploadServer::clearRecords() {
+    records.clear();
+    errors.clear();
+    request_count = 0;
+    connection_count = 0;
+    duplicate_count = 0;
+    reset_count = 0;
+}
+
+err_t UploadServer::accept(void *arg, struct altcp_pcb *pcb, err_t err) {
+    UploadServer *server = (UploadServer *)arg;
+    if (err != ERR_OK || !pcb) {
+        return ERR_VAL;
+    }
+    server->connections.emplace_back(new Connection{server, pcb});
+    server->connection_count++;
+    altcp_arg(pcb, server->connections.back().get());
+    altcp_recv(pcb, recv);
+    altcp_err(pcb, error);
+    return ERR_OK;
+}
+
+err_t UploadServer::recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err) {
+    Connection *conn = (Connection *)arg;
+    UploadServer *server = conn->server;
+    if (!p) {
+        server->dropConnection(conn);   // Closed by the device
+        return ERR_OK;
+    }
+    size_t offset = conn->rx.size();
+    conn->rx.resize(offset + p->tot_len);
+    pbuf_copy_partial(p, &conn->rx[offset], p->tot_len, 0);
+    altcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+    (void)err;
+
+    if (!server->handleRequests(conn)) {
+        altcp_arg(pcb, NULL);
+        altcp_recv(pcb, NULL);
+        altcp_err(pcb, NULL);
+        altcp_abort(pcb);
+        server->connections.remove_if([conn](const std::unique_ptr<Connection> &c) { return c.get() == conn; });
+        return ERR_ABRT;
+    }
+    server->sendDue(conn);
+    return ERR_OK;
+}
+
+void UploadServer::error(void *arg, err_t err) {
+    Connection *conn = (Connection *)arg;
+    (void)err;
+    conn->pcb = nullptr;   // Already freed by lwIP
+    UploadServer *server = conn->server;
+    server->connections.remove_if([conn](const std::unique_ptr<Connection> &c) { return c.get() == conn; });
+}
+
+void UploadServer::tick(void *arg) {
+    UploadServer *server = (UploadServer *)arg;
+    net_wire_server_begin();
+    for (auto it = server->connections.begin(); it != server->connections.end();) {
+        Connection *conn = (it++)->get();   // sendDue() may remove it
+        server->sendDue(conn);
+    }
+    sys_timeout(1, tick, server);
+    net_wire_server_end();
+}
+
+bool UploadServer::handleRequests(Connection *conn) {
+    while (!conn->closing) {
+        size_t head_end = conn->rx.find("\r\n\r\n");
+        if (head_end == std::string::npos) {
+            return true;
+        }
+        std::string head = conn->rx.substr(0, head_end);
+        size_t body_len = strtoul(header_value(head, "Content-Length").c_str(), NULL, 10);
+        if (conn->rx.size() < head_end + 4 + body_len) {
+            return true;
+        }
+
+        bool reset = false;
+        std::string response = handleRequest(head, (const uint8_t *)conn->rx.data() + head_end + 4, body_len, reset);
+        conn->rx.erase(0, head_end + 4 + body_len);
+        if (reset) {
+            reset_count++;
+            return false;
+        }
+
+        // Responses leave in request order; the last one on a connection closes it
+        bool close = faults.close_every && conn->answered + conn->responses.size() + 1 >= faults.close_every;
+        if (close) {
+            response.insert(response.find("\r\n") + 2, "Connection: close\r\n");
+            conn->closing = true;
+        }
+        conn->responses.push_back({now_ms() + faults.response_delay_ms, response, close});
+    }
+    return true;
+}
+
+std::string UploadServer::handleRequest(const std::string &head, const uint8_t *body, size_t body_len,
+                                        bool &reset) {
+    request_count++;
+    std::string content_type = header_value(head, "Content-Type");
+    std::string content_encoding = header_value(head, "Content-Encoding");
+
+    int status = 200;
+    const char *reason = "OK";
+    size_t stored = 0;
+    DecodedUpload upload;
+    std::string error;
+    if (faults.refuse_cbor && content_type == "application/cbor") {
+        status = 415;
+        reason = "Unsupported Media Type";
+    } else if (faults.max_body_bytes && body_len > faults.max_body_bytes) {
+        status = 413;
+        reason = "Payload Too Large";
+    } else if (!decodeUpload(body, body_len, content_type.c_str(),
+                             content_encoding.empty() ? nullptr : content_encoding.c_str(), upload, error)) {
+        errors.push_back(error);
+        status = 400;
+        reason = "Bad Request";
+    } else {
+        // Only the first records are stored when the server says so
+        stored = upload.records.size();
+        if (faults.accept_at_most && stored > faults.accept_at_most) {
+            stored = faults.accept_at_most;
+        }
+        for (size_t i = 0; i < stored; i++) {
+            auto key = std::make_pair(upload.device, upload.first_sequence + (uint32_t)i);
+            if (!records.emplace(key, upload.records[i]).second) {
+                duplicate_count++;
+            }
+        }
+
+        // The request is stored; the response may still never arrive
+        if ((faults.reset_every && request_count % faults.reset_every == 0) ||
+            (faults.lose_response_percent && net_wire_rand() % 100 < faults.lose_response_percent)) {
+            reset = true;
+            return std::string();
+        }
+    }
+
+    char body_text[48];
+    snprintf(body_text, sizeof(body_text), "{\"accepted\":%lu}", (unsigned long)stored);
+    char response[256];
+    snprintf(response, sizeof(response),
+             "HTTP/1.1 %d %s\r\n"
+             "Content-Type: application/json\r\n"
+             "X-Accepted-Records: %lu\r\n"
+             "Content-Length: %u\r\n"
+             "\r\n%s",
+             status, reason, (unsigned long)stored, (unsigned)strlen(body_text), body_text);
+    return response;
+}
+
+void UploadServer::sendDue(Connection *conn) {
+    uint32_t now = now_ms();
+    bool written = false;
+    while (conn->pcb && !conn->responses.empty() && (int32_t)(now - conn->responses.front().due_ms) >= 0) {
+        Response &response = conn->responses.front();
+        if (altcp_sndbuf(conn->pcb) < response.data.size()) {
+            break;   // Next tick
+        }
+        altcp_write(conn->pcb, response.data.data(), (u16_t)response.data.size(), TCP_WRITE_FLAG_COPY);
+        written = true;
+        conn->answered++;
+        bool close = response.close;
+        conn->responses.pop_front();
+        if (close) {
+            altcp_output(conn->pcb);
+            dropConnection(conn);
+            return;
+        }
+    }
+    if (written) {
+        altcp_output(conn->pcb);
+    }
+}
+
+void UploadServer::dropConnection(Connection *conn) {
+    if (conn->pcb) {
+        altcp_arg(conn->pcb, NULL);
+        altcp_recv(conn->pcb, NULL);
+        altcp_err(conn->pcb, NULL);
+        if (altcp_close(conn->pcb) != ERR_OK) {
+            altcp_abort(conn->pcb);
+        }
+        conn->pcb = nullptr;
+    }
+    connections.remove_if([conn](const std::unique_ptr<Connection> &c) { return c.get() == conn; });
+}
@@ -0,0 +1,100 @@
+#ifndef NET_UPLOAD_SERVER_H
+#define NET_UPLOAD_SERVER_H
+
+// Stand-in upload server of the host network rig: HTTPS (altcp_tls over the
+// rig's lwIP) on the server address, taking POSTs of the firmware's JSON and
+// CBOR bodies. Bodies are decoded with host/upload_decoder.h and stored by
+// (device, sequence number), the way the real server de-duplicates: a record
+// sent again is acknowledged but not stored twice, and counted.
+//
+// Faults make it misbehave like the real server and network path do.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "lwip/altcp.h"
+#include "upload_decoder.h"
+
+struct altcp_tls_config;
+
+struct UploadServerFaults {
+    uint32_t response_delay_ms = 0;      // Before each response
+    uint32_t close_every = 0;            // Close a connection after this many responses, 0 never
+    uint32_t reset_every = 0;            // Every Nth request is stored, then the connection reset unanswered
+    uint8_t lose_response_percent = 0;   // Same, for a random share of the requests
+    uint32_t max_body_bytes = 0;         // Larger bodies get 413 Payload Too Large, 0 for no limit
+    uint32_t accept_at_most = 0;         // Records stored per request (X-Accepted-Records), 0 for all
+    bool refuse_cbor = false;            // 415 Unsupported Media Type for application/cbor
+};
+
+class UploadServer {
+public:
+    UploadServer() = default;
+    ~UploadServer();
+
+    // Listens on port with the PEM key and certificate; false if that fails
+    bool start(uint16_t port, const char *key_path, const char *cert_path);
+    void stop();
+
+    void setFaults(const UploadServerFaults &faults) { this->faults = faults; }
+
+    // Stored records by device and sequence number
+    const std::map<std::pair<std::string, uint32_t>, DecodedRecord> &getRecords() const { return records; }
+    bool hasRecord(const std::string &device, uint32_t sequence) const {
+        return records.count(std::make_pair(device, sequence)) > 0;
+    }
+
+    uint32_t getRequestCount() const { return request_count; }
+    uint32_t getConnectionCount() const { return connection_count; }
+    uint32_t getDuplicateCount() const { return duplicate_count; }       // Records received again
+    uint32_t getResetCount() const { return reset_count; }               // Requests stored but not answered
+    const std::vector<std::string> &getErrors() const { return errors; } // Bodies that did not decode
+
+    void clearRecords();
+
+private:
+    struct Response {
+        uint32_t due_ms;
+        std::string data;
+        bool close;
+    };
+
+    struct Connection {
+        UploadServer *server;
+        struct altcp_pcb *pcb;
+        std::string rx;
+        std::list<Response> responses;
+        uint32_t answered = 0;
+        bool closing = false;
+    };
+
+    struct altcp_tls_config *tls_config = nullptr;
+    struct altcp_pcb *listen_pcb = nullptr;
+    std::list<std::unique_ptr<Connection>> connections;
+    UploadServerFaults faults;
+    std::map<std::pair<std::string, uint32_t>, DecodedRecord> records;
+    std::vector<std::string> errors;
+    uint32_t request_count = 0;
+    uint32_t connection_count = 0;
+    uint32_t duplicate_count = 0;
+    uint32_t reset_count = 0;
+    bool ticking = false;
+
+    // Handles the complete requests in rx; false if the connection was reset
+    bool handleRequests(Connection *conn);
+    std::string handleRequest(const std::string &header, const uint8_t *body, size_t body_len, bool &reset);
+    void sendDue(Connection *conn);
+    void dropConnection(Connection *conn);
+
+    static err_t accept(void *arg, struct altcp_pcb *pcb, err_t err);
+    static err_t recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err);
+    static void error(void *arg, err_t err);
+    static void tick(void *arg);
+};
+
+#endif // NET_UPLOAD_SERVER_H
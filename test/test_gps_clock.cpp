@@ -0,0 +1,84 @@
+// GpsClock disciplined from 1 Hz GPS seconds whose sentences arrive 50-150 ms
+// late. Checks that the clock syncs on the first sample, settles on the
+// least delayed samples, follows a small error and a large one in either
+// direction, and that UTC never goes back while it does, read every 10 ms.
+
+#include "libs/clock/gps_clock.h"
+#include "host_clock.h"
+#include "test_check.h"
+
+static const uint32_t START_EPOCH = 1717286400;
+
+static uint32_t seed = 7;
+static uint32_t delayUs() {
+    seed = seed * 1664525u + 1013904223u;
+    return 50000 + (seed >> 8) % 100000;
+}
+
+struct Run {
+    uint64_t last_us = 0;
+    uint32_t backwards = 0;        // Reads lower than the one before
+};
+
+// Feeds seconds GPS seconds, the receiver's UTC being the timebase plus
+// gps_offset_us; returns the clock's error against it at the end
+static int64_t feed(GpsClock &clock, Run &run, int64_t gps_offset_us, uint32_t seconds) {
+    for (uint32_t i = 0; i < seconds; i++) {
+        // Next whole GPS second, then the sentence describing it
+        int64_t utc_us = (int64_t)host_clock_now_us() + gps_offset_us;
+        int64_t next_us = (utc_us / 1000000 + 1) * 1000000;
+        uint32_t delay_us = delayUs();
+        for (int64_t t = utc_us; t < next_us + delay_us; t += 10000) {
+            host_clock_advance_us((uint64_t)(next_us + delay_us - t < 10000 ? next_us + delay_us - t : 10000));
+            uint64_t now_us = clock.nowUs();
+            run.backwards += clock.isSynced() && now_us < run.last_us ? 1 : 0;
+            run.last_us = now_us;
+        }
+        clock.discipline((uint32_t)(next_us / 1000000), host_clock_now_us());
+    }
+    return (int64_t)clock.nowUs() - ((int64_t)host_clock_now_us() + gps_offset_us);
+}
+
+int main() {
+    host_clock_advance_us(5000000);
+    int64_t gps_offset_us = (int64_t)START_EPOCH * 1000000 - (int64_t)host_clock_now_us() + 300000;
+
+    GpsClock clock;
+    clock.setFallback(START_EPOCH - 3600);
+    CHECK(!clock.isSynced());
+    CHECK(clock.now() == START_EPOCH - 3600);
+
+    // The first sample syncs and reports the step from the fallback time
+    Run run;
+    feed(clock, run, gps_offset_us, 1);
+    CHECK(clock.isSynced());
+    CHECK_NEAR(clock.getSyncStepUs() / 1000000.0, 3600.3, 0.2);
+
+    // Settles behind GPS by about the shortest sentence delay
+    int64_t error_us = feed(clock, run, gps_offset_us, 120);
+    CHECK(error_us < 0 && error_us > -100000);
+    printf("Settled: %lld us behind GPS\n", (long long)error_us);
+
+    // A 200 ms error either way is slewed out
+    gps_offset_us += 200000;
+    error_us = feed(clock, run, gps_offset_us, 120);
+    CHECK(error_us < 0 && error_us > -100000);
+    gps_offset_us -= 200000;
+    error_us = feed(clock, run, gps_offset_us, 120);
+    CHECK(error_us < 0 && error_us > -100000);
+
+    // Two seconds ahead is stepped forward at the end of the window
+    gps_offset_us += 2000000;
+    error_us = feed(clock, run, gps_offset_us, GPS_CLOCK_WINDOW + 1);
+    CHECK(error_us < 0 && error_us > -200000);
+
+    // Two seconds behind is slewed out over several windows, never stepped
+    gps_offset_us -= 2000000;
+    error_us = feed(clock, run, gps_offset_us, GPS_CLOCK_WINDOW + 1);
+    CHECK(error_us > 1000000);
+    error_us = feed(clock, run, gps_offset_us, 120);
+    CHECK(error_us < 0 && error_us > -100000);
+
+    CHECK(run.backwards == 0);
+    return TEST_RESULT();
+}
@@ -0,0 +1,161 @@
+// Replays the sample NMEA log and GPX track through GpsPlayback into myGPS,
+// the same path the device uses with GPS_PLAYBACK enabled, and checks the
+// decoded fixes and the pacing against the virtual clock.
+
+#include "libs/gps/myGPS.h"
+#include "libs/gps/gps_playback.h"
+#include "pico/stdlib.h"
+#include "test_check.h"
+#include <vector>
+
+struct Fix {
+    int32_t lat_e7;
+    int32_t lon_e7;
+    uint64_t capture_us;
+    uint32_t epoch;
+    bool steers_clock;   // takeRmcTime() released the sample
+};
+
+// Runs a playback to the end like the main loop does: read, and sleep a tick
+// whenever nothing is due
+static std::vector<Fix> replay(const char *data, size_t length, uint32_t speed) {
+    myGPS gps(uart0, UART0_BAUD_RATE, UART0_TX_PIN, UART0_RX_PIN);
+    GpsPlayback playback(data, length, time_us_64);
+    playback.setSpeed(speed);
+    gps.setPlayback(&playback);
+
+    std::vector<Fix> fixes;
+    std::string line;
+    uint64_t deadline_us = time_us_64() + 3600ULL * 1000000ULL;
+    while (!playback.finished() && time_us_64() < deadline_us) {
+        if (gps.readLine(line) == 1) {
+            sleep_ms(10);
+        }
+        Fix fix;
+        if (gps.takeFix(fix.lat_e7, fix.lon_e7, fix.capture_us)) {
+            uint32_t rmc_epoch;
+            uint64_t rmc_capture_us;
+            fix.steers_clock = gps.takeRmcTime(rmc_epoch, rmc_capture_us);
+            if (!gps.getUtcEpoch(fix.epoch)) {
+                fix.epoch = 0;
+            }
+            fixes.push_back(fix);
+        }
+    }
+    CHECK(playback.finished());
+    return fixes;
+}
+
+static void testNmeaRealTime(const char *data, size_t length) {
+    uint64_t start_us = time_us_64();
+    std::vector<Fix> fixes = replay(data, length, 1);
+
+    CHECK(fixes.size() == 180);
+    if (fixes.size() != 180) {
+        return;
+    }
+    CHECK_NEAR(fixes[0].lat_e7, 482066200, 20);
+    CHECK_NEAR(fixes[0].lon_e7, 156175100, 20);
+
+    // 1 Hz track, paced in real time across the UTC midnight rollover
+    for (size_t i = 1; i < fixes.size(); i++) {
+        CHECK_NEAR((double)(fixes[i].capture_us - fixes[i - 1].capture_us), 1000000.0, 20000.0);
+        CHECK(fixes[i].epoch == fixes[i - 1].epoch + 1);
+        CHECK(fixes[i].steers_clock);
+    }
+    CHECK(fixes[0].epoch == myGPS::utcToEpoch(2024, 6, 1, 23, 58, 30));
+    CHECK_NEAR((double)(time_us_64() - start_us) / 1e6, 179.0, 0.5);
+}
+
+static void testNmeaDeterministicAndScaled(const char *data, size_t length) {
+    std::vector<Fix> first = replay(data, length, 10);
+    std::vector<Fix> second = replay(data, length, 10);
+
+    CHECK(first.size() == second.size());
+    for (size_t i = 0; i < first.size() && i < second.size(); i++) {
+        CHECK(first[i].lat_e7 == second[i].lat_e7 && first[i].lon_e7 == second[i].lon_e7);
+        CHECK(first[i].epoch == second[i].epoch);
+    }
+
+    // 10x speed: consecutive fixes 100 ms apart on the clock, and accelerated
+    // time must never steer the system clock
+    for (size_t i = 1; i < first.size(); i++) {
+        CHECK_NEAR((double)(first[i].capture_us - first[i - 1].capture_us), 100000.0, 20000.0);
+        CHECK(!first[i].steers_clock);
+    }
+}
+
+static void testGpx(const char *data, size_t length) {
+    CHECK(GpsPlayback::detectFormat(data, length) == GPS_PLAYBACK_GPX);
+
+    std::vector<Fix> fixes = replay(data, length, 0);
+    CHECK(fixes.size() == 60);
+    if (fixes.size() != 60) {
+        return;
+    }
+    CHECK_NEAR(fixes[0].lat_e7, 482066200, 20);
+    CHECK_NEAR(fixes[0].lon_e7, 156175100, 20);
+    CHECK(fixes[0].epoch == myGPS::utcToEpoch(2024, 6, 1, 23, 58, 30));
+
+    // Point 30 has no <time> and continues one second after point 29
+    CHECK(fixes[30].epoch == fixes[29].epoch + 1);
+    CHECK(fixes[59].epoch == fixes[0].epoch + 59);
+}
+
+// Points without <time> across midnight at the end of a month: the date
+// moves on with the time of day
+static void testGpxUntimedMidnight() {
+    static const char GPX[] =
+        "<?xml version=\"1.0\"?><gpx><trk><trkseg>"
+        "<trkpt lat=\"48.2066200\" lon=\"15.6175100\"><time>2024-06-30T23:59:58Z</time></trkpt>"
+        "<trkpt lat=\"48.2066300\" lon=\"15.6175200\"></trkpt>"
+        "<trkpt lat=\"48.2066400\" lon=\"15.6175300\"></trkpt>"
+        "<trkpt lat=\"48.2066500\" lon=\"15.6175400\"></trkpt>"
+        "</trkseg></trk></gpx>";
+
+    std::vector<Fix> fixes = replay(GPX, sizeof(GPX) - 1, 0);
+    CHECK(fixes.size() == 4);
+    if (fixes.size() != 4) {
+        return;
+    }
+    CHECK(fixes[0].epoch == myGPS::utcToEpoch(2024, 6, 30, 23, 59, 58));
+    for (size_t i = 1; i < fixes.size(); i++) {
+        CHECK(fixes[i].epoch == fixes[i - 1].epoch + 1);
+    }
+    CHECK(fixes[3].epoch == myGPS::utcToEpoch(2024, 7, 1, 0, 0, 1));
+}
+
+static void testLoop(const char *data, size_t length) {
+    GpsPlayback playback(data, length, time_us_64);
+    playback.setSpeed(0);
+    playback.setLoop(true);
+
+    size_t bytes = 0;
+    while (playback.getLoopCount() < 2 && bytes < 10 * length) {
+        if (playback.readable()) {
+            playback.getc();
+            bytes++;
+        }
+    }
+    CHECK(playback.getLoopCount() == 2);
+    CHECK(!playback.finished());
+}
+
+int main() {
+    size_t nmea_length, gpx_length;
+    char *nmea = test_read_file(TEST_DATA_DIR "/ride.nmea", &nmea_length);
+    char *gpx = test_read_file(TEST_DATA_DIR "/ride.gpx", &gpx_length);
+
+    CHECK(GpsPlayback::detectFormat(nmea, nmea_length) == GPS_PLAYBACK_NMEA);
+    CHECK(GpsPlayback::blobLength(nmea, nmea_length) == nmea_length);
+
+    testNmeaRealTime(nmea, nmea_length);
+    testNmeaDeterministicAndScaled(nmea, nmea_length);
+    testGpx(gpx, gpx_length);
+    testGpxUntimedMidnight();
+    testLoop(gpx, gpx_length);
+
+    free(nmea);
+    free(gpx);
+    return TEST_RESULT();
+}
@@ -0,0 +1,161 @@
+// Replays a noisy 6 m/s ride through PositionFilter and compares the position
+// it estimates for sensor samples taken between fixes with the last raw fix,
+// the device's behaviour before the filter. Also covers outlier gating,
+// restarts and the fixed-point cosine.
+
+#include "libs/track/position_filter.h"
+#include "test_check.h"
+#include <cmath>
+#include <vector>
+
+static const double METRES_PER_DEG = 111319.491;
+static const double ORIGIN_LAT = 48.2066200;
+static const double ORIGIN_LON = 15.6175100;
+
+struct Truth {
+    double north_m;
+    double east_m;
+};
+
+// Deterministic noise source (LCG + Box-Muller)
+static uint32_t seed = 2024;
+static double uniform() {
+    seed = seed * 1664525u + 1013904223u;
+    return (seed >> 8) / 16777216.0;
+}
+static double gaussian() {
+    double u1 = uniform() + 1e-12, u2 = uniform();
+    return sqrt(-2.0 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+static void toE7(const Truth &t, double noise_sigma_m, int32_t &lat_e7, int32_t &lon_e7) {
+    double lat = ORIGIN_LAT + (t.north_m + noise_sigma_m * gaussian()) / METRES_PER_DEG;
+    double lon = ORIGIN_LON + (t.east_m + noise_sigma_m * gaussian()) /
+                              (METRES_PER_DEG * cos(ORIGIN_LAT * M_PI / 180));
+    lat_e7 = (int32_t)llround(lat * 1e7);
+    lon_e7 = (int32_t)llround(lon * 1e7);
+}
+
+static double errorM(const Truth &t, int32_t lat_e7, int32_t lon_e7) {
+    double north = (lat_e7 / 1e7 - ORIGIN_LAT) * METRES_PER_DEG;
+    double east = (lon_e7 / 1e7 - ORIGIN_LON) * METRES_PER_DEG * cos(ORIGIN_LAT * M_PI / 180);
+    return hypot(north - t.north_m, east - t.east_m);
+}
+
+// Ride at 6 m/s with gentle curves and a few turns; position at time_ms
+static Truth truthAt(uint32_t time_ms) {
+    static std::vector<Truth> path;
+    if (path.empty()) {
+        double north = 0, east = 0, heading = 0.4;
+        for (uint32_t ms = 0; ms <= 700000; ms += 100) {
+            path.push_back({north, east});
+            heading += (ms % 90000 < 3000) ? 0.05 : 0.0005;
+            north += 0.6 * cos(heading);
+            east += 0.6 * sin(heading);
+        }
+    }
+    return path[time_ms / 100];
+}
+
+static void testRide() {
+    PositionFilter filter;
+    int32_t lat_e7, lon_e7;
+    CHECK(!filter.estimate(0, lat_e7, lon_e7));
+
+    // 1 Hz fixes with 4 m per-axis noise. Each cycle a sensor sample is
+    // tagged 0.5 to 2.5 s after the last fix the filter has seen, as the
+    // multi-second sensor reads do
+    double filter_sum = 0, raw_sum = 0;
+    int samples = 0;
+    int32_t raw_lat_e7 = 0, raw_lon_e7 = 0;
+    for (uint32_t t_ms = 1000; t_ms <= 600000; t_ms += 1000) {
+        toE7(truthAt(t_ms), 4.0, raw_lat_e7, raw_lon_e7);
+        filter.update(raw_lat_e7, raw_lon_e7, t_ms);
+
+        uint32_t sample_ms = t_ms + 500 + (uint32_t)(uniform() * 2000);
+        if (t_ms < 30000) {
+            continue;   // Warm-up
+        }
+        CHECK(filter.estimate(sample_ms, lat_e7, lon_e7));
+        Truth truth = truthAt(sample_ms);
+        filter_sum += errorM(truth, lat_e7, lon_e7);
+        raw_sum += errorM(truth, raw_lat_e7, raw_lon_e7);
+        samples++;
+    }
+
+    double filter_mean = filter_sum / samples, raw_mean = raw_sum / samples;
+    printf("Ride: %d samples, mean error %.2f m filtered vs %.2f m last raw fix, %lu rejected\n",
+           samples, filter_mean, raw_mean, (unsigned long)filter.getRejectedCount());
+    CHECK(samples > 500);
+    CHECK(filter_mean < raw_mean * 0.8);
+    CHECK(filter.getRejectedCount() == 0);
+}
+
+static void testOutlierAndRestart() {
+    PositionFilter filter;
+    int32_t lat_e7, lon_e7;
+    uint32_t t_ms = 0;
+    for (int i = 0; i < 30; i++, t_ms += 1000) {
+        toE7(truthAt(t_ms), 1.0, lat_e7, lon_e7);
+        filter.update(lat_e7, lon_e7, t_ms);
+    }
+    uint32_t fixes = filter.getFixCount();
+
+    // A single 300 m jump is rejected and does not move the estimate
+    toE7({truthAt(t_ms).north_m + 300, truthAt(t_ms).east_m}, 0.0, lat_e7, lon_e7);
+    filter.update(lat_e7, lon_e7, t_ms);
+    CHECK(filter.getRejectedCount() == 1);
+    CHECK(filter.getFixCount() == fixes);
+    CHECK(filter.estimate(t_ms, lat_e7, lon_e7));
+    CHECK(errorM(truthAt(t_ms), lat_e7, lon_e7) < 5.0);
+
+    // Repeated jumps mean the prediction is wrong: restart on the new position
+    Truth moved = {truthAt(t_ms).north_m + 300, truthAt(t_ms).east_m};
+    for (int i = 1; i < POSITION_FILTER_MAX_REJECTS; i++) {
+        t_ms += 1000;
+        toE7(moved, 0.0, lat_e7, lon_e7);
+        filter.update(lat_e7, lon_e7, t_ms);
+    }
+    CHECK(filter.estimate(t_ms, lat_e7, lon_e7));
+    CHECK(errorM(moved, lat_e7, lon_e7) < 1.0);
+
+    // A long gap restarts at the next fix
+    t_ms += POSITION_FILTER_MAX_GAP_MS + 1000;
+    Truth after_gap = {moved.north_m + 500, moved.east_m - 200};
+    toE7(after_gap, 0.0, lat_e7, lon_e7);
+    filter.update(lat_e7, lon_e7, t_ms);
+    CHECK(filter.getLastFixMs() == t_ms);
+    CHECK(filter.estimate(t_ms, lat_e7, lon_e7));
+    CHECK(errorM(after_gap, lat_e7, lon_e7) < 1.0);
+}
+
+static void testExtrapolationLimit() {
+    PositionFilter filter;
+    int32_t lat_e7, lon_e7;
+    for (uint32_t t_ms = 0; t_ms <= 60000; t_ms += 1000) {
+        toE7(truthAt(t_ms), 0.5, lat_e7, lon_e7);
+        filter.update(lat_e7, lon_e7, t_ms);
+    }
+
+    int32_t near_lat, near_lon, far_lat, far_lon;
+    CHECK(filter.estimate(60000 + POSITION_FILTER_MAX_EXTRAPOLATION_MS, near_lat, near_lon));
+    CHECK(filter.estimate(60000 + 60000, far_lat, far_lon));
+    CHECK(near_lat == far_lat && near_lon == far_lon);
+}
+
+static void testCosine() {
+    double worst = 0;
+    for (int deg10 = -800; deg10 <= 800; deg10 += 5) {
+        int32_t q16 = PositionFilter::cosLatitudeQ16(deg10 * 1000000);
+        worst = fmax(worst, fabs(q16 / 65536.0 - cos(deg10 / 10.0 * M_PI / 180)));
+    }
+    CHECK(worst < 1e-4);
+}
+
+int main() {
+    testRide();
+    testOutlierAndRestart();
+    testExtrapolationLimit();
+    testCosine();
+    return TEST_RESULT();
+}
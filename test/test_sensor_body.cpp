@@ -0,0 +1,237 @@
+// Round trip of the upload encodings: JSON and CBOR bodies are read the way
+// the clients stream them, decoded by an independent decoder
+// (host/upload_decoder.cpp) and compared with the records they were built
+// from, with and without track encoding. Deflated bodies are inflated with
+// zlib and must give back the exact bytes.
+
+#include "libs/https/sensor_json_body.h"
+#include "libs/https/sensor_cbor_body.h"
+#include "libs/https/deflate_body.h"
+#include "upload_decoder.h"
+#include "test_check.h"
+#include <cmath>
+#include <vector>
+
+static const char *TOKEN = "test-token";
+static const char *DEVICE = "E6614103E72B8B2A";
+static const SensorBody::Fallback FALLBACK = {1717286400, 48.2, 15.6};
+
+// A ride along a gentle curve, 1 record per 5 s, with the odd record lacking
+// a position or a timestamp, and flags set
+static std::vector<SensorData> makeRecords(size_t count, bool finite) {
+    std::vector<SensorData> records(count);
+    for (size_t i = 0; i < count; i++) {
+        SensorData &r = records[i];
+        double lat = 48.2066200 + i * 0.00002 + 0.00001 * sin(i * 0.05);
+        double lon = 15.6175100 + i * 0.00003;
+        r.latitude = (uint32_t)(int32_t)llround(lat * 1e7);
+        r.longitude = (uint32_t)(int32_t)llround(lon * 1e7);
+        r.timestamp = 1717286400 + 5 * (uint32_t)i;
+        r.temp = 21.5f + 0.01f * (float)i;
+        r.hum = 45.25f;
+        r.pres = 1013.2f;
+        r.gasRes = 123456.0f;
+        r.pm2_5 = (uint16_t)(i % 40);
+        r.pm10 = (uint16_t)(i % 60);
+        r.co2 = 420 + (uint32_t)i;
+    }
+    records[5].latitude = records[5].longitude = 0;
+    records[6].latitude = records[6].longitude = 0;
+    records[7].timestamp = 0;
+    records[10].is_fake_gps = true;
+    records[11].time_unsynced = true;
+    if (!finite) {
+        records[9].temp = NAN;
+    }
+    return records;
+}
+
+// Reads a body in one go and again in odd-sized pieces after a rewind;
+// both must give getLength() identical bytes
+static std::vector<uint8_t> readAll(http_body_source_t *body) {
+    std::vector<uint8_t> whole(body->length + 64);
+    body->rewind(body);
+    size_t n = 0, got;
+    while ((got = body->read(body, (char *)whole.data() + n, whole.size() - n)) > 0) {
+        n += got;
+    }
+    CHECK(n == body->length);
+    whole.resize(n);
+
+    std::vector<uint8_t> pieces;
+    body->rewind(body);
+    char piece[7];
+    while ((got = body->read(body, piece, sizeof(piece))) > 0) {
+        pieces.insert(pieces.end(), piece, piece + got);
+    }
+    CHECK(pieces == whole);
+    body->rewind(body);
+    return whole;
+}
+
+static double segmentDistanceM(const DecodedRecord &p, const DecodedRecord &a, const DecodedRecord &b) {
+    double scale_y = 0.0111319491;
+    double scale_x = scale_y * cos(a.lat_e7 * 1e-7 * M_PI / 180);
+    double ex = (b.lon_e7 - a.lon_e7) * scale_x, ey = (b.lat_e7 - a.lat_e7) * scale_y;
+    double px = (p.lon_e7 - a.lon_e7) * scale_x, py = (p.lat_e7 - a.lat_e7) * scale_y;
+    double length2 = ex * ex + ey * ey;
+    double t = length2 > 0 ? fmin(1, fmax(0, (px * ex + py * ey) / length2)) : 0;
+    return hypot(px - t * ex, py - t * ey);
+}
+
+static void checkDecoded(const DecodedUpload &upload, const std::vector<SensorData> &records,
+                         const SensorBody &body, float track_max_error_m, bool cbor) {
+    CHECK(upload.schema == (track_max_error_m > 0 ? SENSOR_BODY_SCHEMA_TRACK : SENSOR_BODY_SCHEMA_ABSOLUTE));
+    CHECK(upload.token == TOKEN);
+    CHECK(upload.device == DEVICE);
+    CHECK(upload.first_sequence == 1000);
+    CHECK(upload.last_sequence == 1000 + records.size() - 1);
+    CHECK(upload.records.size() == records.size());
+    if (upload.records.size() != records.size()) {
+        return;
+    }
+
+    size_t with_position = 0;
+    int last_kept = -1;
+    for (size_t i = 0; i < records.size(); i++) {
+        const SensorData &in = records[i];
+        const DecodedRecord &out = upload.records[i];
+        CHECK(out.epoch == (in.timestamp ? in.timestamp : FALLBACK.epoch));
+
+        if (in.latitude == 0 && in.longitude == 0) {
+            CHECK(out.has_position);
+            CHECK(out.lat_e7 == (int32_t)llround(FALLBACK.latitude * 1e7));
+            CHECK(out.lon_e7 == (int32_t)llround(FALLBACK.longitude * 1e7));
+            continue;
+        }
+
+        // Positions are exact where sent; a left-out one must lie within the
+        // error bound of the segment between the kept ones around it
+        if (out.has_position) {
+            with_position++;
+            CHECK(out.lat_e7 == (int32_t)in.latitude && out.lon_e7 == (int32_t)in.longitude);
+            last_kept = (int)i;
+        } else {
+            CHECK(track_max_error_m > 0);
+            size_t next = i + 1;
+            // Records without a position carry the fallback, not part of the track
+            while (next < records.size() && (!upload.records[next].has_position ||
+                                             (records[next].latitude == 0 && records[next].longitude == 0))) {
+                next++;
+            }
+            CHECK(last_kept >= 0 && next < records.size());
+            if (last_kept >= 0 && next < records.size()) {
+                DecodedRecord actual;
+                actual.lat_e7 = (int32_t)in.latitude;
+                actual.lon_e7 = (int32_t)in.longitude;
+                CHECK(segmentDistanceM(actual, upload.records[last_kept], upload.records[next]) <=
+                      track_max_error_m + 0.01);
+            }
+        }
+
+        if (std::isnan(in.temp)) {
+            CHECK(!out.has_temperature);
+        } else {
+            CHECK(out.has_temperature);
+            CHECK_NEAR(out.temperature_centi, llroundf(in.temp * 100.0f), cbor ? 0 : 1);
+        }
+        CHECK_NEAR(out.humidity_centi, llroundf(in.hum * 100.0f), cbor ? 0 : 1);
+        CHECK_NEAR(out.pressure_deci, llroundf(in.pres * 10.0f), cbor ? 0 : 1);
+        CHECK_NEAR(out.gas_resistance, llroundf(in.gasRes), cbor ? 0 : 1);
+        CHECK(out.pm25 == in.pm2_5 && out.pm10 == in.pm10 && out.co2 == in.co2);
+        if (cbor) {
+            CHECK(out.flags == ((in.is_fake_gps ? 1 : 0) | (in.time_unsynced ? 2 : 0)));
+        }
+    }
+
+    size_t track_positions = body.getPositionCount() ? body.getKeptPositionCount() : with_position;
+    CHECK(with_position == track_positions);
+}
+
+static void checkDeflate(http_body_source_t *inner, const std::vector<uint8_t> &plain, const char *name) {
+    DeflateBody deflated(inner);
+    std::vector<uint8_t> compressed = readAll(&deflated);
+    CHECK(compressed.size() == deflated.getLength());
+#if TEST_HAVE_ZLIB
+    std::vector<uint8_t> inflated;
+    CHECK(inflateZlib(compressed.data(), compressed.size(), inflated));
+    CHECK(inflated == plain);
+#endif
+    printf("%-28s %6zu -> %6zu bytes deflated (%.1f%%)\n", name, plain.size(), compressed.size(),
+           plain.empty() ? 0.0 : 100.0 * compressed.size() / plain.size());
+}
+
+static void testBody(bool cbor, float track_max_error_m) {
+    std::vector<SensorData> records = makeRecords(120, !cbor);
+    SensorBody::Origin origin = {DEVICE, 1000};
+    SensorBody *body;
+    if (cbor) {
+        body = new SensorCborBody(records.data(), records.size(), TOKEN, origin, FALLBACK, track_max_error_m);
+    } else {
+        body = new SensorJsonBody(records.data(), records.size(), TOKEN, origin, FALLBACK, track_max_error_m);
+    }
+    CHECK(body->getSchema() == (track_max_error_m > 0 ? SENSOR_BODY_SCHEMA_TRACK : SENSOR_BODY_SCHEMA_ABSOLUTE));
+
+    std::vector<uint8_t> bytes = readAll(body);
+    DecodedUpload upload;
+    std::string error;
+    bool decoded = cbor ? decodeCborUpload(bytes.data(), bytes.size(), upload, error)
+                        : decodeJsonUpload((const char *)bytes.data(), bytes.size(), upload, error);
+    if (!decoded) {
+        fprintf(stderr, "Decoding failed: %s\n", error.c_str());
+    }
+    CHECK(decoded);
+    checkDecoded(upload, records, *body, track_max_error_m, cbor);
+
+    char name[64];
+    snprintf(name, sizeof(name), "%s schema %u", cbor ? "CBOR" : "JSON", (unsigned)body->getSchema());
+    printf("%-28s %6zu bytes, %5.1f bytes/record\n", name, bytes.size(), (double)bytes.size() / records.size());
+    checkDeflate(body, bytes, name);
+
+#if TEST_HAVE_ZLIB
+    // The way the server sees it
+    DeflateBody deflated(body);
+    std::vector<uint8_t> compressed = readAll(&deflated);
+    DecodedUpload via_deflate;
+    CHECK(decodeUpload(compressed.data(), compressed.size(), cbor ? "application/cbor" : "application/json",
+                       "deflate", via_deflate, error));
+    CHECK(via_deflate.records.size() == records.size());
+#endif
+    delete body;
+}
+
+static void testDeflateEdgeCases() {
+    // Empty, incompressible, and long runs (maximum match length and distance)
+    std::string empty;
+    std::string noise(5000, '\0');
+    uint32_t seed = 7;
+    for (char &c : noise) {
+        seed = seed * 1103515245u + 12345u;
+        c = (char)(seed >> 16);
+    }
+    std::string runs(20000, 'a');
+    for (size_t i = 0; i < runs.size(); i += 997) {
+        runs[i] = (char)('b' + i % 7);
+    }
+
+    const std::string *inputs[] = {&empty, &noise, &runs};
+    const char *names[] = {"empty", "noise", "runs"};
+    for (int i = 0; i < 3; i++) {
+        http_string_body_t body;
+        http_string_body_init(&body, inputs[i]->data(), inputs[i]->size());
+        std::vector<uint8_t> plain(inputs[i]->begin(), inputs[i]->end());
+        checkDeflate(&body.source, plain, names[i]);
+    }
+}
+
+int main() {
+    testBody(false, 0.0f);
+    testBody(false, TRACK_DEFAULT_MAX_ERROR_M);
+    testBody(true, 0.0f);
+    testBody(true, TRACK_DEFAULT_MAX_ERROR_M);
+    testDeflateEdgeCases();
+#if !TEST_HAVE_ZLIB
+    printf("zlib not found: deflate output was not inflated\n");
+#endif
+    return TEST_RESULT();
+}